@@ -0,0 +1,297 @@
+#include "CommandRunner.h"
+#include <algorithm>
+#include <charconv>
+#include <iterator>
+#include <chrono>
+#include <cstdio>
+
+namespace {
+
+constexpr std::int64_t NANOSECONDS = 1000000000;
+
+// Whether a command changes the namespace
+bool changesNamespace(std::string_view command) {
+    static const std::string_view CHANGES[] = {"mkdir", "add",   "rm",    "backup", "undo", "rename", "move",
+                                               "moves", "sort",  "touch", "write",  "cp",   "rmtree", "cptree"};
+    return std::find(std::begin(CHANGES), std::end(CHANGES), command) != std::end(CHANGES);
+}
+
+} // namespace
+
+// Implementation of CommandRunner constructor
+CommandRunner::CommandRunner(FileSystem& fs, std::ostream& output)
+    : fileSystem(fs), out(output), follower(nullptr), lineNumber(0), executed(0), failed(0) {}
+
+// Function to serve a replica: changes are rejected, stats include the replication gauges
+void CommandRunner::setFollower(const ReplicationFollower* replica) {
+    follower = replica;
+}
+
+// Function to run every command read from in, then any moves still queued
+void CommandRunner::run(std::istream& in) {
+    std::string line;
+    while (std::getline(in, line)) {
+        runLine(line);
+    }
+    processMoves();
+}
+
+// Private helper function to print a failed change
+void CommandRunner::report(FileSystem::Status status, std::string_view subject) {
+    if (status == FileSystem::OK) {
+        return;
+    }
+    failed++;
+    out << "Error: line " << lineNumber << ": '" << subject << "': " << FileSystem::describe(status) << ".\n";
+}
+
+// Private helper function to print a command that could not be run
+void CommandRunner::reject(const std::string& reason) {
+    failed++;
+    out << "Error: line " << lineNumber << ": " << reason << ".\n";
+}
+
+// Private helper function to report where a name, a path or a glob is found
+void CommandRunner::search(const std::string& target) {
+    if (target.find_first_of("*?") != std::string::npos) {
+        std::vector<FileSystem::Match> matches = fileSystem.findByPattern(target);
+        out << matches.size() << " match(es) for " << target << '\n';
+        for (const FileSystem::Match& match : matches) {
+            out << "  " << match.directory << (match.directory == "/" ? "" : "/") << match.name
+                << (match.isDirectory ? " (Directory)" : "") << '\n';
+        }
+    } else if (!fileSystem.search(target)) {
+        out << "File not found: " << target << '\n';
+    } else if (target.find('/') != std::string::npos) {
+        out << "File found: " << target << '\n';
+    } else {
+        out << "File found: " << target << " in";
+        for (const std::string& dir : fileSystem.locate(target)) {
+            out << " '" << dir << "'";
+        }
+        out << '\n';
+    }
+}
+
+// Private helper function to run the queued moves, reporting batches that did not all move
+void CommandRunner::processMoves() {
+    for (const FileSystem::MoveResult& result : fileSystem.processMoveQueue()) {
+        if (result.missing || result.conflicts) {
+            reject("moved " + std::to_string(result.moved) + " file(s) from '" + result.sourceDirectory + "' to '" +
+                   result.destinationDirectory + "', " + std::to_string(result.missing) + " not found, " +
+                   std::to_string(result.conflicts) + " rejected");
+        }
+    }
+}
+
+// Private helper function to print one page of a directory and the token to continue from
+void CommandRunner::listPage(const std::string& dirpath, std::int64_t limit, std::string_view token) {
+    FileSystem::ListCursor cursor;
+    if (!token.empty() && !cursor.parse(token)) {
+        reject("'" + std::string(token) + "' is not a listing token");
+        return;
+    }
+    std::vector<FileSystem::DirectoryEntry> page;
+    FileSystem::Status status = fileSystem.listPage(dirpath, cursor, static_cast<std::size_t>(limit), page);
+    for (const FileSystem::DirectoryEntry& entry : page) {
+        out << "- " << entry.name << (entry.isDirectory ? " (Directory)" : " (File)") << '\n';
+    }
+    if (status == FileSystem::OK && !cursor.done) {
+        out << "next " << cursor.token() << '\n';
+    }
+    report(status, dirpath);
+}
+
+// Private helper function to read a non-negative whole number, rejecting the line if it is not one
+bool CommandRunner::number(std::string_view text, std::int64_t& value) {
+    std::from_chars_result parsed = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (parsed.ec != std::errc() || parsed.ptr != text.data() + text.size() || value < 0) {
+        reject("'" + std::string(text) + "' is not a number");
+        return false;
+    }
+    return true;
+}
+
+// Function to run one line of a script
+void CommandRunner::runLine(std::string_view line) {
+    lineNumber++;
+    words.clear();
+    std::size_t at = 0;
+    while (at < line.size()) {
+        std::size_t start = line.find_first_not_of(" \t\r", at);
+        if (start == std::string_view::npos) {
+            break;
+        }
+        std::size_t end = line.find_first_of(" \t\r", start);
+        if (end == std::string_view::npos) {
+            end = line.size();
+        }
+        words.push_back(line.substr(start, end - start));
+        at = end;
+    }
+    if (words.empty() || words[0][0] == '#') {
+        return;
+    }
+    executed++;
+
+    std::string_view command = words[0];
+    std::size_t arguments = words.size() - 1;
+    auto word = [this](std::size_t i) { return std::string(words[i]); };
+    if (follower && changesNamespace(command)) {
+        reject("'" + std::string(command) + "' would change a read-only replica");
+    } else if (command == "mkdir" && arguments == 1) {
+        report(fileSystem.insertDirectory(word(1)), words[1]);
+    } else if (command == "add" && (arguments == 2 || arguments == 3)) {
+        std::int64_t size = 0;
+        if (arguments == 3 && !number(words[3], size)) {
+            return;
+        }
+        std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        FileSystem::Status status =
+            fileSystem.insertFile(word(1), word(2), false, FileSystem::Metadata{static_cast<std::uint64_t>(size), now, now, 0644});
+        report(status, status == FileSystem::DIRECTORY_NOT_FOUND ? word(1) : word(1) + "/" + word(2));
+    } else if (command == "search" && arguments == 1) {
+        search(word(1));
+    } else if (command == "rm" && arguments == 1) {
+        report(fileSystem.remove(word(1)), words[1]);
+    } else if (command == "ls" && arguments == 1) {
+        fileSystem.displayDirectoryContents(word(1), out);
+    } else if (command == "ls" && (arguments == 2 || arguments == 3)) {
+        std::int64_t limit;
+        if (number(words[2], limit)) {
+            listPage(word(1), limit, arguments == 3 ? words[3] : std::string_view());
+        }
+    } else if (command == "tree" && arguments == 0) {
+        fileSystem.displayDirectoryStructure(out);
+    } else if (command == "backup" && arguments == 0) {
+        fileSystem.createBackup();
+    } else if (command == "undo" && arguments == 0) {
+        report(fileSystem.restoreBackup(), "undo");
+    } else if (command == "rename" && arguments == 2) {
+        FileSystem::Status status = fileSystem.renameDirectory(word(1), word(2));
+        report(status, status == FileSystem::NOT_FOUND || status == FileSystem::INTO_ITSELF ? words[1] : words[2]);
+    } else if (command == "move" && arguments == 3) {
+        fileSystem.enqueueMove(word(1), word(2), word(3), false);
+    } else if (command == "moves" && arguments == 0) {
+        processMoves();
+    } else if (command == "sort" && (arguments == 1 || arguments == 2)) {
+        std::string keyName = arguments == 2 ? word(2) : "name";
+        bool keep = keyName.back() == '+';
+        if (keep) {
+            keyName.pop_back();
+        }
+        FileSystem::SortKey key;
+        if (!FileSystem::sortKeyNamed(keyName, key)) {
+            reject("unknown sort key '" + keyName + "'");
+        } else {
+            report(keep ? fileSystem.keepSorted(word(1), key) : fileSystem.sortDirectory(word(1), key), words[1]);
+        }
+    } else if (command == "touch" && (arguments == 2 || arguments == 3)) {
+        FileSystem::Metadata meta;
+        std::int64_t size;
+        std::int64_t seconds = 0;
+        if (!number(words[2], size) || (arguments == 3 && !number(words[3], seconds))) {
+            return;
+        }
+        if (fileSystem.stat(word(1), meta) != FileSystem::OK) {
+            report(FileSystem::NOT_FOUND, words[1]);
+            return;
+        }
+        meta.size = static_cast<std::uint64_t>(size);
+        meta.mtime = arguments == 3 ? seconds * NANOSECONDS
+                                    : std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                          std::chrono::system_clock::now().time_since_epoch()).count();
+        report(fileSystem.setMetadata(word(1), meta), words[1]);
+    } else if (command == "stat" && arguments == 1) {
+        FileSystem::Metadata meta;
+        FileSystem::Status status = fileSystem.stat(word(1), meta);
+        if (status == FileSystem::OK) {
+            char mode[8];
+            std::snprintf(mode, sizeof(mode), "%04o", meta.mode);
+            out << words[1] << " size=" << meta.size << " mtime=" << meta.mtime / NANOSECONDS
+                << " ctime=" << meta.ctime / NANOSECONDS << " mode=" << mode << '\n';
+        }
+        report(status, words[1]);
+    } else if (command == "du" && arguments == 1) {
+        FileSystem::Usage usage;
+        FileSystem::Status status = fileSystem.usage(word(1), usage);
+        if (status == FileSystem::OK) {
+            out << words[1] << " bytes=" << usage.bytes << " entries=" << usage.entries
+                << " newest=" << usage.newest / NANOSECONDS << '\n';
+        }
+        report(status, words[1]);
+    } else if (command == "changed" && (arguments == 1 || arguments == 2)) {
+        std::int64_t seconds;
+        if (!number(words[1], seconds)) {
+            return;
+        }
+        std::vector<FileSystem::Match> matches = fileSystem.modifiedSince(seconds * NANOSECONDS, arguments == 2 ? word(2) : "");
+        out << matches.size() << " entr" << (matches.size() == 1 ? "y" : "ies") << " modified since " << words[1] << '\n';
+        for (const FileSystem::Match& match : matches) {
+            out << "  " << match.directory << (match.directory == "/" ? "" : "/") << match.name
+                << (match.isDirectory ? " (Directory)" : "") << '\n';
+        }
+    } else if (command == "write" && arguments >= 2) {
+        std::string_view text = line.substr(static_cast<std::size_t>(words[2].data() - line.data()));
+        text = text.substr(0, text.find_last_not_of(" \t\r") + 1);
+        report(fileSystem.writeFile(word(1), text), words[1]);
+    } else if (command == "cat" && arguments == 1) {
+        std::string data;
+        FileSystem::Status status = fileSystem.readFile(word(1), data);
+        if (status == FileSystem::OK) {
+            out << data << '\n';
+        }
+        report(status, words[1]);
+    } else if (command == "cp" && arguments == 2) {
+        std::string copiedName;
+        FileSystem::Status status = fileSystem.copyFile(word(1), word(2), copiedName);
+        report(status, status == FileSystem::DIRECTORY_NOT_FOUND ? words[2] : words[1]);
+    } else if (command == "rmtree" && arguments == 1) {
+        report(fileSystem.removeTree(word(1)), words[1]);
+    } else if (command == "cptree" && arguments == 2) {
+        std::string copiedName;
+        FileSystem::Status status = fileSystem.copyTree(word(1), word(2), copiedName);
+        report(status, status == FileSystem::DIRECTORY_NOT_FOUND || status == FileSystem::INTO_ITSELF ? words[2] : words[1]);
+    } else if (command == "diff" && arguments <= 2) {
+        std::int64_t before = 1;
+        std::int64_t after = 0;
+        if ((arguments >= 1 && !number(words[1], before)) || (arguments == 2 && !number(words[2], after))) {
+            return;
+        }
+        std::vector<FileSystem::Change> changes;
+        FileSystem::Status status = fileSystem.diff(static_cast<std::size_t>(before), static_cast<std::size_t>(after), changes);
+        if (status == FileSystem::OK) {
+            static const char* const KINDS[] = {"added", "removed", "renamed", "modified"};
+            out << changes.size() << " change(s)" << '\n';
+            for (const FileSystem::Change& change : changes) {
+                out << "  " << KINDS[change.kind] << ' ' << change.path;
+                if (change.kind == FileSystem::Change::RENAMED) {
+                    out << " -> " << change.newPath;
+                }
+                out << (change.isDirectory ? " (Directory)" : "") << '\n';
+            }
+        }
+        report(status, "diff");
+    } else if (command == "hash" && arguments == 1) {
+        std::uint64_t hash;
+        FileSystem::Status status = fileSystem.treeHash(word(1), hash);
+        if (status == FileSystem::OK) {
+            char hex[17];
+            std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+            out << words[1] << " hash=" << hex << '\n';
+        }
+        report(status, words[1]);
+    } else if (command == "stats" && arguments == 0) {
+        fileSystem.dumpStats(out);
+        if (follower) {
+            follower->dumpStats(out);
+        }
+    } else if (command == "save" && arguments == 1) {
+        if (!fileSystem.save(word(1))) {
+            failed++;
+        }
+    } else {
+        reject("unknown command or wrong number of arguments for '" + std::string(command) + "'");
+    }
+}
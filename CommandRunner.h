@@ -0,0 +1,89 @@
+#ifndef COMMAND_RUNNER_H
+#define COMMAND_RUNNER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+#include "FileSystem.h"
+#include "Replication.h"
+
+// Runs a script of file system commands without prompts, one command per line.
+// Words are separated by spaces or tabs; blank lines and lines starting with
+// '#' are skipped.
+//
+//   mkdir PATH            insert a directory
+//   add DIR NAME [SIZE]   insert a file into DIR
+//   search NAME|PATH|GLOB report where an entry is (globs use '*' and '?')
+//   rm NAME|PATH          remove a file or an empty directory
+//   ls DIR [LIMIT [TOKEN]] list a directory; with LIMIT, one page of at most LIMIT entries
+//                         (starting at TOKEN), ending with "next TOKEN" unless it was the last
+//   tree                  display the directory structure
+//   backup                create a backup
+//   undo                  restore the most recent backup
+//   rename DIR NEW        rename (or, with a path, move) a directory
+//   move SRC DEST NAME    queue a move of a file
+//   moves                 process the move queue (also done at the end of a script)
+//   sort DIR [KEY]        sort by name, type, extension, size or mtime; KEY+ keeps it sorted
+//   save PATH             write an image
+//   stats                 print gauges, and per-operation metrics if built in
+//   touch PATH SIZE [TIME] set a file's size and mtime (seconds since the epoch, default now)
+//   stat PATH             print an entry's size, times and mode
+//   du DIR                print the bytes and entries beneath a directory
+//   changed TIME [DIR]    list the entries modified at or after TIME (seconds)
+//   write PATH TEXT       replace a file's contents with the rest of the line
+//   cat PATH              print a file's contents
+//   cp PATH DIR           copy a file into DIR (as copy_NAME, copy_1_NAME, ...)
+//   rmtree PATH           remove a directory and everything beneath it
+//   cptree PATH DIR       copy a directory and everything beneath it into DIR
+//   diff [OLD [NEW]]      list what changed between two states, numbered by backup
+//                         depth (0 is now); by default the last backup and now
+//   hash DIR              print the hash of a directory's subtree
+//
+// Changes print nothing when they succeed; failures print one "Error:" line
+// naming the script line. On a read-only replica (see setFollower) every
+// command that would change the namespace is rejected, and stats adds the
+// replication gauges.
+class CommandRunner {
+public:
+    CommandRunner(FileSystem& fs, std::ostream& output);
+
+    // Function to run every command read from in
+    void run(std::istream& in);
+
+    // Function to run one line of a script
+    void runLine(std::string_view line);
+
+    // Function to serve a replica kept up to date by follower: reads only
+    void setFollower(const ReplicationFollower* follower);
+
+    std::size_t commands() const {
+        return executed;
+    }
+
+    // Commands that were rejected or whose change failed
+    std::size_t failures() const {
+        return failed;
+    }
+
+private:
+    FileSystem& fileSystem;
+    std::ostream& out;
+    const ReplicationFollower* follower; // set on a read-only replica
+    std::size_t lineNumber;
+    std::size_t executed;
+    std::size_t failed;
+    std::vector<std::string_view> words;
+
+    void report(FileSystem::Status status, std::string_view subject);
+    void reject(const std::string& reason);
+    void search(const std::string& target);
+    void processMoves();
+    void listPage(const std::string& dirpath, std::int64_t limit, std::string_view token);
+    bool number(std::string_view text, std::int64_t& value);
+};
+
+#endif // COMMAND_RUNNER_H
@@ -0,0 +1,103 @@
+#include "ContentStore.h"
+
+// Implementation of ContentStore constructor
+ContentStore::ContentStore() : storedBytes(0) {}
+
+// Implementation of ContentStore destructor
+ContentStore::~ContentStore() {
+    for (const std::pair<const std::uint64_t, Blob*>& entry : blobs) {
+        delete entry.second;
+    }
+}
+
+// Function to hash content: 64-bit FNV-1a, eight bytes per step
+std::uint64_t ContentStore::hashBytes(std::string_view data) {
+    std::uint64_t hash = 0xcbf29ce484222325ULL;
+    std::size_t i = 0;
+    for (; i + 8 <= data.size(); i += 8) {
+        std::uint64_t word = 0;
+        for (int k = 0; k < 8; k++) {
+            word |= static_cast<std::uint64_t>(static_cast<unsigned char>(data[i + k])) << (8 * k);
+        }
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < data.size(); i++) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 0x100000001b3ULL;
+    }
+    return hash ^ data.size();
+}
+
+// Private helper function to find the blob holding exactly data
+ContentStore::Blob* ContentStore::find(std::string_view data, std::uint64_t hash) const {
+    auto range = blobs.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second->view == data) {
+            return it->second;
+        }
+    }
+    return nullptr;
+}
+
+// Function to store data, or find the blob already holding it
+ContentStore::Blob* ContentStore::put(std::string_view data) {
+    if (data.empty()) {
+        return nullptr;
+    }
+    std::uint64_t hash = hashBytes(data);
+    Blob* blob = find(data, hash);
+    if (blob) {
+        blob->references++;
+        return blob;
+    }
+    blob = new Blob();
+    blob->hash = hash;
+    blob->references = 1;
+    blob->owned.assign(data.data(), data.size());
+    blob->view = blob->owned;
+    blobs.emplace(hash, blob);
+    storedBytes += data.size();
+    return blob;
+}
+
+// Function to add a blob whose bytes live elsewhere, without copying them
+ContentStore::Blob* ContentStore::adopt(std::string_view data, std::uint64_t hash) {
+    if (data.empty()) {
+        return nullptr;
+    }
+    Blob* blob = find(data, hash);
+    if (blob) {
+        blob->references++;
+        return blob;
+    }
+    blob = new Blob();
+    blob->hash = hash;
+    blob->references = 1;
+    blob->view = data;
+    blobs.emplace(hash, blob);
+    storedBytes += data.size();
+    return blob;
+}
+
+// Function to take a reference to a blob
+void ContentStore::retain(Blob* blob) {
+    if (blob) {
+        blob->references++;
+    }
+}
+
+// Function to drop a reference to a blob, freeing it with the last one
+void ContentStore::release(Blob* blob) {
+    if (blob == nullptr || --blob->references > 0) {
+        return;
+    }
+    auto range = blobs.equal_range(blob->hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == blob) {
+            blobs.erase(it);
+            break;
+        }
+    }
+    storedBytes -= blob->view.size();
+    delete blob;
+}
@@ -0,0 +1,75 @@
+#ifndef CONTENT_STORE_H
+#define CONTENT_STORE_H
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+
+// Content-addressed store of file contents. Identical contents are stored once
+// and shared by reference count, so copying a file only takes a reference, and
+// writing to one of the copies stores (or finds) a new blob while the others
+// keep the old one.
+//
+// Blobs never change once stored, so a reader that holds a blob pointer (inside
+// an epoch, through an entry that has not been reclaimed) may read its bytes
+// without locks. Storing, taking and dropping references are for one writer at
+// a time.
+class ContentStore {
+public:
+    class Blob {
+    public:
+        std::string_view bytes() const {
+            return view;
+        }
+
+    private:
+        friend class ContentStore;
+        std::uint64_t hash;
+        std::size_t references;
+        std::string_view view; // into owned, or into memory the store does not own (an image)
+        std::string owned;
+    };
+
+    ContentStore();
+    ~ContentStore();
+
+    ContentStore(const ContentStore&) = delete;
+    ContentStore& operator=(const ContentStore&) = delete;
+
+    // Function to store data, or find the blob already holding it; the caller
+    // gets one reference. Empty data is no blob (nullptr).
+    Blob* put(std::string_view data);
+
+    // Function to add a blob whose bytes live elsewhere and outlive it (a mapped
+    // image), without copying them; the caller gets one reference
+    Blob* adopt(std::string_view data, std::uint64_t hash);
+
+    // Functions to take and drop a reference; the last one frees the blob
+    void retain(Blob* blob);
+    void release(Blob* blob);
+
+    static std::uint64_t hashBytes(std::string_view data);
+
+    static std::uint64_t hashOf(const Blob* blob) {
+        return blob->hash;
+    }
+
+    // Blobs stored, and the bytes they hold between them
+    std::size_t size() const {
+        return blobs.size();
+    }
+
+    std::size_t bytes() const {
+        return storedBytes;
+    }
+
+private:
+    std::unordered_multimap<std::uint64_t, Blob*> blobs; // content hash -> blobs with that hash
+    std::size_t storedBytes;
+
+    Blob* find(std::string_view data, std::uint64_t hash) const;
+};
+
+#endif // CONTENT_STORE_H
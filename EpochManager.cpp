@@ -0,0 +1,135 @@
+#include "EpochManager.h"
+#include <stdexcept>
+
+namespace {
+
+// Process-wide registry of thread slots, claimed on a thread's first guard and
+// returned when the thread exits, so slot indexes stay below MAX_THREADS
+std::mutex registryLock;
+std::vector<bool> claimedSlots(EpochManager::MAX_THREADS, false);
+
+class SlotClaim {
+public:
+    std::size_t index;
+    SlotClaim() : index(EpochManager::MAX_THREADS) {
+        std::lock_guard<std::mutex> lock(registryLock);
+        for (std::size_t i = 0; i < claimedSlots.size(); i++) {
+            if (!claimedSlots[i]) {
+                claimedSlots[i] = true;
+                index = i;
+                return;
+            }
+        }
+        throw std::runtime_error("too many threads reading concurrently");
+    }
+    ~SlotClaim() {
+        std::lock_guard<std::mutex> lock(registryLock);
+        claimedSlots[index] = false;
+    }
+};
+
+} // namespace
+
+// Implementation of Guard constructor
+EpochManager::Guard::Guard(EpochManager& epochs) : manager(epochs.enabled ? &epochs : nullptr), slot(0) {
+    if (manager) {
+        slot = threadSlot();
+        manager->enter(slot);
+    }
+}
+
+// Implementation of Guard destructor
+EpochManager::Guard::~Guard() {
+    if (manager) {
+        manager->leave(slot);
+    }
+}
+
+// Implementation of EpochManager constructor
+EpochManager::EpochManager() : enabled(false), globalEpoch(1) {}
+
+// Implementation of EpochManager destructor
+EpochManager::~EpochManager() {
+    // Nobody reads any more: everything retired can go
+    for (Retired& entry : retired) {
+        entry.action();
+    }
+}
+
+// Private helper function to get the calling thread's slot index
+std::size_t EpochManager::threadSlot() {
+    static thread_local SlotClaim claim;
+    return claim.index;
+}
+
+// Private helper function to announce a reader
+void EpochManager::enter(std::size_t slot) {
+    ThreadSlot& state = slots[slot];
+    if (state.depth++ == 0) {
+        // Release, so reclaim() seeing this epoch also sees every access of the previous section
+        state.epoch.store(globalEpoch.load(std::memory_order_acquire), std::memory_order_release);
+        // The announcement must be visible before any shared pointer is read
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+// Private helper function to end a reader's announcement
+void EpochManager::leave(std::size_t slot) {
+    ThreadSlot& state = slots[slot];
+    if (--state.depth == 0) {
+        state.epoch.store(IDLE, std::memory_order_release);
+    }
+}
+
+// Function to switch deferred reclamation on
+void EpochManager::enable() {
+    enabled = true;
+}
+
+// Function to run action once no reader can still reach what it frees
+void EpochManager::retire(std::function<void()> action) {
+    if (!enabled) {
+        action();
+        return;
+    }
+    // Stamp with the current epoch and open the next one: readers that announce
+    // the next epoch started after the unlink and cannot reach the retired node
+    std::lock_guard<std::mutex> lock(retiredLock);
+    retired.push_back(Retired{globalEpoch.fetch_add(1, std::memory_order_acq_rel), std::move(action)});
+}
+
+// Function to run the retired actions that no active reader can observe
+void EpochManager::reclaim() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::uint64_t oldest = IDLE;
+    for (const ThreadSlot& state : slots) {
+        std::uint64_t epoch = state.epoch.load(std::memory_order_acquire);
+        if (epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+
+    std::vector<Retired> ready;
+    {
+        std::lock_guard<std::mutex> lock(retiredLock);
+        std::size_t kept = 0;
+        for (Retired& entry : retired) {
+            if (entry.epoch < oldest) {
+                ready.push_back(std::move(entry));
+            } else {
+                retired[kept++] = std::move(entry);
+            }
+        }
+        retired.resize(kept);
+    }
+    // Oldest first, so a structure retired before its parts is released first
+    for (Retired& entry : ready) {
+        entry.action();
+    }
+}
+
+// Number of retired actions waiting for readers to leave
+std::size_t EpochManager::pending() const {
+    std::lock_guard<std::mutex> lock(retiredLock);
+    return retired.size();
+}
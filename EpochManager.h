@@ -0,0 +1,85 @@
+#ifndef EPOCH_MANAGER_H
+#define EPOCH_MANAGER_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Epoch-based reclamation for structures read without locks.
+//
+// A reader brackets its accesses with a Guard, which announces the global epoch
+// it started in. A writer that unlinks a node hands its destruction to retire();
+// the action runs from reclaim() once every reader that was active when the node
+// was unlinked has left. While the manager is disabled (single-threaded use),
+// retire() runs the action at once and guards cost a branch.
+class EpochManager {
+public:
+    static constexpr std::size_t MAX_THREADS = 256;
+
+    // Marks a reader critical section; guards nest
+    class Guard {
+    public:
+        explicit Guard(EpochManager& epochs);
+        ~Guard();
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+    private:
+        EpochManager* manager; // nullptr while the manager is disabled
+        std::size_t slot;
+    };
+
+    EpochManager();
+    ~EpochManager();
+
+    EpochManager(const EpochManager&) = delete;
+    EpochManager& operator=(const EpochManager&) = delete;
+
+    // Function to switch deferred reclamation on; call before sharing the owner between threads
+    void enable();
+
+    bool isEnabled() const {
+        return enabled;
+    }
+
+    // Function to run action once no reader can still reach what it frees
+    void retire(std::function<void()> action);
+
+    // Function to run the retired actions that no active reader can observe.
+    // The caller must hold whatever lock the actions need.
+    void reclaim();
+
+    // Number of retired actions waiting for readers to leave
+    std::size_t pending() const;
+
+private:
+    static constexpr std::uint64_t IDLE = ~static_cast<std::uint64_t>(0);
+
+    class alignas(64) ThreadSlot {
+    public:
+        std::atomic<std::uint64_t> epoch; // epoch announced by the reader, IDLE outside a guard
+        int depth;                        // nesting depth, only touched by the owning thread
+        ThreadSlot() : epoch(IDLE), depth(0) {}
+    };
+
+    class Retired {
+    public:
+        std::uint64_t epoch;
+        std::function<void()> action;
+    };
+
+    bool enabled;
+    std::atomic<std::uint64_t> globalEpoch;
+    ThreadSlot slots[MAX_THREADS];
+    mutable std::mutex retiredLock;
+    std::vector<Retired> retired;
+
+    void enter(std::size_t slot);
+    void leave(std::size_t slot);
+    static std::size_t threadSlot();
+};
+
+#endif // EPOCH_MANAGER_H
@@ -1,472 +1,3494 @@
 #include "FileSystem.h"
+#include "Metrics.h"
+#include "Parallel.h"
 #include <iostream>
+#include <algorithm>
+#include <type_traits>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <numeric>
+#include <cstdlib>
+#include <chrono>
+#include <charconv>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-// Implementation of FileNode constructor
-FileSystem::FileNode::FileNode(const std::string& n, bool isDir) : name(n), isDirectory(isDir), next(nullptr) {}
+namespace {
 
-// Implementation of DirectoryNode constructor
-FileSystem::DirectoryNode::DirectoryNode(const std::string& n) : name(n), files(nullptr), next(nullptr) {}
+// Function to mix the bits of a 64-bit value (the splitmix64 finalizer)
+std::uint64_t mixBits(std::uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
 
-// Implementation of FileMoveOperation constructor
-FileSystem::FileMoveOperation::FileMoveOperation(const std::string& srcDir, const std::string& destDir, const std::string& fname, bool isDir)
-    : sourceDirectory(srcDir), destinationDirectory(destDir), filename(fname), isDirectory(isDir) {}
+// Functions to hash what an entry is apart from its name: a directory is what
+// its subtree holds, a file its size, mtime, mode and contents
+std::uint64_t directoryIdentity(std::uint64_t subtree) {
+    return mixBits(subtree ^ 0x6469726563746f72ULL);
+}
 
-// Implementation of FileSystem constructor
-FileSystem::FileSystem() : root(nullptr), bstRoot(nullptr) {}
+std::uint64_t fileIdentity(const FileSystem::Metadata& meta, std::uint64_t content) {
+    std::uint64_t hash = mixBits(meta.size ^ 0x66696c6566696c65ULL);
+    hash = mixBits(hash ^ static_cast<std::uint64_t>(meta.mtime));
+    hash = mixBits(hash ^ meta.mode);
+    return mixBits(hash ^ content);
+}
 
-// Implementation of FileSystem destructor
-FileSystem::~FileSystem() {
-    // Start by deleting all files within directories
-    DirectoryNode* currentDir = root;
-    while (currentDir != nullptr) {
-        FileNode* currentFile = currentDir->files;
-        while (currentFile != nullptr) {
-            FileNode* nextFile = currentFile->next;
-            delete currentFile;
-            currentFile = nextFile;
-        }
-        // After deleting files in the directory, delete the directory node itself
-        DirectoryNode* nextDir = currentDir->next;
-        delete currentDir;
-        currentDir = nextDir;
+// Function to hash an entry: its name and what it is
+std::uint64_t namedHash(std::string_view name, std::uint64_t identity) {
+    return mixBits(ContentStore::hashBytes(name) ^ mixBits(identity + 0x9e3779b97f4a7c15ULL));
+}
+
+// What a name sorts on by extension: the text after its last dot, or nothing
+// for a name with no dot or only a leading one
+std::string_view extensionOf(std::string_view name) {
+    std::size_t dot = name.rfind('.');
+    return dot == std::string_view::npos || dot == 0 ? std::string_view() : name.substr(dot + 1);
+}
+
+// The first eight bytes of a string as a big-endian number, zero padded, so
+// that prefixes compare the way the strings do unless they are equal
+std::uint64_t prefixOf(std::string_view text) {
+    std::uint64_t prefix = 0;
+    for (std::size_t i = 0; i < 8; i++) {
+        prefix = prefix << 8 | (i < text.size() ? static_cast<unsigned char>(text[i]) : 0u);
     }
+    return prefix;
+}
+
+} // namespace
+
+// Implementation of FileNode constructor
+FileSystem::FileNode::FileNode(NameId n, bool isDir, unsigned childId, const Metadata& metadata, ContentStore::Blob* blob)
+    : name(n), isDirectory(isDir), child(childId), meta(metadata), content(blob), next(nullptr), prev(nullptr) {}
 
-    // Delete the BST nodes
-    deleteBST(bstRoot);
+// Implementation of DirectoryNode constructor
+FileSystem::DirectoryNode::DirectoryNode(NameId n, unsigned dirId, unsigned parentId, EpochManager* epochs)
+    : name(n), id(dirId), parent(parentId), refCount(1), files(nullptr), tail(nullptr), fileIndex(epochs),
+      imageBacked(false), imageFirst(0), imageCount(0), order(UNSORTED), packed(nullptr), changes(1), scannedAt(0) {}
+
+// Implementation of DirectoryNode destructor; readers are done with the entry array by now
+FileSystem::DirectoryNode::~DirectoryNode() {
+    delete packed.load(std::memory_order_relaxed);
 }
 
-// Private helper function to delete BST nodes recursively
-void FileSystem::deleteBST(BSTNode* root) {
-    if (root == nullptr) {
-        return;
+// Function to compare two entries by the sort key alone
+bool FileSystem::EntryOrder::keyLess(const EntryKey& a, const EntryKey& b) const {
+    switch (key) {
+        case BY_TYPE:
+            return a.isDirectory && !b.isDirectory;
+        case BY_EXTENSION:
+            return extensionOf(names->str(a.name)) < extensionOf(names->str(b.name));
+        case BY_NAME:
+            return names->str(a.name) < names->str(b.name);
+        case BY_SIZE:
+            return a.size < b.size;
+        case BY_MTIME:
+            return a.mtime < b.mtime;
+        default:
+            return false;
+    }
+}
+
+// Function to compare two entries by the sort key, then by name
+bool FileSystem::EntryOrder::operator()(const EntryKey& a, const EntryKey& b) const {
+    if (keyLess(a, b)) {
+        return true;
+    }
+    if (keyLess(b, a)) {
+        return false;
     }
-    deleteBST(root->left);
-    deleteBST(root->right);
-    delete root;
+    return names->str(a.name) < names->str(b.name);
 }
 
-// Private helper function to find a directory by name
-FileSystem::DirectoryNode* FileSystem::findDirectory(const std::string& dirname) const {
-    DirectoryNode* temp = root;
-    while (temp != nullptr) {
-        if (temp->name == dirname) {
-            return temp;
+// Function to find where a name is among the entries, trying position hint first;
+// size() if it is not there. Four names are compared at a time with SSE2 where available.
+std::size_t FileSystem::EntryArray::find(NameId name, std::size_t hint) const {
+    std::size_t n = names.size();
+    if (hint < n && names[hint] == name) {
+        return hint;
+    }
+    const NameId* ids = names.data();
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i wanted = _mm_set1_epi32(static_cast<int>(name));
+    for (; i + 4 <= n; i += 4) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ids + i));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(block, wanted))));
+        if (mask != 0) {
+            return i + static_cast<unsigned>(__builtin_ctz(mask));
+        }
+    }
+#endif
+    // Names left over (or every name without SSE2)
+    for (; i < n; i++) {
+        if (ids[i] == name) {
+            return i;
         }
-        temp = temp->next;
     }
-    return nullptr;
+    return n;
 }
 
-// Private helper function to find a file in a directory
-FileSystem::FileNode* FileSystem::findFile(DirectoryNode* dir, const std::string& filename) const {
-    FileNode* temp = dir->files;
-    while (temp != nullptr) {
-        if (temp->name == filename) {
-            return temp;
+// Function to visit the directory id of every subdirectory entry, in order. With
+// SSE2 the flags are tested sixteen at a time, so runs of files cost a byte each.
+template <typename Visit>
+void FileSystem::EntryArray::forEachDirectory(Visit visit) const {
+    const std::uint8_t* bits = flags.data();
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    for (; i < flags.size(); i += 16) {
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bits + i))));
+        while (mask != 0) {
+            visit(children[i + static_cast<unsigned>(__builtin_ctz(mask))]);
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < size(); i++) {
+        if (bits[i] & DIRECTORY) {
+            visit(children[i]);
         }
-        temp = temp->next;
     }
-    return nullptr;
 }
 
-// Private helper function to insert a file into a directory
-void FileSystem::insertFileIntoDirectory(DirectoryNode* dir, FileNode* fileToInsert) {
-    if (!dir || !fileToInsert) {
-        return;
+// Implementation of DirectoryTable constructor
+FileSystem::DirectoryTable::DirectoryTable(EpochManager* reclaimer) : slots(allocate(16)), count(0), epochs(reclaimer) {}
+
+// Implementation of DirectoryTable destructor
+FileSystem::DirectoryTable::~DirectoryTable() {
+    ::operator delete(slots.load(std::memory_order_relaxed));
+}
+
+// Private helper function to allocate an array of empty directory slots
+FileSystem::DirectoryTable::Slots* FileSystem::DirectoryTable::allocate(std::size_t capacity) {
+    Slots* created = static_cast<Slots*>(::operator new(sizeof(Slots) + capacity * sizeof(Slot)));
+    created->capacity = capacity;
+    for (std::size_t i = 0; i < capacity; i++) {
+        Slot* slot = new (&created->at()[i]) Slot();
+        slot->node.store(nullptr, std::memory_order_relaxed);
+        slot->setUsage(Usage{0, 0, 0, 0});
+        slot->hash.store(0, std::memory_order_relaxed);
     }
-    
-    // If the directory has no files yet, insert the file as the first file
-    if (!dir->files) {
-        dir->files = fileToInsert;
-        return;
+    return created;
+}
+
+// Private helper function to move the slots into a bigger array and publish it
+void FileSystem::DirectoryTable::grow(std::size_t capacity) {
+    Slots* old = slots.load(std::memory_order_relaxed);
+    Slots* bigger = allocate(capacity);
+    std::size_t used = count.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < used; i++) {
+        bigger->at()[i].node.store(old->at()[i].node.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        bigger->at()[i].setUsage(old->at()[i].usage());
+        bigger->at()[i].hash.store(old->at()[i].hash.load(std::memory_order_relaxed), std::memory_order_relaxed);
     }
-    
-    // Otherwise, find the last file in the directory and insert the new file after it
-    FileNode* temp = dir->files;
-    while (temp->next) {
-        temp = temp->next;
+    slots.store(bigger, std::memory_order_release);
+    epochs->retire([old]() { ::operator delete(old); });
+}
+
+// Function to replace the directory stored under an id
+void FileSystem::DirectoryTable::set(std::size_t id, DirectoryNode* dir) {
+    slots.load(std::memory_order_relaxed)->at()[id].node.store(dir, std::memory_order_release);
+}
+
+// Function to add a directory under the next id
+void FileSystem::DirectoryTable::push_back(DirectoryNode* dir) {
+    std::size_t used = count.load(std::memory_order_relaxed);
+    if (used == slots.load(std::memory_order_relaxed)->capacity) {
+        grow(used * 2);
     }
-    temp->next = fileToInsert;
+    // The slot is filled before the count makes it visible
+    Slot& slot = slots.load(std::memory_order_relaxed)->at()[used];
+    slot.setUsage(Usage{0, 0, 0, 0});
+    slot.hash.store(0, std::memory_order_relaxed);
+    slot.node.store(dir, std::memory_order_release);
+    count.store(used + 1, std::memory_order_release);
 }
 
-// Private helper function to insert a file into BST
-void FileSystem::insertIntoBST(BSTNode*& root, const std::string& key) {
-    if (root == nullptr) {
-        root = new BSTNode(key);
-    } else if (key < root->key) {
-        insertIntoBST(root->left, key);
-    } else {
-        insertIntoBST(root->right, key);
+// Function to make room for a number of directories
+void FileSystem::DirectoryTable::reserve(std::size_t capacity) {
+    if (capacity > slots.load(std::memory_order_relaxed)->capacity) {
+        grow(capacity);
     }
 }
 
-// Private helper function to search for a file in BST
-bool FileSystem::searchBST(BSTNode* root, const std::string& key) const {
-    if (root == nullptr) {
-        return false;
+// Function to fill an empty table with the directories of another, and their usage and hashes
+void FileSystem::DirectoryTable::assign(const DirectoryTable& other) {
+    std::size_t used = other.size();
+    reserve(used);
+    for (std::size_t i = 0; i < used; i++) {
+        set(i, other[i]);
+        setUsage(i, other.usage(i));
+        setHash(i, other.hash(i));
     }
+    count.store(used, std::memory_order_release);
+}
 
-    if (root->key == key) {
-        return true;
-    } else if (key < root->key) {
-        return searchBST(root->left, key);
+// Implementation of Version constructor
+FileSystem::Version::Version(const NameTable* names, EpochManager* epochs)
+    : directories(epochs), searchIndex(NameOrder(names)), refCount(1) {}
+
+// Implementation of WriteLock constructor
+FileSystem::WriteLock::WriteLock(FileSystem& owner, bool exclusiveAccess)
+    : fs(&owner), writer(&owner),
+      active(owner.concurrent && owner.exclusiveOwner.load(std::memory_order_relaxed) != std::this_thread::get_id()),
+      exclusive(exclusiveAccess), stripeCount(0), indexHeld(false), guard(owner.epochs) {
+    if (!active) {
+        return;
+    }
+    if (exclusive) {
+        fs->structureLock.lock();
+        fs->exclusiveOwner.store(std::this_thread::get_id(), std::memory_order_relaxed);
     } else {
-        return searchBST(root->right, key);
+        fs->structureLock.lock_shared();
     }
 }
 
-// Function to insert a directory into the file system
-void FileSystem::insertDirectory(const std::string& dirname) {
-    // Check if directory with the same name already exists
-    if (findDirectory(dirname) != nullptr) {
-        std::cout << "Error: Directory '" << dirname << "' already exists." << std::endl;
-        return;
+// Implementation of WriteLock constructor for operations that only read
+FileSystem::WriteLock::WriteLock(const FileSystem& owner)
+    : fs(&owner), writer(nullptr),
+      active(owner.concurrent && owner.exclusiveOwner.load(std::memory_order_relaxed) != std::this_thread::get_id()),
+      exclusive(true), stripeCount(0), indexHeld(false), guard(owner.epochs) {
+    if (active) {
+        fs->structureLock.lock();
+        fs->exclusiveOwner.store(std::this_thread::get_id(), std::memory_order_relaxed);
     }
+}
 
-    // If directory does not exist, proceed with insertion
-    if (root == nullptr) {
-        root = new DirectoryNode(dirname);
+// Implementation of WriteLock destructor
+FileSystem::WriteLock::~WriteLock() {
+    if (!active) {
+        return;
+    }
+    // Retired nodes go back to the pools, which only the global section may touch
+    if (!exclusive && !indexHeld) {
+        fs->indexLock.lock();
+        indexHeld = true;
+    }
+    fs->epochs.reclaim();
+    bool checkpointDue = writer != nullptr && writer->checkpointDue.exchange(false);
+    std::string checkpointPath = checkpointDue ? writer->checkpointPath : std::string();
+    if (indexHeld) {
+        fs->indexLock.unlock();
+    }
+    for (std::size_t i = stripeCount; i-- > 0;) {
+        fs->directoryLocks[stripes[i]].unlock();
+    }
+    if (exclusive) {
+        fs->exclusiveOwner.store(std::thread::id(), std::memory_order_relaxed);
+        fs->structureLock.unlock();
     } else {
-        DirectoryNode* temp = root;
-        while (temp->next != nullptr) {
-            temp = temp->next;
-        }
-        temp->next = new DirectoryNode(dirname);
+        fs->structureLock.unlock_shared();
+    }
+    // A checkpoint needs the structure to itself, so it runs once every lock is released
+    if (checkpointDue) {
+        writer->checkpoint(checkpointPath);
     }
 }
 
-// Function to insert a file into the file system
-void FileSystem::insertFile(const std::string& dirname, const std::string& filename, bool isDir) {
-    // Find the directory where the file is to be inserted
-    DirectoryNode* dir = findDirectory(dirname);
-    if (dir == nullptr) {
-        std::cout << "Error: Directory '" << dirname << "' not found." << std::endl;
+// Function to lock the stripes of up to two directories, in stripe order
+void FileSystem::WriteLock::lockDirectories(unsigned first, unsigned second) {
+    if (!active || exclusive || stripeCount > 0) {
         return;
     }
+    stripes[stripeCount++] = fs->stripeOf(first);
+    if (second != NO_DIRECTORY && fs->stripeOf(second) != stripes[0]) {
+        stripes[stripeCount++] = fs->stripeOf(second);
+        if (stripes[1] < stripes[0]) {
+            std::swap(stripes[0], stripes[1]);
+        }
+    }
+    for (std::size_t i = 0; i < stripeCount; i++) {
+        fs->directoryLocks[stripes[i]].lock();
+    }
+}
 
-    // Check if file with the same name already exists in the directory
-    if (findFile(dir, filename) != nullptr) {
-        std::cout << "Error: File '" << filename << "' already exists in directory '" << dirname << "'." << std::endl;
+// Function to enter the global section (journal, names, pools, search index)
+void FileSystem::WriteLock::lockIndex() {
+    if (!active || exclusive || indexHeld) {
         return;
     }
+    fs->indexLock.lock();
+    indexHeld = true;
+}
 
-    // If file does not exist, proceed with insertion
-    if (dir->files == nullptr) {
-        dir->files = new FileNode(filename, isDir);
-    } else {
-        FileNode* temp = dir->files;
-        while (temp->next != nullptr) {
-            temp = temp->next;
-        }
-        temp->next = new FileNode(filename, isDir);
+// Implementation of FileMoveOperation constructor
+FileSystem::FileMoveOperation::FileMoveOperation(const std::string& srcDir, const std::string& destDir, const std::string& fname, bool isDir)
+    : sourceDirectory(srcDir), destinationDirectory(destDir), filename(fname), isDirectory(isDir) {}
+
+// Implementation of MoveBatch constructor
+FileSystem::MoveBatch::MoveBatch(const std::string& srcDir, const std::string& destDir)
+    : sourceDirectory(srcDir), destinationDirectory(destDir), moved(0), missing(0), conflicts(0) {}
+
+// Implementation of ListCursor constructor
+FileSystem::ListCursor::ListCursor() : directory(NO_DIRECTORY), last(NameTable::NONE), position(0), done(false) {}
+
+// Function to write the cursor as "directory.last.position" (done is not kept:
+// a finished cursor resumed later picks up entries appended since)
+std::string FileSystem::ListCursor::token() const {
+    return std::to_string(directory) + "." + std::to_string(last) + "." + std::to_string(position);
+}
+
+// Function to read a cursor back from its token, returns false if it is not one
+bool FileSystem::ListCursor::parse(std::string_view text) {
+    unsigned parsedDirectory;
+    NameId parsedLast;
+    std::uint64_t parsedPosition;
+    const char* at = text.data();
+    const char* end = text.data() + text.size();
+    std::from_chars_result parsed = std::from_chars(at, end, parsedDirectory);
+    if (parsed.ec != std::errc() || parsed.ptr == end || *parsed.ptr != '.') {
+        return false;
+    }
+    parsed = std::from_chars(parsed.ptr + 1, end, parsedLast);
+    if (parsed.ec != std::errc() || parsed.ptr == end || *parsed.ptr != '.') {
+        return false;
+    }
+    parsed = std::from_chars(parsed.ptr + 1, end, parsedPosition);
+    if (parsed.ec != std::errc() || parsed.ptr != end) {
+        return false;
     }
+    directory = parsedDirectory;
+    last = parsedLast;
+    position = parsedPosition;
+    done = false;
+    return true;
+}
 
-    // Insert the file into the binary search tree
-    insertIntoBST(bstRoot, filename);
+// Implementation of FileSystem constructor
+FileSystem::FileSystem() : current(new Version(&names, &epochs)), published(current), sequence(0), replaying(false),
+      replayTime(0), checkpointEvery(0), checkpointBackups(0), concurrent(false), checkpointDue(false), suffixIndex(nullptr),
+      nameFilter(new NameFilter(NAME_FILTER_START)) {
+    current->directories.push_back(directoryPool.create(names.intern(""), ROOT_DIRECTORY, NO_DIRECTORY, &epochs));
 }
 
-// Function to search for a file in the file system using BST
-bool FileSystem::search(const std::string& filename) const {
-    return searchBST(bstRoot, filename);
+// Implementation of FileSystem destructor
+FileSystem::~FileSystem() {
+    // File nodes are trivially destructible and go away with their pool in bulk;
+    // only directories (which own hash tables) and versions are destroyed one by one.
+    static_assert(std::is_trivially_destructible<FileNode>::value, "file nodes are freed in bulk");
+    delete suffixIndex.load(std::memory_order_relaxed);
+    delete nameFilter.load(std::memory_order_relaxed);
+    backups.push(current);
+    while (!backups.empty()) {
+        Version* version = backups.top();
+        backups.pop();
+        if (--version->refCount > 0) {
+            continue;
+        }
+        for (std::size_t id = 0; id < version->directories.size(); id++) {
+            DirectoryNode* dir = version->directories[id];
+            if (dir && --dir->refCount == 0) {
+                directoryPool.destroy(dir);
+            }
+        }
+        delete version;
+    }
 }
 
-// Function to display the directory structure
-void FileSystem::displayDirectoryStructure() const {
-    DirectoryNode* tempDir = root;
-    while (tempDir != nullptr) {
-        std::cout << "Directory: " << tempDir->name << std::endl;
-        FileNode* tempFile = tempDir->files;
-        while (tempFile != nullptr) {
-            std::cout << "- " << tempFile->name << (tempFile->isDirectory ? " (Directory)" : " (File)") << std::endl;
-            tempFile = tempFile->next;
+// Private helper function to drop one reference to a version, freeing what nobody else shares
+void FileSystem::releaseVersion(Version* version) {
+    if (--version->refCount > 0) {
+        return;
+    }
+    for (std::size_t id = 0; id < version->directories.size(); id++) {
+        DirectoryNode* dir = version->directories[id];
+        if (dir) {
+            releaseDirectory(dir);
         }
-        tempDir = tempDir->next;
     }
+    retireVersion(version);
 }
-void FileSystem::createBackup() {
-    // Create a new FileSystem object to store the backup
-    FileSystem* backup = new FileSystem();
-    
-    // Copy the entire file system to the backup
-    // Traverse the current file system and insert directories and files into the backup
-    DirectoryNode* currentDir = root;
-    while (currentDir != nullptr) {
-        backup->insertDirectory(currentDir->name); // Insert directory into the backup
-        
-        // Insert files from the current directory into the backup
-        FileNode* currentFile = currentDir->files;
-        while (currentFile != nullptr) {
-            backup->insertFile(currentDir->name, currentFile->name, currentFile->isDirectory);
-            currentFile = currentFile->next;
-        }
-        
-        currentDir = currentDir->next;
-    }
-    
-    // Push the backup onto the stack
-    backups.push(backup);
-}
-
-void FileSystem::restoreBackup() {
-    if (!backups.empty()) {
-        // Get the most recent backup
-        FileSystem* backup = backups.top();
-        
-        // Clear the current file system
-        DirectoryNode* currentDir = root;
-        while (currentDir != nullptr) {
-            DirectoryNode* nextDir = currentDir->next;
-            delete currentDir;
-            currentDir = nextDir;
-        }
-        root = nullptr;
-        
-        // Copy the backup file system to the current file system
-        DirectoryNode* backupDir = backup->root;
-        while (backupDir != nullptr) {
-            insertDirectory(backupDir->name); // Insert directory into the current file system
-            
-            // Insert files from the backup directory into the current file system
-            FileNode* backupFile = backupDir->files;
-            while (backupFile != nullptr) {
-                insertFile(backupDir->name, backupFile->name, backupFile->isDirectory);
-                backupFile = backupFile->next;
-            }
-            
-            backupDir = backupDir->next;
-        }
-        
-        // Pop the backup from the stack and delete it
-        backups.pop();
-        delete backup;
+
+// Private helper function to drop one reference to a directory, deleting it and its files on the last one
+void FileSystem::releaseDirectory(DirectoryNode* dir) {
+    if (--dir->refCount > 0) {
+        return;
+    }
+    if (concurrent) {
+        epochs.retire([this, dir]() { destroyDirectory(dir); });
     } else {
-        std::cout << "No backup available." << std::endl;
+        destroyDirectory(dir);
     }
 }
 
+// Private helper function to free a directory nobody refers to, with its file nodes
+void FileSystem::destroyDirectory(DirectoryNode* dir) {
+    FileNode* currentFile = dir->files;
+    while (currentFile != nullptr) {
+        FileNode* nextFile = currentFile->next;
+        destroyFile(currentFile);
+        currentFile = nextFile;
+    }
+    directoryPool.destroy(dir);
+}
 
-// Function to remove a file from the file system
-void FileSystem::remove(const std::string& filename) {
-    DirectoryNode* tempDir = root;
-    DirectoryNode* prevDir = nullptr;
+// Private helper function to free a file node once no reader can be standing on it
+void FileSystem::retireFile(FileNode* file) {
+    if (concurrent) {
+        epochs.retire([this, file]() { destroyFile(file); });
+    } else {
+        destroyFile(file);
+    }
+}
 
-    while (tempDir != nullptr) {
-        FileNode* tempFile = tempDir->files;
-        FileNode* prevFile = nullptr;
+// Private helper function to make a file node holding a reference to its contents
+FileSystem::FileNode* FileSystem::createFile(NameId name, bool isDir, unsigned child, const Metadata& metadata,
+                                             ContentStore::Blob* content) {
+    contents.retain(content);
+    return filePool.create(name, isDir, child, metadata, content);
+}
 
-        while (tempFile != nullptr) {
-            if (tempFile->name == filename) {
-                if (prevFile != nullptr) {
-                    prevFile->next = tempFile->next;
-                } else {
-                    tempDir->files = tempFile->next;
-                }
-                delete tempFile;
-                return;
-            }
-            prevFile = tempFile;
-            tempFile = tempFile->next;
-        }
+// Private helper function to free a file node and drop its reference to its contents
+void FileSystem::destroyFile(FileNode* file) {
+    contents.release(file->content);
+    filePool.destroy(file);
+}
 
-        prevDir = tempDir;
-        tempDir = tempDir->next;
+// Private helper function to free a version once no reader can be inside it
+void FileSystem::retireVersion(Version* version) {
+    if (concurrent) {
+        epochs.retire([version]() { delete version; });
+    } else {
+        delete version;
     }
 }
 
+// Private helper function to pick the lock stripe guarding a directory
+std::size_t FileSystem::stripeOf(unsigned dirId) const {
+    return dirId % DIRECTORY_STRIPES;
+}
 
-// Function to enqueue a move operation
-void FileSystem::enqueueMove(const std::string& sourceDir, const std::string& destDir, const std::string& filename, bool isDir) {
-    moveQueue.push(FileMoveOperation(sourceDir, destDir, filename, isDir));
+// Private helper function to make a version current for writers and readers alike
+void FileSystem::publish(Version* version) {
+    current = version;
+    published.store(version, std::memory_order_release);
+}
+
+// Private helper function to change the search index of the current version.
+// Readers may be inside the tree in concurrent mode, so the change is made to a
+// copy (every node it touches is shared and gets copied), published with one
+// store, and the old tree is retired.
+template <typename Update>
+void FileSystem::updateSearchIndex(Update change) {
+    if (!concurrent) {
+        change(current->searchIndex);
+        return;
+    }
+    NameIndex* changed = new NameIndex(current->searchIndex);
+    change(*changed);
+    current->searchIndex.swap(*changed);
+    epochs.retire([changed]() { delete changed; });
 }
 
+// Private helper function to get a current version that no backup shares.
+// Copies only the directory table; directories and the search index stay shared.
+FileSystem::Version* FileSystem::writableVersion() {
+    if (current->refCount == 1) {
+        return current;
+    }
+    Version* copy = new Version(&names, &epochs);
+    copy->directories.assign(current->directories);
+    copy->searchIndex = current->searchIndex;
+    for (std::size_t id = 0; id < copy->directories.size(); id++) {
+        DirectoryNode* dir = copy->directories[id];
+        if (dir) {
+            dir->refCount++;
+        }
+    }
+    current->refCount--;
+    publish(copy);
+    return copy;
+}
 
-// Function to process the move queue
-void FileSystem::processMoveQueue() {
-    while (!moveQueue.empty()) {
-        FileMoveOperation operation = moveQueue.front();
-        moveQueue.pop();
-        
-        // Find the source and destination directories
-        DirectoryNode* sourceDir = findDirectory(operation.sourceDirectory);
-        DirectoryNode* destDir = findDirectory(operation.destinationDirectory);
-        
-        if (sourceDir && destDir) {
-            // Find the file in the source directory
-            FileNode* fileToMove = findFile(sourceDir, operation.filename);
-            
-            if (fileToMove) {
-                // Remove the file from the source directory
-                remove(fileToMove->name);
-                
-                // Insert the file into the destination directory
-                this->insertFile(destDir->name, fileToMove->name, fileToMove->isDirectory);
-                
-                std::cout << "Moved file '" << operation.filename << "' from '" << operation.sourceDirectory << "' to '" << operation.destinationDirectory << "'" << std::endl;
-            } else {
-                std::cout << "File '" << operation.filename << "' not found in directory '" << operation.sourceDirectory << "'" << std::endl;
-            }
+// Private helper function to get a copy of a directory that no backup shares.
+// An image-backed directory is materialized here: its entries become file nodes
+// and its names move into the search index.
+// Always look directories up again by id afterwards: the old pointer may now belong to a backup.
+FileSystem::DirectoryNode* FileSystem::writableDirectory(unsigned dirId) {
+    DirectoryNode* dir = writableVersion()->directories[dirId];
+    if (dir->refCount == 1 && !dir->imageBacked) {
+        return dir;
+    }
+    return installDirectory(dirId, copyDirectory(dir));
+}
+
+// Private helper function to copy a directory's entries into new, unpublished nodes
+FileSystem::DirectoryNode* FileSystem::copyDirectory(const DirectoryNode* dir) {
+    DirectoryNode* copy = directoryPool.create(dir->name, dir->id, dir->parent, &epochs);
+    METRICS_COUNT(DIRECTORY_COPIES, 1);
+    forEachEntry(dir, [&](const EntryInfo& entry) {
+        METRICS_COUNT(ENTRIES_COPIED, 1);
+        FileNode* fileCopy = createFile(entry.name, entry.isDirectory, entry.child, entry.meta, entry.content);
+        fileCopy->prev = copy->tail;
+        if (copy->tail) {
+            copy->tail->next = fileCopy;
         } else {
-            std::cout << "Source or destination directory not found" << std::endl;
+            copy->files = fileCopy;
         }
+        copy->tail = fileCopy;
+        copy->fileIndex.insert(fileCopy);
+    });
+    copy->order = dir->order;
+    indexSortedEntries(copy);
+    return copy;
+}
+
+// Private helper function to replace a directory of the current version by a private copy of it
+FileSystem::DirectoryNode* FileSystem::installDirectory(unsigned dirId, DirectoryNode* copy) {
+    Version* version = writableVersion();
+    DirectoryNode* dir = version->directories[dirId];
+    if (dir->imageBacked) {
+        updateSearchIndex([&](NameIndex& index) {
+            for (FileNode* file = copy->files; file != nullptr; file = file->next) {
+                index.insert(file->name, dirId);
+            }
+        });
     }
+    version->directories.set(dirId, copy);
+    releaseDirectory(dir);
+    return copy;
 }
 
-// Display specific directory
-void FileSystem::displayDirectoryContents(const std::string& dirname) const {
-    DirectoryNode* dir = findDirectory(dirname);
-    if (dir) {
-        if (dir->files) {
-            std::cout << "Contents of directory '" << dirname << "':" << std::endl;
-            FileNode* tempFile = dir->files;
-            while (tempFile != nullptr) {
-                std::cout << "- " << tempFile->name << (tempFile->isDirectory ? " (Directory)" : " (File)") << std::endl;
-                tempFile = tempFile->next;
+// Private helper function to turn a path into "a/b/c" form (no empty components, root is "")
+std::string FileSystem::normalizePath(const std::string& path) {
+    std::string normalized;
+    std::size_t start = 0;
+    while (start <= path.size()) {
+        std::size_t slash = path.find('/', start);
+        if (slash == std::string::npos) {
+            slash = path.size();
+        }
+        if (slash > start) {
+            if (!normalized.empty()) {
+                normalized += '/';
             }
-        } else {
-            std::cout << "Directory '" << dirname << "' is empty." << std::endl;
+            normalized.append(path, start, slash - start);
         }
+        start = slash + 1;
+    }
+    return normalized;
+}
+
+// Private helper function to split a normalized path into its parent path and last component
+void FileSystem::splitPath(const std::string& path, std::string& parent, std::string& leaf) {
+    std::size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        parent.clear();
+        leaf = path;
     } else {
-        std::cout << "Directory '" << dirname << "' not found." << std::endl;
+        parent = path.substr(0, slash);
+        leaf = path.substr(slash + 1);
     }
 }
 
-//Rename Directory
-void FileSystem::renameDirectory(const std::string& oldName, const std::string& newName) {
-    // Check if the directory with the old name exists
-    DirectoryNode* oldDir = findDirectory(oldName);
-    if (!oldDir) {
-        std::cout << "Error: Directory '" << oldName << "' not found." << std::endl;
-        return;
+// Private helper function to build the path of a directory from its parent links
+std::string FileSystem::directoryPath(const Version* version, const DirectoryNode* dir) const {
+    if (dir->id == ROOT_DIRECTORY) {
+        return "/";
+    }
+    std::vector<const DirectoryNode*> chain;
+    for (; dir != nullptr && dir->id != ROOT_DIRECTORY; dir = version->directories[dir->parent]) {
+        chain.push_back(dir);
+    }
+    std::string path;
+    for (std::size_t i = chain.size(); i-- > 0;) {
+        path.append(names.str(chain[i]->name));
+        if (i > 0) {
+            path += '/';
+        }
     }
+    return path;
+}
 
-    // Check if a directory with the new name already exists
-    if (findDirectory(newName)) {
-        std::cout << "Error: Directory '" << newName << "' already exists." << std::endl;
-        return;
+// Private helper function to check whether a directory is ancestorId or lies beneath it
+bool FileSystem::isWithin(unsigned dirId, unsigned ancestorId) const {
+    for (unsigned id = dirId; id != NO_DIRECTORY; id = current->directories[id]->parent) {
+        if (id == ancestorId) {
+            return true;
+        }
     }
+    return false;
+}
 
-    // Update the name of the directory node
-    oldDir->name = newName;
-    std::cout << "Directory '" << oldName << "' renamed to '" << newName << "'." << std::endl;
+// Private helper function to remember a resolved path prefix
+void FileSystem::cacheDentry(const std::string& path, unsigned dirId) const {
+    // Readers share nothing writable in concurrent mode, so the cache is off there
+    if (concurrent) {
+        return;
+    }
+    if (dentryCache.size() >= DENTRY_CACHE_LIMIT) {
+        dentryCache.clear();
+    }
+    dentryCache[path] = dirId;
 }
 
-// Function to copy a file
-void FileSystem::copyFile() {
-    std::string filename;
-    std::cout << "Enter the name of the file you want to copy: ";
-    std::cin >> filename;
+// Private helper function to forget every cached path, after directories were renamed,
+// moved or removed, or a backup was restored
+void FileSystem::invalidateDentryCache() {
+    dentryCache.clear();
+}
 
-    // Find the file in the file system
-    FileNode* fileToCopy = nullptr;
-    DirectoryNode* currentDir = root;
-    while (currentDir != nullptr) {
-        fileToCopy = findFile(currentDir, filename);
-        if (fileToCopy != nullptr) {
+// Private helper function to resolve a directory path. The walk starts from the
+// longest cached prefix, and every prefix resolved on the way is cached.
+FileSystem::DirectoryNode* FileSystem::findDirectory(const Version* version, const std::string& dirpath) const {
+    std::string path = normalizePath(dirpath);
+    unsigned dirId = ROOT_DIRECTORY;
+    std::size_t resolved = 0;
+    METRICS_COUNT(PATH_LOOKUPS, 1);
+    for (std::size_t end = concurrent ? 0 : path.size(); end > 0;) {
+        std::unordered_map<std::string, unsigned>::const_iterator cached = dentryCache.find(path.substr(0, end));
+        if (cached != dentryCache.end()) {
+            METRICS_COUNT(DENTRY_HITS, 1);
+            dirId = cached->second;
+            resolved = end;
             break;
         }
-        currentDir = currentDir->next;
+        std::size_t slash = path.rfind('/', end - 1);
+        end = slash == std::string::npos ? 0 : slash;
     }
 
-    if (fileToCopy != nullptr) {
-        std::string destinationDir;
-        std::cout << "Enter the name of the directory you want to paste the file into: ";
-        std::cin >> destinationDir;
+    DirectoryNode* dir = version->directories[dirId];
+    std::size_t start = resolved == 0 ? 0 : resolved + 1;
+    while (start < path.size()) {
+        std::size_t slash = path.find('/', start);
+        if (slash == std::string::npos) {
+            slash = path.size();
+        }
+        // A name that was never interned cannot belong to any directory
+        METRICS_COUNT(PATH_COMPONENTS, 1);
+        NameId name = names.find(std::string_view(path).substr(start, slash - start));
+        EntryInfo entry;
+        if (name == NameTable::NONE || !lookupEntry(dir, name, entry) || !entry.isDirectory) {
+            return nullptr;
+        }
+        // A directory removed by a concurrent writer leaves an empty slot
+        dir = version->directories[entry.child];
+        if (dir == nullptr) {
+            return nullptr;
+        }
+        cacheDentry(path.substr(0, slash), dir->id);
+        start = slash + 1;
+    }
+    return dir;
+}
 
-        // Find the destination directory
-        DirectoryNode* destDir = findDirectory(destinationDir);
-        if (destDir != nullptr) {
-            // Check if a file with the copied name already exists in the destination directory
-            std::string copiedFilename = "copy_" + filename;
-            FileNode* existingFile = findFile(destDir, copiedFilename);
-            int copyCount = 1;
-            while (existingFile != nullptr) {
-                // If a file with the copied name already exists, update the copied filename
-                copiedFilename = "copy_" + std::to_string(copyCount) + "_" + filename;
-                existingFile = findFile(destDir, copiedFilename);
-                copyCount++;
-            }
-
-            // Create a copy of the file
-            FileNode* copiedFile = new FileNode(copiedFilename, fileToCopy->isDirectory);
-
-            // Insert the copied file into the destination directory
-            insertFileIntoDirectory(destDir, copiedFile);
-            std::cout << "File copied successfully." << std::endl;
-        } else {
-            std::cout << "Error: Destination directory '" << destinationDir << "' not found." << std::endl;
+// Private helper function to find a file in a (writable) directory
+FileSystem::FileNode* FileSystem::findFile(DirectoryNode* dir, const std::string& filename) const {
+    NameId name = names.find(filename);
+    return name == NameTable::NONE ? nullptr : dir->fileIndex.find(name);
+}
+
+// Private helper function to find a file in a (writable) directory by interned name
+FileSystem::FileNode* FileSystem::findFile(DirectoryNode* dir, NameId filename) const {
+    return dir->fileIndex.find(filename);
+}
+
+// Private helper function to look up an entry in any directory, image-backed or not
+bool FileSystem::lookupEntry(const DirectoryNode* dir, NameId name, EntryInfo& entry) const {
+    METRICS_COUNT(ENTRY_LOOKUPS, 1);
+    if (!dir->imageBacked) {
+        FileNode* file = dir->fileIndex.find(name);
+        if (file == nullptr) {
+            return false;
+        }
+        entry.name = file->name;
+        entry.isDirectory = file->isDirectory;
+        entry.child = file->child;
+        entry.meta = file->meta;
+        entry.content = file->content;
+        return true;
+    }
+    // A larger directory's filter turns most misses away before the search
+    std::uint32_t filter = image->directories()[dir->id].filter;
+    if (filter != NamespaceImage::NO_FILTER) {
+        if (!NameFilter::mayContain(image->directoryFilters() + filter, NameFilter::wordsFor(dir->imageCount), name)) {
+            METRICS_COUNT(DIRECTORY_FILTER_REJECTS, 1);
+            return false;
         }
-    } else {
-        std::cout << "Error: File '" << filename << "' not found." << std::endl;
     }
+    // Binary search over the directory's slice of the sorted permutation
+    const NamespaceImage::Entry* entries = image->entries();
+    const std::uint32_t* first = image->sorted() + dir->imageFirst;
+    const std::uint32_t* last = first + dir->imageCount;
+    std::string_view wanted = names.str(name);
+    const std::uint32_t* found = std::lower_bound(first, last, wanted, [&](std::uint32_t index, std::string_view key) {
+        return names.str(entries[index].name) < key;
+    });
+    if (found == last || entries[*found].name != name) {
+        if (filter != NamespaceImage::NO_FILTER) {
+            METRICS_COUNT(DIRECTORY_FILTER_FALSE_POSITIVES, 1);
+        }
+        return false;
+    }
+    imageEntry(entries[*found], entry);
+    return true;
 }
 
-// Function to sort files in a specified directory by alphabetical order
-void FileSystem::sortFilesInDirectory() {
-    std::string dirname;
-    std::cout << "Enter the name of the directory you want to sort: ";
-    std::cin >> dirname;
+// Private helper function to read an entry stored in the image
+void FileSystem::imageEntry(const NamespaceImage::Entry& stored, EntryInfo& entry) const {
+    entry.name = stored.name;
+    entry.child = stored.child;
+    entry.isDirectory = entry.child != NamespaceImage::NO_DIRECTORY;
+    entry.meta = Metadata{stored.size, stored.mtime, stored.ctime, stored.mode};
+    entry.content = stored.content < imageBlobs.size() ? imageBlobs[stored.content] : nullptr;
+}
 
-    // Find the directory in the file system
-    DirectoryNode* dir = findDirectory(dirname);
-    if (dir) {
-        // Sort the files within the directory alphabetically using Quicksort
-        quickSortFiles(dir->files);
+// Private helper function to check whether a directory has an entry with the given name
+bool FileSystem::hasEntry(const DirectoryNode* dir, const std::string& filename) const {
+    NameId name = names.find(filename);
+    EntryInfo entry;
+    return name != NameTable::NONE && lookupEntry(dir, name, entry);
+}
 
-        std::cout << "Files in directory '" << dirname << "' sorted successfully." << std::endl;
-    } else {
-        std::cout << "Error: Directory '" << dirname << "' not found." << std::endl;
+// Private helper function to check whether a directory has no entries
+bool FileSystem::isEmpty(const DirectoryNode* dir) const {
+    return dir->imageBacked ? dir->imageCount == 0 : dir->files == nullptr;
+}
+
+// Private helper function to visit the entries of a directory in list order
+template <typename Visit>
+void FileSystem::forEachEntry(const DirectoryNode* dir, Visit visit) const {
+    EntryInfo entry;
+    if (dir->imageBacked) {
+        const NamespaceImage::Entry* entries = image->entries() + dir->imageFirst;
+        for (unsigned i = 0; i < dir->imageCount; i++) {
+            imageEntry(entries[i], entry);
+            visit(entry);
+        }
+        return;
+    }
+    const EntryArray* packed = packedEntries(dir);
+    if (packed) {
+        for (std::size_t i = 0; i < packed->size(); i++) {
+            entry.name = packed->names[i];
+            entry.isDirectory = (packed->flags[i] & EntryArray::DIRECTORY) != 0;
+            entry.child = packed->children[i];
+            entry.meta = packed->meta[i];
+            entry.content = packed->contents[i];
+            visit(entry);
+        }
+        return;
+    }
+    // Walk the list, and let the next walk build the array if this one was long
+    std::uint64_t changes = dir->changes.load();
+    std::size_t count = 0;
+    for (FileNode* file = dir->files.load(std::memory_order_acquire); file != nullptr;
+         file = file->next.load(std::memory_order_acquire), count++) {
+        entry.name = file->name;
+        entry.isDirectory = file->isDirectory;
+        entry.child = file->child;
+        entry.meta = file->meta;
+        entry.content = file->content;
+        visit(entry);
+    }
+    if (count >= PACKED_ENTRIES) {
+        dir->scannedAt.store(changes, std::memory_order_relaxed);
     }
 }
 
-// Quicksort implementation for sorting files
-void FileSystem::quickSortFiles(FileNode*& head) {
-    if (!head || !head->next) {
+// Private helper function to visit the ids of a directory's subdirectories in list order
+template <typename Visit>
+void FileSystem::forEachSubdirectory(const DirectoryNode* dir, Visit visit) const {
+    const EntryArray* packed = dir->imageBacked ? nullptr : packedEntries(dir);
+    if (packed) {
+        packed->forEachDirectory(visit);
         return;
     }
+    forEachEntry(dir, [&](const EntryInfo& entry) {
+        if (entry.isDirectory) {
+            visit(entry.child);
+        }
+    });
+}
 
-    // Partition the list
-    FileNode* pivot = head;
-    FileNode* current = head->next;
-    FileNode* smallerHead = nullptr;
-    FileNode* smallerTail = nullptr;
-    FileNode* largerHead = nullptr;
-    FileNode* largerTail = nullptr;
-
-    while (current) {
-        FileNode* next = current->next;
-        if (current->name < pivot->name) {
-            if (!smallerHead) {
-                smallerHead = current;
-                smallerTail = current;
-            } else {
-                smallerTail->next = current;
-                smallerTail = current;
-            }
-        } else {
-            if (!largerHead) {
-                largerHead = current;
-                largerTail = current;
-            } else {
-                largerTail->next = current;
-                largerTail = current;
-            }
+// Private helper function to get a directory's entries laid out contiguously, or
+// nullptr if its files list should be walked. The array is built when a large
+// directory is walked the second time without having changed in between: a small
+// directory, or one that changes between scans, stays a list alone, as building
+// the array would cost more than it saves. A reader may build it while a writer
+// changes the directory; if a change lands during the build, the reader takes
+// the array back unless the writer already dropped it.
+const FileSystem::EntryArray* FileSystem::packedEntries(const DirectoryNode* dir) const {
+    EntryArray* packed = dir->packed.load(std::memory_order_acquire);
+    if (packed != nullptr || dir->imageBacked) {
+        return packed;
+    }
+    // Claim the build (changes is never 0), so readers scanning together build it once
+    std::uint64_t changes = dir->changes.load();
+    std::uint64_t expected = changes;
+    if (dir->scannedAt.load(std::memory_order_relaxed) != changes ||
+        !dir->scannedAt.compare_exchange_strong(expected, 0, std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    packed = new EntryArray();
+    for (FileNode* file = dir->files.load(std::memory_order_acquire); file != nullptr;
+         file = file->next.load(std::memory_order_acquire)) {
+        packed->names.push_back(file->name);
+        packed->flags.push_back(file->isDirectory ? EntryArray::DIRECTORY : 0);
+        packed->children.push_back(file->child);
+        packed->meta.push_back(file->meta);
+        packed->contents.push_back(file->content);
+    }
+    packed->flags.resize((packed->flags.size() + 15) / 16 * 16, 0);
+    METRICS_COUNT(ENTRY_ARRAYS_BUILT, 1);
+    dir->packed.store(packed);
+    if (dir->changes.load() != changes) {
+        EntryArray* built = packed;
+        if (dir->packed.compare_exchange_strong(built, nullptr)) {
+            retireEntryArray(packed);
+        }
+        return nullptr;
+    }
+    return packed;
+}
+
+// Private helper function to note a change to a directory's files list, made
+// before the call, dropping the entry array that no longer matches it
+void FileSystem::entriesChanged(DirectoryNode* dir) {
+    dir->changes.fetch_add(1);
+    retireEntryArray(dir->packed.exchange(nullptr));
+}
+
+// Private helper function to free an entry array once no reader can be scanning it
+void FileSystem::retireEntryArray(EntryArray* packed) const {
+    if (packed == nullptr) {
+        return;
+    }
+    if (concurrent) {
+        epochs.retire([packed]() { delete packed; });
+    } else {
+        delete packed;
+    }
+}
+
+// Private helper function to visit the next page of a directory's entries and
+// move the cursor past them. A directory still backed by the image never
+// changes, so its page starts at the cursor's position; otherwise it starts
+// after the last entry returned, found by name. Returns false if the directory
+// is gone.
+template <typename Visit>
+bool FileSystem::pageEntries(const Version* version, ListCursor& cursor, std::size_t limit, Visit visit) const {
+    const DirectoryNode* dir =
+        cursor.directory < version->directories.size() ? version->directories[cursor.directory] : nullptr;
+    if (dir == nullptr) {
+        return false;
+    }
+    EntryInfo entry;
+    std::size_t taken = 0;
+    if (dir->imageBacked) {
+        const NamespaceImage::Entry* entries = image->entries() + dir->imageFirst;
+        std::uint64_t i = cursor.position;
+        for (; i < dir->imageCount && taken < limit; i++, taken++) {
+            imageEntry(entries[i], entry);
+            visit(entry);
+            cursor.last = entry.name;
         }
-        current = next;
+        cursor.position = i;
+        cursor.done = i >= dir->imageCount;
+        return true;
     }
 
-    // Concatenate smaller and larger partitions
-    if (smallerTail) {
-        smallerTail->next = nullptr;
-        quickSortFiles(smallerHead);
-        head = smallerHead;
-        while (smallerTail->next) {
-            smallerTail = smallerTail->next;
+    const EntryArray* packed = packedEntries(dir);
+    if (packed) {
+        // The last entry returned is where the cursor left it unless entries came or went
+        std::size_t i = cursor.last == NameTable::NONE ? packed->size()
+                                                       : packed->find(cursor.last, cursor.position - 1);
+        i = i < packed->size() ? i + 1 : std::min<std::uint64_t>(cursor.position, packed->size());
+        for (; i < packed->size() && taken < limit; i++, taken++) {
+            entry.name = packed->names[i];
+            entry.isDirectory = (packed->flags[i] & EntryArray::DIRECTORY) != 0;
+            entry.child = packed->children[i];
+            entry.meta = packed->meta[i];
+            entry.content = packed->contents[i];
+            visit(entry);
+            cursor.last = entry.name;
         }
-        smallerTail->next = pivot;
+        cursor.position += taken;
+        cursor.done = i >= packed->size();
+        return true;
+    }
+
+    std::uint64_t changes = dir->changes.load();
+    FileNode* file = dir->files.load(std::memory_order_acquire);
+    FileNode* lastFile = cursor.last == NameTable::NONE ? nullptr : dir->fileIndex.find(cursor.last);
+    if (lastFile) {
+        file = lastFile->next.load(std::memory_order_acquire);
     } else {
-        head = pivot;
+        // Nothing returned yet, or the last entry returned was removed since
+        for (std::uint64_t skipped = 0; file != nullptr && skipped < cursor.position; skipped++) {
+            file = file->next.load(std::memory_order_acquire);
+        }
+    }
+    for (; file != nullptr && taken < limit; file = file->next.load(std::memory_order_acquire), taken++) {
+        entry.name = file->name;
+        entry.isDirectory = file->isDirectory;
+        entry.child = file->child;
+        entry.meta = file->meta;
+        entry.content = file->content;
+        visit(entry);
+        cursor.last = entry.name;
     }
-    pivot->next = nullptr;
-    quickSortFiles(largerHead);
-    pivot->next = largerHead;
-}
\ No newline at end of file
+    cursor.position += taken;
+    cursor.done = file == nullptr;
+    if (cursor.done && cursor.position >= PACKED_ENTRIES) {
+        dir->scannedAt.store(changes, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+// Private helper function to find the ids of the directories holding a file name
+std::vector<unsigned> FileSystem::findHolders(const Version* version, const std::string& filename) const {
+    NameId name = names.find(filename);
+    if (name == NameTable::NONE) {
+        return std::vector<unsigned>();
+    }
+    return findHolders(version, name);
+}
+
+// Private helper function to find the ids of the directories holding an interned name.
+// Names the filter has never counted are in no directory; the others are found through
+// the image's holder table for directories still backed by the image, and through the
+// search index for materialized ones.
+std::vector<unsigned> FileSystem::findHolders(const Version* version, NameId name) const {
+    std::vector<unsigned> holders;
+    if (!nameFilter.load(std::memory_order_acquire)->mayContain(name)) {
+        METRICS_COUNT(NAME_FILTER_REJECTS, 1);
+        return holders;
+    }
+    METRICS_COUNT(INDEX_LOOKUPS, 1);
+    if (image) {
+        const NamespaceImage::Holder* first = image->holders();
+        const NamespaceImage::Holder* last = first + image->header().entryCount;
+        const NamespaceImage::Holder* found = std::lower_bound(first, last, names.str(name),
+            [this](const NamespaceImage::Holder& holder, std::string_view key) { return names.str(holder.name) < key; });
+        for (; found != last && found->name == name; ++found) {
+            if (found->directory < version->directories.size()) {
+                DirectoryNode* dir = version->directories[found->directory];
+                if (dir && dir->imageBacked) {
+                    holders.push_back(found->directory);
+                }
+            }
+        }
+    }
+    const std::vector<unsigned>* indexed = version->searchIndex.find(name);
+    if (indexed) {
+        holders.insert(holders.end(), indexed->begin(), indexed->end());
+    }
+    if (holders.empty()) {
+        METRICS_COUNT(NAME_FILTER_FALSE_POSITIVES, 1);
+    }
+    return holders;
+}
+
+// Private helper function to collect the names starting with prefix: a range of
+// the search index for materialized directories, a range of the image's holder
+// table (also ordered by name) for image-backed ones. Names may repeat.
+void FileSystem::namesWithPrefix(const Version* version, std::string_view prefix, std::vector<NameId>& found) const {
+    version->searchIndex.forEachFrom(prefix, [&](NameId name, const std::vector<unsigned>&) {
+        if (names.str(name).substr(0, prefix.size()) != prefix) {
+            return false;
+        }
+        found.push_back(name);
+        return true;
+    });
+    if (image) {
+        const NamespaceImage::Holder* first = image->holders();
+        const NamespaceImage::Holder* last = first + image->header().entryCount;
+        const NamespaceImage::Holder* holder = std::lower_bound(first, last, prefix,
+            [this](const NamespaceImage::Holder& entry, std::string_view key) { return names.str(entry.name) < key; });
+        for (; holder != last && names.str(holder->name).substr(0, prefix.size()) == prefix; ++holder) {
+            if (found.empty() || found.back() != holder->name) {
+                found.push_back(holder->name);
+            }
+        }
+    }
+}
+
+// Private helper function to collect the names ending with suffix. The suffix
+// index covers the names interned before it was built and the newer ones are
+// checked one by one; once they outgrow a quarter of the index, the first query
+// to get the lock builds a fresh one (the others do not wait for it).
+void FileSystem::namesWithSuffix(std::string_view suffix, std::vector<NameId>& found) const {
+    std::size_t total = names.size();
+    SuffixIndex* index = suffixIndex.load(std::memory_order_acquire);
+    std::size_t covered = index ? index->covered() : 0;
+    if (total - covered > covered / 4 + 1024 && suffixLock.try_lock()) {
+        std::lock_guard<std::mutex> hold(suffixLock, std::adopt_lock);
+        index = suffixIndex.load(std::memory_order_acquire);
+        if (index == nullptr || index->covered() < total) {
+            SuffixIndex* fresh = new SuffixIndex(names);
+            SuffixIndex* old = suffixIndex.exchange(fresh, std::memory_order_acq_rel);
+            if (old) {
+                epochs.retire([old]() { delete old; });
+            }
+            index = fresh;
+        }
+        covered = index->covered();
+    }
+    if (index) {
+        index->findEnding(suffix, found);
+    }
+    for (std::size_t id = covered; id < total; id++) {
+        std::string_view text = names.str(static_cast<NameId>(id));
+        if (text.size() >= suffix.size() && text.substr(text.size() - suffix.size()) == suffix) {
+            found.push_back(static_cast<NameId>(id));
+        }
+    }
+}
+
+// Private helper function to turn candidate names into matches, one per directory
+// holding the name, keeping only the names the filter (if any) accepts
+std::vector<FileSystem::Match> FileSystem::collectMatches(const Version* version, std::vector<NameId>& candidates,
+                                                          const NamePattern* filter) const {
+    std::sort(candidates.begin(), candidates.end(), NameOrder(&names));
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    std::vector<Match> matches;
+    for (NameId name : candidates) {
+        std::string_view text = names.str(name);
+        if (filter && !filter->matches(text)) {
+            continue;
+        }
+        for (unsigned id : findHolders(version, name)) {
+            DirectoryNode* dir = version->directories[id];
+            EntryInfo entry;
+            if (dir && lookupEntry(dir, name, entry)) {
+                matches.push_back(Match{directoryPath(version, dir), std::string(text), entry.isDirectory});
+            }
+        }
+    }
+    return matches;
+}
+
+// Private helper function to find an entry by path, or by bare name in the first directory holding it
+bool FileSystem::findEntry(const Version* version, const std::string& path, unsigned& dirId, EntryInfo& entry) const {
+    std::string normalized = normalizePath(path);
+    if (path.find('/') == std::string::npos) {
+        std::vector<unsigned> holders = findHolders(version, normalized);
+        if (holders.empty()) {
+            return false;
+        }
+        dirId = holders.front();
+        DirectoryNode* holder = version->directories[dirId];
+        return holder != nullptr && lookupEntry(holder, names.find(normalized), entry);
+    }
+    std::string parentPath;
+    std::string leaf;
+    splitPath(normalized, parentPath, leaf);
+    DirectoryNode* dir = findDirectory(version, parentPath);
+    NameId name = names.find(leaf);
+    if (dir == nullptr || leaf.empty() || name == NameTable::NONE) {
+        return false;
+    }
+    dirId = dir->id;
+    return lookupEntry(dir, name, entry);
+}
+
+// Private helper function to create a directory and its entry in the parent
+void FileSystem::createDirectory(unsigned parentId, NameId name, const Metadata& metadata) {
+    Version* version = writableVersion();
+    unsigned dirId = static_cast<unsigned>(version->directories.size());
+    version->directories.push_back(directoryPool.create(name, dirId, parentId, &epochs));
+    version->directories.setUsage(dirId, Usage{0, 0, 0, metadata.ctime});
+    FileNode* entry = createFile(name, true, dirId, metadata);
+    insertFileIntoDirectory(writableDirectory(parentId), entry);
+    addUsage(parentId, 0, 1, metadata.mtime, metadata.ctime);
+    rehash(parentId, 0, entryHash(entry));
+}
+
+// Private helper function to insert a file into a (writable) directory
+void FileSystem::insertFileIntoDirectory(DirectoryNode* dir, FileNode* fileToInsert) {
+    if (!dir || !fileToInsert) {
+        return;
+    }
+    linkFile(dir, fileToInsert);
+    updateSearchIndex([&](NameIndex& index) { index.insert(fileToInsert->name, dir->id); });
+}
+
+// Private helper function to add a file to a (writable) directory's list and
+// hash index, leaving the search index to the caller. The file goes at the end,
+// or in a sorted directory before the first entry ordered after it. The node is
+// complete before the store that links it in, so readers walking the list either
+// see all of it or stop before it.
+void FileSystem::linkFile(DirectoryNode* dir, FileNode* fileToLink) {
+    filterName(fileToLink->name);
+    FileNode* successor = nullptr;
+    if (dir->sorted) {
+        EntryKey key = entryKey(fileToLink);
+        dir->sorted->forEachFrom(key, [&](const EntryKey&, const std::vector<FileNode*>& entries) {
+            successor = entries.front();
+            return false;
+        });
+        dir->sorted->insert(key, fileToLink);
+    }
+
+    fileToLink->next.store(successor, std::memory_order_relaxed);
+    if (successor) {
+        fileToLink->prev = successor->prev;
+        if (successor->prev) {
+            successor->prev->next.store(fileToLink, std::memory_order_release);
+        } else {
+            dir->files.store(fileToLink, std::memory_order_release);
+        }
+        successor->prev = fileToLink;
+    } else {
+        // If the directory has no files yet, insert the file as the first file,
+        // otherwise append it after the tail
+        fileToLink->prev = dir->tail;
+        if (!dir->files) {
+            dir->files.store(fileToLink, std::memory_order_release);
+        } else {
+            dir->tail->next.store(fileToLink, std::memory_order_release);
+        }
+        dir->tail = fileToLink;
+    }
+    dir->fileIndex.insert(fileToLink);
+    entriesChanged(dir);
+}
+
+// Private helper function to unlink a file from its (writable) directory without deleting it.
+// The node keeps its next link, so a reader standing on it still walks on to the rest of the list.
+void FileSystem::unlinkFileFromDirectory(DirectoryNode* dir, FileNode* fileToUnlink) {
+    FileNode* nextFile = fileToUnlink->next.load(std::memory_order_relaxed);
+    if (fileToUnlink->prev) {
+        fileToUnlink->prev->next.store(nextFile, std::memory_order_release);
+    } else {
+        dir->files.store(nextFile, std::memory_order_release);
+    }
+    if (nextFile) {
+        nextFile->prev = fileToUnlink->prev;
+    } else {
+        dir->tail = fileToUnlink->prev;
+    }
+    fileToUnlink->prev = nullptr;
+    entriesChanged(dir);
+    dir->fileIndex.erase(fileToUnlink->name);
+    if (dir->sorted) {
+        dir->sorted->erase(entryKey(fileToUnlink), fileToUnlink);
+    }
+    updateSearchIndex([&](NameIndex& index) { index.erase(fileToUnlink->name, dir->id); });
+    unfilterName(fileToUnlink->name);
+}
+
+// Private helper function to get an unlinked node ready to be linked into another list or
+// under another name. Readers may still be standing on it in concurrent mode, so there it
+// is replaced by a fresh copy and retired.
+FileSystem::FileNode* FileSystem::detachedNode(FileNode* file) {
+    if (!concurrent) {
+        return file;
+    }
+    FileNode* fresh = createFile(file->name, file->isDirectory, file->child, file->meta, file->content);
+    retireFile(file);
+    return fresh;
+}
+
+// Private helper function to change the metadata and contents of a linked entry.
+// Readers may be reading it in concurrent mode, so there a copy takes its place in
+// the list and the indexes (each switched over with one store) and the old node is
+// retired; a reader standing on it still walks on through its next link. In a
+// directory kept sorted by size or mtime, an entry whose key changes is unlinked
+// and linked again at its new place.
+void FileSystem::replaceFile(DirectoryNode* dir, FileNode* file, const Metadata& metadata, ContentStore::Blob* content) {
+    EntryKey key = entryKey(file);
+    if (dir->sorted) {
+        EntryKey changed = key;
+        changed.size = metadata.size;
+        changed.mtime = metadata.mtime;
+        EntryOrder order{&names, dir->order};
+        if (order.keyLess(key, changed) || order.keyLess(changed, key)) {
+            unlinkFileFromDirectory(dir, file);
+            FileNode* moved = detachedNode(file);
+            contents.retain(content);
+            contents.release(moved->content);
+            moved->meta = metadata;
+            moved->content = content;
+            linkFile(dir, moved);
+            updateSearchIndex([&](NameIndex& index) { index.insert(moved->name, dir->id); });
+            return;
+        }
+    }
+    if (!concurrent) {
+        contents.retain(content);
+        contents.release(file->content);
+        file->meta = metadata;
+        file->content = content;
+        entriesChanged(dir);
+        return;
+    }
+    FileNode* fresh = createFile(file->name, file->isDirectory, file->child, metadata, content);
+    FileNode* nextFile = file->next.load(std::memory_order_relaxed);
+    fresh->next.store(nextFile, std::memory_order_relaxed);
+    fresh->prev = file->prev;
+    if (file->prev) {
+        file->prev->next.store(fresh, std::memory_order_release);
+    } else {
+        dir->files.store(fresh, std::memory_order_release);
+    }
+    if (nextFile) {
+        nextFile->prev = fresh;
+    } else {
+        dir->tail = fresh;
+    }
+    dir->fileIndex.replace(fresh);
+    if (dir->sorted) {
+        dir->sorted->erase(key, file);
+        dir->sorted->insert(key, fresh);
+    }
+    entriesChanged(dir);
+    retireFile(file);
+}
+
+// Private helper function to restore prev and tail links after the files list was reordered
+void FileSystem::relinkDirectory(DirectoryNode* dir) {
+    FileNode* prevFile = nullptr;
+    for (FileNode* file = dir->files; file != nullptr; file = file->next) {
+        file->prev = prevFile;
+        prevFile = file;
+    }
+    dir->tail = prevFile;
+    entriesChanged(dir);
+}
+
+// Function to insert a directory into the file system
+FileSystem::Status FileSystem::insertDirectory(const std::string& dirpath) {
+    METRICS_TIME(INSERT_DIRECTORY);
+    WriteLock lock(*this, false);
+    std::string path = normalizePath(dirpath);
+    std::string parentPath;
+    std::string leaf;
+    splitPath(path, parentPath, leaf);
+
+    // The parent has to exist already (and still exist once it is locked)
+    DirectoryNode* parent = findDirectory(current, parentPath);
+    if (parent != nullptr) {
+        lock.lockDirectories(parent->id);
+        parent = current->directories[parent->id];
+    }
+    if (parent == nullptr) {
+        return DIRECTORY_NOT_FOUND;
+    }
+
+    // Check if directory with the same name already exists
+    if (path.empty() || hasEntry(parent, leaf)) {
+        return ALREADY_EXISTS;
+    }
+
+    // If directory does not exist, proceed with insertion
+    lock.lockIndex();
+    std::int64_t now = operationTime();
+    createDirectory(parent->id, names.intern(leaf), newMetadata(true, now));
+    logOperation(Journal::INSERT_DIRECTORY, path, "", "", false, now);
+    return OK;
+}
+
+// Function to insert a file (or, with isDir, a subdirectory) into the file system
+FileSystem::Status FileSystem::insertFile(const std::string& dirpath, const std::string& filename, bool isDir) {
+    return insertFile(dirpath, filename, isDir, newMetadata(isDir, operationTime()));
+}
+
+// Function to insert a file (or subdirectory) with the given size, mtime and mode
+FileSystem::Status FileSystem::insertFile(const std::string& dirpath, const std::string& filename, bool isDir,
+                                          const Metadata& metadata) {
+    METRICS_TIME(INSERT_FILE);
+    // A name no path could reach would make an entry nothing can find, move or remove
+    if (filename.empty() || filename.find('/') != std::string::npos) {
+        return INVALID_NAME;
+    }
+    WriteLock lock(*this, false);
+
+    // Find the directory where the file is to be inserted
+    DirectoryNode* dir = findDirectory(current, dirpath);
+    if (dir != nullptr) {
+        lock.lockDirectories(dir->id);
+        dir = current->directories[dir->id];
+    }
+    if (dir == nullptr) {
+        return DIRECTORY_NOT_FOUND;
+    }
+
+    // Check if file with the same name already exists in the directory
+    if (hasEntry(dir, filename)) {
+        return ALREADY_EXISTS;
+    }
+
+    // If file does not exist, proceed with insertion
+    std::string path = directoryPath(current, dir);
+    lock.lockIndex();
+    Metadata meta = metadata;
+    meta.ctime = operationTime();
+    if (isDir) {
+        meta.size = 0;
+        createDirectory(dir->id, names.intern(filename), meta);
+    } else {
+        FileNode* entry = createFile(names.intern(filename), false, NO_DIRECTORY, meta);
+        insertFileIntoDirectory(writableDirectory(dir->id), entry);
+        addUsage(dir->id, static_cast<std::int64_t>(meta.size), 1, meta.mtime, meta.ctime);
+        rehash(dir->id, 0, entryHash(entry));
+    }
+    logOperation(Journal::INSERT_FILE, path, filename, "", isDir, meta.ctime, &meta);
+    return OK;
+}
+
+// Function to search for a file by name (anywhere, using the search index) or by path
+bool FileSystem::search(const std::string& filename) const {
+    METRICS_TIME(SEARCH);
+    EpochManager::Guard guard(epochs);
+    const Version* version = published.load(std::memory_order_acquire);
+    if (filename.find('/') == std::string::npos) {
+        return !findHolders(version, filename).empty();
+    }
+    unsigned dirId;
+    EntryInfo entry;
+    return findEntry(version, filename, dirId, entry);
+}
+
+// Function to list the paths of the directories that hold a file with the given name
+std::vector<std::string> FileSystem::locate(const std::string& filename) const {
+    METRICS_TIME(LOCATE);
+    EpochManager::Guard guard(epochs);
+    const Version* version = published.load(std::memory_order_acquire);
+    std::vector<std::string> dirnames;
+    for (unsigned id : findHolders(version, filename)) {
+        DirectoryNode* dir = version->directories[id];
+        if (dir) {
+            dirnames.push_back(directoryPath(version, dir));
+        }
+    }
+    return dirnames;
+}
+
+// Function to list the names in a directory, in list order (empty if it does not exist)
+std::vector<std::string> FileSystem::listDirectory(const std::string& dirpath) const {
+    METRICS_TIME(LIST_DIRECTORY);
+    EpochManager::Guard guard(epochs);
+    const Version* version = published.load(std::memory_order_acquire);
+    std::vector<std::string> entries;
+    DirectoryNode* dir = findDirectory(version, dirpath);
+    if (dir) {
+        forEachEntry(dir, [&](const EntryInfo& entry) { entries.push_back(std::string(names.str(entry.name))); });
+    }
+    return entries;
+}
+
+// Function to list the next page of a directory
+FileSystem::Status FileSystem::listPage(const std::string& dirpath, ListCursor& cursor, std::size_t limit,
+                                        std::vector<DirectoryEntry>& page) const {
+    METRICS_TIME(LIST_DIRECTORY);
+    EpochManager::Guard guard(epochs);
+    const Version* version = published.load(std::memory_order_acquire);
+    if (cursor.directory == NO_DIRECTORY) {
+        DirectoryNode* dir = findDirectory(version, dirpath);
+        if (dir == nullptr) {
+            return DIRECTORY_NOT_FOUND;
+        }
+        cursor.directory = dir->id;
+    }
+    bool found = pageEntries(version, cursor, limit, [&](const EntryInfo& entry) {
+        page.push_back(DirectoryEntry{std::string(names.str(entry.name)), entry.isDirectory, entry.meta});
+    });
+    return found ? OK : DIRECTORY_NOT_FOUND;
+}
+
+// Function to find every entry whose name starts with prefix
+std::vector<FileSystem::Match> FileSystem::findByPrefix(const std::string& prefix) const {
+    METRICS_TIME(FIND);
+    EpochManager::Guard guard(epochs);
+    const Version* version = published.load(std::memory_order_acquire);
+    std::vector<NameId> candidates;
+    namesWithPrefix(version, prefix, candidates);
+    return collectMatches(version, candidates, nullptr);
+}
+
+// Function to find every entry whose name ends with suffix
+std::vector<FileSystem::Match> FileSystem::findBySuffix(const std::string& suffix) const {
+    METRICS_TIME(FIND);
+    EpochManager::Guard guard(epochs);
+    const Version* version = published.load(std::memory_order_acquire);
+    std::vector<NameId> candidates;
+    namesWithSuffix(suffix, candidates);
+    return collectMatches(version, candidates, nullptr);
+}
+
+// Function to find every entry whose name matches a glob. Candidates come from the
+// prefix or suffix range of the longer literal end; a pattern with wildcards at both
+// ends is checked against every name, on several threads for large tables.
+std::vector<FileSystem::Match> FileSystem::findByPattern(const std::string& pattern) const {
+    METRICS_TIME(FIND);
+    EpochManager::Guard guard(epochs);
+    const Version* version = published.load(std::memory_order_acquire);
+    NamePattern glob(pattern);
+    std::vector<NameId> candidates;
+    if (!glob.hasWildcards()) {
+        NameId name = names.find(pattern);
+        if (name != NameTable::NONE) {
+            candidates.push_back(name);
+        }
+    } else if (!glob.prefix().empty() && glob.prefix().size() >= glob.suffix().size()) {
+        namesWithPrefix(version, glob.prefix(), candidates);
+    } else if (!glob.suffix().empty()) {
+        namesWithSuffix(glob.suffix(), candidates);
+    } else {
+        static constexpr std::size_t NAMES_PER_THREAD = 1 << 16;
+        std::size_t total = names.size();
+        std::size_t slices = std::max<std::size_t>(1, std::min<std::size_t>(workerCount(0), total / NAMES_PER_THREAD));
+        std::vector<std::vector<NameId>> found(slices);
+        parallelFor(slices, [&](std::size_t slice) {
+            for (std::size_t id = total * slice / slices; id < total * (slice + 1) / slices; id++) {
+                if (glob.matches(names.str(static_cast<NameId>(id)))) {
+                    found[slice].push_back(static_cast<NameId>(id));
+                }
+            }
+        });
+        for (const std::vector<NameId>& part : found) {
+            candidates.insert(candidates.end(), part.begin(), part.end());
+        }
+        return collectMatches(version, candidates, nullptr);
+    }
+    return collectMatches(version, candidates, &glob);
+}
+
+// Function to display the directory structure, depth first.
+// The root is only listed when it holds files of its own. Entries are fetched a
+// page at a time, each page in its own epoch, so a large namespace neither holds
+// back reclamation nor needs memory beyond a page per level of the walk.
+void FileSystem::displayDirectoryStructure(std::ostream& out) const {
+    // A directory whose subdirectories are being visited, with the current page of them
+    class Level {
+    public:
+        ListCursor cursor;
+        std::vector<unsigned> subdirectories;
+        std::size_t next;
+    };
+
+    // Print one directory's header and entries, page by page
+    auto display = [&](unsigned dirId) {
+        ListCursor cursor;
+        cursor.directory = dirId;
+        do {
+            EpochManager::Guard guard(epochs);
+            const Version* version = published.load(std::memory_order_acquire);
+            if (cursor.position == 0) {
+                DirectoryNode* dir = dirId < version->directories.size() ? version->directories[dirId] : nullptr;
+                if (dir == nullptr) {
+                    return; // removed by a concurrent writer
+                }
+                out << "Directory: " << directoryPath(version, dir) << '\n';
+            }
+            bool found = pageEntries(version, cursor, DISPLAY_PAGE, [&](const EntryInfo& entry) {
+                out << "- " << names.str(entry.name) << (entry.isDirectory ? " (Directory)" : " (File)") << '\n';
+            });
+            if (!found) {
+                return;
+            }
+        } while (!cursor.done);
+    };
+
+    bool hasFiles = false;
+    ListCursor scan;
+    scan.directory = ROOT_DIRECTORY;
+    while (!hasFiles && !scan.done) {
+        EpochManager::Guard guard(epochs);
+        pageEntries(published.load(std::memory_order_acquire), scan, DISPLAY_PAGE,
+                    [&](const EntryInfo& entry) { hasFiles = hasFiles || !entry.isDirectory; });
+    }
+    if (hasFiles) {
+        display(ROOT_DIRECTORY);
+    }
+
+    // Visit subdirectories in list order
+    std::vector<Level> levels(1);
+    levels.back().cursor.directory = ROOT_DIRECTORY;
+    levels.back().next = 0;
+    while (!levels.empty()) {
+        Level& level = levels.back();
+        if (level.next == level.subdirectories.size()) {
+            if (level.cursor.done) {
+                levels.pop_back();
+                continue;
+            }
+            level.subdirectories.clear();
+            level.next = 0;
+            EpochManager::Guard guard(epochs);
+            bool found = pageEntries(published.load(std::memory_order_acquire), level.cursor, DISPLAY_PAGE,
+                                     [&](const EntryInfo& entry) {
+                if (entry.isDirectory) {
+                    level.subdirectories.push_back(entry.child);
+                }
+            });
+            if (!found) {
+                levels.pop_back();
+            }
+            continue;
+        }
+        unsigned dirId = level.subdirectories[level.next++];
+        display(dirId);
+        levels.emplace_back();
+        levels.back().cursor.directory = dirId;
+        levels.back().next = 0;
+    }
+}
+
+// Function to create a backup of the file system.
+// The backup shares the current version; whichever side changes next copies
+// only the directory table and the directories it touches.
+void FileSystem::createBackup() {
+    METRICS_TIME(BACKUP);
+    WriteLock lock(*this, true);
+    current->refCount++;
+    backups.push(current);
+    if (concurrent) {
+        // Writers under the shared lock count on a current version that no backup holds
+        writableVersion();
+    }
+    logOperation(Journal::CREATE_BACKUP, "");
+}
+
+// Function to restore the most recent backup by making it the current version
+FileSystem::Status FileSystem::restoreBackup() {
+    METRICS_TIME(RESTORE);
+    WriteLock lock(*this, true);
+    if (backups.empty()) {
+        return NO_BACKUP;
+    }
+    // Replay cannot recreate a backup taken before the last checkpoint, so
+    // restoring one is made durable by checkpointing again. It is still logged
+    // first, for replicas that joined before the backup was taken.
+    bool predatesCheckpoint = backups.size() <= checkpointBackups;
+    releaseVersion(current);
+    publish(backups.top());
+    backups.pop();
+    if (concurrent) {
+        writableVersion();
+    }
+    invalidateDentryCache();
+    if (predatesCheckpoint) {
+        checkpointBackups = backups.size();
+    }
+    logOperation(Journal::RESTORE_BACKUP, "");
+    if (predatesCheckpoint && journal.isOpen() && !checkpointPath.empty()) {
+        checkpoint(checkpointPath);
+    }
+    return OK;
+}
+
+
+// Function to remove a file (or an empty directory) from the file system
+FileSystem::Status FileSystem::remove(const std::string& filename) {
+    METRICS_TIME(REMOVE);
+    WriteLock lock(*this, false);
+
+    // The search index knows which directories hold a bare name; drop it from the first one
+    unsigned dirId;
+    EntryInfo entry;
+    if (!findEntry(current, filename, dirId, entry)) {
+        return NOT_FOUND;
+    }
+    // A directory is removed together with its entry, so lock both, then make sure
+    // a concurrent writer has not replaced the entry in the meantime
+    lock.lockDirectories(dirId, entry.isDirectory ? entry.child : NO_DIRECTORY);
+    DirectoryNode* holder = current->directories[dirId];
+    EntryInfo locked;
+    if (!holder || !lookupEntry(holder, entry.name, locked) || locked.child != entry.child) {
+        return NOT_FOUND;
+    }
+    // Log the resolved path: which directory a bare name picks depends on index order
+    std::string path = entryPath(dirId, entry.name);
+    if (entry.isDirectory) {
+        DirectoryNode* subdir = current->directories[entry.child];
+        if (!isEmpty(subdir)) {
+            return NOT_EMPTY;
+        }
+        lock.lockIndex();
+        Version* version = writableVersion();
+        version->directories.set(subdir->id, nullptr);
+        releaseDirectory(subdir);
+        invalidateDentryCache();
+    }
+    lock.lockIndex();
+    std::int64_t now = operationTime();
+    DirectoryNode* dir = writableDirectory(dirId);
+    FileNode* fileToRemove = findFile(dir, entry.name);
+    std::uint64_t removedHash = entryHash(fileToRemove);
+    unlinkFileFromDirectory(dir, fileToRemove);
+    retireFile(fileToRemove);
+    addUsage(dirId, -static_cast<std::int64_t>(locked.meta.size), -1, 0, now);
+    rehash(dirId, removedHash, 0);
+    logOperation(Journal::REMOVE, path, "", "", false, now);
+    return OK;
+}
+
+
+// Function to enqueue a move operation
+void FileSystem::enqueueMove(const std::string& sourceDir, const std::string& destDir, const std::string& filename, bool isDir) {
+    std::lock_guard<std::mutex> guard(moveLock);
+    moveQueue.push(FileMoveOperation(sourceDir, destDir, filename, isDir));
+}
+
+
+// Private helper function to drain the move queue into batches keyed by (source, destination).
+// File moves of different names never affect each other, so a file move may join an
+// earlier batch for its key as long as no later batch has touched the same name and
+// no directory move lies between them.
+std::vector<FileSystem::MoveBatch> FileSystem::groupMoveQueue() {
+    std::vector<MoveBatch> batches;
+    std::map<std::pair<std::string, std::string>, std::size_t> batchForKey;
+    std::unordered_map<std::string, std::size_t> lastBatchForName;
+    std::queue<FileMoveOperation> queued;
+    {
+        std::lock_guard<std::mutex> guard(moveLock);
+        queued.swap(moveQueue);
+    }
+
+    // Moving a directory changes the paths later moves name, so no move is merged
+    // into a batch ahead of one: a directory move gets a batch of its own, and
+    // batches before barrier take no more moves. An entry counts as a directory if
+    // the caller said so, if it is one now, or if an earlier move put a directory
+    // under that path.
+    std::size_t barrier = 0;
+    std::unordered_set<std::string> movedDirectories; // normalized paths directory moves lead to
+    auto movesDirectory = [&](const FileMoveOperation& operation) {
+        if (operation.isDirectory ||
+            movedDirectories.count(normalizePath(operation.sourceDirectory) + "/" + operation.filename)) {
+            return true;
+        }
+        DirectoryNode* source = findDirectory(current, operation.sourceDirectory);
+        FileNode* entry = source ? findFile(source, operation.filename) : nullptr;
+        return entry != nullptr && entry->isDirectory;
+    };
+
+    while (!queued.empty()) {
+        FileMoveOperation operation = queued.front();
+        queued.pop();
+
+        std::pair<std::string, std::string> key(operation.sourceDirectory, operation.destinationDirectory);
+        if (movesDirectory(operation)) {
+            movedDirectories.insert(normalizePath(operation.destinationDirectory) + "/" + operation.filename);
+            batches.push_back(MoveBatch(operation.sourceDirectory, operation.destinationDirectory));
+            batches.back().filenames.push_back(operation.filename);
+            barrier = batches.size();
+            lastBatchForName[operation.filename] = barrier - 1;
+            continue;
+        }
+        std::map<std::pair<std::string, std::string>, std::size_t>::iterator open = batchForKey.find(key);
+        std::unordered_map<std::string, std::size_t>::iterator last = lastBatchForName.find(operation.filename);
+
+        std::size_t batch;
+        if (open != batchForKey.end() && open->second >= barrier &&
+            (last == lastBatchForName.end() || last->second <= open->second)) {
+            batch = open->second;
+        } else {
+            batch = batches.size();
+            batches.push_back(MoveBatch(operation.sourceDirectory, operation.destinationDirectory));
+            batchForKey[key] = batch;
+        }
+        batches[batch].filenames.push_back(operation.filename);
+        lastBatchForName[operation.filename] = batch;
+    }
+    return batches;
+}
+
+// Private helper function to move one batch, resolving both directories once and
+// splicing the existing nodes from the source list into the destination list
+void FileSystem::executeMoveBatch(MoveBatch& batch) {
+    DirectoryNode* sourceDir = findDirectory(current, batch.sourceDirectory);
+    DirectoryNode* destDir = findDirectory(current, batch.destinationDirectory);
+    if (!sourceDir || !destDir) {
+        batch.missing = batch.filenames.size();
+        return;
+    }
+    if (sourceDir == destDir) {
+        // Moving into the same directory leaves every file where it is
+        for (const std::string& filename : batch.filenames) {
+            if (hasEntry(sourceDir, filename)) {
+                batch.moved++;
+            } else {
+                batch.missing++;
+            }
+        }
+        return;
+    }
+
+    // Copy-on-write may replace either directory, so resolve both by id.
+    // Neither path changes during the batch: a directory is never moved into itself.
+    unsigned sourceId = sourceDir->id;
+    unsigned destId = destDir->id;
+    std::string sourcePath = directoryPath(current, sourceDir);
+    std::string destPath = directoryPath(current, destDir);
+    DirectoryNode* source = writableDirectory(sourceId);
+    DirectoryNode* dest = writableDirectory(destId);
+    std::int64_t now = operationTime();
+    bool movedDirectory = false;
+    for (const std::string& filename : batch.filenames) {
+        FileNode* fileToMove = findFile(source, filename);
+        if (!fileToMove) {
+            batch.missing++;
+        } else if (findFile(dest, fileToMove->name) || (fileToMove->isDirectory && isWithin(destId, fileToMove->child))) {
+            // The name is taken, or a directory would be moved into itself
+            batch.conflicts++;
+        } else {
+            // What leaves the source's ancestors: the entry, and a directory's whole subtree
+            Usage moving{fileToMove->meta.size, 1, fileToMove->meta.mtime, 0};
+            if (fileToMove->isDirectory) {
+                Usage subtree = current->directories.usage(fileToMove->child);
+                moving = Usage{subtree.bytes, subtree.entries + 1, std::max(subtree.newest, moving.newest), 0};
+            }
+            std::uint64_t movingHash = entryHash(fileToMove);
+            unlinkFileFromDirectory(source, fileToMove);
+            fileToMove = detachedNode(fileToMove);
+            fileToMove->meta.ctime = now;
+            insertFileIntoDirectory(dest, fileToMove);
+            if (fileToMove->isDirectory) {
+                writableDirectory(fileToMove->child)->parent = destId;
+                movedDirectory = true;
+            }
+            addUsage(sourceId, -static_cast<std::int64_t>(moving.bytes), -static_cast<std::int64_t>(moving.entries), 0, now);
+            addUsage(destId, static_cast<std::int64_t>(moving.bytes), static_cast<std::int64_t>(moving.entries),
+                     moving.newest, now);
+            rehash(sourceId, movingHash, 0);
+            rehash(destId, 0, movingHash);
+            batch.moved++;
+            logOperation(Journal::MOVE, sourcePath, destPath, filename, false, now);
+        }
+    }
+    if (movedDirectory) {
+        invalidateDentryCache();
+    }
+}
+
+// Function to process the move queue in batches, reporting one line per batch
+std::vector<FileSystem::MoveResult> FileSystem::processMoveQueue() {
+    METRICS_TIME(MOVE_QUEUE);
+    WriteLock lock(*this, true);
+    std::vector<MoveBatch> batches = groupMoveQueue();
+    std::vector<MoveResult> results;
+    results.reserve(batches.size());
+    for (MoveBatch& batch : batches) {
+        executeMoveBatch(batch);
+        METRICS_COUNT(ENTRIES_MOVED, batch.moved);
+        results.push_back(MoveResult{batch.sourceDirectory, batch.destinationDirectory, batch.moved, batch.missing,
+                                     batch.conflicts});
+    }
+    return results;
+}
+
+// Display specific directory, a page at a time
+void FileSystem::displayDirectoryContents(const std::string& dirname, std::ostream& out) const {
+    ListCursor cursor;
+    std::vector<DirectoryEntry> page;
+    if (listPage(dirname, cursor, DISPLAY_PAGE, page) != OK) {
+        out << "Directory '" << dirname << "' not found." << '\n';
+        return;
+    }
+    if (page.empty()) {
+        out << "Directory '" << dirname << "' is empty." << '\n';
+        return;
+    }
+    out << "Contents of directory '" << dirname << "':" << '\n';
+    for (;;) {
+        for (const DirectoryEntry& entry : page) {
+            out << "- " << entry.name << (entry.isDirectory ? " (Directory)" : " (File)") << '\n';
+        }
+        page.clear();
+        if (cursor.done || listPage(dirname, cursor, DISPLAY_PAGE, page) != OK) {
+            break;
+        }
+    }
+}
+
+//Rename Directory
+FileSystem::Status FileSystem::renameDirectory(const std::string& oldName, const std::string& newName) {
+    METRICS_TIME(RENAME);
+    WriteLock lock(*this, true);
+
+    // Check if the directory with the old name exists
+    DirectoryNode* oldDir = findDirectory(current, oldName);
+    if (!oldDir || oldDir->id == ROOT_DIRECTORY) {
+        return NOT_FOUND;
+    }
+
+    // A bare new name stays under the same parent, a path names the new parent too
+    std::string newParentPath;
+    std::string newLeaf;
+    if (newName.find('/') == std::string::npos) {
+        newParentPath = directoryPath(current, current->directories[oldDir->parent]);
+        newLeaf = newName;
+    } else {
+        splitPath(normalizePath(newName), newParentPath, newLeaf);
+    }
+    DirectoryNode* newParent = findDirectory(current, newParentPath);
+    if (!newParent || newLeaf.empty()) {
+        return DIRECTORY_NOT_FOUND;
+    }
+    if (isWithin(newParent->id, oldDir->id)) {
+        return INTO_ITSELF;
+    }
+
+    // Check if a directory with the new name already exists
+    if (hasEntry(newParent, newLeaf)) {
+        return ALREADY_EXISTS;
+    }
+
+    // Move the entry from the old parent to the new one under the new name
+    std::string oldPath = directoryPath(current, oldDir);
+    std::string newPath = entryPath(newParent->id, names.intern(newLeaf));
+    unsigned dirId = oldDir->id;
+    unsigned oldParentId = oldDir->parent;
+    unsigned newParentId = newParent->id;
+    NameId oldLeaf = oldDir->name;
+    NameId name = names.intern(newLeaf);
+    std::int64_t now = operationTime();
+    DirectoryNode* parent = writableDirectory(oldParentId);
+    FileNode* entry = findFile(parent, oldLeaf);
+    Usage subtree = current->directories.usage(dirId);
+    std::int64_t newest = std::max(subtree.newest, entry->meta.mtime);
+    std::uint64_t oldHash = entryHash(entry);
+    unlinkFileFromDirectory(parent, entry);
+    entry = detachedNode(entry);
+    entry->name = name;
+    entry->meta.ctime = now;
+    insertFileIntoDirectory(writableDirectory(newParentId), entry);
+    addUsage(oldParentId, -static_cast<std::int64_t>(subtree.bytes), -static_cast<std::int64_t>(subtree.entries + 1), 0, now);
+    addUsage(newParentId, static_cast<std::int64_t>(subtree.bytes), static_cast<std::int64_t>(subtree.entries + 1), newest,
+             now);
+
+    // Update the name and parent of the directory node itself
+    DirectoryNode* dir = writableDirectory(dirId);
+    dir->name = name;
+    dir->parent = newParentId;
+    rehash(oldParentId, oldHash, 0);
+    rehash(newParentId, 0, entryHash(entry));
+    invalidateDentryCache();
+    logOperation(Journal::RENAME_DIRECTORY, oldPath, newPath, "", false, now);
+    return OK;
+}
+
+// Function to copy a file chosen at the prompt
+void FileSystem::copyFile() {
+    std::string filename;
+    std::cout << "Enter the name of the file you want to copy: ";
+    std::cin >> filename;
+
+    // Find the file in the file system
+    unsigned sourceId;
+    EntryInfo fileToCopy;
+    bool found;
+    {
+        EpochManager::Guard guard(epochs);
+        found = findEntry(published.load(std::memory_order_acquire), filename, sourceId, fileToCopy);
+    }
+
+    if (found && fileToCopy.isDirectory) {
+        std::cout << "Error: '" << filename << "' is a directory." << std::endl;
+    } else if (found) {
+        std::string destinationDir;
+        std::cout << "Enter the name of the directory you want to paste the file into: ";
+        std::cin >> destinationDir;
+
+        std::string copiedFilename;
+        Status status = copyFile(filename, destinationDir, copiedFilename);
+        if (status == OK) {
+            std::cout << "File copied successfully." << std::endl;
+        } else if (status == DIRECTORY_NOT_FOUND) {
+            std::cout << "Error: Destination directory '" << destinationDir << "' not found." << std::endl;
+        } else {
+            std::cout << "Error: '" << filename << "': " << describe(status) << "." << std::endl;
+        }
+    } else {
+        std::cout << "Error: File '" << filename << "' not found." << std::endl;
+    }
+}
+
+// Function to copy a file into a directory under the next free copy name
+FileSystem::Status FileSystem::copyFile(const std::string& path, const std::string& destinationDir, std::string& copiedName) {
+    return copyInto(path, destinationDir, "", copiedName);
+}
+
+// Private helper function to pick the name of the next copy of a file in a directory.
+// Every copy made so far took the number after the last, so the first number tried
+// is nearly always free; an entry inserted under a copy name is stepped over.
+std::string FileSystem::copyName(const DirectoryNode* dir, NameId name) {
+    std::string base(names.str(name));
+    unsigned& next = copyIndexes[(static_cast<std::uint64_t>(dir->id) << 32) | name];
+    for (;;) {
+        std::string candidate = next == 0 ? "copy_" + base : "copy_" + std::to_string(next) + "_" + base;
+        next++;
+        if (!hasEntry(dir, candidate)) {
+            return candidate;
+        }
+    }
+}
+
+// Private helper function to copy a file into a directory, under the given name or
+// (when it is empty) the next free copy name. The copy shares the source's contents.
+FileSystem::Status FileSystem::copyInto(const std::string& path, const std::string& destinationDir,
+                                        const std::string& name, std::string& copiedName) {
+    METRICS_TIME(COPY);
+    WriteLock lock(*this, false);
+    unsigned sourceId;
+    EntryInfo source;
+    if (!findEntry(current, path, sourceId, source)) {
+        return NOT_FOUND;
+    }
+    if (source.isDirectory) {
+        return IS_DIRECTORY;
+    }
+    DirectoryNode* destDir = findDirectory(current, destinationDir);
+    if (destDir == nullptr) {
+        return DIRECTORY_NOT_FOUND;
+    }
+
+    // Lock both directories, then make sure neither changed in the meantime
+    unsigned destId = destDir->id;
+    lock.lockDirectories(sourceId, destId);
+    DirectoryNode* holder = current->directories[sourceId];
+    destDir = current->directories[destId];
+    EntryInfo locked;
+    if (!holder || !lookupEntry(holder, source.name, locked) || locked.isDirectory) {
+        return NOT_FOUND;
+    }
+    if (destDir == nullptr) {
+        return DIRECTORY_NOT_FOUND;
+    }
+    if (!name.empty() && hasEntry(destDir, name)) {
+        return ALREADY_EXISTS;
+    }
+
+    // Same size, mode and contents, written now
+    lock.lockIndex();
+    copiedName = name.empty() ? copyName(destDir, source.name) : name;
+    std::string sourcePath = entryPath(sourceId, source.name);
+    std::string destPath = directoryPath(current, destDir);
+    std::int64_t now = operationTime();
+    Metadata meta{locked.meta.size, now, now, locked.meta.mode};
+    FileNode* copiedFile = createFile(names.intern(copiedName), false, NO_DIRECTORY, meta, locked.content);
+    insertFileIntoDirectory(writableDirectory(destId), copiedFile);
+    addUsage(destId, static_cast<std::int64_t>(meta.size), 1, meta.mtime, now);
+    rehash(destId, 0, entryHash(copiedFile));
+    logOperation(Journal::COPY_FILE, sourcePath, destPath, copiedName, false, now);
+    return OK;
+}
+
+// Function to replace the contents of a file. The data is stored once however
+// many files hold it; the file's old contents go when nothing else holds them.
+FileSystem::Status FileSystem::writeFile(const std::string& path, std::string_view data) {
+    METRICS_TIME(WRITE_FILE);
+    WriteLock lock(*this, false);
+    unsigned dirId;
+    EntryInfo entry;
+    if (!findEntry(current, path, dirId, entry)) {
+        return NOT_FOUND;
+    }
+    lock.lockDirectories(dirId);
+    DirectoryNode* holder = current->directories[dirId];
+    EntryInfo locked;
+    if (!holder || !lookupEntry(holder, entry.name, locked) || locked.child != entry.child) {
+        return NOT_FOUND;
+    }
+    if (locked.isDirectory) {
+        return IS_DIRECTORY;
+    }
+    std::string logged = entryPath(dirId, entry.name);
+    lock.lockIndex();
+    std::int64_t now = operationTime();
+    Metadata meta{data.size(), now, now, locked.meta.mode};
+    ContentStore::Blob* blob = contents.put(data);
+    DirectoryNode* dir = writableDirectory(dirId);
+    replaceFile(dir, findFile(dir, entry.name), meta, blob);
+    rehash(dirId, entryHash(locked.name, false, NO_DIRECTORY, locked.meta, locked.content),
+           entryHash(locked.name, false, NO_DIRECTORY, meta, blob));
+    contents.release(blob); // the file holds its own reference now
+    addUsage(dirId, static_cast<std::int64_t>(meta.size) - static_cast<std::int64_t>(locked.meta.size), 0, now, 0);
+    logOperation(Journal::WRITE_FILE, logged, "", std::string(data), false, now, &meta);
+    return OK;
+}
+
+// Function to read the contents of a file
+FileSystem::Status FileSystem::readFile(const std::string& path, std::string& data) const {
+    METRICS_TIME(READ_FILE);
+    EpochManager::Guard guard(epochs);
+    unsigned dirId;
+    EntryInfo entry;
+    if (!findEntry(published.load(std::memory_order_acquire), path, dirId, entry)) {
+        return NOT_FOUND;
+    }
+    if (entry.isDirectory) {
+        return IS_DIRECTORY;
+    }
+    if (entry.content) {
+        data.assign(entry.content->bytes().data(), entry.content->bytes().size());
+    } else {
+        data.clear();
+    }
+    return OK;
+}
+
+// Private helper function to collect the ids of a directory and of every directory
+// beneath it, in no particular order, and (when named is set) the names of their
+// entries. A large subtree is walked on several threads.
+// Callers hold the whole structure, so nothing changes under the walk.
+std::vector<unsigned> FileSystem::collectSubtree(unsigned dirId, unsigned threads,
+                                                 std::vector<NameHolder>* named) const {
+    const DirectoryTable& table = current->directories;
+    unsigned workers = table.usage(dirId).entries < PARALLEL_WALK_ENTRIES ? 1 : workerCount(threads);
+    std::vector<std::vector<unsigned>> found(workers);
+    std::vector<std::vector<NameHolder>> foundNames(workers);
+    parallelWalk(std::vector<unsigned>(1, dirId), workers, [&](std::size_t worker, unsigned id, const auto& spawn) {
+        const DirectoryNode* dir = table[id];
+        found[worker].push_back(id);
+        if (!named) {
+            forEachSubdirectory(dir, [&](unsigned child) { spawn(child); });
+            return;
+        }
+        forEachEntry(dir, [&](const EntryInfo& entry) {
+            if (entry.isDirectory) {
+                spawn(entry.child);
+            }
+            foundNames[worker].push_back(NameHolder{entry.name, id, 0});
+        });
+    });
+
+    std::vector<unsigned> subtree;
+    for (std::size_t worker = 0; worker < workers; worker++) {
+        subtree.insert(subtree.end(), found[worker].begin(), found[worker].end());
+        if (named) {
+            named->insert(named->end(), foundNames[worker].begin(), foundNames[worker].end());
+        }
+    }
+    return subtree;
+}
+
+// Function to remove a directory together with everything beneath it. The
+// subtree is unhooked from the table at once, the directories no backup shares
+// are freed together (after the readers in concurrent mode), and the names
+// leave the search index in one batch and the name filter one by one.
+FileSystem::Status FileSystem::removeTree(const std::string& path, unsigned threads) {
+    METRICS_TIME(REMOVE_TREE);
+    WriteLock lock(*this, true);
+    unsigned dirId;
+    EntryInfo entry;
+    if (!findEntry(current, path, dirId, entry)) {
+        return NOT_FOUND;
+    }
+    std::string logged = entryPath(dirId, entry.name);
+    if (!entry.isDirectory) {
+        return remove(logged);
+    }
+
+    std::vector<NameHolder> removedNames;
+    std::vector<unsigned> subtree = collectSubtree(entry.child, threads, &removedNames);
+    Usage removed = current->directories.usage(entry.child);
+    std::int64_t now = operationTime();
+    DirectoryNode* parent = writableDirectory(dirId);
+    FileNode* fileToRemove = findFile(parent, entry.name);
+    std::uint64_t removedHash = entryHash(fileToRemove);
+    unlinkFileFromDirectory(parent, fileToRemove);
+    retireFile(fileToRemove);
+    addUsage(dirId, -static_cast<std::int64_t>(removed.bytes), -static_cast<std::int64_t>(removed.entries + 1), 0, now);
+    rehash(dirId, removedHash, 0);
+    for (const NameHolder& name : removedNames) {
+        unfilterName(name.name);
+    }
+    // Names of directories still backed by the image are not in the index
+    removedNames.erase(std::remove_if(removedNames.begin(), removedNames.end(),
+                                      [this](const NameHolder& name) {
+                                          return current->directories[name.holder]->imageBacked;
+                                      }),
+                       removedNames.end());
+    unindexNames(removedNames);
+
+    Version* version = writableVersion();
+    std::vector<DirectoryNode*> unused;
+    for (unsigned id : subtree) {
+        DirectoryNode* dir = version->directories[id];
+        version->directories.set(id, nullptr);
+        if (--dir->refCount == 0) {
+            unused.push_back(dir);
+        }
+    }
+    if (concurrent) {
+        epochs.retire([this, unused]() {
+            for (DirectoryNode* dir : unused) {
+                destroyDirectory(dir);
+            }
+        });
+    } else {
+        for (DirectoryNode* dir : unused) {
+            destroyDirectory(dir);
+        }
+    }
+    invalidateDentryCache();
+    logOperation(Journal::REMOVE_TREE, logged, "", "", false, now);
+    return OK;
+}
+
+// Function to copy a directory and everything beneath it into a directory under the next free copy name
+FileSystem::Status FileSystem::copyTree(const std::string& path, const std::string& destinationDir,
+                                        std::string& copiedName, unsigned threads) {
+    return copyTreeInto(path, destinationDir, "", copiedName, threads);
+}
+
+// Private helper function to copy a subtree into a directory, under the given
+// name or (when it is empty) the next free copy name. The copies are numbered
+// in the order of the directories they copy and filled before the entry naming
+// the top one is linked, so readers never see a partial copy; their names go to
+// the search index in one batch.
+FileSystem::Status FileSystem::copyTreeInto(const std::string& path, const std::string& destinationDir,
+                                            const std::string& name, std::string& copiedName, unsigned threads) {
+    METRICS_TIME(COPY_TREE);
+    WriteLock lock(*this, true);
+    unsigned sourceId;
+    EntryInfo source;
+    if (!findEntry(current, path, sourceId, source)) {
+        return NOT_FOUND;
+    }
+    if (!source.isDirectory) {
+        return copyInto(entryPath(sourceId, source.name), destinationDir, name, copiedName);
+    }
+    DirectoryNode* destDir = findDirectory(current, destinationDir);
+    if (destDir == nullptr) {
+        return DIRECTORY_NOT_FOUND;
+    }
+    unsigned destId = destDir->id;
+    if (isWithin(destId, source.child)) {
+        return INTO_ITSELF;
+    }
+    if (!name.empty() && hasEntry(destDir, name)) {
+        return ALREADY_EXISTS;
+    }
+
+    copiedName = name.empty() ? copyName(destDir, source.name) : name;
+    std::string sourcePath = entryPath(sourceId, source.name);
+    std::string destPath = directoryPath(current, destDir);
+    std::int64_t now = operationTime();
+    std::vector<unsigned> subtree = collectSubtree(source.child, threads, nullptr);
+    std::sort(subtree.begin(), subtree.end());
+
+    DirectoryTable& table = writableVersion()->directories;
+    std::vector<unsigned> remap(table.size(), NO_DIRECTORY);
+    unsigned nextId = static_cast<unsigned>(table.size());
+    for (unsigned id : subtree) {
+        remap[id] = nextId++;
+    }
+    table.reserve(nextId);
+    NameId copiedId = names.intern(copiedName);
+    for (unsigned id : subtree) {
+        const DirectoryNode* dir = table[id];
+        bool top = id == source.child;
+        table.push_back(directoryPool.create(top ? copiedId : dir->name.load(), remap[id],
+                                             top ? destId : remap[dir->parent], &epochs));
+    }
+
+    // Entries keep their metadata and contents; subdirectory entries name the copies
+    std::vector<NameHolder> placed;
+    for (unsigned id : subtree) {
+        const DirectoryNode* dir = table[id];
+        DirectoryNode* copy = table[remap[id]];
+        forEachEntry(dir, [&](const EntryInfo& entry) {
+            unsigned child = entry.isDirectory ? remap[entry.child] : NO_DIRECTORY;
+            linkFile(copy, createFile(entry.name, entry.isDirectory, child, entry.meta, entry.content));
+            placed.push_back(NameHolder{entry.name, copy->id, 0});
+        });
+        copy->order = dir->order;
+        indexSortedEntries(copy);
+        Usage usage = table.usage(id);
+        usage.changed = now;
+        table.setUsage(copy->id, usage);
+        table.setHash(copy->id, table.hash(id)); // same names, metadata and contents beneath it
+    }
+
+    Metadata meta = source.meta;
+    meta.ctime = now;
+    Usage copied = table.usage(source.child);
+    FileNode* copiedTop = createFile(copiedId, true, remap[source.child], meta);
+    linkFile(writableDirectory(destId), copiedTop);
+    rehash(destId, 0, entryHash(copiedTop));
+    placed.push_back(NameHolder{copiedId, destId, 0});
+    indexNames(placed, workerCount(threads));
+    addUsage(destId, static_cast<std::int64_t>(copied.bytes), static_cast<std::int64_t>(copied.entries + 1),
+             std::max(copied.newest, meta.mtime), now);
+    logOperation(Journal::COPY_TREE, sourcePath, destPath, copiedName, false, now);
+    return OK;
+}
+
+// Private helper function to give the time of the operation being applied: now, or
+// while replaying, the time the journal recorded for it
+std::int64_t FileSystem::operationTime() const {
+    if (replaying && replayTime != 0) {
+        return replayTime;
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+// Private helper function to build the metadata of a new, empty entry
+FileSystem::Metadata FileSystem::newMetadata(bool isDir, std::int64_t time) {
+    return Metadata{0, time, time, isDir ? 0755u : 0644u};
+}
+
+// Private helper function to account for entries added to or removed from a
+// directory: the deltas and the newest mtime go to the directory and each of its
+// ancestors, and changed (unless 0) becomes the directory's change time. Callers
+// hold the global section or the whole structure, so no two run at once.
+void FileSystem::addUsage(unsigned dirId, std::int64_t bytes, std::int64_t entries, std::int64_t newest,
+                          std::int64_t changed) {
+    DirectoryTable& table = writableVersion()->directories;
+    for (unsigned id = dirId; id != NO_DIRECTORY; id = table[id]->parent) {
+        Usage usage = table.usage(id);
+        usage.bytes += static_cast<std::uint64_t>(bytes);
+        usage.entries += static_cast<std::uint64_t>(entries);
+        usage.newest = std::max(usage.newest, newest);
+        if (id == dirId && changed != 0) {
+            usage.changed = changed;
+        }
+        table.setUsage(id, usage);
+    }
+}
+
+// Private helper functions to hash an entry of the current version, from its parts or its node
+std::uint64_t FileSystem::entryHash(NameId name, bool isDir, unsigned child, const Metadata& meta,
+                                    const ContentStore::Blob* content) const {
+    std::uint64_t identity = isDir ? directoryIdentity(current->directories.hash(child))
+                                   : fileIdentity(meta, content ? ContentStore::hashOf(content) : 0);
+    return namedHash(names.str(name), identity);
+}
+
+std::uint64_t FileSystem::entryHash(const FileNode* file) const {
+    return entryHash(file->name, file->isDirectory, file->child, file->meta, file->content);
+}
+
+// Private helper function to account for entries of a directory changing. A
+// directory's hash is the sum of its entries' hashes, so an entry is taken out
+// or put in by subtraction or addition, in any order; a directory's own entry
+// hashes its subtree's, so the change is carried to each ancestor in turn.
+void FileSystem::rehash(unsigned dirId, std::uint64_t removed, std::uint64_t added) {
+    DirectoryTable& table = writableVersion()->directories;
+    for (unsigned id = dirId; removed != added;) {
+        std::uint64_t before = table.hash(id);
+        std::uint64_t after = before - removed + added;
+        table.setHash(id, after);
+        const DirectoryNode* dir = table[id];
+        if (dir->parent == NO_DIRECTORY) {
+            break;
+        }
+        std::string_view name = names.str(dir->name);
+        removed = namedHash(name, directoryIdentity(before));
+        added = namedHash(name, directoryIdentity(after));
+        id = dir->parent;
+    }
+}
+
+// Function to change the size, mtime and mode of an entry found by path or bare name
+FileSystem::Status FileSystem::setMetadata(const std::string& path, const Metadata& metadata) {
+    METRICS_TIME(SET_METADATA);
+    WriteLock lock(*this, false);
+    unsigned dirId;
+    EntryInfo entry;
+    if (!findEntry(current, path, dirId, entry)) {
+        return NOT_FOUND;
+    }
+    lock.lockDirectories(dirId);
+    DirectoryNode* holder = current->directories[dirId];
+    EntryInfo locked;
+    if (!holder || !lookupEntry(holder, entry.name, locked) || locked.child != entry.child) {
+        return NOT_FOUND;
+    }
+    std::string logged = entryPath(dirId, entry.name);
+    lock.lockIndex();
+    Metadata meta = metadata;
+    meta.ctime = operationTime();
+    if (locked.isDirectory) {
+        meta.size = 0;
+    }
+    DirectoryNode* dir = writableDirectory(dirId);
+    FileNode* file = findFile(dir, entry.name);
+    std::uint64_t oldHash = entryHash(file);
+    replaceFile(dir, file, meta, file->content);
+    rehash(dirId, oldHash, entryHash(entry.name, locked.isDirectory, locked.child, meta, locked.content));
+    addUsage(dirId, static_cast<std::int64_t>(meta.size) - static_cast<std::int64_t>(locked.meta.size), 0, meta.mtime, 0);
+    logOperation(Journal::SET_METADATA, logged, "", "", false, meta.ctime, &meta);
+    return OK;
+}
+
+// Function to read the metadata of an entry found by path or bare name. The root
+// has no entry; it reports the last change to its own entries.
+FileSystem::Status FileSystem::stat(const std::string& path, Metadata& metadata) const {
+    METRICS_TIME(STAT);
+    EpochManager::Guard guard(epochs);
+    const Version* version = published.load(std::memory_order_acquire);
+    if (normalizePath(path).empty()) {
+        std::int64_t changed = version->directories.usage(ROOT_DIRECTORY).changed;
+        metadata = Metadata{0, changed, changed, 0755u};
+        return OK;
+    }
+    unsigned dirId;
+    EntryInfo entry;
+    if (!findEntry(version, path, dirId, entry)) {
+        return NOT_FOUND;
+    }
+    metadata = entry.meta;
+    return OK;
+}
+
+// Function to read what a directory holds. Each figure is kept up to date as
+// entries change; under concurrent writers they may straddle one change.
+FileSystem::Status FileSystem::usage(const std::string& dirpath, Usage& result) const {
+    METRICS_TIME(STAT);
+    EpochManager::Guard guard(epochs);
+    const Version* version = published.load(std::memory_order_acquire);
+    DirectoryNode* dir = findDirectory(version, dirpath);
+    if (dir == nullptr) {
+        return NOT_FOUND;
+    }
+    result = version->directories.usage(dir->id);
+    return OK;
+}
+
+// Function to find the entries with an mtime at or after time, depth first and in
+// list order. Subtrees whose newest mtime is older are skipped unvisited.
+std::vector<FileSystem::Match> FileSystem::modifiedSince(std::int64_t time, const std::string& dirpath) const {
+    METRICS_TIME(STAT);
+    EpochManager::Guard guard(epochs);
+    const Version* version = published.load(std::memory_order_acquire);
+    std::vector<Match> matches;
+    DirectoryNode* start = findDirectory(version, dirpath);
+    if (start == nullptr) {
+        return matches;
+    }
+    std::vector<unsigned> pending(1, start->id);
+    while (!pending.empty()) {
+        unsigned id = pending.back();
+        pending.pop_back();
+        DirectoryNode* dir = version->directories[id];
+        if (dir == nullptr || version->directories.usage(id).newest < time) {
+            continue; // removed by a concurrent writer, or nothing recent beneath it
+        }
+        std::string path = directoryPath(version, dir);
+        std::size_t firstChild = pending.size();
+        forEachEntry(dir, [&](const EntryInfo& entry) {
+            if (entry.meta.mtime >= time) {
+                matches.push_back(Match{path, std::string(names.str(entry.name)), entry.isDirectory});
+            }
+            if (entry.isDirectory) {
+                pending.push_back(entry.child);
+            }
+        });
+        std::reverse(pending.begin() + firstChild, pending.end());
+    }
+    return matches;
+}
+
+// Function to read the hash of a directory's subtree
+FileSystem::Status FileSystem::treeHash(const std::string& dirpath, std::uint64_t& hash) const {
+    EpochManager::Guard guard(epochs);
+    const Version* version = published.load(std::memory_order_acquire);
+    DirectoryNode* dir = findDirectory(version, dirpath);
+    if (dir == nullptr) {
+        return NOT_FOUND;
+    }
+    hash = version->directories.hash(dir->id);
+    return OK;
+}
+
+// Function to compare two states of this file system, by backup depth
+FileSystem::Status FileSystem::diff(std::size_t before, std::size_t after, std::vector<Change>& changes) const {
+    METRICS_TIME(DIFF);
+    WriteLock lock(*this);
+    if (before > backups.size() || after > backups.size()) {
+        return NO_BACKUP;
+    }
+    std::vector<const Version*> states(1, current);
+    std::stack<Version*> older = backups;
+    while (states.size() <= std::max(before, after)) {
+        states.push_back(older.top());
+        older.pop();
+    }
+    changes.clear();
+    diffVersions(*this, states[before], *this, states[after], changes);
+    return OK;
+}
+
+// Function to compare the current states of two file systems
+std::vector<FileSystem::Change> FileSystem::diff(const FileSystem& before, const FileSystem& after) {
+    METRICS_TIME(DIFF);
+    EpochManager::Guard beforeGuard(before.epochs);
+    EpochManager::Guard afterGuard(after.epochs);
+    std::vector<Change> changes;
+    diffVersions(before, before.published.load(std::memory_order_acquire), after,
+                 after.published.load(std::memory_order_acquire), changes);
+    return changes;
+}
+
+// Private helper function to compare two versions, which may belong to different
+// file systems, so names are compared as text. Directories are compared pairwise
+// from the root, descending only where the hashes differ; entries found on one
+// side only are paired up as renames by what they are, apart from their names.
+void FileSystem::diffVersions(const FileSystem& older, const Version* before, const FileSystem& newer,
+                              const Version* after, std::vector<Change>& changes) {
+    class Pair {
+    public:
+        unsigned before;
+        unsigned after;
+        std::string path;
+    };
+    class Unmatched {
+    public:
+        std::string path;
+        bool isDirectory;
+        std::uint64_t identity;
+    };
+    auto identity = [](const Version* version, const EntryInfo& entry) {
+        return entry.isDirectory ? directoryIdentity(version->directories.hash(entry.child))
+                                 : fileIdentity(entry.meta, entry.content ? ContentStore::hashOf(entry.content) : 0);
+    };
+    auto childPath = [](const std::string& dir, std::string_view name) {
+        return dir.empty() ? std::string(name) : dir + "/" + std::string(name);
+    };
+
+    std::vector<Unmatched> removed;
+    std::vector<Unmatched> added;
+    std::vector<Pair> pending(1, Pair{ROOT_DIRECTORY, ROOT_DIRECTORY, ""});
+    while (!pending.empty()) {
+        Pair pair = std::move(pending.back());
+        pending.pop_back();
+        if (before->directories.hash(pair.before) == after->directories.hash(pair.after)) {
+            continue;
+        }
+        std::unordered_map<std::string_view, EntryInfo> held;
+        older.forEachEntry(before->directories[pair.before],
+                           [&](const EntryInfo& entry) { held.emplace(older.names.str(entry.name), entry); });
+        newer.forEachEntry(after->directories[pair.after], [&](const EntryInfo& entry) {
+            std::string_view name = newer.names.str(entry.name);
+            std::string path = childPath(pair.path, name);
+            std::unordered_map<std::string_view, EntryInfo>::iterator found = held.find(name);
+            if (found == held.end()) {
+                added.push_back(Unmatched{path, entry.isDirectory, identity(after, entry)});
+                return;
+            }
+            EntryInfo old = found->second;
+            held.erase(found);
+            if (old.isDirectory && entry.isDirectory) {
+                pending.push_back(Pair{old.child, entry.child, path});
+            } else if (old.isDirectory != entry.isDirectory) {
+                removed.push_back(Unmatched{path, old.isDirectory, identity(before, old)});
+                added.push_back(Unmatched{path, entry.isDirectory, identity(after, entry)});
+            } else if (identity(before, old) != identity(after, entry)) {
+                changes.push_back(Change{Change::MODIFIED, path, "", false});
+            }
+        });
+        for (const std::pair<const std::string_view, EntryInfo>& gone : held) {
+            removed.push_back(Unmatched{childPath(pair.path, gone.first), gone.second.isDirectory,
+                                        identity(before, gone.second)});
+        }
+    }
+
+    // Directory and file identities never collide, so equal identities are the same kind
+    std::unordered_multimap<std::uint64_t, std::size_t> removedBy;
+    for (std::size_t i = 0; i < removed.size(); i++) {
+        removedBy.emplace(removed[i].identity, i);
+    }
+    for (const Unmatched& entry : added) {
+        std::unordered_multimap<std::uint64_t, std::size_t>::iterator match = removedBy.find(entry.identity);
+        if (match == removedBy.end()) {
+            changes.push_back(Change{Change::ADDED, entry.path, "", entry.isDirectory});
+            continue;
+        }
+        Unmatched& source = removed[match->second];
+        changes.push_back(Change{Change::RENAMED, source.path, entry.path, entry.isDirectory});
+        source.path.clear();
+        removedBy.erase(match);
+    }
+    for (const Unmatched& entry : removed) {
+        if (!entry.path.empty()) {
+            changes.push_back(Change{Change::REMOVED, entry.path, "", entry.isDirectory});
+        }
+    }
+    std::sort(changes.begin(), changes.end(), [](const Change& a, const Change& b) {
+        return a.path != b.path ? a.path < b.path : a.kind < b.kind;
+    });
+}
+
+// Function to write the current version to a compact binary image.
+// Names keep their ids; directories are renumbered densely, skipping removed ones.
+bool FileSystem::save(const std::string& path) const {
+    METRICS_TIME(SAVE);
+    WriteLock lock(*this);
+    std::vector<std::uint32_t> imageId(current->directories.size(), NamespaceImage::NO_DIRECTORY);
+    std::uint32_t directoryCount = 0;
+    for (std::size_t id = 0; id < current->directories.size(); id++) {
+        if (current->directories[id]) {
+            imageId[id] = directoryCount++;
+        }
+    }
+
+    std::vector<NamespaceImage::Directory> directories;
+    std::vector<NamespaceImage::Entry> entries;
+    std::vector<std::uint32_t> sorted;
+    std::vector<std::string_view> blobs;
+    std::unordered_map<const ContentStore::Blob*, std::uint32_t> blobIndex; // each blob is written once
+    directories.reserve(directoryCount);
+    for (std::size_t id = 0; id < current->directories.size(); id++) {
+        const DirectoryNode* dir = current->directories[id];
+        if (!dir) {
+            continue;
+        }
+        NamespaceImage::Directory record;
+        record.name = dir->name;
+        record.parent = dir->parent == NO_DIRECTORY ? NamespaceImage::NO_DIRECTORY : imageId[dir->parent];
+        record.firstEntry = static_cast<std::uint32_t>(entries.size());
+        forEachEntry(dir, [&](const EntryInfo& entry) {
+            NamespaceImage::Entry out;
+            out.name = entry.name;
+            out.child = entry.isDirectory ? imageId[entry.child] : NamespaceImage::NO_DIRECTORY;
+            out.size = entry.meta.size;
+            out.mtime = entry.meta.mtime;
+            out.ctime = entry.meta.ctime;
+            out.mode = entry.meta.mode;
+            out.content = NamespaceImage::NO_CONTENT;
+            if (entry.content) {
+                std::pair<std::unordered_map<const ContentStore::Blob*, std::uint32_t>::iterator, bool> added =
+                    blobIndex.emplace(entry.content, static_cast<std::uint32_t>(blobs.size()));
+                if (added.second) {
+                    blobs.push_back(entry.content->bytes());
+                }
+                out.content = added.first->second;
+            }
+            entries.push_back(out);
+        });
+        record.entryCount = static_cast<std::uint32_t>(entries.size()) - record.firstEntry;
+        record.order = dir->order;
+        record.filter = NamespaceImage::NO_FILTER; // filled in by write()
+        Usage usage = current->directories.usage(id);
+        record.bytes = usage.bytes;
+        record.entries = usage.entries;
+        record.newest = usage.newest;
+        record.changed = usage.changed;
+        record.hash = current->directories.hash(id);
+        directories.push_back(record);
+
+        // This directory's slice of the permutation, ordered by name
+        std::size_t first = sorted.size();
+        sorted.resize(entries.size());
+        std::iota(sorted.begin() + first, sorted.end(), record.firstEntry);
+        std::sort(sorted.begin() + first, sorted.end(), [&](std::uint32_t a, std::uint32_t b) {
+            return names.str(entries[a].name) < names.str(entries[b].name);
+        });
+    }
+
+    std::string error;
+    if (!NamespaceImage::write(path, names, directories, entries, sorted, blobs, sequence, error)) {
+        std::cout << "Error: " << error << "." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Function to replace the namespace with a mapped image. Nothing is parsed or
+// copied per entry: each directory gets a node pointing at its slice of the image.
+bool FileSystem::open(const std::string& path) {
+    METRICS_TIME(OPEN);
+    // Every name id changes meaning, which readers on other threads could not survive
+    if (concurrent) {
+        std::cout << "Error: cannot open an image while the file system is shared between threads." << std::endl;
+        return false;
+    }
+    if (journal.isOpen()) {
+        std::cout << "Error: cannot open an image while a journal is open." << std::endl;
+        return false;
+    }
+    std::unique_ptr<NamespaceImage> opened(new NamespaceImage());
+    std::string error;
+    if (!opened->map(path, error)) {
+        std::cout << "Error: " << error << "." << std::endl;
+        return false;
+    }
+
+    // Every node refers to names of the old table, so drop them all first
+    releaseVersion(current);
+    while (!backups.empty()) {
+        releaseVersion(backups.top());
+        backups.pop();
+    }
+    checkpointBackups = 0;
+    invalidateDentryCache();
+    copyIndexes.clear();
+    delete suffixIndex.exchange(nullptr, std::memory_order_relaxed);
+    for (ContentStore::Blob* blob : imageBlobs) {
+        contents.release(blob);
+    }
+    opened->attachNames(names);
+    image.swap(opened);
+    replaceNameFilter(new NameFilter(image->nameFilter(), image->header().nameFilterBytes, image->header().entryCount));
+
+    // Contents stay in the mapping; the store only points at them
+    const NamespaceImage::Blob* stored = image->blobs();
+    imageBlobs.resize(image->header().blobCount);
+    for (std::size_t i = 0; i < imageBlobs.size(); i++) {
+        imageBlobs[i] = contents.adopt(image->blob(i), stored[i].hash);
+    }
+
+    const NamespaceImage::Header& header = image->header();
+    const NamespaceImage::Directory* directories = image->directories();
+    sequence = header.journalSequence;
+    publish(new Version(&names, &epochs));
+    current->directories.reserve(header.directoryCount);
+    for (std::uint32_t id = 0; id < header.directoryCount; id++) {
+        DirectoryNode* dir = directoryPool.create(directories[id].name, id, directories[id].parent, &epochs);
+        dir->imageBacked = true;
+        dir->imageFirst = directories[id].firstEntry;
+        dir->imageCount = directories[id].entryCount;
+        dir->order = directories[id].order <= BY_MTIME ? static_cast<SortKey>(directories[id].order) : UNSORTED;
+        current->directories.push_back(dir);
+        current->directories.setUsage(id, Usage{directories[id].bytes, directories[id].entries, directories[id].newest,
+                                                directories[id].changed});
+        current->directories.setHash(id, directories[id].hash);
+    }
+    return true;
+}
+
+// Private helper function to build an unambiguous path ("/name" at the root) for an entry
+std::string FileSystem::entryPath(unsigned dirId, NameId name) const {
+    std::string path = dirId == ROOT_DIRECTORY ? "" : directoryPath(current, current->directories[dirId]);
+    path += '/';
+    path.append(names.str(name));
+    return path;
+}
+
+// Private helper function to number an applied operation, pass it to the record sink
+// and append it to the journal. An operation a checkpoint will cover instead is not
+// journaled, but a replica still needs it.
+void FileSystem::logOperation(Journal::Operation operation, const std::string& first, const std::string& second,
+                              const std::string& third, bool flag, std::int64_t time, const Metadata* metadata,
+                              bool journaled) {
+    sequence++;
+    if (replaying || (!journal.isOpen() && !recordSink)) {
+        return;
+    }
+    Journal::Record record;
+    record.sequence = sequence;
+    record.operation = operation;
+    record.flag = flag;
+    record.first = first;
+    record.second = second;
+    record.third = third;
+    record.time = time;
+    if (metadata) {
+        record.size = metadata->size;
+        record.mtime = metadata->mtime;
+        record.mode = metadata->mode;
+    }
+    if (recordSink) {
+        recordSink(record);
+    }
+    if (!journal.isOpen() || !journaled) {
+        return;
+    }
+    if (!journal.append(record)) {
+        std::cout << "Error: cannot write the journal." << std::endl;
+    }
+    METRICS_COUNT(JOURNAL_RECORDS, 1);
+    if (checkpointEvery != 0 && journal.size() >= checkpointEvery) {
+        if (concurrent) {
+            checkpointDue = true; // runs once this writer has released its locks
+        } else {
+            checkpoint(checkpointPath);
+        }
+    }
+}
+
+// Private helper function to apply one journal record through the regular operations
+// Operations take their time from the record; records from before times were
+// logged carry none and get the time of the replay.
+void FileSystem::applyRecord(const Journal::Record& record) {
+    replayTime = record.time;
+    switch (record.operation) {
+        case Journal::INSERT_DIRECTORY:
+            insertDirectory(record.first);
+            break;
+        case Journal::INSERT_FILE:
+            if (record.time != 0) {
+                insertFile(record.first, record.second, record.flag, Metadata{record.size, record.mtime, 0, record.mode});
+            } else {
+                insertFile(record.first, record.second, record.flag);
+            }
+            break;
+        case Journal::SET_METADATA:
+            setMetadata(record.first, Metadata{record.size, record.mtime, 0, record.mode});
+            break;
+        case Journal::WRITE_FILE:
+            writeFile(record.first, record.third);
+            break;
+        case Journal::COPY_FILE: {
+            std::string copiedName;
+            copyInto(record.first, record.second, record.third, copiedName);
+            break;
+        }
+        case Journal::REMOVE:
+            remove(record.first);
+            break;
+        case Journal::REMOVE_TREE:
+            removeTree(record.first);
+            break;
+        case Journal::COPY_TREE: {
+            std::string copiedName;
+            copyTreeInto(record.first, record.second, record.third, copiedName, 0);
+            break;
+        }
+        case Journal::RENAME_DIRECTORY:
+            renameDirectory(record.first, record.second);
+            break;
+        case Journal::MOVE: {
+            MoveBatch batch(record.first, record.second);
+            batch.filenames.push_back(record.third);
+            executeMoveBatch(batch);
+            break;
+        }
+        case Journal::SORT_DIRECTORY: {
+            // Records from before sort keys existed carry none: those sorted by name
+            DirectoryNode* dir = findDirectory(current, record.first);
+            SortKey key = record.second.empty() ? BY_NAME : static_cast<SortKey>(std::atoi(record.second.c_str()));
+            if (dir && key <= BY_MTIME) {
+                reorderDirectory(dir->id, key, record.flag);
+            }
+            break;
+        }
+        case Journal::CREATE_BACKUP:
+            createBackup();
+            break;
+        case Journal::RESTORE_BACKUP:
+            restoreBackup();
+            break;
+    }
+}
+
+// Function to replay a journal and log every later change to it
+bool FileSystem::openJournal(const std::string& path, Journal::Durability durability, std::size_t* replayedCount) {
+    WriteLock lock(*this, true);
+    std::size_t replayed = 0;
+    std::size_t replayedBackups = 0; // backups on the stack that the journal recreates
+    std::string error;
+
+    replaying = true;
+    bool opened = journal.open(path, durability, [&](const Journal::Record& record) {
+        if (record.sequence <= sequence) {
+            return; // already in the image
+        }
+        applyRecord(record);
+        sequence = record.sequence;
+        replayed++;
+        if (record.operation == Journal::CREATE_BACKUP) {
+            replayedBackups++;
+        } else if (record.operation == Journal::RESTORE_BACKUP && replayedBackups > 0) {
+            replayedBackups--;
+        }
+    }, error);
+    replaying = false;
+    checkpointBackups = backups.size() - std::min<std::size_t>(backups.size(), replayedBackups);
+
+    if (!opened) {
+        std::cout << "Error: " << error << "." << std::endl;
+        return false;
+    }
+    if (replayedCount) {
+        *replayedCount = replayed;
+    }
+    return true;
+}
+
+// Function to pass every change to sink as it is logged
+void FileSystem::setRecordSink(std::function<void(const Journal::Record&)> sink) {
+    WriteLock lock(*this, true);
+    recordSink = std::move(sink);
+}
+
+// Function to apply records logged by another file system. Like a journal replay
+// they are not logged again, and every operation takes its time from its record.
+std::size_t FileSystem::applyRecords(const std::vector<Journal::Record>& records) {
+    METRICS_TIME(REPLICATE);
+    WriteLock lock(*this, true);
+    std::size_t applied = 0;
+    replaying = true;
+    for (const Journal::Record& record : records) {
+        if (record.sequence <= sequence) {
+            continue; // already in the snapshot this file system started from
+        }
+        if (record.operation == Journal::RESTORE_BACKUP && backups.empty()) {
+            break; // the backup was taken before that snapshot, which holds none
+        }
+        applyRecord(record);
+        sequence = record.sequence;
+        applied++;
+        if (Metrics::enabled() && record.time != 0) {
+            // From the change on the other file system to its replay here
+            std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            Metrics::record(Metrics::REPLICATION_LAG, static_cast<std::uint64_t>(std::max<std::int64_t>(now - record.time, 0)));
+        }
+    }
+    replaying = false;
+    METRICS_COUNT(REPLICATED_RECORDS, applied);
+    return applied;
+}
+
+// Function to return the sequence number of the last change
+std::uint64_t FileSystem::lastSequence() const {
+    WriteLock lock(*this);
+    return sequence;
+}
+
+// Function to tune group commit for the open journal
+void FileSystem::setGroupCommit(std::size_t records, std::chrono::milliseconds window) {
+    WriteLock lock(*this, false);
+    lock.lockIndex();
+    journal.setGroupCommit(records, window);
+}
+
+// Function to make every logged operation durable now
+bool FileSystem::syncJournal() {
+    WriteLock lock(*this, false);
+    lock.lockIndex();
+    if (journal.isOpen() && !journal.sync()) {
+        std::cout << "Error: cannot sync the journal." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Function to save an image and compact the journal it now covers. The image
+// records the last sequence number it holds, so a crash between the two steps
+// only makes the next replay skip records.
+bool FileSystem::checkpoint(const std::string& path) {
+    METRICS_TIME(CHECKPOINT);
+    WriteLock lock(*this, true);
+    if (!save(path)) {
+        return false;
+    }
+    if (journal.isOpen() && !journal.truncate()) {
+        std::cout << "Error: cannot compact the journal." << std::endl;
+        return false;
+    }
+    checkpointPath = path;
+    checkpointBackups = backups.size();
+    return true;
+}
+
+// Function to checkpoint automatically after every so many logged operations
+void FileSystem::setCheckpointInterval(const std::string& path, std::size_t operations) {
+    WriteLock lock(*this, false);
+    lock.lockIndex();
+    checkpointPath = path;
+    checkpointEvery = operations;
+}
+
+// Function to bulk-load the paths listed in a manifest
+bool FileSystem::importManifest(const std::string& manifestPath, unsigned threads, ImportResult* result) {
+    METRICS_TIME(IMPORT);
+    ImportList list;
+    std::string error;
+    if (!list.readManifest(manifestPath, threads, error)) {
+        std::cout << "Error: " << error << "." << std::endl;
+        return false;
+    }
+    ImportResult loaded = bulkLoad(list, threads);
+    if (result) {
+        *result = loaded;
+    }
+    return true;
+}
+
+// Function to bulk-load a host directory tree under targetDir
+bool FileSystem::importDirectory(const std::string& hostPath, const std::string& targetDir, unsigned threads,
+                                 ImportResult* result) {
+    METRICS_TIME(IMPORT);
+    ImportList list;
+    std::string error;
+    if (!list.readDirectory(hostPath, normalizePath(targetDir), threads, error)) {
+        std::cout << "Error: " << error << "." << std::endl;
+        return false;
+    }
+    ImportResult loaded = bulkLoad(list, threads);
+    if (result) {
+        *result = loaded;
+    }
+    return true;
+}
+
+// Private helper function to add imported entries in one pass. Sorted depth
+// first, each entry's parent is on the stack of directories open along the
+// previous entry's path, so nothing is resolved from the root again. The new
+// names then go to the search index in one batch.
+FileSystem::ImportResult FileSystem::bulkLoad(ImportList& list, unsigned threads) {
+    class OpenDirectory {
+    public:
+        std::string_view path;
+        unsigned id;
+    };
+    threads = workerCount(threads);
+    std::size_t duplicates = list.sort(threads);
+    std::size_t conflicts = 0;
+    WriteLock lock(*this, true);
+    writableVersion();
+    // Whether to journal each entry; a replica is sent every entry either way
+    bool logEach = journal.isOpen() && checkpointPath.empty();
+    std::int64_t now = operationTime();
+    Metadata fileMeta = newMetadata(false, now);
+    Metadata directoryMeta = newMetadata(true, now);
+
+    std::vector<OpenDirectory> open(1, OpenDirectory{std::string_view(), ROOT_DIRECTORY});
+    std::vector<NameHolder> placed;
+    for (const ImportList::Entry& item : list.entries()) {
+        std::string_view path = item.path;
+        // Close the directories this entry does not lie beneath
+        while (open.size() > 1) {
+            std::string_view top = open.back().path;
+            if (path.size() > top.size() && path[top.size()] == '/' && path.compare(0, top.size(), top) == 0) {
+                break;
+            }
+            open.pop_back();
+        }
+
+        // Walk the remaining components, creating the missing ones
+        std::size_t start = open.size() > 1 ? open.back().path.size() + 1 : 0;
+        for (;;) {
+            std::size_t end = path.find('/', start);
+            bool last = end == std::string_view::npos;
+            if (last) {
+                end = path.size();
+            }
+            bool isDirectory = !last || item.isDirectory;
+            unsigned parentId = open.back().id;
+            std::string_view component = path.substr(start, end - start);
+            NameId name = names.intern(component);
+            EntryInfo entry;
+            if (lookupEntry(current->directories[parentId], name, entry)) {
+                if (entry.isDirectory != isDirectory) {
+                    conflicts++;
+                    break;
+                }
+                if (last) {
+                    duplicates++;
+                }
+            } else {
+                entry.child = NO_DIRECTORY;
+                if (isDirectory) {
+                    entry.child = static_cast<unsigned>(current->directories.size());
+                    current->directories.push_back(directoryPool.create(name, entry.child, parentId, &epochs));
+                    current->directories.setUsage(entry.child, Usage{0, 0, 0, now});
+                }
+                const Metadata& meta = isDirectory ? directoryMeta : fileMeta;
+                FileNode* created = createFile(name, isDirectory, entry.child, meta);
+                linkFile(writableDirectory(parentId), created);
+                addUsage(parentId, 0, 1, now, now);
+                rehash(parentId, 0, entryHash(created));
+                placed.push_back(NameHolder{name, parentId, 0});
+                if (logEach || recordSink) {
+                    logOperation(Journal::INSERT_FILE, std::string(open.back().path), std::string(component), "",
+                                 isDirectory, now, &meta, logEach);
+                }
+            }
+            if (isDirectory) {
+                open.push_back(OpenDirectory{path.substr(0, end), entry.child});
+            }
+            if (last) {
+                break;
+            }
+            start = end + 1;
+        }
+    }
+
+    indexNames(placed, threads);
+
+    // Logging every entry would dwarf the import, so an image is written instead when there is one
+    if (journal.isOpen() && !logEach) {
+        checkpoint(checkpointPath);
+    }
+    return ImportResult{placed.size(), duplicates, conflicts};
+}
+
+// Private helper function to add the names placed in directories to the search
+// index in one batch. Unless the batch is small next to the index, the names
+// are merged with it and the index is built bottom up once; a name's new
+// holders go after its existing ones, in placement order.
+void FileSystem::indexNames(std::vector<NameHolder>& placed, unsigned threads) {
+    if (placed.size() * 8 < current->searchIndex.size()) {
+        // Too few new names to pay for rebuilding a large index
+        updateSearchIndex([&](NameIndex& index) {
+            for (const NameHolder& entry : placed) {
+                index.insert(entry.name, entry.holder);
+            }
+        });
+        return;
+    }
+    if (placed.empty()) {
+        return;
+    }
+
+    // Group the holders of each new name, in placement order, then order the names by text
+    NameOrder byText(&names);
+    for (std::size_t i = 0; i < placed.size(); i++) {
+        placed[i].order = i;
+    }
+    parallelSort(placed.begin(), placed.end(), [](const NameHolder& a, const NameHolder& b) {
+        return a.name != b.name ? a.name < b.name : a.order < b.order;
+    }, threads);
+    std::vector<NameId> added;
+    std::vector<std::vector<unsigned>> addedHolders;
+    for (const NameHolder& entry : placed) {
+        if (added.empty() || added.back() != entry.name) {
+            added.push_back(entry.name);
+            addedHolders.emplace_back();
+        }
+        addedHolders.back().push_back(entry.holder);
+    }
+    std::vector<std::size_t> rank(added.size());
+    std::iota(rank.begin(), rank.end(), 0);
+    parallelSort(rank.begin(), rank.end(), [&](std::size_t a, std::size_t b) {
+        return byText(added[a], added[b]);
+    }, threads);
+
+    // Merge with the names already indexed; new holders go after the existing ones
+    std::vector<NameId> keys;
+    std::vector<std::vector<unsigned>> holders;
+    keys.reserve(current->searchIndex.size() + added.size());
+    holders.reserve(current->searchIndex.size() + added.size());
+    std::size_t next = 0;
+    current->searchIndex.forEach([&](NameId key, const std::vector<unsigned>& existing) {
+        for (; next < rank.size() && byText(added[rank[next]], key); next++) {
+            keys.push_back(added[rank[next]]);
+            holders.push_back(std::move(addedHolders[rank[next]]));
+        }
+        keys.push_back(key);
+        holders.push_back(existing);
+        if (next < rank.size() && added[rank[next]] == key) {
+            holders.back().insert(holders.back().end(), addedHolders[rank[next]].begin(),
+                                  addedHolders[rank[next]].end());
+            next++;
+        }
+    });
+    for (; next < rank.size(); next++) {
+        keys.push_back(added[rank[next]]);
+        holders.push_back(std::move(addedHolders[rank[next]]));
+    }
+    updateSearchIndex([&](NameIndex& index) { index.build(keys, holders); });
+}
+
+// Private helper function to drop the names of removed directories from the
+// search index in one batch. Unless the batch is small next to the index, the
+// index is rebuilt bottom up from what is left of it, without their holders.
+void FileSystem::unindexNames(const std::vector<NameHolder>& removed) {
+    if (removed.empty()) {
+        return;
+    }
+    if (removed.size() * 8 < current->searchIndex.size()) {
+        updateSearchIndex([&](NameIndex& index) {
+            for (const NameHolder& entry : removed) {
+                index.erase(entry.name, entry.holder);
+            }
+        });
+        return;
+    }
+    std::vector<bool> gone(current->directories.size(), false);
+    for (const NameHolder& entry : removed) {
+        gone[entry.holder] = true;
+    }
+    std::vector<NameId> keys;
+    std::vector<std::vector<unsigned>> holders;
+    current->searchIndex.forEach([&](NameId key, const std::vector<unsigned>& existing) {
+        std::vector<unsigned> kept;
+        for (unsigned holder : existing) {
+            if (!gone[holder]) {
+                kept.push_back(holder);
+            }
+        }
+        if (!kept.empty()) {
+            keys.push_back(key);
+            holders.push_back(std::move(kept));
+        }
+    });
+    updateSearchIndex([&](NameIndex& index) { index.build(keys, holders); });
+}
+
+// Private helper function to count a name about to be linked. A full filter is
+// replaced by one twice its size, counting the current version afresh, but only
+// while no backup needs its names counted too; until then it just fills up.
+void FileSystem::filterName(NameId name) {
+    NameFilter* filter = nameFilter.load(std::memory_order_relaxed);
+    if (filter->size() >= filter->capacity() && backups.empty()) {
+        NameFilter* fresh = new NameFilter(filter->capacity() * 2);
+        for (std::size_t id = 0; id < current->directories.size(); id++) {
+            const DirectoryNode* dir = current->directories[id];
+            if (dir) {
+                forEachEntry(dir, [&](const EntryInfo& entry) { fresh->add(entry.name); });
+            }
+        }
+        replaceNameFilter(fresh);
+        filter = fresh;
+    }
+    filter->add(name);
+}
+
+// Private helper function to stop counting an unlinked name. A backup may still
+// hold it, so while there are backups the count stays.
+void FileSystem::unfilterName(NameId name) {
+    if (backups.empty()) {
+        nameFilter.load(std::memory_order_relaxed)->remove(name);
+    }
+}
+
+// Private helper function to switch lookups over to another name filter; readers
+// may still be probing the old one in concurrent mode, so there it is retired
+void FileSystem::replaceNameFilter(NameFilter* fresh) {
+    NameFilter* old = nameFilter.exchange(fresh, std::memory_order_acq_rel);
+    if (concurrent) {
+        epochs.retire([old]() { delete old; });
+    } else {
+        delete old;
+    }
+}
+
+// Function to let several threads use the file system at once
+void FileSystem::enableConcurrentAccess() {
+    if (concurrent) {
+        return;
+    }
+    epochs.enable();
+    concurrent = true;
+    invalidateDentryCache();
+    // Writers under the shared lock count on a current version that no backup holds
+    writableVersion();
+}
+
+// Private helper function to sort a files list with a stable bottom-up merge sort:
+// each pass merges neighbouring sorted runs of width 1, 2, 4, ..., so the sort
+// takes O(n log n) time whatever the input order, no recursion and no extra memory.
+// Only next links are set; the caller restores prev and tail links.
+template <typename Less>
+FileSystem::FileNode* FileSystem::mergeSortFiles(FileNode* head, Less less) {
+    std::size_t length = 0;
+    for (FileNode* file = head; file != nullptr; file = file->next) {
+        length++;
+    }
+    // Cut a list after count nodes, returning the rest
+    auto cut = [](FileNode* list, std::size_t count) {
+        for (std::size_t i = 1; list != nullptr && i < count; i++) {
+            list = list->next;
+        }
+        if (list == nullptr) {
+            return static_cast<FileNode*>(nullptr);
+        }
+        FileNode* rest = list->next;
+        list->next = nullptr;
+        return rest;
+    };
+
+    for (std::size_t width = 1; width < length; width *= 2) {
+        FileNode* remaining = head;
+        FileNode* mergedTail = nullptr;
+        head = nullptr;
+        while (remaining) {
+            FileNode* left = remaining;
+            FileNode* right = cut(left, width);
+            remaining = cut(right, width);
+            // Take from the left run unless the right one is strictly smaller, which keeps the sort stable
+            while (left || right) {
+                FileNode* taken;
+                if (!right || (left && !less(right, left))) {
+                    taken = left;
+                    left = left->next;
+                } else {
+                    taken = right;
+                    right = right->next;
+                }
+                if (mergedTail) {
+                    mergedTail->next = taken;
+                } else {
+                    head = taken;
+                }
+                mergedTail = taken;
+            }
+        }
+        mergedTail->next = nullptr;
+    }
+    return head;
+}
+
+// Private helper function to sort a large files list through an array: each entry
+// is gathered with the first eight bytes of its sort key and name inline, so most
+// comparisons settle on those without following a node or a name, and the list is
+// relinked in the new order. Stable, like mergeSortFiles, and sets only next links.
+FileSystem::FileNode* FileSystem::sortPackedFiles(FileNode* head, std::size_t count, SortKey key, bool keep) const {
+    class Packed {
+    public:
+        std::uint64_t keyPrefix;
+        std::uint64_t namePrefix;
+        NameId name;
+        bool isDirectory;
+        FileNode* file;
+    };
+    std::vector<Packed> entries;
+    entries.reserve(count);
+    for (FileNode* file = head; file != nullptr; file = file->next) {
+        std::string_view name = names.str(file->name);
+        std::uint64_t namePrefix = prefixOf(name);
+        std::uint64_t keyPrefix = namePrefix;
+        if (key == BY_TYPE) {
+            keyPrefix = file->isDirectory ? 0 : 1;
+        } else if (key == BY_EXTENSION) {
+            keyPrefix = prefixOf(extensionOf(name));
+        } else if (key == BY_SIZE) {
+            keyPrefix = file->meta.size;
+        } else if (key == BY_MTIME) {
+            // Flip the sign bit so that unsigned order is signed order
+            keyPrefix = static_cast<std::uint64_t>(file->meta.mtime) ^ (std::uint64_t(1) << 63);
+        }
+        entries.push_back(Packed{keyPrefix, namePrefix, file->name, file->isDirectory, file});
+    }
+    if (entries.empty()) {
+        return head;
+    }
+
+    // A type, size or mtime prefix is the whole key; equal name or extension prefixes need the strings
+    EntryOrder order{&names, key};
+    bool wholeKey = key == BY_TYPE || key == BY_SIZE || key == BY_MTIME;
+    auto keyLess = [&](const Packed& a, const Packed& b) {
+        if (a.keyPrefix != b.keyPrefix) {
+            return a.keyPrefix < b.keyPrefix;
+        }
+        return !wholeKey && order.keyLess(entryKey(a.file), entryKey(b.file));
+    };
+    std::stable_sort(entries.begin(), entries.end(), [&](const Packed& a, const Packed& b) {
+        if (keyLess(a, b)) {
+            return true;
+        }
+        if (!keep || keyLess(b, a)) {
+            return false;
+        }
+        if (a.namePrefix != b.namePrefix) {
+            return a.namePrefix < b.namePrefix;
+        }
+        return names.str(a.name) < names.str(b.name);
+    });
+    for (std::size_t i = 0; i + 1 < entries.size(); i++) {
+        entries[i].file->next = entries[i + 1].file;
+    }
+    entries.back().file->next = nullptr;
+    return entries.front().file;
+}
+
+// Private helper function to index the entries of a directory kept sorted (its
+// list already in order), or drop the index of one that is not
+void FileSystem::indexSortedEntries(DirectoryNode* dir) {
+    if (dir->order == UNSORTED) {
+        dir->sorted.reset();
+        return;
+    }
+    std::vector<EntryKey> keys;
+    std::vector<std::vector<FileNode*>> entries;
+    for (FileNode* file = dir->files; file != nullptr; file = file->next) {
+        keys.push_back(entryKey(file));
+        entries.push_back(std::vector<FileNode*>(1, file));
+    }
+    dir->sorted.reset(new EntryIndex(EntryOrder{&names, dir->order}));
+    dir->sorted->build(keys, entries);
+}
+
+// Private helper function to make the sort key of an entry
+FileSystem::EntryKey FileSystem::entryKey(const FileNode* file) {
+    return EntryKey{file->name, file->isDirectory, file->meta.size, file->meta.mtime};
+}
+
+// Private helper function to sort the files of a directory, once or (with keep) for good.
+// Sorting relinks the list in place; in concurrent mode readers may be walking it,
+// so a private copy is sorted there and published whole.
+void FileSystem::reorderDirectory(unsigned dirId, SortKey key, bool keep) {
+    std::string path = directoryPath(current, current->directories[dirId]);
+    DirectoryNode* dir = concurrent ? copyDirectory(current->directories[dirId]) : writableDirectory(dirId);
+    EntryOrder order{&names, key};
+    if (key != UNSORTED) {
+        FileNode* head = dir->files;
+        std::size_t count = dir->fileIndex.size();
+        if (count >= PACKED_ENTRIES) {
+            head = sortPackedFiles(head, count, key, keep);
+        } else {
+            head = mergeSortFiles(head, [&](const FileNode* a, const FileNode* b) {
+                EntryKey first = entryKey(a);
+                EntryKey second = entryKey(b);
+                return keep ? order(first, second) : order.keyLess(first, second);
+            });
+        }
+        dir->files = head;
+        relinkDirectory(dir);
+    }
+    dir->order = keep ? key : UNSORTED;
+    indexSortedEntries(dir);
+    if (concurrent) {
+        installDirectory(dirId, dir);
+    }
+    logOperation(Journal::SORT_DIRECTORY, path, std::to_string(key), "", keep);
+}
+
+// Private helper function to sort a directory found by path, once or for good
+FileSystem::Status FileSystem::applySortOrder(const std::string& dirpath, SortKey key, bool keep) {
+    METRICS_TIME(SORT);
+    WriteLock lock(*this, false);
+    DirectoryNode* dir = findDirectory(current, dirpath);
+    if (dir) {
+        lock.lockDirectories(dir->id);
+        dir = current->directories[dir->id];
+    }
+    if (!dir) {
+        return NOT_FOUND;
+    }
+    lock.lockIndex();
+    reorderDirectory(dir->id, key, keep);
+    return OK;
+}
+
+// Function to sort the files in a directory once
+FileSystem::Status FileSystem::sortDirectory(const std::string& dirpath, SortKey key) {
+    return applySortOrder(dirpath, key, false);
+}
+
+// Function to keep a directory sorted from now on
+FileSystem::Status FileSystem::keepSorted(const std::string& dirpath, SortKey key) {
+    return applySortOrder(dirpath, key, true);
+}
+
+// Function to sort a directory chosen at the prompt by the key given there
+void FileSystem::sortFilesInDirectory() {
+    std::string dirname;
+    std::string keyName;
+    std::cout << "Enter the name of the directory you want to sort: ";
+    std::cin >> dirname;
+    std::cout << "Sort by (name, type, extension, size or mtime; end with + to keep it sorted): ";
+    std::cin >> keyName;
+
+    bool keep = !keyName.empty() && keyName.back() == '+';
+    if (keep) {
+        keyName.pop_back();
+    }
+    SortKey key;
+    if (!sortKeyNamed(keyName, key)) {
+        std::cout << "Error: Unknown sort key '" << keyName << "'." << std::endl;
+        return;
+    }
+    Status status = applySortOrder(dirname, key, keep);
+    if (status == OK) {
+        std::cout << "Files in directory '" << dirname << "' sorted successfully." << std::endl;
+    } else {
+        std::cout << "Error: '" << dirname << "': " << describe(status) << "." << std::endl;
+    }
+}
+
+// Function to measure the namespace as it is now
+FileSystem::Gauges FileSystem::gauges() const {
+    WriteLock lock(*this);
+    Gauges sizes{};
+    for (std::size_t id = 0; id < current->directories.size(); id++) {
+        const DirectoryNode* dir = current->directories[id];
+        if (dir) {
+            sizes.directories++;
+            sizes.entries += dir->imageBacked ? dir->imageCount : dir->fileIndex.size();
+        }
+    }
+    sizes.names = names.size();
+    sizes.indexedNames = current->searchIndex.size();
+    sizes.indexHeight = current->searchIndex.height();
+    sizes.backups = backups.size();
+    sizes.nameBytes = names.bytes();
+    sizes.nodeBytes = filePool.bytes() + directoryPool.bytes();
+    sizes.imageBytes = image ? image->size() : 0;
+    sizes.blobs = contents.size();
+    sizes.blobBytes = contents.bytes();
+    sizes.nameFilterBytes = nameFilter.load(std::memory_order_relaxed)->bytes();
+    return sizes;
+}
+
+// Function to print the gauges, then what the metrics recorded
+void FileSystem::dumpStats(std::ostream& out) const {
+    Gauges sizes = gauges();
+    out << "gauge directories " << sizes.directories << '\n'
+        << "gauge entries " << sizes.entries << '\n'
+        << "gauge names " << sizes.names << '\n'
+        << "gauge indexed_names " << sizes.indexedNames << '\n'
+        << "gauge index_height " << sizes.indexHeight << '\n'
+        << "gauge backups " << sizes.backups << '\n'
+        << "gauge name_bytes " << sizes.nameBytes << '\n'
+        << "gauge node_bytes " << sizes.nodeBytes << '\n'
+        << "gauge image_bytes " << sizes.imageBytes << '\n'
+        << "gauge blobs " << sizes.blobs << '\n'
+        << "gauge blob_bytes " << sizes.blobBytes << '\n'
+        << "gauge name_filter_bytes " << sizes.nameFilterBytes << '\n';
+    if (!Metrics::enabled()) {
+        out << "metrics off (build with -DFILESYSTEM_METRICS to record operations)" << '\n';
+        return;
+    }
+    Metrics::Snapshot snapshot = Metrics::collect();
+    for (int op = 0; op < Metrics::OPERATION_COUNT; op++) {
+        const Metrics::Histogram& latency = snapshot.operations[op];
+        if (latency.count == 0) {
+            continue;
+        }
+        out << "operation " << Metrics::name(static_cast<Metrics::Operation>(op)) << " calls=" << latency.count
+            << " total_us=" << latency.total / 1000 << " mean_ns=" << latency.total / latency.count
+            << " p50_ns=" << latency.percentile(0.50) << " p99_ns=" << latency.percentile(0.99)
+            << " max_ns=" << latency.max << '\n';
+    }
+    for (int c = 0; c < Metrics::COUNTER_COUNT; c++) {
+        out << "counter " << Metrics::name(static_cast<Metrics::Counter>(c)) << " " << snapshot.counters[c] << '\n';
+    }
+    // Of the lookups a filter let through, the share that found nothing
+    const std::pair<Metrics::Counter, Metrics::Counter> filters[] = {
+        {Metrics::NAME_FILTER_REJECTS, Metrics::NAME_FILTER_FALSE_POSITIVES},
+        {Metrics::DIRECTORY_FILTER_REJECTS, Metrics::DIRECTORY_FILTER_FALSE_POSITIVES}};
+    for (const std::pair<Metrics::Counter, Metrics::Counter>& filter : filters) {
+        std::uint64_t misses = snapshot.counters[filter.first] + snapshot.counters[filter.second];
+        if (misses > 0) {
+            out << "rate " << Metrics::name(filter.second) << " "
+                << static_cast<double>(snapshot.counters[filter.second]) / misses << '\n';
+        }
+    }
+}
+
+// Function to look up a sort key by name
+bool FileSystem::sortKeyNamed(const std::string& keyName, SortKey& key) {
+    static const std::pair<const char*, SortKey> KEYS[] = {
+        {"name", BY_NAME}, {"type", BY_TYPE}, {"extension", BY_EXTENSION}, {"size", BY_SIZE}, {"mtime", BY_MTIME}};
+    for (const auto& named : KEYS) {
+        if (keyName == named.first) {
+            key = named.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Function to describe a status in a few words
+const char* FileSystem::describe(Status status) {
+    switch (status) {
+        case OK:
+            return "done";
+        case NOT_FOUND:
+            return "not found";
+        case DIRECTORY_NOT_FOUND:
+            return "directory not found";
+        case ALREADY_EXISTS:
+            return "already exists";
+        case NOT_EMPTY:
+            return "directory not empty";
+        case INTO_ITSELF:
+            return "cannot move a directory into itself";
+        case NO_BACKUP:
+            return "no backup available";
+        case IS_DIRECTORY:
+            return "is a directory";
+        case INVALID_NAME:
+            return "invalid name";
+    }
+    return "unknown status";
+}
@@ -2,25 +2,381 @@
 #define FILESYSTEM_H
 
 #include <string>
+#include <iostream>
 #include <queue>
 #include <stack>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <functional>
+#include <cstdint>
+#include "EpochManager.h"
+#include "HashIndex.h"
+#include "SearchIndex.h"
+#include "NameTable.h"
+#include "NodePool.h"
+#include "NamespaceImage.h"
+#include "Journal.h"
+#include "ImportList.h"
+#include "SuffixIndex.h"
+#include "NamePattern.h"
+#include "ContentStore.h"
+#include "NameFilter.h"
 
+// In concurrent mode (see enableConcurrentAccess) lookups and listings take no
+// locks. Readers walk the published version inside an epoch guard; writers link
+// new nodes in with single atomic stores, never change a node a reader can reach
+// in a way that breaks its walk, and retire what they unlink to the epoch manager.
+// Writers lock the directories they change (striped mutexes) under a shared
+// structure lock, and take a short global section for the journal, the name
+// table, the node pools and the search index. Renames, moves, backups and
+// checkpoints take the structure lock exclusively.
 class FileSystem {
+public:
+    // One result of a name query
+    class Match {
+    public:
+        std::string directory; // path of the directory holding the entry ("/" for the root)
+        std::string name;
+        bool isDirectory;
+    };
+
+    // Keys a directory's entries can be sorted by
+    enum SortKey : std::uint8_t {
+        UNSORTED,    // insertion order
+        BY_NAME,
+        BY_TYPE,      // subdirectories before files
+        BY_EXTENSION, // the text after the last '.'
+        BY_SIZE,      // smallest first
+        BY_MTIME      // least recently changed first
+    };
+
+    // Outcome of an operation that changes the namespace
+    enum Status : std::uint8_t {
+        OK,
+        NOT_FOUND,           // no such entry
+        DIRECTORY_NOT_FOUND, // the directory it is in (or would be in) does not exist
+        ALREADY_EXISTS,
+        NOT_EMPTY,           // a directory to remove still has entries
+        INTO_ITSELF,         // a directory cannot be moved beneath itself
+        NO_BACKUP,
+        IS_DIRECTORY,        // the operation needs a file
+        INVALID_NAME         // an entry name is empty or contains '/'
+    };
+
+    // What one batch of queued moves did
+    class MoveResult {
+    public:
+        std::string sourceDirectory;
+        std::string destinationDirectory;
+        std::size_t moved;
+        std::size_t missing;   // not found in the source directory
+        std::size_t conflicts; // name already taken in the destination directory
+    };
+
+    // What one bulk load did
+    class ImportResult {
+    public:
+        std::size_t imported;   // entries created, parent directories included
+        std::size_t duplicates; // listed entries that were already present
+        std::size_t conflicts;  // listed entries whose path is taken by an entry of the other kind
+    };
+
+    // Sizes of the namespace at one moment
+    class Gauges {
+    public:
+        std::size_t directories;
+        std::size_t entries;      // files and subdirectories, over every directory
+        std::size_t names;        // distinct names interned
+        std::size_t indexedNames; // keys of the search index
+        std::size_t indexHeight;  // levels of the search index B+-tree
+        std::size_t backups;      // depth of the backup stack
+        std::size_t nameBytes;
+        std::size_t nodeBytes;    // slabs of the file and directory node pools
+        std::size_t imageBytes;   // the mapped image, 0 without one
+        std::size_t blobs;        // distinct file contents stored
+        std::size_t blobBytes;    // bytes they hold, each stored once
+        std::size_t nameFilterBytes; // counters of the negative lookup filter
+    };
+
+    // Attributes of one entry. Times are nanoseconds since the Unix epoch; mode
+    // holds permission bits only. A directory entry has no size of its own.
+    class Metadata {
+    public:
+        std::uint64_t size;
+        std::int64_t mtime; // last change to the contents
+        std::int64_t ctime; // last change to the entry itself
+        std::uint32_t mode;
+    };
+
+    // What a directory holds, counted over its whole subtree
+    class Usage {
+    public:
+        std::uint64_t bytes;   // sizes of every file beneath it
+        std::uint64_t entries; // files and subdirectories beneath it
+        std::int64_t newest;   // no entry beneath it has a later mtime (an upper bound:
+                               // removing or back-dating an entry does not lower it)
+        std::int64_t changed;  // last time an entry was added to or removed from the directory itself
+    };
+
+    // One entry of a paged listing
+    class DirectoryEntry {
+    public:
+        std::string name;
+        bool isDirectory;
+        Metadata meta;
+    };
+
+    // One difference between two states of the namespace. An entry that went
+    // from one place or name to another with nothing else about it changed (for
+    // a directory, nothing beneath it either) is RENAMED rather than REMOVED and
+    // ADDED; a directory added or removed is one change, however much it holds.
+    class Change {
+    public:
+        enum Kind : std::uint8_t {
+            ADDED,
+            REMOVED,
+            RENAMED,
+            MODIFIED // a file's size, mtime, mode or contents
+        };
+        Kind kind;
+        std::string path;    // "dir/sub/name"; where a REMOVED or RENAMED entry was
+        std::string newPath; // where a RENAMED entry is now
+        bool isDirectory;
+    };
+
+    // Where a paged listing stands between pages. It names the directory by id
+    // and the last entry returned by name rather than pointing into the
+    // namespace, so it may be kept (or passed around as a token) while writers run.
+    class ListCursor {
+    public:
+        unsigned directory;     // id of the directory listed, unset until the first page
+        NameId last;            // name of the last entry returned, NameTable::NONE before the first
+        std::uint64_t position; // entries returned so far
+        bool done;              // the last page reached the end of the directory
+        ListCursor();
+
+        // Functions to write the cursor as a printable continuation token and read it back
+        std::string token() const;
+        bool parse(std::string_view text);
+    };
+
 private:
     class FileNode {
     public:
-        std::string name;
+        NameId name;
+        bool isDirectory;
+        unsigned child; // id of the directory this entry names, when isDirectory
+        Metadata meta;
+        ContentStore::Blob* content; // nullptr while empty
+        std::atomic<FileNode*> next;
+        FileNode* prev;
+        FileNode(NameId n, bool isDir, unsigned childId, const Metadata& metadata, ContentStore::Blob* blob);
+    };
+
+    // What an entry is sorted on. Keys are values rather than nodes, as a B+-tree
+    // keeps copies of keys (separators) after their entries are gone.
+    class EntryKey {
+    public:
+        NameId name;
         bool isDirectory;
-        FileNode* next;
-        FileNode(const std::string& n, bool isDir);
+        std::uint64_t size;
+        std::int64_t mtime;
+        bool operator==(const EntryKey& other) const {
+            return name == other.name; // names are unique within a directory
+        }
+    };
+
+    // Orders the entries of a directory by a sort key, ties broken by name so that
+    // no two entries of one directory compare equal
+    class EntryOrder {
+    public:
+        const NameTable* names;
+        SortKey key;
+        bool keyLess(const EntryKey& a, const EntryKey& b) const; // the key alone
+        bool operator()(const EntryKey& a, const EntryKey& b) const;
+    };
+
+    typedef SearchIndex<FileNode*, EntryKey, EntryOrder> EntryIndex; // entries of a sorted directory, in order
+
+    // The entries of a directory laid out contiguously, each field in an array of
+    // its own, so a scan reads memory in order instead of following one list node
+    // per entry. Built from the files list of a large directory that is scanned
+    // again without having changed (see packedEntries) and dropped as soon as the
+    // directory changes; never modified once published.
+    class EntryArray {
+    public:
+        static constexpr std::uint8_t DIRECTORY = 0x80; // top bit, so _mm_movemask_epi8 reads it off directly
+
+        std::vector<NameId> names;
+        std::vector<std::uint8_t> flags; // padded with zeros to a multiple of 16
+        std::vector<unsigned> children;
+        std::vector<Metadata> meta;
+        std::vector<ContentStore::Blob*> contents;
+
+        std::size_t size() const {
+            return names.size();
+        }
+        std::size_t find(NameId name, std::size_t hint) const;
+        template <typename Visit>
+        void forEachDirectory(Visit visit) const;
     };
 
     class DirectoryNode {
     public:
-        std::string name;
-        FileNode* files;
-        DirectoryNode* next;
-        DirectoryNode(const std::string& n);
+        std::atomic<NameId> name;     // last path component, empty for the root
+        unsigned id;                  // stable across copies, used by the search index and entries
+        std::atomic<unsigned> parent; // id of the enclosing directory, NO_DIRECTORY for the root
+        int refCount;                 // number of versions sharing this directory
+        std::atomic<FileNode*> files;
+        FileNode* tail;
+        HashIndex<FileNode, NameId> fileIndex; // name -> entry, mirrors the files list
+        bool imageBacked;    // entries are still read from the mapped image, files is empty
+        unsigned imageFirst; // first entry in the image
+        unsigned imageCount; // number of entries in the image
+        SortKey order;       // key the files list is kept sorted by, UNSORTED for insertion order
+        std::unique_ptr<EntryIndex> sorted; // finds where a new entry goes, while order is set
+        mutable std::atomic<EntryArray*> packed;          // the entries laid out contiguously, or nullptr
+        mutable std::atomic<std::uint64_t> changes;       // bumped after every change to the files list
+        mutable std::atomic<std::uint64_t> scannedAt;     // changes when a large list was last walked
+        DirectoryNode(NameId n, unsigned dirId, unsigned parentId, EpochManager* epochs);
+        ~DirectoryNode();
+    };
+
+    // Directories of a version indexed by id, each with the usage and hash of its subtree.
+    // Readers index it without locks while one writer replaces or appends slots;
+    // growing publishes a new array and retires the old one. Usage belongs to the
+    // slot rather than the directory, so a change deep in the tree updates its
+    // ancestors without copying them.
+    class DirectoryTable {
+    private:
+        class Slot {
+        public:
+            std::atomic<DirectoryNode*> node;
+            std::atomic<std::uint64_t> bytes;
+            std::atomic<std::uint64_t> entries;
+            std::atomic<std::int64_t> newest;
+            std::atomic<std::int64_t> changed;
+            std::atomic<std::uint64_t> hash; // Merkle hash of the subtree, see rehash
+
+            Usage usage() const {
+                return Usage{bytes.load(std::memory_order_relaxed), entries.load(std::memory_order_relaxed),
+                             newest.load(std::memory_order_relaxed), changed.load(std::memory_order_relaxed)};
+            }
+
+            void setUsage(const Usage& usage) {
+                bytes.store(usage.bytes, std::memory_order_relaxed);
+                entries.store(usage.entries, std::memory_order_relaxed);
+                newest.store(usage.newest, std::memory_order_relaxed);
+                changed.store(usage.changed, std::memory_order_relaxed);
+            }
+        };
+
+        class Slots {
+        public:
+            std::size_t capacity;
+            Slot* at() {
+                return reinterpret_cast<Slot*>(this + 1);
+            }
+        };
+
+        std::atomic<Slots*> slots;
+        std::atomic<std::size_t> count;
+        EpochManager* epochs;
+
+        static Slots* allocate(std::size_t capacity);
+        void grow(std::size_t capacity);
+
+    public:
+        explicit DirectoryTable(EpochManager* reclaimer);
+        ~DirectoryTable();
+        DirectoryTable(const DirectoryTable&) = delete;
+        DirectoryTable& operator=(const DirectoryTable&) = delete;
+
+        std::size_t size() const {
+            return count.load(std::memory_order_acquire);
+        }
+
+        DirectoryNode* operator[](std::size_t id) const {
+            return slots.load(std::memory_order_acquire)->at()[id].node.load(std::memory_order_acquire);
+        }
+
+        Usage usage(std::size_t id) const {
+            return slots.load(std::memory_order_acquire)->at()[id].usage();
+        }
+
+        std::uint64_t hash(std::size_t id) const {
+            return slots.load(std::memory_order_acquire)->at()[id].hash.load(std::memory_order_relaxed);
+        }
+
+        void set(std::size_t id, DirectoryNode* dir);
+        void push_back(DirectoryNode* dir);
+        void reserve(std::size_t capacity);
+        void assign(const DirectoryTable& other);
+
+        // Function to change the usage of one directory (the only writer of it at a time)
+        void setUsage(std::size_t id, const Usage& usage) {
+            slots.load(std::memory_order_relaxed)->at()[id].setUsage(usage);
+        }
+
+        void setHash(std::size_t id, std::uint64_t hash) {
+            slots.load(std::memory_order_relaxed)->at()[id].hash.store(hash, std::memory_order_relaxed);
+        }
+    };
+
+    // A directory entry as seen by readers, whether it lives in the image or in a files list
+    class EntryInfo {
+    public:
+        NameId name;
+        bool isDirectory;
+        unsigned child;
+        Metadata meta;
+        ContentStore::Blob* content;
+    };
+
+    // One state of the namespace. The live state and every backup are versions
+    // that share directories and search index nodes until one of them changes.
+    // Entries refer to subdirectories by id, so copying a directory never forces
+    // a copy of its ancestors.
+    class Version {
+    public:
+        DirectoryTable directories;                           // indexed by id, nullptr once removed
+        SearchIndex<unsigned, NameId, NameOrder> searchIndex; // entry name -> ids of directories holding it,
+                                                              // except directories still backed by the image
+        int refCount;
+        Version(const NameTable* names, EpochManager* epochs);
+    };
+
+    // Locks taken by one writer operation, released (after reclaiming what no
+    // reader can reach any more) when it goes out of scope. Does nothing outside
+    // concurrent mode or inside an operation that holds the structure exclusively.
+    class WriteLock {
+    public:
+        WriteLock(FileSystem& fs, bool exclusive);
+        explicit WriteLock(const FileSystem& fs); // exclusive, for operations that only read
+        ~WriteLock();
+        WriteLock(const WriteLock&) = delete;
+        WriteLock& operator=(const WriteLock&) = delete;
+
+        // Function to lock the stripes of up to two directories, in stripe order
+        void lockDirectories(unsigned first, unsigned second = NO_DIRECTORY);
+
+        // Function to enter the global section (journal, names, pools, search index)
+        void lockIndex();
+
+    private:
+        const FileSystem* fs;
+        FileSystem* writer;   // set when a deferred checkpoint may run afterwards
+        bool active;          // concurrent mode and not nested in an exclusive operation
+        bool exclusive;
+        std::size_t stripes[2];
+        std::size_t stripeCount;
+        bool indexHeld;
+        EpochManager::Guard guard;
     };
 
     class FileMoveOperation {
@@ -32,26 +388,177 @@ private:
         FileMoveOperation(const std::string& srcDir, const std::string& destDir, const std::string& fname, bool isDir);
     };
 
-    class BSTNode {
+    // Queued moves that share a source and destination, executed together
+    class MoveBatch {
+    public:
+        std::string sourceDirectory;
+        std::string destinationDirectory;
+        std::vector<std::string> filenames;
+        std::size_t moved;
+        std::size_t missing;   // not found in the source directory
+        std::size_t conflicts; // name already taken in the destination directory
+        MoveBatch(const std::string& srcDir, const std::string& destDir);
+    };
+
+    // A name held by a directory, as the search index records it
+    class NameHolder {
     public:
-        std::string key;
-        BSTNode* left;
-        BSTNode* right;
-        BSTNode(const std::string& k) : key(k), left(nullptr), right(nullptr) {}
+        NameId name;
+        unsigned holder;
+        std::size_t order; // position among the names being indexed together
     };
 
-    DirectoryNode* root;
-    BSTNode* bstRoot;
+    static constexpr unsigned ROOT_DIRECTORY = 0;
+    static constexpr unsigned NO_DIRECTORY = 0xFFFFFFFFu;
+    static constexpr std::size_t DENTRY_CACHE_LIMIT = 1 << 16;
+    static constexpr std::size_t DIRECTORY_STRIPES = 64;
+    static constexpr std::uint64_t PARALLEL_WALK_ENTRIES = 4096; // smaller subtrees are walked on the caller
+    static constexpr std::size_t DISPLAY_PAGE = 1024;            // entries the display functions fetch at a time
+    static constexpr std::size_t NAME_FILTER_START = 1024;       // names the first filter is sized for
+#if defined(FILESYSTEM_LIST_DIRECTORIES)
+    static constexpr std::size_t PACKED_ENTRIES = SIZE_MAX;      // entry arrays off: directories are always lists
+#else
+    static constexpr std::size_t PACKED_ENTRIES = 64;            // smaller directories are only ever walked as lists
+#endif
+
+    typedef SearchIndex<unsigned, NameId, NameOrder> NameIndex;
+
+    std::unique_ptr<NamespaceImage> image; // mapped image the namespace was opened from, outlives names
+    NameTable names;                     // every file and directory name, stored once
+    NodePool<FileNode> filePool;
+    NodePool<DirectoryNode> directoryPool;
+    ContentStore contents;               // file contents, referenced by file nodes (global section)
+    std::vector<ContentStore::Blob*> imageBlobs; // contents of the mapped image, by image index
+    std::unordered_map<std::uint64_t, unsigned> copyIndexes; // (directory, name) -> next copy number to try
+    mutable EpochManager epochs;         // declared after the pools: retired nodes return to them
+    Version* current;                    // the writers' view
+    std::atomic<Version*> published;     // the readers' view, always equal to current between operations
     std::queue<FileMoveOperation> moveQueue;
-    std::stack<FileSystem*> backups; // Declaration of backups stack
+    std::stack<Version*> backups; // Snapshots sharing structure with the current version
+    mutable std::unordered_map<std::string, unsigned> dentryCache; // resolved path prefix -> directory id
+    Journal journal;              // logical operations since the last checkpoint
+    std::uint64_t sequence;       // sequence number of the last operation applied
+    bool replaying;               // applying journal records, do not log them again
+    std::int64_t replayTime;      // time of the record being replayed
+    std::function<void(const Journal::Record&)> recordSink; // sees every logged change (global section)
+    std::string checkpointPath;
+    std::size_t checkpointEvery;  // logged operations between automatic checkpoints, 0 for none
+    std::size_t checkpointBackups; // bottom backups taken before the last checkpoint, which replay cannot recreate
+    bool concurrent;              // readers and writers may run on several threads
+    std::atomic<bool> checkpointDue; // a concurrent writer reached the checkpoint interval
+    mutable std::shared_mutex structureLock;
+    mutable std::mutex directoryLocks[DIRECTORY_STRIPES];
+    mutable std::mutex indexLock;
+    mutable std::atomic<std::thread::id> exclusiveOwner; // thread holding structureLock exclusively
+    std::mutex moveLock;          // guards moveQueue
+    mutable std::atomic<SuffixIndex*> suffixIndex; // built by suffix queries, replaced as names are added
+    mutable std::mutex suffixLock;                 // held while a fresh suffix index is built
+    // Counts every name of the current version and of the backups (global section);
+    // a name it has never seen is in no directory. Replaced when it fills up.
+    std::atomic<NameFilter*> nameFilter;
+
+    // Private helper functions for path resolution...
+    static std::string normalizePath(const std::string& path);
+    static void splitPath(const std::string& path, std::string& parent, std::string& leaf);
+    std::string directoryPath(const Version* version, const DirectoryNode* dir) const;
+    bool isWithin(unsigned dirId, unsigned ancestorId) const;
+    void cacheDentry(const std::string& path, unsigned dirId) const;
+    void invalidateDentryCache();
 
     // Private helper functions for directory and file management...
-    DirectoryNode* findDirectory(const std::string& dirname) const;
+    DirectoryNode* findDirectory(const Version* version, const std::string& dirpath) const;
     FileNode* findFile(DirectoryNode* dir, const std::string& filename) const;
+    FileNode* findFile(DirectoryNode* dir, NameId filename) const;
+    std::vector<unsigned> findHolders(const Version* version, const std::string& filename) const;
+    std::vector<unsigned> findHolders(const Version* version, NameId name) const;
+    bool findEntry(const Version* version, const std::string& path, unsigned& dirId, EntryInfo& entry) const;
+    bool lookupEntry(const DirectoryNode* dir, NameId name, EntryInfo& entry) const;
+    bool hasEntry(const DirectoryNode* dir, const std::string& filename) const;
+    bool isEmpty(const DirectoryNode* dir) const;
+    template <typename Visit>
+    void forEachEntry(const DirectoryNode* dir, Visit visit) const;
+    template <typename Visit>
+    void forEachSubdirectory(const DirectoryNode* dir, Visit visit) const;
+    const EntryArray* packedEntries(const DirectoryNode* dir) const;
+    void entriesChanged(DirectoryNode* dir);
+    void retireEntryArray(EntryArray* packed) const;
+    template <typename Visit>
+    bool pageEntries(const Version* version, ListCursor& cursor, std::size_t limit, Visit visit) const;
+    void imageEntry(const NamespaceImage::Entry& stored, EntryInfo& entry) const;
+    void createDirectory(unsigned parentId, NameId name, const Metadata& metadata);
     void insertFileIntoDirectory(DirectoryNode* dir, FileNode* fileToInsert);
-    void insertIntoBST(BSTNode*& root, const std::string& key);
-    bool searchBST(BSTNode* root, const std::string& key) const;
-    void deleteBST(BSTNode* root);
+    void linkFile(DirectoryNode* dir, FileNode* fileToLink);
+    void unlinkFileFromDirectory(DirectoryNode* dir, FileNode* fileToUnlink);
+    void relinkDirectory(DirectoryNode* dir);
+    void replaceFile(DirectoryNode* dir, FileNode* file, const Metadata& metadata, ContentStore::Blob* content);
+    FileNode* createFile(NameId name, bool isDir, unsigned child, const Metadata& metadata,
+                         ContentStore::Blob* content = nullptr);
+    void destroyFile(FileNode* file);
+    std::string copyName(const DirectoryNode* dir, NameId name);
+    Status copyInto(const std::string& path, const std::string& destinationDir, const std::string& name,
+                    std::string& copiedName);
+    Status copyTreeInto(const std::string& path, const std::string& destinationDir, const std::string& name,
+                        std::string& copiedName, unsigned threads);
+    std::vector<unsigned> collectSubtree(unsigned dirId, unsigned threads, std::vector<NameHolder>* named) const;
+    FileNode* detachedNode(FileNode* file);
+    std::vector<MoveBatch> groupMoveQueue();
+    void executeMoveBatch(MoveBatch& batch);
+    Status applySortOrder(const std::string& dirpath, SortKey key, bool keep);
+    void reorderDirectory(unsigned dirId, SortKey key, bool keep);
+    void indexSortedEntries(DirectoryNode* dir);
+    static EntryKey entryKey(const FileNode* file);
+    template <typename Less>
+    static FileNode* mergeSortFiles(FileNode* head, Less less);
+    FileNode* sortPackedFiles(FileNode* head, std::size_t count, SortKey key, bool keep) const;
+    ImportResult bulkLoad(ImportList& list, unsigned threads);
+    void indexNames(std::vector<NameHolder>& placed, unsigned threads);
+    void unindexNames(const std::vector<NameHolder>& removed);
+    void filterName(NameId name);
+    void unfilterName(NameId name);
+    void replaceNameFilter(NameFilter* fresh);
+
+    // Private helper functions for metadata and usage...
+    std::int64_t operationTime() const;
+    static Metadata newMetadata(bool isDir, std::int64_t time);
+    void addUsage(unsigned dirId, std::int64_t bytes, std::int64_t entries, std::int64_t newest, std::int64_t changed);
+
+    // Private helper functions for subtree hashes...
+    std::uint64_t entryHash(NameId name, bool isDir, unsigned child, const Metadata& meta,
+                            const ContentStore::Blob* content) const;
+    std::uint64_t entryHash(const FileNode* file) const;
+    void rehash(unsigned dirId, std::uint64_t removed, std::uint64_t added);
+    static void diffVersions(const FileSystem& older, const Version* before, const FileSystem& newer,
+                             const Version* after, std::vector<Change>& changes);
+
+    // Private helper functions for copy-on-write versions...
+    Version* writableVersion();
+    DirectoryNode* writableDirectory(unsigned dirId);
+    void releaseVersion(Version* version);
+    void releaseDirectory(DirectoryNode* dir);
+    void destroyDirectory(DirectoryNode* dir);
+    DirectoryNode* copyDirectory(const DirectoryNode* dir);
+    DirectoryNode* installDirectory(unsigned dirId, DirectoryNode* copy);
+    void publish(Version* version);
+    template <typename Update>
+    void updateSearchIndex(Update change);
+
+    // Private helper functions for concurrent mode...
+    void retireFile(FileNode* file);
+    void retireVersion(Version* version);
+    std::size_t stripeOf(unsigned dirId) const;
+
+    // Private helper functions for name queries...
+    void namesWithPrefix(const Version* version, std::string_view prefix, std::vector<NameId>& found) const;
+    void namesWithSuffix(std::string_view suffix, std::vector<NameId>& found) const;
+    std::vector<Match> collectMatches(const Version* version, std::vector<NameId>& candidates,
+                                      const NamePattern* filter) const;
+
+    // Private helper functions for the journal...
+    std::string entryPath(unsigned dirId, NameId name) const;
+    void logOperation(Journal::Operation operation, const std::string& first, const std::string& second = "",
+                      const std::string& third = "", bool flag = false, std::int64_t time = 0,
+                      const Metadata* metadata = nullptr, bool journaled = true);
+    void applyRecord(const Journal::Record& record);
 
 
 public:
@@ -59,40 +566,184 @@ public:
     ~FileSystem();
 
     // Functions for directory operations...
-    void insertDirectory(const std::string& dirname);
-    void displayDirectoryStructure() const;
+    // Directories are addressed by '/'-separated paths from the root ("docs/2026/10");
+    // a plain name is a top-level directory.
+    Status insertDirectory(const std::string& dirpath);
+    void displayDirectoryStructure(std::ostream& out = std::cout) const;
 
     // Functions for file operations...
-    void insertFile(const std::string& dirname, const std::string& filename, bool isDir);
+    // search and remove take either a bare name (matched anywhere) or a path.
+    // Operations that change the namespace report failures by status, not by printing.
+    Status insertFile(const std::string& dirpath, const std::string& filename, bool isDir);
+    Status insertFile(const std::string& dirpath, const std::string& filename, bool isDir, const Metadata& metadata);
     bool search(const std::string& filename) const;
-    void remove(const std::string& filename);
+    std::vector<std::string> locate(const std::string& filename) const;
+    std::vector<std::string> listDirectory(const std::string& dirpath) const;
+
+    // Function to list a directory a page at a time. A fresh cursor starts at the
+    // first entry of dirpath; each call appends up to limit entries (in list
+    // order) to page and moves the cursor past them. Later calls continue in the
+    // same directory whatever dirpath says, even if it was renamed meanwhile.
+    // Entries inserted while paging are returned if they land after the cursor,
+    // and none is returned twice; if the last entry returned is removed, paging
+    // resumes at its old position instead.
+    Status listPage(const std::string& dirpath, ListCursor& cursor, std::size_t limit,
+                    std::vector<DirectoryEntry>& page) const;
+    Status remove(const std::string& filename);
+
+    // Functions to find every entry whose name starts with prefix, ends with
+    // suffix (an extension such as ".jpg") or matches a glob ('*' matches any run
+    // of characters, '?' any one character). Matches are ordered by name.
+    std::vector<Match> findByPrefix(const std::string& prefix) const;
+    std::vector<Match> findBySuffix(const std::string& suffix) const;
+    std::vector<Match> findByPattern(const std::string& pattern) const;
 
     // Function to enqueue move operation
     void enqueueMove(const std::string& sourceDir, const std::string& destDir, const std::string& filename, bool isDir);
 
-    // Function to process move queue
-    void processMoveQueue();
+    // Function to process move queue, one result per batch of moves
+    std::vector<MoveResult> processMoveQueue();
     
     // Function to create a backup of the file system
     void createBackup();
 
     // Function to restore the most recent backup
-    void restoreBackup();
+    Status restoreBackup();
     
     // Function to display contents of a specified directory
-    void displayDirectoryContents(const std::string& dirname) const;
+    void displayDirectoryContents(const std::string& dirname, std::ostream& out = std::cout) const;
     
-    // Function to rename the directory
-    void renameDirectory(const std::string& oldName, const std::string& newName);
+    // Function to rename the directory (a newName containing '/' also moves it)
+    Status renameDirectory(const std::string& oldName, const std::string& newName);
     
-    // Function to copy a file
+    // Function to copy a file chosen at the prompt
     void copyFile();
 
-    // Function to sort files in a specified directory by alphabetical order
+    // Functions for file contents...
+    // Contents are stored once however many files hold them: a copy shares the
+    // source's contents, and writing to a file gives it contents of its own.
+    // writeFile sets the size to the length written.
+    Status writeFile(const std::string& path, std::string_view data);
+    Status readFile(const std::string& path, std::string& data) const;
+
+    // Function to copy a file into a directory as "copy_NAME" (then "copy_1_NAME",
+    // "copy_2_NAME", ...: each directory remembers the next number to try)
+    Status copyFile(const std::string& path, const std::string& destinationDir, std::string& copiedName);
+
+    // Functions for whole subtrees...
+    // removeTree removes a directory with everything beneath it; copyTree copies
+    // one into destinationDir under the next copy name, entries keeping their
+    // metadata and sharing their contents. Large subtrees are walked on threads
+    // (0 for one per hardware thread) and their names indexed in one batch. A
+    // file is removed or copied as by remove and copyFile.
+    Status removeTree(const std::string& path, unsigned threads = 0);
+    Status copyTree(const std::string& path, const std::string& destinationDir, std::string& copiedName,
+                    unsigned threads = 0);
+
+    // Functions for entry metadata and directory usage...
+    // New entries get mode 0644 (0755 for directories), size 0 and the current
+    // time; setMetadata changes size, mtime and mode (ctime becomes the current
+    // time). Each directory keeps the usage of its subtree up to date as entries
+    // come and go, so usage() reads it without a walk, and modifiedSince() only
+    // enters subtrees whose newest mtime is recent enough.
+    Status setMetadata(const std::string& path, const Metadata& metadata);
+    Status stat(const std::string& path, Metadata& metadata) const;
+    Status usage(const std::string& dirpath, Usage& result) const;
+
+    // Function to find the entries with an mtime at or after time, beneath dirpath
+    std::vector<Match> modifiedSince(std::int64_t time, const std::string& dirpath = "") const;
+
+    // Functions for change detection...
+    // Every directory keeps a hash of its subtree (names, kinds, and each file's
+    // size, mtime, mode and contents, but not ctimes or a directory's own
+    // metadata), updated along the path to the root as entries change, so two
+    // subtrees with equal hashes hold the same. diff compares two states and
+    // skips every subtree whose hash is unchanged, so it costs what changed
+    // rather than what there is. States are numbered by backup depth: 0 is the
+    // current one, 1 the most recent backup, and so on.
+    Status treeHash(const std::string& dirpath, std::uint64_t& hash) const;
+    Status diff(std::size_t before, std::size_t after, std::vector<Change>& changes) const;
+
+    // Function to compare the current states of two file systems (either may
+    // have been opened from an image), ordered by path
+    static std::vector<Change> diff(const FileSystem& before, const FileSystem& after);
+
+    // Function to write the current version to a compact binary image
+    bool save(const std::string& path) const;
+
+    // Function to replace the namespace (and drop all backups) with a mapped image.
+    // Directories are read from the image until they are first modified.
+    bool open(const std::string& path);
+
+    // Function to replay a journal on top of the current state (skipping what the
+    // opened image already holds) and log every later change to it; replayed, if
+    // given, receives the number of operations replayed
+    bool openJournal(const std::string& path, Journal::Durability durability, std::size_t* replayed = nullptr);
+
+    // Function to tune group commit for the open journal
+    void setGroupCommit(std::size_t records, std::chrono::milliseconds window);
+
+    // Function to make every logged operation durable now
+    bool syncJournal();
+
+    // Function to save an image and compact the journal it now covers
+    bool checkpoint(const std::string& path);
+
+    // Function to checkpoint to path after every so many logged operations (0 turns it off)
+    void setCheckpointInterval(const std::string& path, std::size_t operations);
+
+    // Function to pass every change, as the journal record it is logged as, to sink
+    // while it is made (an empty function stops it). Replicas are fed this way.
+    void setRecordSink(std::function<void(const Journal::Record&)> sink);
+
+    // Function to apply records logged by another file system, in order, skipping
+    // those this one already holds; returns how many were applied. It stops short
+    // at a record it cannot replay as the other did (restoring a backup older
+    // than the snapshot this one started from), which lastSequence() shows.
+    std::size_t applyRecords(const std::vector<Journal::Record>& records);
+
+    // Sequence number of the last change made or applied
+    std::uint64_t lastSequence() const;
+
+    // Functions to bulk-load many entries at once, creating missing parent
+    // directories. Paths are read and sorted on worker threads (threads = 0 uses
+    // one per hardware thread), then placed in one pass and indexed in one build.
+    // A manifest lists one path per line, a trailing '/' marking a directory; a
+    // host directory is walked recursively and loaded under targetDir. What was
+    // loaded goes to result, when given.
+    bool importManifest(const std::string& manifestPath, unsigned threads = 0, ImportResult* result = nullptr);
+    bool importDirectory(const std::string& hostPath, const std::string& targetDir = "", unsigned threads = 0,
+                         ImportResult* result = nullptr);
+
+    // Function to let several threads use the file system at once. Lookups and
+    // listings then run without locks; call it before sharing the object.
+    void enableConcurrentAccess();
+
+    // Function to sort the files in a directory once. The sort is stable, so sorting
+    // by one key and then by another orders by the second key, then the first.
+    // A directory being kept sorted returns to insertion order for new entries.
+    Status sortDirectory(const std::string& dirpath, SortKey key);
+
+    // Function to keep a directory sorted from now on (UNSORTED turns it off): it is
+    // sorted once, by the key and then by name, and every new entry is placed in order
+    Status keepSorted(const std::string& dirpath, SortKey key);
+
+    // Function to measure the namespace as it is now
+    Gauges gauges() const;
+
+    // Function to print the gauges and, when built with FILESYSTEM_METRICS, the
+    // calls, latencies and counters recorded so far (see Metrics.h); one line each
+    void dumpStats(std::ostream& out) const;
+
+    // Function to describe a status in a few words ("already exists")
+    static const char* describe(Status status);
+
+    // Function to look up a sort key by name ("name", "type", "extension", "size" or
+    // "mtime"); false for any other name
+    static bool sortKeyNamed(const std::string& keyName, SortKey& key);
+
+    // Function to sort a directory chosen at the prompt
     void sortFilesInDirectory();
-    
-    // Function to sort files in a specified directory by alphabetical order using Quicksort
-    void quickSortFiles(FileNode*& head);
 
 
 };
@@ -0,0 +1,233 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include <string>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <cstddef>
+#include "EpochManager.h"
+
+// Open-addressing (linear probing) hash index from a node's name to the node.
+// The index does not own the nodes; it stores the pointer and the cached hash
+// and compares against node->name on a hash match. Key is the type of
+// node->name (a string or an interned name id).
+//
+// One writer at a time may update the index while any number of readers call
+// find() without locks: slots are atomic, a slot that was ever used never reads
+// as empty again, and growing publishes a new table and retires the old one
+// through the epoch manager.
+template <typename Node, typename Key = std::string>
+class HashIndex {
+private:
+    class Slot {
+    public:
+        std::atomic<std::size_t> hash;
+        std::atomic<Node*> node;
+        Slot() : hash(EMPTY), node(nullptr) {}
+    };
+
+    // Slots follow the table header in the same allocation
+    class Table {
+    public:
+        std::size_t capacity;
+        Slot* slots() {
+            return reinterpret_cast<Slot*>(this + 1);
+        }
+    };
+
+    // Markers kept in the hash field of an unoccupied slot; real hashes avoid both
+    static constexpr std::size_t EMPTY = 0;
+    static constexpr std::size_t TOMBSTONE = 1;
+
+    std::atomic<Table*> table;
+    std::size_t count; // live entries
+    std::size_t used;  // live entries plus tombstones
+    EpochManager* epochs;
+
+    static std::size_t hashName(const Key& name) {
+        // Mix the bits so sequential integer keys do not form long probe runs
+        std::size_t hash = std::hash<Key>()(name);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        return hash < 2 ? hash + 2 : hash;
+    }
+
+    static Table* allocate(std::size_t capacity) {
+        Table* created = static_cast<Table*>(::operator new(sizeof(Table) + capacity * sizeof(Slot)));
+        created->capacity = capacity;
+        for (std::size_t i = 0; i < capacity; i++) {
+            new (&created->slots()[i]) Slot();
+        }
+        return created;
+    }
+
+    static void deallocate(Table* old) {
+        // Slots are trivially destructible atomics
+        ::operator delete(old);
+    }
+
+    void retireTable(Table* old) {
+        if (old == nullptr) {
+            return;
+        }
+        if (epochs) {
+            epochs->retire([old]() { deallocate(old); });
+        } else {
+            deallocate(old);
+        }
+    }
+
+    void rehash(std::size_t capacity) {
+        Table* old = table.load(std::memory_order_relaxed);
+        Table* grown = allocate(capacity);
+        std::size_t mask = capacity - 1;
+        count = 0;
+        if (old) {
+            for (std::size_t j = 0; j < old->capacity; j++) {
+                Node* node = old->slots()[j].node.load(std::memory_order_relaxed);
+                if (node != nullptr) {
+                    std::size_t hash = old->slots()[j].hash.load(std::memory_order_relaxed);
+                    std::size_t i = hash & mask;
+                    while (grown->slots()[i].node.load(std::memory_order_relaxed) != nullptr) {
+                        i = (i + 1) & mask;
+                    }
+                    grown->slots()[i].node.store(node, std::memory_order_relaxed);
+                    grown->slots()[i].hash.store(hash, std::memory_order_relaxed);
+                    count++;
+                }
+            }
+        }
+        used = count;
+        table.store(grown, std::memory_order_release);
+        retireTable(old);
+    }
+
+public:
+    explicit HashIndex(EpochManager* reclaimer = nullptr) : table(nullptr), count(0), used(0), epochs(reclaimer) {}
+
+    ~HashIndex() {
+        // The owner is unreachable by now, so the table can go at once
+        Table* current = table.load(std::memory_order_relaxed);
+        if (current) {
+            deallocate(current);
+        }
+    }
+
+    HashIndex(const HashIndex&) = delete;
+    HashIndex& operator=(const HashIndex&) = delete;
+
+    // Function to look up a node by name, nullptr if absent. Safe against a concurrent writer.
+    Node* find(const Key& name) const {
+        Table* current = table.load(std::memory_order_acquire);
+        if (current == nullptr) {
+            return nullptr;
+        }
+        std::size_t hash = hashName(name);
+        std::size_t mask = current->capacity - 1;
+        std::size_t i = hash & mask;
+        for (;;) {
+            // Read the hash first: it is published after the node and only ever
+            // leaves EMPTY, so an empty hash really ends the probe run
+            std::size_t slotHash = current->slots()[i].hash.load(std::memory_order_acquire);
+            if (slotHash == EMPTY) {
+                return nullptr;
+            }
+            if (slotHash == hash) {
+                Node* node = current->slots()[i].node.load(std::memory_order_acquire);
+                if (node != nullptr && node->name == name) {
+                    return node;
+                }
+            }
+            i = (i + 1) & mask;
+        }
+    }
+
+    // Function to index a node under node->name (caller guarantees uniqueness)
+    void insert(Node* node) {
+        // Keep the load factor (tombstones included) under 70%
+        Table* current = table.load(std::memory_order_relaxed);
+        std::size_t capacity = current ? current->capacity : 0;
+        if ((used + 1) * 10 >= capacity * 7) {
+            std::size_t grown = capacity == 0 ? 16 : capacity;
+            while ((count + 1) * 10 >= grown * 5) {
+                grown *= 2;
+            }
+            rehash(grown);
+            current = table.load(std::memory_order_relaxed);
+        }
+        std::size_t hash = hashName(node->name);
+        std::size_t mask = current->capacity - 1;
+        std::size_t i = hash & mask;
+        while (current->slots()[i].node.load(std::memory_order_relaxed) != nullptr) {
+            i = (i + 1) & mask;
+        }
+        if (current->slots()[i].hash.load(std::memory_order_relaxed) != TOMBSTONE) {
+            used++;
+        }
+        current->slots()[i].node.store(node, std::memory_order_relaxed);
+        current->slots()[i].hash.store(hash, std::memory_order_release);
+        count++;
+    }
+
+    // Function to drop the entry for a name, returns false if it was absent
+    bool erase(const Key& name) {
+        Table* current = table.load(std::memory_order_relaxed);
+        if (current == nullptr) {
+            return false;
+        }
+        std::size_t hash = hashName(name);
+        std::size_t mask = current->capacity - 1;
+        for (std::size_t i = hash & mask;; i = (i + 1) & mask) {
+            Slot& slot = current->slots()[i];
+            std::size_t slotHash = slot.hash.load(std::memory_order_relaxed);
+            if (slotHash == EMPTY) {
+                return false;
+            }
+            Node* node = slot.node.load(std::memory_order_relaxed);
+            if (slotHash == hash && node != nullptr && node->name == name) {
+                slot.hash.store(TOMBSTONE, std::memory_order_release);
+                slot.node.store(nullptr, std::memory_order_release);
+                count--;
+                return true;
+            }
+        }
+    }
+
+    // Function to index node in place of the node with the same name, returns false
+    // if there was none. A concurrent reader finds one node or the other.
+    bool replace(Node* node) {
+        Table* current = table.load(std::memory_order_relaxed);
+        if (current == nullptr) {
+            return false;
+        }
+        std::size_t hash = hashName(node->name);
+        std::size_t mask = current->capacity - 1;
+        for (std::size_t i = hash & mask;; i = (i + 1) & mask) {
+            Slot& slot = current->slots()[i];
+            std::size_t slotHash = slot.hash.load(std::memory_order_relaxed);
+            if (slotHash == EMPTY) {
+                return false;
+            }
+            Node* old = slot.node.load(std::memory_order_relaxed);
+            if (slotHash == hash && old != nullptr && old->name == node->name) {
+                slot.node.store(node, std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    // Function to drop every entry and release the table
+    void clear() {
+        retireTable(table.exchange(nullptr, std::memory_order_acq_rel));
+        count = 0;
+        used = 0;
+    }
+
+    std::size_t size() const {
+        return count;
+    }
+};
+
+#endif // HASH_INDEX_H
@@ -0,0 +1,551 @@
+#include "HostMirror.h"
+#include <algorithm>
+#include <filesystem>
+#include <set>
+#include <utility>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Metrics.h"
+
+namespace {
+
+// What a watch reports: entries appearing, vanishing, renamed, rewritten or changed
+constexpr std::uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE |
+                                     IN_ATTRIB | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+constexpr std::size_t BATCH_EVENTS = 65536; // a batch this large is applied without waiting longer
+constexpr std::int64_t NANOSECONDS = 1000000000;
+
+// Function to join a namespace directory path ("/" for the root) and a name
+std::string childPath(const std::string& directory, const std::string& name) {
+    return directory == "/" ? "/" + name : directory + "/" + name;
+}
+
+// Function to turn a directory path into "/" followed by its non-empty components
+std::string absolutePath(const std::string& path) {
+    std::string absolute;
+    std::size_t start = 0;
+    while (start <= path.size()) {
+        std::size_t slash = std::min(path.find('/', start), path.size());
+        if (slash > start) {
+            absolute += '/';
+            absolute.append(path, start, slash - start);
+        }
+        start = slash + 1;
+    }
+    return absolute.empty() ? "/" : absolute;
+}
+
+// Function to read the attributes the namespace keeps from a host entry
+FileSystem::Metadata hostMetadata(const struct stat& status) {
+    FileSystem::Metadata meta;
+    meta.size = S_ISDIR(status.st_mode) ? 0 : static_cast<std::uint64_t>(status.st_size);
+    meta.mtime = static_cast<std::int64_t>(status.st_mtim.tv_sec) * NANOSECONDS + status.st_mtim.tv_nsec;
+    meta.ctime = static_cast<std::int64_t>(status.st_ctim.tv_sec) * NANOSECONDS + status.st_ctim.tv_nsec;
+    meta.mode = static_cast<std::uint32_t>(status.st_mode & 07777);
+    return meta;
+}
+
+} // namespace
+
+// Implementation of HostMirror constructor
+HostMirror::HostMirror(FileSystem& fs)
+    : fileSystem(fs), importThreads(0), notify(-1), wakeRead(-1), wakeWrite(-1), rootWatch(-1),
+      quietInterval(20), longestInterval(250), watchCount(0), batchCount(0), unwatchedCount(0) {}
+
+// Implementation of HostMirror destructor
+HostMirror::~HostMirror() {
+    stop();
+}
+
+// Function to return why the first directory that could not be watched was not
+std::string HostMirror::watchError() const {
+    std::lock_guard<std::mutex> guard(errorMutex);
+    return firstWatchError;
+}
+
+// Function to change the batch window
+void HostMirror::setBatchWindow(std::chrono::milliseconds quiet, std::chrono::milliseconds longest) {
+    quietInterval = quiet;
+    longestInterval = std::max(longest, quiet);
+}
+
+// Function to import a host tree under targetDir and start following its changes
+bool HostMirror::start(const std::string& hostPath, const std::string& targetDir, std::string& error, unsigned threads) {
+    if (notify >= 0) {
+        error = "already mirroring '" + hostRoot + "'";
+        return false;
+    }
+    struct stat status;
+    if (::stat(hostPath.c_str(), &status) != 0 || !S_ISDIR(status.st_mode)) {
+        error = "'" + hostPath + "' is not a directory";
+        return false;
+    }
+    int wake[2];
+    notify = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify < 0 || ::pipe2(wake, O_CLOEXEC) != 0) {
+        error = "cannot watch '" + hostPath + "': " + std::strerror(errno);
+        if (notify >= 0) {
+            ::close(notify);
+            notify = -1;
+        }
+        return false;
+    }
+    wakeRead = wake[0];
+    wakeWrite = wake[1];
+    hostRoot = hostPath;
+    while (hostRoot.size() > 1 && hostRoot.back() == '/') {
+        hostRoot.pop_back();
+    }
+    targetRoot = absolutePath(targetDir);
+    importThreads = threads;
+    unwatchedCount.store(0, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> guard(errorMutex);
+        firstWatchError.clear();
+    }
+
+    // Create the target directory one level at a time, then make sure it is one
+    for (std::size_t slash = targetRoot.find('/', 1); targetRoot != "/"; slash = targetRoot.find('/', slash + 1)) {
+        fileSystem.insertDirectory(targetRoot.substr(1, slash == std::string::npos ? std::string::npos : slash - 1));
+        if (slash == std::string::npos) {
+            break;
+        }
+    }
+    FileSystem::Usage usage;
+    bool holdsEntries = false;
+    if (fileSystem.usage(targetRoot, usage) != FileSystem::OK) {
+        error = "'" + targetDir + "' is not a directory";
+    } else if ((rootWatch = addWatches(-1, "", hostRoot, holdsEntries)) < 0) {
+        error = "cannot watch '" + hostRoot + "': " + std::strerror(errno);
+    } else if (holdsEntries && !fileSystem.importDirectory(hostRoot, targetRoot, importThreads)) {
+        error = "cannot import '" + hostRoot + "'";
+    }
+    if (!error.empty()) {
+        ::close(notify);
+        ::close(wakeRead);
+        ::close(wakeWrite);
+        notify = wakeRead = wakeWrite = -1;
+        watches.clear();
+        watchCount.store(0, std::memory_order_release);
+        return false;
+    }
+
+    // Changes made during the import are already waiting; they are applied first
+    fileSystem.enableConcurrentAccess();
+    watcher = std::thread([this]() { watch(); });
+    return true;
+}
+
+// Function to stop watching once what has been reported is applied
+void HostMirror::stop() {
+    if (notify < 0) {
+        return;
+    }
+    char byte = 0;
+    while (::write(wakeWrite, &byte, 1) < 0 && errno == EINTR) {
+    }
+    watcher.join();
+    ::close(notify);
+    ::close(wakeRead);
+    ::close(wakeWrite);
+    notify = wakeRead = wakeWrite = -1;
+    watches.clear();
+    rootWatch = -1;
+    watchCount.store(0, std::memory_order_release);
+}
+
+// Private helper function to gather reports into batches and apply each, until stopped
+void HostMirror::watch() {
+    std::vector<Event> events;
+    std::chrono::steady_clock::time_point opened;
+    for (;;) {
+        int timeout = -1;
+        if (!events.empty()) {
+            std::chrono::milliseconds left = longestInterval - std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                                  std::chrono::steady_clock::now() - opened);
+            timeout = static_cast<int>(std::max<std::int64_t>(0, std::min(quietInterval, left).count()));
+        }
+        pollfd ready[2] = {{notify, POLLIN, 0}, {wakeRead, POLLIN, 0}};
+        int count = ::poll(ready, 2, timeout);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        bool stopping = count < 0 || ready[1].revents != 0;
+        bool idle = events.empty();
+        if (count > 0 && (ready[0].revents & POLLIN) && !readEvents(events)) {
+            stopping = true;
+        }
+        if (idle && !events.empty()) {
+            opened = std::chrono::steady_clock::now();
+        }
+        if (stopping) {
+            readEvents(events);
+            if (!events.empty()) {
+                applyBatch(events);
+            }
+            return;
+        }
+        // Quiet for a whole interval, open for the longest, or simply large enough
+        if (!events.empty() && (count == 0 || events.size() >= BATCH_EVENTS ||
+                                std::chrono::steady_clock::now() - opened >= longestInterval)) {
+            applyBatch(events);
+            events.clear();
+        }
+    }
+}
+
+// Private helper function to read every report waiting; returns false if inotify failed
+bool HostMirror::readEvents(std::vector<Event>& events) {
+    alignas(inotify_event) char buffer[64 * 1024];
+    for (;;) {
+        ssize_t length = ::read(notify, buffer, sizeof(buffer));
+        if (length < 0) {
+            return errno == EAGAIN || errno == EINTR;
+        }
+        if (length == 0) {
+            return false;
+        }
+        for (ssize_t at = 0; at < length;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + at);
+            events.push_back(Event{event->wd, event->mask, event->cookie,
+                                   event->len > 0 ? std::string(event->name) : std::string()});
+            at += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+        }
+    }
+}
+
+// Private helper function to apply one batch of reports. Renames come first, in
+// the order they happened, since later reports name entries by where they went;
+// then every other entry reported is made to match the host, once.
+void HostMirror::applyBatch(const std::vector<Event>& events) {
+    METRICS_TIME(MIRROR_BATCH);
+    METRICS_COUNT(MIRROR_EVENTS, events.size());
+
+    // A rename is reported as a pair sharing a cookie; one without its other half
+    // left or entered the tree (or has its other half in the next batch)
+    std::unordered_map<std::uint32_t, std::size_t> movedFrom;
+    std::vector<std::size_t> pairOf(events.size(), events.size());
+    for (std::size_t i = 0; i < events.size(); i++) {
+        if (events[i].mask & IN_MOVED_FROM) {
+            movedFrom[events[i].cookie] = i;
+        } else if (events[i].mask & IN_MOVED_TO) {
+            std::unordered_map<std::uint32_t, std::size_t>::iterator from = movedFrom.find(events[i].cookie);
+            if (from != movedFrom.end()) {
+                pairOf[i] = from->second;
+                pairOf[from->second] = i;
+                movedFrom.erase(from);
+            }
+        }
+    }
+
+    std::set<std::pair<int, std::string>> dirty;
+    std::vector<std::pair<int, std::string>> queued; // both ends of every file move in the move queue
+    std::vector<int> ignored;
+    bool overflow = false;
+    auto processQueued = [&]() {
+        if (queued.empty()) {
+            return;
+        }
+        for (const FileSystem::MoveResult& result : fileSystem.processMoveQueue()) {
+            if (result.missing != 0 || result.conflicts != 0) {
+                // Some move did not apply: look at both ends of every one
+                dirty.insert(queued.begin(), queued.end());
+                break;
+            }
+        }
+        queued.clear();
+    };
+
+    for (std::size_t i = 0; i < events.size(); i++) {
+        const Event& event = events[i];
+        if (event.mask & IN_Q_OVERFLOW) {
+            overflow = true;
+            continue;
+        }
+        if (event.mask & IN_IGNORED) {
+            ignored.push_back(event.watch);
+            continue;
+        }
+        if (event.name.empty()) {
+            continue; // about a watched directory itself, which its parent reports too
+        }
+        bool paired = pairOf[i] != events.size();
+        if (!paired || (event.mask & IN_MOVED_FROM)) {
+            if (!paired) {
+                dirty.emplace(event.watch, event.name);
+            }
+            continue;
+        }
+
+        const Event& from = events[pairOf[i]];
+        if (watches.count(from.watch) == 0 || watches.count(event.watch) == 0) {
+            dirty.emplace(from.watch, from.name);
+            dirty.emplace(event.watch, event.name);
+        } else if (event.mask & IN_ISDIR) {
+            processQueued(); // the moves are queued by paths this rename may change
+            std::string source = childPath(namespacePathOf(from.watch), from.name);
+            std::string destination = childPath(namespacePathOf(event.watch), event.name);
+            FileSystem::Status status = fileSystem.renameDirectory(source, destination);
+            if (status == FileSystem::ALREADY_EXISTS) {
+                // The host replaced an empty directory there
+                dropWatches(event.watch, event.name);
+                fileSystem.removeTree(destination, importThreads);
+                status = fileSystem.renameDirectory(source, destination);
+            }
+            moveWatch(from.watch, from.name, event.watch, event.name);
+            if (status != FileSystem::OK) {
+                dirty.emplace(from.watch, from.name);
+                dirty.emplace(event.watch, event.name);
+            }
+        } else if (from.watch != event.watch && from.name == event.name) {
+            fileSystem.enqueueMove(namespacePathOf(from.watch), namespacePathOf(event.watch), event.name, false);
+            queued.emplace_back(from.watch, from.name);
+            queued.emplace_back(event.watch, event.name);
+        } else {
+            // A file that changed its name is removed and inserted again
+            dirty.emplace(from.watch, from.name);
+            dirty.emplace(event.watch, event.name);
+        }
+    }
+    processQueued();
+
+    if (overflow) {
+        rescan();
+    } else {
+        for (const std::pair<int, std::string>& entry : dirty) {
+            reconcile(entry.first, entry.second);
+        }
+    }
+
+    // Directories that are gone have taken their watches with them
+    for (int wd : ignored) {
+        std::unordered_map<int, Watch>::iterator gone = watches.find(wd);
+        if (gone == watches.end()) {
+            continue;
+        }
+        std::unordered_map<int, Watch>::iterator parent = watches.find(gone->second.parent);
+        if (parent != watches.end()) {
+            std::unordered_map<std::string, int>::iterator child = parent->second.children.find(gone->second.name);
+            if (child != parent->second.children.end() && child->second == wd) {
+                parent->second.children.erase(child);
+            }
+        }
+        watches.erase(gone);
+    }
+    watchCount.store(watches.size(), std::memory_order_release);
+    batchCount.fetch_add(1, std::memory_order_acq_rel);
+}
+
+// Private helper function to make one entry of a watched directory match the host
+void HostMirror::reconcile(int parent, const std::string& name) {
+    if (watches.count(parent) == 0) {
+        return;
+    }
+    std::string hostPath = hostPathOf(parent) + "/" + name;
+    std::string directory = namespacePathOf(parent);
+    std::string path = childPath(directory, name);
+    struct stat status;
+    bool exists = ::lstat(hostPath.c_str(), &status) == 0;
+    bool hostDirectory = exists && S_ISDIR(status.st_mode);
+    FileSystem::Metadata held;
+    FileSystem::Usage usage;
+    bool present = fileSystem.stat(path, held) == FileSystem::OK;
+    bool heldDirectory = present && fileSystem.usage(path, usage) == FileSystem::OK;
+
+    // Gone from the host, or replaced by an entry of the other kind
+    if (present && (!exists || heldDirectory != hostDirectory)) {
+        if (heldDirectory) {
+            fileSystem.removeTree(path, importThreads);
+            dropWatches(parent, name);
+        } else {
+            fileSystem.remove(path);
+        }
+        present = false;
+    }
+    if (!exists) {
+        return;
+    }
+
+    FileSystem::Metadata meta = hostMetadata(status);
+    if (present) {
+        if (held.mtime != meta.mtime || held.mode != meta.mode || held.size != meta.size) {
+            fileSystem.setMetadata(path, meta);
+        }
+        return;
+    }
+    if (fileSystem.insertFile(directory, name, hostDirectory, meta) != FileSystem::OK || !hostDirectory) {
+        return;
+    }
+    // Whatever the new directory already holds was never reported
+    bool holdsEntries = false;
+    if (addWatches(parent, name, hostPath, holdsEntries) >= 0 && holdsEntries) {
+        fileSystem.importDirectory(hostPath, path, importThreads);
+    }
+}
+
+// Private helper function to compare every watched directory with the host,
+// after the kernel dropped reports
+void HostMirror::rescan() {
+    std::vector<int> directories;
+    directories.reserve(watches.size());
+    for (const std::pair<const int, Watch>& watched : watches) {
+        directories.push_back(watched.first);
+    }
+    for (int wd : directories) {
+        if (watches.count(wd) == 0) {
+            continue; // dropped with a directory removed earlier in the rescan
+        }
+        std::set<std::string> names;
+        std::error_code code;
+        for (std::filesystem::directory_iterator it(hostPathOf(wd), code);
+             !code && it != std::filesystem::directory_iterator(); it.increment(code)) {
+            names.insert(it->path().filename().string());
+        }
+        for (const std::string& held : fileSystem.listDirectory(namespacePathOf(wd))) {
+            names.insert(held);
+        }
+        for (const std::string& name : names) {
+            reconcile(wd, name);
+        }
+    }
+}
+
+// Private helper function to watch a host directory and every directory beneath
+// it; returns the directory's watch, or -1 if it cannot be watched
+int HostMirror::addWatches(int parent, const std::string& name, const std::string& hostPath, bool& holdsEntries) {
+    class Pending {
+    public:
+        int parent;
+        std::string name;
+        std::string hostPath;
+    };
+    int top = -1;
+    std::vector<Pending> pending(1, Pending{parent, name, hostPath});
+    while (!pending.empty()) {
+        Pending next = std::move(pending.back());
+        pending.pop_back();
+        int wd = ::inotify_add_watch(notify, next.hostPath.c_str(), WATCH_MASK);
+        if (wd < 0) {
+            if (top >= 0) {
+                std::lock_guard<std::mutex> guard(errorMutex);
+                if (firstWatchError.empty()) {
+                    firstWatchError = "cannot watch '" + next.hostPath + "': " + std::strerror(errno);
+                }
+                unwatchedCount.fetch_add(1, std::memory_order_release);
+            }
+            if (top < 0) {
+                return -1;
+            }
+            continue;
+        }
+        // A directory that left the tree and came back keeps its watch
+        std::unordered_map<int, Watch>::iterator known = watches.find(wd);
+        if (known != watches.end() && watches.count(known->second.parent) != 0) {
+            std::unordered_map<std::string, int>& siblings = watches[known->second.parent].children;
+            std::unordered_map<std::string, int>::iterator old = siblings.find(known->second.name);
+            if (old != siblings.end() && old->second == wd) {
+                siblings.erase(old);
+            }
+        }
+        Watch& watched = watches[wd];
+        watched.parent = next.parent;
+        watched.name = next.name;
+        if (next.parent >= 0) {
+            watches[next.parent].children[next.name] = wd;
+        }
+
+        std::error_code code;
+        for (std::filesystem::directory_iterator it(next.hostPath, code);
+             !code && it != std::filesystem::directory_iterator(); it.increment(code)) {
+            if (top < 0) {
+                holdsEntries = true;
+            }
+            std::error_code statusCode;
+            if (std::filesystem::is_directory(it->symlink_status(statusCode))) {
+                pending.push_back(Pending{wd, it->path().filename().string(), it->path().string()});
+            }
+        }
+        if (top < 0) {
+            top = wd;
+        }
+    }
+    watchCount.store(watches.size(), std::memory_order_release);
+    return top;
+}
+
+// Private helper function to stop watching a directory and everything beneath it
+void HostMirror::dropWatches(int parent, const std::string& name) {
+    std::unordered_map<int, Watch>::iterator holder = watches.find(parent);
+    if (holder == watches.end()) {
+        return;
+    }
+    std::unordered_map<std::string, int>::iterator child = holder->second.children.find(name);
+    if (child == holder->second.children.end()) {
+        return;
+    }
+    std::vector<int> pending(1, child->second);
+    holder->second.children.erase(child);
+    while (!pending.empty()) {
+        int wd = pending.back();
+        pending.pop_back();
+        std::unordered_map<int, Watch>::iterator watched = watches.find(wd);
+        if (watched == watches.end()) {
+            continue;
+        }
+        for (const std::pair<const std::string, int>& below : watched->second.children) {
+            pending.push_back(below.second);
+        }
+        ::inotify_rm_watch(notify, wd); // fails harmlessly if the directory is already gone
+        watches.erase(watched);
+    }
+    watchCount.store(watches.size(), std::memory_order_release);
+}
+
+// Private helper function to follow a renamed directory in the watch tree
+void HostMirror::moveWatch(int fromParent, const std::string& fromName, int toParent, const std::string& toName) {
+    Watch& source = watches[fromParent];
+    std::unordered_map<std::string, int>::iterator child = source.children.find(fromName);
+    if (child == source.children.end()) {
+        return; // not watched yet: it is picked up when the destination is reconciled
+    }
+    int wd = child->second;
+    source.children.erase(child);
+    Watch& moved = watches[wd];
+    moved.parent = toParent;
+    moved.name = toName;
+    watches[toParent].children[toName] = wd;
+}
+
+// Private helper function to build the path of a watched directory below the top
+std::string HostMirror::relativePath(int wd) const {
+    std::vector<const std::string*> components;
+    for (std::unordered_map<int, Watch>::const_iterator at = watches.find(wd);
+         at != watches.end() && at->second.parent >= 0; at = watches.find(at->second.parent)) {
+        components.push_back(&at->second.name);
+    }
+    std::string path;
+    for (std::size_t i = components.size(); i-- > 0;) {
+        if (!path.empty()) {
+            path += '/';
+        }
+        path += *components[i];
+    }
+    return path;
+}
+
+// Private helper functions to find a watched directory on the host and in the namespace
+std::string HostMirror::hostPathOf(int wd) const {
+    std::string relative = relativePath(wd);
+    return relative.empty() ? hostRoot : hostRoot + "/" + relative;
+}
+
+std::string HostMirror::namespacePathOf(int wd) const {
+    std::string relative = relativePath(wd);
+    return relative.empty() ? targetRoot : childPath(targetRoot, relative);
+}
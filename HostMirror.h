@@ -0,0 +1,132 @@
+#ifndef HOST_MIRROR_H
+#define HOST_MIRROR_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+#include "FileSystem.h"
+
+// Keeps a directory of a file system a copy of a host directory tree. start()
+// imports the tree once; from then on Linux inotify reports what changes on the
+// host, and only the entries named in those reports are looked at again, so the
+// cost follows the rate of change rather than the size of the tree.
+//
+// Reports are gathered into batches: a batch closes once the host has been
+// quiet for the quiet interval, or when its first report is the longest
+// interval old. Within a batch every entry is looked at once however often it
+// was reported (a file written a thousand times is one setMetadata), entries
+// renamed within a batch are renamed in the namespace (a directory with
+// renameDirectory, a file moved to another directory through the move queue)
+// instead of being removed and imported again, and everything else is made to
+// match the host: created entries are inserted with the host's size, mtime and
+// mode, vanished ones removed (directories with removeTree), changed ones
+// updated with setMetadata. A directory that appears is watched and whatever
+// it already holds is imported in bulk.
+//
+// Entries loaded by the first import carry the import time rather than the
+// host's (see importDirectory) until they next change. If the kernel's event
+// queue overflows, every watched directory is compared with the host again.
+// A file's new size is seen when its writer closes it. Symbolic links are
+// mirrored as files and never followed.
+class HostMirror {
+public:
+    explicit HostMirror(FileSystem& fs);
+    ~HostMirror();
+
+    HostMirror(const HostMirror&) = delete;
+    HostMirror& operator=(const HostMirror&) = delete;
+
+    // Function to import hostPath under targetDir (created if missing) and keep
+    // it up to date on a thread of its own. Puts the file system in concurrent
+    // mode; nothing else should change targetDir, and moves queued by others are
+    // processed with the mirror's. Imports use threads worker threads (0 for one
+    // per hardware thread). Returns false and sets error on failure.
+    bool start(const std::string& hostPath, const std::string& targetDir, std::string& error, unsigned threads = 0);
+
+    // Function to stop watching, applying whatever has already been reported
+    void stop();
+
+    // Function to change how long a batch waits for the host to go quiet, and
+    // how long it may keep waiting altogether (20 ms and 250 ms unless changed
+    // before start)
+    void setBatchWindow(std::chrono::milliseconds quiet, std::chrono::milliseconds longest);
+
+    // Directories watched now
+    std::size_t watched() const {
+        return watchCount.load(std::memory_order_acquire);
+    }
+
+    // Batches applied so far
+    std::uint64_t batches() const {
+        return batchCount.load(std::memory_order_acquire);
+    }
+
+    // Directories that could not be watched, so their changes are missed
+    std::size_t unwatched() const {
+        return unwatchedCount.load(std::memory_order_acquire);
+    }
+
+    // Function to return why the first directory that could not be watched was
+    // not ("" if every directory is watched)
+    std::string watchError() const;
+
+private:
+    // One watched directory, known by its parent's watch and its name there, so
+    // renaming a directory does not touch the watches beneath it
+    class Watch {
+    public:
+        int parent; // -1 for the top of the tree
+        std::string name;
+        std::unordered_map<std::string, int> children; // watched subdirectories by name
+    };
+
+    // One report read from inotify
+    class Event {
+    public:
+        int watch;
+        std::uint32_t mask;
+        std::uint32_t cookie;
+        std::string name;
+    };
+
+    FileSystem& fileSystem;
+    std::string hostRoot;
+    std::string targetRoot; // "/" followed by the normalized target directory
+    unsigned importThreads;
+    int notify;             // the inotify descriptor
+    int wakeRead;           // pipe that wakes the watcher to stop
+    int wakeWrite;
+    std::thread watcher;
+    std::unordered_map<int, Watch> watches; // by watch descriptor; the watcher's alone once it runs
+    int rootWatch;
+    std::chrono::milliseconds quietInterval;
+    std::chrono::milliseconds longestInterval;
+    std::atomic<std::size_t> watchCount;
+    std::atomic<std::uint64_t> batchCount;
+    std::atomic<std::size_t> unwatchedCount;
+    mutable std::mutex errorMutex; // guards firstWatchError, set on the watcher thread
+    std::string firstWatchError;
+
+    // Private helper functions run on the watcher thread
+    void watch();
+    bool readEvents(std::vector<Event>& events);
+    void applyBatch(const std::vector<Event>& events);
+    void reconcile(int parent, const std::string& name);
+    void rescan();
+
+    // Private helper functions for the watch tree
+    int addWatches(int parent, const std::string& name, const std::string& hostPath, bool& holdsEntries);
+    void dropWatches(int parent, const std::string& name);
+    void moveWatch(int fromParent, const std::string& fromName, int toParent, const std::string& toName);
+    std::string relativePath(int wd) const;
+    std::string hostPathOf(int wd) const;
+    std::string namespacePathOf(int wd) const;
+};
+
+#endif // HOST_MIRROR_H
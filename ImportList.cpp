@@ -0,0 +1,240 @@
+#include "ImportList.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Orders paths component by component: '/' ranks below every other byte, so a
+// directory is followed by everything beneath it before any sibling sorting after it
+bool pathLess(const ImportList::Entry& a, const ImportList::Entry& b) {
+    std::size_t common = std::min(a.path.size(), b.path.size());
+    std::size_t at = static_cast<std::size_t>(
+        std::mismatch(a.path.begin(), a.path.begin() + common, b.path.begin()).first - a.path.begin());
+    if (at == common) {
+        return a.path.size() < b.path.size();
+    }
+    int left = a.path[at] == '/' ? -1 : static_cast<unsigned char>(a.path[at]);
+    int right = b.path[at] == '/' ? -1 : static_cast<unsigned char>(b.path[at]);
+    return left < right;
+}
+
+} // namespace
+
+// Implementation of ImportList constructor
+ImportList::ImportList() : mapped(nullptr), mappedLength(0) {}
+
+// Implementation of ImportList destructor
+ImportList::~ImportList() {
+    if (mapped != nullptr) {
+        munmap(mapped, mappedLength);
+    }
+}
+
+// Private helper function to add one path, trimming its slashes and copying it
+// only when doubled slashes have to be collapsed
+void ImportList::addPath(std::string_view path, bool isDirectory, std::vector<Entry>& out,
+                         std::deque<std::string>& owned) {
+    while (!path.empty() && path.back() == '/') {
+        path.remove_suffix(1);
+        isDirectory = true;
+    }
+    while (!path.empty() && path.front() == '/') {
+        path.remove_prefix(1);
+    }
+    if (path.empty()) {
+        return;
+    }
+    if (path.find("//") != std::string_view::npos) {
+        std::string collapsed;
+        collapsed.reserve(path.size());
+        for (char c : path) {
+            if (c != '/' || collapsed.back() != '/') {
+                collapsed.push_back(c);
+            }
+        }
+        owned.push_back(std::move(collapsed));
+        path = owned.back();
+    }
+    out.push_back(Entry{path, isDirectory});
+}
+
+// Private helper function to append the per-thread results in order, keeping their copies alive
+void ImportList::gather(std::vector<std::vector<Entry>>& parts, std::vector<std::deque<std::string>>& owned) {
+    std::size_t total = list.size();
+    for (const std::vector<Entry>& part : parts) {
+        total += part.size();
+    }
+    list.reserve(total);
+    for (const std::vector<Entry>& part : parts) {
+        list.insert(list.end(), part.begin(), part.end());
+    }
+    // Moving a deque keeps its elements in place, so the views stay valid
+    for (std::deque<std::string>& strings : owned) {
+        if (!strings.empty()) {
+            copies.push_back(std::move(strings));
+        }
+    }
+}
+
+// Function to read a manifest, splitting it between threads at line boundaries
+bool ImportList::readManifest(const std::string& path, unsigned threads, std::string& error) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "cannot open '" + path + "'";
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        ::close(fd);
+        error = "'" + path + "' is not a regular file";
+        return false;
+    }
+    std::size_t size = static_cast<std::size_t>(info.st_size);
+    if (size == 0) {
+        ::close(fd);
+        return true;
+    }
+    void* base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        error = "cannot map '" + path + "'";
+        return false;
+    }
+    if (mapped != nullptr) {
+        munmap(mapped, mappedLength);
+    }
+    mapped = base;
+    mappedLength = size;
+    const char* text = static_cast<const char*>(base);
+
+    // Slices of at least 64 KiB; each starts just after a newline
+    std::size_t slices = std::max<std::size_t>(1, std::min<std::size_t>(workerCount(threads), size >> 16));
+    std::vector<std::size_t> bounds(slices + 1, size);
+    bounds[0] = 0;
+    for (std::size_t slice = 1; slice < slices; slice++) {
+        std::size_t at = std::max(size * slice / slices, bounds[slice - 1]);
+        const void* newline = at < size ? std::memchr(text + at, '\n', size - at) : nullptr;
+        bounds[slice] = newline ? static_cast<std::size_t>(static_cast<const char*>(newline) - text) + 1 : size;
+    }
+
+    std::vector<std::vector<Entry>> parts(slices);
+    std::vector<std::deque<std::string>> owned(slices);
+    parallelFor(slices, [&](std::size_t slice) {
+        std::size_t at = bounds[slice];
+        std::size_t end = bounds[slice + 1];
+        while (at < end) {
+            const void* newline = std::memchr(text + at, '\n', end - at);
+            std::size_t lineEnd = newline ? static_cast<std::size_t>(static_cast<const char*>(newline) - text) : end;
+            std::string_view line(text + at, lineEnd - at);
+            at = lineEnd + 1;
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            if (line.empty() || line.front() == '#') {
+                continue;
+            }
+            addPath(line, false, parts[slice], owned[slice]);
+        }
+    });
+    gather(parts, owned);
+    return true;
+}
+
+// Function to walk a host directory (without following symlinks), listing
+// every entry beneath it as a path under target; threads share the top-level entries
+bool ImportList::readDirectory(const std::string& hostPath, const std::string& target, unsigned threads,
+                               std::string& error) {
+    namespace fs = std::filesystem;
+    std::error_code code;
+    fs::path root(hostPath);
+    if (!fs::is_directory(root, code)) {
+        error = "'" + hostPath + "' is not a directory";
+        return false;
+    }
+    std::vector<fs::directory_entry> top;
+    fs::directory_iterator it(root, fs::directory_options::skip_permission_denied, code);
+    for (; !code && it != fs::directory_iterator(); it.increment(code)) {
+        top.push_back(*it);
+    }
+    if (code) {
+        error = "cannot read '" + hostPath + "'";
+        return false;
+    }
+
+    // Host paths all start with the root and a separator; that prefix is replaced by target
+    std::size_t rootLength = (root / "").native().size();
+    std::string prefix = target;
+    while (!prefix.empty() && prefix.back() == '/') {
+        prefix.pop_back();
+    }
+    if (!prefix.empty()) {
+        prefix.push_back('/');
+    }
+
+    std::size_t slices = std::max<std::size_t>(1, std::min<std::size_t>(workerCount(threads), top.size()));
+    std::vector<std::vector<Entry>> parts(slices);
+    std::vector<std::deque<std::string>> owned(slices);
+    std::vector<std::string> failures(slices);
+    parallelFor(slices, [&](std::size_t slice) {
+        std::vector<Entry>& out = parts[slice];
+        std::deque<std::string>& strings = owned[slice];
+        auto add = [&](const fs::directory_entry& entry) {
+            std::error_code statusCode;
+            bool isDirectory = fs::is_directory(entry.symlink_status(statusCode));
+            strings.push_back(prefix + fs::path(entry.path().native().substr(rootLength)).generic_string());
+            addPath(strings.back(), isDirectory, out, strings);
+            return isDirectory;
+        };
+        for (std::size_t i = slice; i < top.size(); i += slices) {
+            if (!add(top[i])) {
+                continue;
+            }
+            std::error_code walkCode;
+            fs::recursive_directory_iterator walk(top[i].path(), fs::directory_options::skip_permission_denied,
+                                                  walkCode);
+            for (; !walkCode && walk != fs::recursive_directory_iterator(); walk.increment(walkCode)) {
+                add(*walk);
+            }
+            if (walkCode && failures[slice].empty()) {
+                failures[slice] = "cannot read '" + top[i].path().string() + "'";
+            }
+        }
+    });
+    for (const std::string& failure : failures) {
+        if (!failure.empty()) {
+            error = failure;
+            return false;
+        }
+    }
+    // An empty host directory still creates the target
+    if (top.empty() && !prefix.empty()) {
+        owned[0].push_back(prefix);
+        addPath(owned[0].back(), true, parts[0], owned[0]);
+    }
+    gather(parts, owned);
+    return true;
+}
+
+// Function to sort the paths depth first and merge duplicates (a path listed
+// as both a file and a directory becomes a directory); returns how many were merged
+std::size_t ImportList::sort(unsigned threads) {
+    parallelSort(list.begin(), list.end(), pathLess, workerCount(threads));
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < list.size(); i++) {
+        if (kept > 0 && list[kept - 1].path == list[i].path) {
+            list[kept - 1].isDirectory = list[kept - 1].isDirectory || list[i].isDirectory;
+        } else {
+            list[kept++] = list[i];
+        }
+    }
+    std::size_t merged = list.size() - kept;
+    list.resize(kept);
+    return merged;
+}
@@ -0,0 +1,57 @@
+#ifndef IMPORT_LIST_H
+#define IMPORT_LIST_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <cstddef>
+
+// Paths gathered for a bulk import, read on worker threads from a manifest or
+// a host directory tree and sorted so that every directory comes right before
+// everything beneath it.
+//
+// A manifest holds one '/'-separated path per line, relative to the root; a
+// trailing '/' marks a directory, and blank lines and lines starting with '#'
+// are skipped. Paths are kept as views into the mapped manifest (or into
+// copies owned by the list), so the list must outlive its entries.
+class ImportList {
+public:
+    class Entry {
+    public:
+        std::string_view path; // no leading, trailing or doubled slashes
+        bool isDirectory;
+    };
+
+    ImportList();
+    ~ImportList();
+
+    ImportList(const ImportList&) = delete;
+    ImportList& operator=(const ImportList&) = delete;
+
+    // Function to read a manifest, splitting it between threads at line boundaries
+    bool readManifest(const std::string& path, unsigned threads, std::string& error);
+
+    // Function to walk a host directory (without following symlinks), listing
+    // every entry beneath it as a path under target; threads share the top-level entries
+    bool readDirectory(const std::string& hostPath, const std::string& target, unsigned threads, std::string& error);
+
+    // Function to sort the paths depth first and merge duplicates (a path listed
+    // as both a file and a directory becomes a directory); returns how many were merged
+    std::size_t sort(unsigned threads);
+
+    const std::vector<Entry>& entries() const {
+        return list;
+    }
+
+private:
+    void* mapped;                                // the manifest, while it is read from
+    std::size_t mappedLength;
+    std::vector<std::deque<std::string>> copies; // paths that had to be rewritten, per thread
+    std::vector<Entry> list;
+
+    static void addPath(std::string_view path, bool isDirectory, std::vector<Entry>& out, std::deque<std::string>& owned);
+    void gather(std::vector<std::vector<Entry>>& parts, std::vector<std::deque<std::string>>& owned);
+};
+
+#endif // IMPORT_LIST_H
@@ -0,0 +1,314 @@
+#include "Journal.h"
+#include <array>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// CRC-32 (IEEE), table driven
+std::uint32_t crc32(const char* data, std::size_t length) {
+    // Built once, even when the first records are framed on several threads at once
+    static const std::array<std::uint32_t, 256> table = [] {
+        std::array<std::uint32_t, 256> built;
+        for (std::uint32_t i = 0; i < 256; i++) {
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            built[i] = c;
+        }
+        return built;
+    }();
+    std::uint32_t crc = 0xFFFFFFFFu;
+    for (std::size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+template <typename T>
+void put(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void putString(std::string& out, const std::string& value) {
+    put(out, static_cast<std::uint32_t>(value.size()));
+    out.append(value);
+}
+
+template <typename T>
+bool get(const char*& in, const char* end, T& value) {
+    if (static_cast<std::size_t>(end - in) < sizeof(value)) {
+        return false;
+    }
+    std::memcpy(&value, in, sizeof(value));
+    in += sizeof(value);
+    return true;
+}
+
+bool getString(const char*& in, const char* end, std::string& value) {
+    std::uint32_t length;
+    if (!get(in, end, length) || static_cast<std::size_t>(end - in) < length) {
+        return false;
+    }
+    value.assign(in, length);
+    in += length;
+    return true;
+}
+
+bool decodePayload(const char* payload, std::size_t length, Journal::Record& record) {
+    const char* in = payload;
+    const char* end = payload + length;
+    std::uint8_t operation;
+    std::uint8_t flag;
+    if (!get(in, end, record.sequence) || !get(in, end, operation) || !get(in, end, flag) ||
+        !getString(in, end, record.first) || !getString(in, end, record.second) || !getString(in, end, record.third)) {
+        return false;
+    }
+    record.time = 0;
+    record.size = 0;
+    record.mtime = 0;
+    record.mode = 0;
+    if (in != end && (!get(in, end, record.time) || !get(in, end, record.size) || !get(in, end, record.mtime) ||
+                      !get(in, end, record.mode))) {
+        return false;
+    }
+    if (operation < Journal::INSERT_DIRECTORY || operation > Journal::COPY_TREE || in != end) {
+        return false;
+    }
+    record.operation = static_cast<Journal::Operation>(operation);
+    record.flag = flag != 0;
+    return true;
+}
+
+} // namespace
+
+// Implementation of Record constructor
+Journal::Record::Record() : sequence(0), operation(INSERT_DIRECTORY), flag(false), time(0), size(0), mtime(0), mode(0) {}
+
+// Implementation of Journal constructor
+Journal::Journal()
+    : fd(-1), durability(GROUP_COMMIT), pending(0), records(0), groupRecords(512), groupWindow(10), stopping(false) {}
+
+// Implementation of Journal destructor
+Journal::~Journal() {
+    close();
+}
+
+// Function to open (or create) a journal and replay its intact records
+bool Journal::open(const std::string& path, Durability level, const std::function<void(const Record&)>& replay, std::string& error) {
+    close();
+    int file = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (file < 0) {
+        error = "cannot open journal '" + path + "'";
+        return false;
+    }
+
+    // Read the whole journal; it is compacted at every checkpoint, so it stays small
+    std::vector<char> contents;
+    char chunk[64 * 1024];
+    ssize_t got;
+    while ((got = ::read(file, chunk, sizeof(chunk))) > 0) {
+        contents.insert(contents.end(), chunk, chunk + got);
+    }
+    if (got < 0) {
+        ::close(file);
+        error = "cannot read journal '" + path + "'";
+        return false;
+    }
+
+    std::size_t valid = 0;
+    std::size_t count = 0;
+    Record record;
+    std::size_t length;
+    while ((length = decode(contents.data() + valid, contents.size() - valid, record)) != 0) {
+        replay(record);
+        valid += length;
+        count++;
+    }
+
+    // Cut off a torn tail so new records follow the last intact one
+    if (valid != contents.size() && (::ftruncate(file, static_cast<off_t>(valid)) != 0 || ::fsync(file) != 0)) {
+        ::close(file);
+        error = "cannot repair journal '" + path + "'";
+        return false;
+    }
+    if (::lseek(file, static_cast<off_t>(valid), SEEK_SET) < 0) {
+        ::close(file);
+        error = "cannot seek in journal '" + path + "'";
+        return false;
+    }
+    fd = file;
+    durability = level;
+    records = count;
+    if (durability == GROUP_COMMIT) {
+        stopping = false;
+        flusher = std::thread(&Journal::flushGroups, this);
+    }
+    return true;
+}
+
+// Function to append a record
+bool Journal::append(const Record& record) {
+    if (fd < 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    encode(record, buffer);
+    bool firstOfGroup = pending++ == 0;
+    if (firstOfGroup) {
+        groupStart = std::chrono::steady_clock::now();
+    }
+    records++;
+
+    switch (durability) {
+        case EVERY_OPERATION:
+            return syncLocked();
+        case GROUP_COMMIT:
+            if (pending >= groupRecords || std::chrono::steady_clock::now() - groupStart >= groupWindow) {
+                return syncLocked();
+            }
+            if (firstOfGroup) {
+                groupStarted.notify_one();
+            }
+            return buffer.size() < BUFFER_LIMIT || writeBuffer();
+        case BUFFERED:
+            return buffer.size() < BUFFER_LIMIT || writeBuffer();
+    }
+    return true;
+}
+
+// Function to append a record to out, framed as the journal stores it. The
+// payload is written in place behind a header that is filled in afterwards.
+void Journal::encode(const Record& record, std::string& out) {
+    std::size_t header = out.size();
+    put(out, std::uint32_t(0));
+    put(out, std::uint32_t(0));
+    std::size_t payload = out.size();
+    put(out, record.sequence);
+    put(out, static_cast<std::uint8_t>(record.operation));
+    put(out, static_cast<std::uint8_t>(record.flag ? 1 : 0));
+    putString(out, record.first);
+    putString(out, record.second);
+    putString(out, record.third);
+    put(out, record.time);
+    put(out, record.size);
+    put(out, record.mtime);
+    put(out, record.mode);
+    std::uint32_t length = static_cast<std::uint32_t>(out.size() - payload);
+    std::uint32_t checksum = crc32(out.data() + payload, length);
+    std::memcpy(&out[header], &length, sizeof(length));
+    std::memcpy(&out[header + sizeof(length)], &checksum, sizeof(checksum));
+}
+
+// Function to read the framed record at the start of data
+std::size_t Journal::decode(const char* data, std::size_t length, Record& record) {
+    if (length < 2 * sizeof(std::uint32_t)) {
+        return 0;
+    }
+    std::uint32_t payload;
+    std::uint32_t checksum;
+    std::memcpy(&payload, data, sizeof(payload));
+    std::memcpy(&checksum, data + sizeof(payload), sizeof(checksum));
+    const char* start = data + 2 * sizeof(std::uint32_t);
+    if (length - 2 * sizeof(std::uint32_t) < payload || crc32(start, payload) != checksum ||
+        !decodePayload(start, payload, record)) {
+        return 0;
+    }
+    return 2 * sizeof(std::uint32_t) + payload;
+}
+
+// Private helper function to hand the buffered records to the kernel
+bool Journal::writeBuffer() {
+    std::size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+        if (n < 0) {
+            buffer.erase(0, written);
+            return false;
+        }
+        written += static_cast<std::size_t>(n);
+    }
+    buffer.clear();
+    return true;
+}
+
+// Function to write and fsync everything appended so far
+bool Journal::sync() {
+    if (fd < 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    return syncLocked();
+}
+
+// Private helper function to write and fsync the buffer, with the lock held
+bool Journal::syncLocked() {
+    if (!writeBuffer() || ::fdatasync(fd) != 0) {
+        return false;
+    }
+    pending = 0;
+    return true;
+}
+
+// Function to drop every record once a checkpoint holds them
+bool Journal::truncate() {
+    if (fd < 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    buffer.clear();
+    pending = 0;
+    records = 0;
+    return ::ftruncate(fd, 0) == 0 && ::lseek(fd, 0, SEEK_SET) == 0 && ::fsync(fd) == 0;
+}
+
+// Function to flush, sync and close the journal
+void Journal::close() {
+    if (fd < 0) {
+        return;
+    }
+    if (flusher.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        groupStarted.notify_one();
+        flusher.join();
+    }
+    sync();
+    ::close(fd);
+    fd = -1;
+    buffer.clear();
+    pending = 0;
+    records = 0;
+}
+
+// Function to tune group commit
+void Journal::setGroupCommit(std::size_t groupSize, std::chrono::milliseconds window) {
+    std::lock_guard<std::mutex> guard(lock);
+    groupRecords = groupSize == 0 ? 1 : groupSize;
+    groupWindow = window;
+}
+
+// Private helper function run by the flusher thread: sleeps until the oldest
+// unsynced record has waited out the window, then syncs its group
+void Journal::flushGroups() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (!stopping) {
+        if (pending == 0) {
+            groupStarted.wait(guard);
+            continue;
+        }
+        std::chrono::steady_clock::time_point deadline = groupStart + groupWindow;
+        if (std::chrono::steady_clock::now() < deadline) {
+            groupStarted.wait_until(guard, deadline);
+        } else if (!syncLocked()) {
+            // The records stay buffered; try again a window later rather than spin
+            groupStarted.wait_for(guard, groupWindow);
+        }
+    }
+}
@@ -0,0 +1,128 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <string>
+#include <functional>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+
+// Append-only journal of logical namespace operations.
+//
+// Each record is framed as [u32 payload length][u32 CRC-32 of the payload][payload],
+// the payload being the sequence number (u64), the operation (u8), a flag (u8), three
+// length-prefixed strings, then the time of the operation (i64, nanoseconds since
+// the epoch, 0 when not given) and an entry's size (u64), mtime (i64) and mode
+// (u32). Records written before times were logged end after the strings and read
+// back with zeros there. Records are collected in a buffer and
+// written out in groups, so many operations share one write and one fsync. With
+// group commit a background thread syncs a group whose window runs out before
+// the next record arrives, so an idle process does not sit on unwritten records.
+// Reading stops at the first torn or corrupt record, which is then cut off.
+class Journal {
+public:
+    // How long an appended operation may stay unsynced
+    enum Durability {
+        BUFFERED,        // written when the buffer fills, synced only by sync() and checkpoints
+        GROUP_COMMIT,    // synced once a group is full or its oldest record is older than the window
+        EVERY_OPERATION  // written and synced before append returns
+    };
+
+    enum Operation : std::uint8_t {
+        INSERT_DIRECTORY = 1,
+        INSERT_FILE,
+        REMOVE,
+        RENAME_DIRECTORY,
+        MOVE,
+        SORT_DIRECTORY,
+        CREATE_BACKUP,
+        RESTORE_BACKUP,
+        SET_METADATA,
+        WRITE_FILE, // the data is the third string
+        COPY_FILE,  // source path, destination directory, name of the copy
+        REMOVE_TREE,
+        COPY_TREE   // as COPY_FILE
+    };
+
+    class Record {
+    public:
+        std::uint64_t sequence;
+        Operation operation;
+        bool flag;
+        std::string first;
+        std::string second;
+        std::string third;
+        std::int64_t time;
+        std::uint64_t size;  // INSERT_FILE and SET_METADATA
+        std::int64_t mtime;
+        std::uint32_t mode;
+        Record();
+    };
+
+    Journal();
+    ~Journal();
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Function to open (or create) a journal, passing every intact record to replay
+    // in order before positioning for appends. Returns false and sets error on failure.
+    bool open(const std::string& path, Durability level, const std::function<void(const Record&)>& replay, std::string& error);
+
+    // Function to append a record; it is durable according to the durability level
+    bool append(const Record& record);
+
+    // Function to write and fsync everything appended so far
+    bool sync();
+
+    // Function to drop every record once a checkpoint holds them
+    bool truncate();
+
+    // Function to flush, sync and close the journal
+    void close();
+
+    // Function to append a record to out, framed exactly as the journal stores it
+    static void encode(const Record& record, std::string& out);
+
+    // Function to read the framed record at the start of data; returns the bytes
+    // it took, or 0 if data does not start with an intact record
+    static std::size_t decode(const char* data, std::size_t length, Record& record);
+
+    // Function to tune group commit: a group is synced once it holds this many
+    // records or its oldest record has waited this long
+    void setGroupCommit(std::size_t groupSize, std::chrono::milliseconds window);
+
+    bool isOpen() const {
+        return fd >= 0;
+    }
+
+    // Records appended since the journal was opened or last truncated
+    std::size_t size() const {
+        return records;
+    }
+
+private:
+    static constexpr std::size_t BUFFER_LIMIT = 256 * 1024;
+
+    int fd;
+    Durability durability;
+    std::string buffer;                          // encoded records not yet written
+    std::size_t pending;                         // records not yet synced
+    std::size_t records;
+    std::size_t groupRecords;
+    std::chrono::milliseconds groupWindow;
+    std::chrono::steady_clock::time_point groupStart; // when the oldest unsynced record was appended
+    std::mutex lock;                             // guards the above against the flusher
+    std::condition_variable groupStarted;        // wakes the flusher for a new group, or to stop
+    std::thread flusher;                         // syncs groups whose window ran out (GROUP_COMMIT only)
+    bool stopping;
+
+    bool writeBuffer();
+    bool syncLocked();
+    void flushGroups();
+};
+
+#endif // JOURNAL_H
@@ -0,0 +1,186 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// One thread's counts. Only the owning thread writes them, so an update is a
+// relaxed load and store rather than a locked read-modify-write; collect()
+// reads them with relaxed loads from other threads.
+class ThreadBlock {
+public:
+    std::atomic<std::uint64_t> buckets[Metrics::OPERATION_COUNT][Metrics::Histogram::BUCKETS];
+    std::atomic<std::uint64_t> calls[Metrics::OPERATION_COUNT];
+    std::atomic<std::uint64_t> total[Metrics::OPERATION_COUNT];
+    std::atomic<std::uint64_t> max[Metrics::OPERATION_COUNT];
+    std::atomic<std::uint64_t> counters[Metrics::COUNTER_COUNT];
+};
+
+// The blocks of running threads, and the sums of threads that have exited
+class Registry {
+public:
+    std::mutex lock;
+    std::vector<ThreadBlock*> live;
+    Metrics::Snapshot retired;
+};
+
+// Never destroyed: threads may still exit while static objects are torn down
+Registry& registry() {
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+void bump(std::atomic<std::uint64_t>& value, std::uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+void addTo(const ThreadBlock& block, Metrics::Snapshot& sums) {
+    for (int op = 0; op < Metrics::OPERATION_COUNT; op++) {
+        Metrics::Histogram& histogram = sums.operations[op];
+        for (int b = 0; b < Metrics::Histogram::BUCKETS; b++) {
+            histogram.buckets[b] += block.buckets[op][b].load(std::memory_order_relaxed);
+        }
+        histogram.count += block.calls[op].load(std::memory_order_relaxed);
+        histogram.total += block.total[op].load(std::memory_order_relaxed);
+        histogram.max = std::max(histogram.max, block.max[op].load(std::memory_order_relaxed));
+    }
+    for (int c = 0; c < Metrics::COUNTER_COUNT; c++) {
+        sums.counters[c] += block.counters[c].load(std::memory_order_relaxed);
+    }
+}
+
+// Registers a block for its thread and folds it into the retired sums when the thread exits
+class ThreadOwner {
+public:
+    ThreadBlock* block;
+
+    ThreadOwner() : block(new ThreadBlock()) {
+        Registry& shared = registry();
+        std::lock_guard<std::mutex> guard(shared.lock);
+        shared.live.push_back(block);
+    }
+
+    ~ThreadOwner() {
+        Registry& shared = registry();
+        std::lock_guard<std::mutex> guard(shared.lock);
+        addTo(*block, shared.retired);
+        shared.live.erase(std::find(shared.live.begin(), shared.live.end(), block));
+        delete block;
+    }
+};
+
+ThreadBlock& localBlock() {
+    thread_local ThreadOwner owner;
+    return *owner.block;
+}
+
+} // namespace
+
+// Implementation of Histogram constructor
+Metrics::Histogram::Histogram() : buckets(), count(0), total(0), max(0) {}
+
+// Implementation of Snapshot constructor
+Metrics::Snapshot::Snapshot() : counters() {}
+
+// Function to map a latency to its bucket: exact below 8 ns, then eight buckets per power of two
+std::size_t Metrics::Histogram::bucketOf(std::uint64_t nanoseconds) {
+    if (nanoseconds < SUB_BUCKETS) {
+        return static_cast<std::size_t>(nanoseconds);
+    }
+    int magnitude = 63 - __builtin_clzll(nanoseconds); // at least 3
+    std::uint64_t sub = (nanoseconds >> (magnitude - 3)) & (SUB_BUCKETS - 1);
+    return static_cast<std::size_t>((magnitude - 2) * SUB_BUCKETS + sub);
+}
+
+// Function to return the latency at or below which the given fraction of calls
+// finished, as the upper edge of the bucket holding it (never above the maximum)
+std::uint64_t Metrics::Histogram::percentile(double fraction) const {
+    if (count == 0) {
+        return 0;
+    }
+    std::uint64_t rank = static_cast<std::uint64_t>(fraction * static_cast<double>(count) + 0.5);
+    rank = std::max<std::uint64_t>(1, std::min(rank, count));
+    std::uint64_t seen = 0;
+    for (int b = 0; b < BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen >= rank) {
+            if (b < SUB_BUCKETS) {
+                return static_cast<std::uint64_t>(b);
+            }
+            int magnitude = b / SUB_BUCKETS + 2;
+            std::uint64_t upper = ((static_cast<std::uint64_t>(SUB_BUCKETS + b % SUB_BUCKETS) + 1) << (magnitude - 3)) - 1;
+            return std::min(upper, max);
+        }
+    }
+    return max;
+}
+
+// Function to record one call on the calling thread
+void Metrics::record(Operation operation, std::uint64_t nanoseconds) {
+    ThreadBlock& block = localBlock();
+    bump(block.buckets[operation][Histogram::bucketOf(nanoseconds)], 1);
+    bump(block.calls[operation], 1);
+    bump(block.total[operation], nanoseconds);
+    if (nanoseconds > block.max[operation].load(std::memory_order_relaxed)) {
+        block.max[operation].store(nanoseconds, std::memory_order_relaxed);
+    }
+}
+
+// Function to add to a counter on the calling thread
+void Metrics::count(Counter counter, std::uint64_t amount) {
+    bump(localBlock().counters[counter], amount);
+}
+
+// Function to sum what every thread has recorded
+Metrics::Snapshot Metrics::collect() {
+    Registry& shared = registry();
+    std::lock_guard<std::mutex> guard(shared.lock);
+    Snapshot sums = shared.retired;
+    for (const ThreadBlock* block : shared.live) {
+        addTo(*block, sums);
+    }
+    return sums;
+}
+
+// Function to start again from zero. Counts a running thread adds at the same
+// moment may be lost, as it does not lock its block.
+void Metrics::reset() {
+    Registry& shared = registry();
+    std::lock_guard<std::mutex> guard(shared.lock);
+    shared.retired = Snapshot();
+    for (ThreadBlock* block : shared.live) {
+        for (int op = 0; op < OPERATION_COUNT; op++) {
+            for (int b = 0; b < Histogram::BUCKETS; b++) {
+                block->buckets[op][b].store(0, std::memory_order_relaxed);
+            }
+            block->calls[op].store(0, std::memory_order_relaxed);
+            block->total[op].store(0, std::memory_order_relaxed);
+            block->max[op].store(0, std::memory_order_relaxed);
+        }
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            block->counters[c].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+const char* Metrics::name(Operation operation) {
+    static const char* const NAMES[OPERATION_COUNT] = {
+        "insert_directory", "insert_file", "search", "locate", "list_directory", "remove",
+        "find",             "move_queue",  "backup", "restore", "rename",        "sort",
+        "save",             "open",        "checkpoint", "import", "set_metadata", "stat",
+        "write_file",       "read_file",   "copy",   "remove_tree", "copy_tree",
+        "replicate",        "replication_lag", "mirror_batch", "diff"};
+    return operation < OPERATION_COUNT ? NAMES[operation] : "unknown";
+}
+
+const char* Metrics::name(Counter counter) {
+    static const char* const NAMES[COUNTER_COUNT] = {
+        "path_lookups",     "path_components", "dentry_hits",   "entry_lookups",  "index_lookups",
+        "directory_copies", "entries_copied",  "entries_moved", "journal_records",
+        "name_filter_rejects", "name_filter_false_positives", "directory_filter_rejects",
+        "directory_filter_false_positives", "replicated_records", "mirror_events",
+        "entry_arrays_built"};
+    return counter < COUNTER_COUNT ? NAMES[counter] : "unknown";
+}
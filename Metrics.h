@@ -0,0 +1,144 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// Call counts and latency histograms per public FileSystem operation, plus
+// counters for the work done inside them (path components walked, entries
+// copied, ...). Every thread records into its own block without locks or
+// read-modify-write atomics; collect() sums the blocks of live threads and of
+// threads that have exited.
+//
+// Recording is compiled in only when FILESYSTEM_METRICS is defined (build with
+// -DFILESYSTEM_METRICS); otherwise METRICS_TIME and METRICS_COUNT expand to
+// nothing and collect() returns zeros.
+class Metrics {
+public:
+    enum Operation : std::uint8_t {
+        INSERT_DIRECTORY,
+        INSERT_FILE,
+        SEARCH,
+        LOCATE,
+        LIST_DIRECTORY,
+        REMOVE,
+        FIND,        // prefix, suffix and pattern queries
+        MOVE_QUEUE,  // one processMoveQueue call
+        BACKUP,
+        RESTORE,
+        RENAME,
+        SORT,
+        SAVE,
+        OPEN,
+        CHECKPOINT,
+        IMPORT,
+        SET_METADATA,
+        STAT,        // stat, usage and modifiedSince
+        WRITE_FILE,
+        READ_FILE,
+        COPY,
+        REMOVE_TREE,
+        COPY_TREE,
+        REPLICATE,       // one batch of records applied on a replica
+        REPLICATION_LAG, // not a call: from a change on the primary to its replay on a replica
+        MIRROR_BATCH,    // one batch of host changes applied by a mirror
+        DIFF,
+        OPERATION_COUNT
+    };
+
+    enum Counter : std::uint8_t {
+        PATH_LOOKUPS,                     // directory paths resolved
+        PATH_COMPONENTS,                  // components walked while resolving them
+        DENTRY_HITS,                      // lookups that started from a cached prefix
+        ENTRY_LOOKUPS,                    // single entries looked up in a directory
+        INDEX_LOOKUPS,                    // names looked up in the search index
+        DIRECTORY_COPIES,                 // directories copied because a backup or reader shared them
+        ENTRIES_COPIED,                   // entries in those copies
+        ENTRIES_MOVED,                    // entries moved by processMoveQueue
+        JOURNAL_RECORDS,                  // records appended to the journal
+        NAME_FILTER_REJECTS,              // names the name filter ruled out before the search index
+        NAME_FILTER_FALSE_POSITIVES,      // names it let through that no directory held
+        DIRECTORY_FILTER_REJECTS,         // names an image directory's filter ruled out before its search
+        DIRECTORY_FILTER_FALSE_POSITIVES, // names it let through that the directory did not hold
+        REPLICATED_RECORDS,               // records applied on a replica
+        MIRROR_EVENTS,                    // inotify reports read by a mirror
+        ENTRY_ARRAYS_BUILT,               // directories laid out contiguously for scanning
+        COUNTER_COUNT
+    };
+
+    // Latencies in nanoseconds, in buckets of an eighth of a power of two
+    class Histogram {
+    public:
+        static constexpr int SUB_BUCKETS = 8;
+        static constexpr int BUCKETS = 64 * SUB_BUCKETS;
+
+        std::uint64_t buckets[BUCKETS];
+        std::uint64_t count;
+        std::uint64_t total;
+        std::uint64_t max;
+
+        Histogram();
+
+        // Function to return the latency at or below which the given fraction of calls finished
+        std::uint64_t percentile(double fraction) const;
+
+        static std::size_t bucketOf(std::uint64_t nanoseconds);
+    };
+
+    class Snapshot {
+    public:
+        Histogram operations[OPERATION_COUNT];
+        std::uint64_t counters[COUNTER_COUNT];
+        Snapshot();
+    };
+
+    // Records the time from construction to destruction against one operation
+    class Timer {
+    public:
+        explicit Timer(Operation op) : operation(op), start(std::chrono::steady_clock::now()) {}
+        ~Timer() {
+            record(operation, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  std::chrono::steady_clock::now() - start).count()));
+        }
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+    private:
+        Operation operation;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    static constexpr bool enabled() {
+#ifdef FILESYSTEM_METRICS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // Function to record one call on the calling thread
+    static void record(Operation operation, std::uint64_t nanoseconds);
+
+    // Function to add to a counter on the calling thread
+    static void count(Counter counter, std::uint64_t amount);
+
+    // Function to sum what every thread has recorded
+    static Snapshot collect();
+
+    // Function to start every count and histogram again from zero
+    static void reset();
+
+    static const char* name(Operation operation);
+    static const char* name(Counter counter);
+};
+
+#ifdef FILESYSTEM_METRICS
+#define METRICS_TIME(operation) Metrics::Timer metricsTimer(Metrics::operation)
+#define METRICS_COUNT(counter, amount) Metrics::count(Metrics::counter, amount)
+#else
+#define METRICS_TIME(operation) ((void)0)
+#define METRICS_COUNT(counter, amount) ((void)0)
+#endif
+
+#endif // METRICS_H
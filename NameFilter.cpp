@@ -0,0 +1,99 @@
+#include "NameFilter.h"
+
+// Implementation of NameFilter constructor
+NameFilter::NameFilter(std::size_t expected) : blocks(1), count(0) {
+    while (blocks * NAMES_PER_BLOCK < expected) {
+        blocks *= 2;
+    }
+    data.reset(new std::atomic<std::uint8_t>[blocks * BLOCK_BYTES]);
+    for (std::size_t i = 0; i < blocks * BLOCK_BYTES; i++) {
+        data[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+// Implementation of NameFilter constructor from stored counters
+NameFilter::NameFilter(const std::uint8_t* counters, std::size_t length, std::size_t names)
+    : blocks(length / BLOCK_BYTES), count(names) {
+    data.reset(new std::atomic<std::uint8_t>[length]);
+    for (std::size_t i = 0; i < length; i++) {
+        data[i].store(counters[i], std::memory_order_relaxed);
+    }
+}
+
+// Function to count one more entry with this name
+void NameFilter::add(NameId name) {
+    std::uint64_t hash = mix(name);
+    std::atomic<std::uint8_t>* block = blockOf(hash);
+    for (int probe = 0; probe < PROBES; probe++) {
+        unsigned counter = static_cast<unsigned>(hash >> (7 * probe)) & (COUNTERS_PER_BLOCK - 1);
+        unsigned shift = (counter & 1) * 4;
+        std::uint8_t pair = block[counter >> 1].load(std::memory_order_relaxed);
+        if (((pair >> shift) & 15) != 15) {
+            block[counter >> 1].store(static_cast<std::uint8_t>(pair + (1u << shift)), std::memory_order_release);
+        }
+    }
+    count++;
+}
+
+// Function to count one entry with this name less; saturated counters stay put
+void NameFilter::remove(NameId name) {
+    std::uint64_t hash = mix(name);
+    std::atomic<std::uint8_t>* block = blockOf(hash);
+    for (int probe = 0; probe < PROBES; probe++) {
+        unsigned counter = static_cast<unsigned>(hash >> (7 * probe)) & (COUNTERS_PER_BLOCK - 1);
+        unsigned shift = (counter & 1) * 4;
+        std::uint8_t pair = block[counter >> 1].load(std::memory_order_relaxed);
+        unsigned value = (pair >> shift) & 15;
+        if (value != 0 && value != 15) {
+            block[counter >> 1].store(static_cast<std::uint8_t>(pair - (1u << shift)), std::memory_order_release);
+        }
+    }
+    if (count > 0) {
+        count--;
+    }
+}
+
+// Function to copy the counters out
+std::vector<std::uint8_t> NameFilter::counters() const {
+    std::vector<std::uint8_t> copy(blocks * BLOCK_BYTES);
+    for (std::size_t i = 0; i < copy.size(); i++) {
+        copy[i] = data[i].load(std::memory_order_relaxed);
+    }
+    return copy;
+}
+
+// Function to check a stored counter length: a power of two number of blocks
+bool NameFilter::validLength(std::uint64_t length) {
+    std::uint64_t blockCount = length / BLOCK_BYTES;
+    return length % BLOCK_BYTES == 0 && blockCount != 0 && (blockCount & (blockCount - 1)) == 0;
+}
+
+// Function to size a directory filter: a power of two number of words
+std::size_t NameFilter::wordsFor(std::size_t names) {
+    std::size_t words = 1;
+    while (words * NAMES_PER_WORD < names) {
+        words *= 2;
+    }
+    return words;
+}
+
+// Function to add a name to a directory filter
+void NameFilter::addTo(std::uint64_t* words, std::size_t wordCount, NameId name) {
+    std::uint64_t hash = mix(name);
+    std::uint64_t& word = words[(hash >> 32) & (wordCount - 1)];
+    for (int probe = 0; probe < WORD_PROBES; probe++) {
+        word |= std::uint64_t(1) << ((hash >> (6 * probe)) & 63);
+    }
+}
+
+// Function to probe a directory filter
+bool NameFilter::mayContain(const std::uint64_t* words, std::size_t wordCount, NameId name) {
+    std::uint64_t hash = mix(name);
+    std::uint64_t word = words[(hash >> 32) & (wordCount - 1)];
+    for (int probe = 0; probe < WORD_PROBES; probe++) {
+        if ((word & (std::uint64_t(1) << ((hash >> (6 * probe)) & 63))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
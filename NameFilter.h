@@ -0,0 +1,100 @@
+#ifndef NAME_FILTER_H
+#define NAME_FILTER_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "NameTable.h"
+
+// Counting Bloom filter over name ids: answers "no entry has this name" without
+// touching an index. Counters are four bits, two to a byte, and all the probes
+// of one name fall in the same 64-byte block, so a lookup reads one cache line.
+// A counter that reaches 15 stays there (removing can no longer tell how many
+// names share it), which only costs false positives.
+//
+// One writer at a time may add and remove names while any number of readers
+// call mayContain() without locks.
+//
+// The static functions build and probe the fixed filters the image keeps for
+// its larger directories: one 64-bit word per probe, never changed once written.
+class NameFilter {
+public:
+    static constexpr std::size_t BLOCK_BYTES = 64;
+
+    // Filter sized for about expected names
+    explicit NameFilter(std::size_t expected);
+
+    // Filter holding the counters of another, as written by counters()
+    NameFilter(const std::uint8_t* data, std::size_t length, std::size_t names);
+
+    NameFilter(const NameFilter&) = delete;
+    NameFilter& operator=(const NameFilter&) = delete;
+
+    void add(NameId name);
+    void remove(NameId name);
+
+    bool mayContain(NameId name) const {
+        std::uint64_t hash = mix(name);
+        const std::atomic<std::uint8_t>* block = blockOf(hash);
+        for (int probe = 0; probe < PROBES; probe++) {
+            unsigned counter = static_cast<unsigned>(hash >> (7 * probe)) & (COUNTERS_PER_BLOCK - 1);
+            std::uint8_t pair = block[counter >> 1].load(std::memory_order_relaxed);
+            if (((counter & 1) ? pair >> 4 : pair & 15) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Names added and not removed, and how many the filter was sized for
+    std::size_t size() const {
+        return count;
+    }
+
+    std::size_t capacity() const {
+        return blocks * NAMES_PER_BLOCK;
+    }
+
+    std::size_t bytes() const {
+        return blocks * BLOCK_BYTES;
+    }
+
+    // Function to copy the counters out, to be stored and read back later
+    std::vector<std::uint8_t> counters() const;
+
+    // Function to check that length bytes of counters could have come from counters()
+    static bool validLength(std::uint64_t length);
+
+    // Functions for fixed directory filters of the given number of 64-bit words
+    static std::size_t wordsFor(std::size_t names);
+    static void addTo(std::uint64_t* words, std::size_t wordCount, NameId name);
+    static bool mayContain(const std::uint64_t* words, std::size_t wordCount, NameId name);
+
+private:
+    static constexpr int PROBES = 5;
+    static constexpr unsigned COUNTERS_PER_BLOCK = BLOCK_BYTES * 2;
+    static constexpr std::size_t NAMES_PER_BLOCK = 16; // eight counters per name
+    static constexpr int WORD_PROBES = 3;
+    static constexpr std::size_t NAMES_PER_WORD = 4;   // sixteen bits per name
+
+    std::unique_ptr<std::atomic<std::uint8_t>[]> data;
+    std::size_t blocks; // a power of two
+    std::size_t count;
+
+    static std::uint64_t mix(NameId name) {
+        std::uint64_t hash = static_cast<std::uint64_t>(name) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+        hash *= 0xBF58476D1CE4E5B9ULL;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    // The probes use the low 35 bits of the hash, the block the high ones
+    std::atomic<std::uint8_t>* blockOf(std::uint64_t hash) const {
+        return data.get() + ((hash >> 40) & (blocks - 1)) * BLOCK_BYTES;
+    }
+};
+
+#endif // NAME_FILTER_H
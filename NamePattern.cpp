@@ -0,0 +1,114 @@
+#include "NamePattern.h"
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Implementation of NamePattern constructor
+NamePattern::NamePattern(const std::string& pattern) : glob(pattern), minLength(0), wildcards(false) {
+    std::size_t first = glob.find_first_of("*?");
+    if (first == std::string::npos) {
+        head = glob;
+        minLength = glob.size();
+        return;
+    }
+    wildcards = true;
+    std::size_t last = glob.find_last_of("*?");
+    head = glob.substr(0, first);
+    tail = glob.substr(last + 1);
+    for (char c : glob) {
+        if (c != '*') {
+            minLength++;
+        }
+    }
+
+    // The longest literal run strictly between head and tail
+    std::size_t runStart = first;
+    for (std::size_t i = first; i <= last + 1; i++) {
+        if (i == last + 1 || glob[i] == '*' || glob[i] == '?') {
+            if (i - runStart > needle.size()) {
+                needle = glob.substr(runStart, i - runStart);
+            }
+            runStart = i + 1;
+        }
+    }
+}
+
+// Function to check whether text contains needle. Every 16 candidate positions are
+// tested at once by comparing the needle's first and last characters; only positions
+// where both agree are compared in full.
+bool NamePattern::contains(std::string_view text, std::string_view needle) {
+    std::size_t n = text.size();
+    std::size_t m = needle.size();
+    if (m > n) {
+        return false;
+    }
+    const char* s = text.data();
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        __m128i blockLast = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + m - 1));
+        unsigned mask = static_cast<unsigned>(
+            _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(blockFirst, first), _mm_cmpeq_epi8(blockLast, last))));
+        while (mask != 0) {
+            unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+            if (m <= 2 || std::memcmp(s + i + bit + 1, needle.data() + 1, m - 2) == 0) {
+                return true;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    // Positions left over (or every position without SSE2)
+    for (; i + m <= n; i++) {
+        if (s[i] == needle[0] && std::memcmp(s + i, needle.data(), m) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Function to check whether a whole name matches the pattern
+bool NamePattern::matches(std::string_view name) const {
+    if (!wildcards) {
+        return name == head;
+    }
+    if (name.size() < minLength || name.compare(0, head.size(), head) != 0 ||
+        name.compare(name.size() - tail.size(), tail.size(), tail) != 0) {
+        return false;
+    }
+    std::string_view middle = name.substr(head.size(), name.size() - head.size() - tail.size());
+    if (!needle.empty() && !contains(middle, needle)) {
+        return false;
+    }
+    return globMatches(name);
+}
+
+// Private helper function to run the glob itself, backtracking only to the last '*'
+bool NamePattern::globMatches(std::string_view name) const {
+    std::size_t p = 0;
+    std::size_t i = 0;
+    std::size_t star = std::string::npos;
+    std::size_t resume = 0;
+    while (i < name.size()) {
+        if (p < glob.size() && (glob[p] == '?' || glob[p] == name[i])) {
+            p++;
+            i++;
+        } else if (p < glob.size() && glob[p] == '*') {
+            star = p++;
+            resume = i;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            i = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (p < glob.size() && glob[p] == '*') {
+        p++;
+    }
+    return p == glob.size();
+}
@@ -0,0 +1,50 @@
+#ifndef NAME_PATTERN_H
+#define NAME_PATTERN_H
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+// A glob over entry names: '*' matches any run of characters (including none),
+// '?' any single character, and every other character itself.
+//
+// matches() rejects most names before running the glob: the literal text before
+// the first wildcard and after the last one must frame the name, and the longest
+// literal run in between must occur in it. That search runs 16 bytes at a time
+// with SSE2 where available.
+class NamePattern {
+public:
+    explicit NamePattern(const std::string& glob);
+
+    // Function to check whether a whole name matches the pattern
+    bool matches(std::string_view name) const;
+
+    // Literal text before the first wildcard (the whole pattern if there is none)
+    const std::string& prefix() const {
+        return head;
+    }
+
+    // Literal text after the last wildcard (empty if there is none)
+    const std::string& suffix() const {
+        return tail;
+    }
+
+    bool hasWildcards() const {
+        return wildcards;
+    }
+
+    // Function to check whether text contains needle (a non-empty needle)
+    static bool contains(std::string_view text, std::string_view needle);
+
+private:
+    std::string glob;
+    std::string head;
+    std::string tail;
+    std::string needle;    // longest literal run between head and tail
+    std::size_t minLength; // characters every match needs: literals and '?'s
+    bool wildcards;
+
+    bool globMatches(std::string_view name) const;
+};
+
+#endif // NAME_PATTERN_H
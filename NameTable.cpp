@@ -0,0 +1,189 @@
+#include "NameTable.h"
+#include <cstring>
+#include <new>
+
+// Implementation of NameTable constructor
+NameTable::NameTable()
+    : chunkUsed(CHUNK_SIZE), count(0), slots(allocateSlots(64)), storedBytes(0), savedBlob(nullptr), savedOffsets(nullptr),
+      savedHashes(nullptr), savedSlots(nullptr), savedSlotCount(0), savedCount(0) {
+    for (std::atomic<Entry*>& segment : segments) {
+        segment.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+// Implementation of NameTable destructor
+NameTable::~NameTable() {
+    reset();
+    ::operator delete(slots.load(std::memory_order_relaxed));
+}
+
+// Private helper function to hash a name (FNV-1a)
+std::uint32_t NameTable::hashName(std::string_view name) {
+    std::uint32_t hash = 2166136261u;
+    for (char c : name) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Private helper function to copy a name into chunk storage
+const char* NameTable::store(std::string_view name) {
+    if (name.size() > CHUNK_SIZE / 4) {
+        // Long names get a chunk of their own, kept ahead of the current chunk
+        // so that chunks.back() is still the one being filled
+        char* chunk = new char[name.size()];
+        std::memcpy(chunk, name.data(), name.size());
+        chunks.insert(chunks.end() - (chunks.empty() ? 0 : 1), chunk);
+        storedBytes += name.size();
+        return chunk;
+    }
+    if (chunks.empty() || chunkUsed + name.size() > CHUNK_SIZE) {
+        chunks.push_back(new char[CHUNK_SIZE]);
+        chunkUsed = 0;
+    }
+    char* data = chunks.back() + chunkUsed;
+    std::memcpy(data, name.data(), name.size());
+    chunkUsed += name.size();
+    storedBytes += name.size();
+    return data;
+}
+
+// Private helper function to allocate an empty slot table
+NameTable::SlotTable* NameTable::allocateSlots(std::size_t capacity) {
+    SlotTable* table = static_cast<SlotTable*>(::operator new(sizeof(SlotTable) + capacity * sizeof(std::atomic<NameId>)));
+    table->capacity = capacity;
+    for (std::size_t i = 0; i < capacity; i++) {
+        new (&table->ids()[i]) std::atomic<NameId>(NONE);
+    }
+    return table;
+}
+
+// Private helper function to double the slot table, publishing the new one whole
+void NameTable::grow() {
+    SlotTable* old = slots.load(std::memory_order_relaxed);
+    SlotTable* bigger = allocateSlots(old->capacity * 2);
+    std::size_t mask = bigger->capacity - 1;
+    std::size_t stored = count.load(std::memory_order_relaxed);
+    for (std::size_t index = 0; index < stored; index++) {
+        std::size_t i = entry(index).hash & mask;
+        while (bigger->ids()[i].load(std::memory_order_relaxed) != NONE) {
+            i = (i + 1) & mask;
+        }
+        bigger->ids()[i].store(static_cast<NameId>(savedCount + index), std::memory_order_relaxed);
+    }
+    slots.store(bigger, std::memory_order_release);
+    oldSlots.push_back(old);
+}
+
+// Private helper function to free every in-memory name and start over with an empty table
+void NameTable::reset() {
+    for (char* chunk : chunks) {
+        delete[] chunk;
+    }
+    chunks.clear();
+    chunkUsed = CHUNK_SIZE;
+    for (std::atomic<Entry*>& segment : segments) {
+        delete[] segment.exchange(nullptr, std::memory_order_relaxed);
+    }
+    count.store(0, std::memory_order_relaxed);
+    for (SlotTable* old : oldSlots) {
+        ::operator delete(old);
+    }
+    oldSlots.clear();
+    ::operator delete(slots.exchange(allocateSlots(64), std::memory_order_relaxed));
+    storedBytes = 0;
+}
+
+// Private helper function to look a name up in the attached saved table
+NameId NameTable::findSaved(std::string_view name, std::uint32_t hash) const {
+    if (savedSlotCount == 0) {
+        return NONE;
+    }
+    std::size_t mask = savedSlotCount - 1;
+    std::size_t i = hash & mask;
+    while (savedSlots[i] != NONE) {
+        NameId id = savedSlots[i];
+        if (savedHashes[id] == hash && str(id) == name) {
+            return id;
+        }
+        i = (i + 1) & mask;
+    }
+    return NONE;
+}
+
+// Private helper function to look a name up among the names stored in memory
+NameId NameTable::findStored(std::string_view name, std::uint32_t hash) const {
+    SlotTable* table = slots.load(std::memory_order_acquire);
+    std::size_t mask = table->capacity - 1;
+    for (std::size_t i = hash & mask;; i = (i + 1) & mask) {
+        NameId id = table->ids()[i].load(std::memory_order_acquire);
+        if (id == NONE) {
+            return NONE;
+        }
+        const Entry& stored = entry(id - savedCount);
+        if (stored.hash == hash && std::string_view(stored.data, stored.length) == name) {
+            return id;
+        }
+    }
+}
+
+// Function to get the id of a name, adding it if it is new
+NameId NameTable::intern(std::string_view name) {
+    std::uint32_t hash = hashName(name);
+    NameId found = findSaved(name, hash);
+    if (found == NONE) {
+        found = findStored(name, hash);
+    }
+    if (found != NONE) {
+        return found;
+    }
+
+    // Fill the entry before its id becomes reachable through the slot table
+    std::size_t segment;
+    std::size_t offset;
+    std::size_t index = count.load(std::memory_order_relaxed);
+    locate(index, segment, offset);
+    Entry* entries = segments[segment].load(std::memory_order_relaxed);
+    if (entries == nullptr) {
+        entries = new Entry[FIRST_SEGMENT << segment];
+        segments[segment].store(entries, std::memory_order_release);
+    }
+    entries[offset].data = store(name);
+    entries[offset].length = static_cast<std::uint32_t>(name.size());
+    entries[offset].hash = hash;
+
+    NameId id = static_cast<NameId>(savedCount + index);
+    count.store(index + 1, std::memory_order_release);
+    SlotTable* table = slots.load(std::memory_order_relaxed);
+    std::size_t mask = table->capacity - 1;
+    std::size_t i = hash & mask;
+    while (table->ids()[i].load(std::memory_order_relaxed) != NONE) {
+        i = (i + 1) & mask;
+    }
+    table->ids()[i].store(id, std::memory_order_release);
+    if ((index + 1) * 10 >= table->capacity * 7) {
+        grow();
+    }
+    return id;
+}
+
+// Function to get the id of a name without adding it
+NameId NameTable::find(std::string_view name) const {
+    std::uint32_t hash = hashName(name);
+    NameId saved = findSaved(name, hash);
+    return saved != NONE ? saved : findStored(name, hash);
+}
+
+// Function to drop every name and serve the first ids from a saved table
+void NameTable::attach(const char* blob, const std::uint64_t* offsets, const std::uint32_t* savedHashTable,
+                       const NameId* savedSlotTable, std::size_t slotCount, NameId nameCount) {
+    reset();
+
+    savedBlob = blob;
+    savedOffsets = offsets;
+    savedHashes = savedHashTable;
+    savedSlots = savedSlotTable;
+    savedSlotCount = slotCount;
+    savedCount = nameCount;
+}
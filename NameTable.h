@@ -0,0 +1,156 @@
+#ifndef NAME_TABLE_H
+#define NAME_TABLE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+typedef std::uint32_t NameId;
+
+// String interning table. Every distinct name is stored once in chunked
+// storage and referred to everywhere else by a 32-bit id. Names live until
+// the table is destroyed.
+//
+// The table can also be attached to a saved table (a mapped image): ids below
+// the saved count are then served straight from the saved arrays and only
+// names interned afterwards are stored in memory.
+//
+// intern() needs external serialization, but find(), str() and size() may run
+// concurrently with it: entries live in segments that never move, and a
+// grown slot table is published whole while the old ones are kept until
+// the table is destroyed (together they are smaller than the newest one).
+class NameTable {
+private:
+    static constexpr std::size_t CHUNK_SIZE = 64 * 1024;
+    static constexpr unsigned FIRST_SEGMENT_BITS = 10;           // segment k holds 1024 << k entries
+    static constexpr std::size_t FIRST_SEGMENT = std::size_t(1) << FIRST_SEGMENT_BITS;
+    static constexpr std::size_t SEGMENT_COUNT = 23;             // enough for every 32-bit id
+
+    class Entry {
+    public:
+        const char* data;
+        std::uint32_t length;
+        std::uint32_t hash;
+    };
+
+    // Open-addressing table of in-memory ids; the ids follow the header
+    class SlotTable {
+    public:
+        std::size_t capacity;
+        std::atomic<NameId>* ids() {
+            return reinterpret_cast<std::atomic<NameId>*>(this + 1);
+        }
+    };
+
+    std::vector<char*> chunks;            // name storage, freed in bulk
+    std::size_t chunkUsed;                // bytes used in chunks.back()
+    std::atomic<Entry*> segments[SEGMENT_COUNT]; // (id - savedCount) -> name and hash
+    std::atomic<std::size_t> count;       // names stored in memory, published after their entry
+    std::atomic<SlotTable*> slots;
+    std::vector<SlotTable*> oldSlots;     // outgrown tables, readers may still probe them
+    std::size_t storedBytes;
+
+    // Attached saved table, all empty when not attached
+    const char* savedBlob;
+    const std::uint64_t* savedOffsets;    // savedCount + 1 offsets into savedBlob
+    const std::uint32_t* savedHashes;
+    const NameId* savedSlots;
+    std::size_t savedSlotCount;
+    NameId savedCount;
+
+    const char* store(std::string_view name);
+    void grow();
+    void reset();
+    NameId findSaved(std::string_view name, std::uint32_t hash) const;
+    NameId findStored(std::string_view name, std::uint32_t hash) const;
+    static SlotTable* allocateSlots(std::size_t capacity);
+
+    // Segment and offset of the index-th in-memory entry
+    static void locate(std::size_t index, std::size_t& segment, std::size_t& offset) {
+        std::size_t biased = index + FIRST_SEGMENT;
+#if defined(__GNUC__)
+        unsigned bits = 63 - static_cast<unsigned>(__builtin_clzll(biased));
+#else
+        unsigned bits = 0;
+        while ((biased >> bits) > 1) {
+            bits++;
+        }
+#endif
+        segment = bits - FIRST_SEGMENT_BITS;
+        offset = biased - (FIRST_SEGMENT << segment);
+    }
+
+    const Entry& entry(std::size_t index) const {
+        std::size_t segment;
+        std::size_t offset;
+        locate(index, segment, offset);
+        return segments[segment].load(std::memory_order_acquire)[offset];
+    }
+
+public:
+    static constexpr NameId NONE = 0xFFFFFFFFu;
+
+    // Hash used for every slot table, stable across processes (FNV-1a)
+    static std::uint32_t hashName(std::string_view name);
+
+    NameTable();
+    ~NameTable();
+
+    NameTable(const NameTable&) = delete;
+    NameTable& operator=(const NameTable&) = delete;
+
+    // Function to get the id of a name, adding it if it is new
+    NameId intern(std::string_view name);
+
+    // Function to get the id of a name without adding it, NONE if it was never interned
+    NameId find(std::string_view name) const;
+
+    std::string_view str(NameId id) const {
+        if (id < savedCount) {
+            return std::string_view(savedBlob + savedOffsets[id], savedOffsets[id + 1] - savedOffsets[id]);
+        }
+        const Entry& stored = entry(id - savedCount);
+        return std::string_view(stored.data, stored.length);
+    }
+
+    std::size_t size() const {
+        return savedCount + count.load(std::memory_order_acquire);
+    }
+
+    // Function to drop every name and serve ids [0, nameCount) from a saved table instead.
+    // The saved arrays must outlive the table (or the next attach); no reader may run.
+    void attach(const char* blob, const std::uint64_t* offsets, const std::uint32_t* savedHashTable,
+                const NameId* savedSlotTable, std::size_t slotCount, NameId nameCount);
+
+    // Bytes of name storage held by the table
+    std::size_t bytes() const {
+        return storedBytes;
+    }
+};
+
+// Orders interned ids by the names they stand for
+class NameOrder {
+private:
+    const NameTable* table;
+
+public:
+    NameOrder(const NameTable* names) : table(names) {}
+
+    bool operator()(NameId a, NameId b) const {
+        return table->str(a) < table->str(b);
+    }
+
+    // Names against plain text, for range lookups by prefix
+    bool operator()(NameId a, std::string_view b) const {
+        return table->str(a) < b;
+    }
+
+    bool operator()(std::string_view a, NameId b) const {
+        return a < table->str(b);
+    }
+};
+
+#endif // NAME_TABLE_H
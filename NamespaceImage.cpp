@@ -0,0 +1,295 @@
+#include "NamespaceImage.h"
+#include "ContentStore.h"
+#include "NameFilter.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char MAGIC[8] = {'F', 'S', 'I', 'M', 'A', 'G', 'E', '\0'};
+
+std::uint64_t align8(std::uint64_t offset) {
+    return (offset + 7) & ~static_cast<std::uint64_t>(7);
+}
+
+template <typename T>
+void writeSection(std::ofstream& out, std::uint64_t at, const T* data, std::size_t count) {
+    // Pad up to the section start
+    static const char zeros[8] = {0};
+    std::uint64_t position = static_cast<std::uint64_t>(out.tellp());
+    out.write(zeros, static_cast<std::streamsize>(at - position));
+    out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(count * sizeof(T)));
+}
+
+// Check that every section lies inside the file, in layout order, and the root exists
+bool sectionsFit(const NamespaceImage::Header& h) {
+    std::uint64_t ends[] = {
+        sizeof(NamespaceImage::Header),
+        h.nameOffsetsAt, h.nameOffsetsAt + (h.nameCount + 1) * sizeof(std::uint64_t),
+        h.nameBlobAt, h.nameHashesAt, h.nameHashesAt + h.nameCount * sizeof(std::uint32_t),
+        h.nameSlotsAt, h.nameSlotsAt + h.slotCount * sizeof(NameId),
+        h.directoriesAt, h.directoriesAt + h.directoryCount * sizeof(NamespaceImage::Directory),
+        h.entriesAt, h.entriesAt + h.entryCount * sizeof(NamespaceImage::Entry),
+        h.sortedAt, h.sortedAt + h.entryCount * sizeof(std::uint32_t),
+        h.holdersAt, h.holdersAt + h.entryCount * sizeof(NamespaceImage::Holder),
+        h.nameFilterAt, h.nameFilterAt + h.nameFilterBytes,
+        h.directoryFiltersAt, h.directoryFiltersAt + h.directoryFilterWords * sizeof(std::uint64_t),
+        h.blobsAt, h.blobsAt + h.blobCount * sizeof(NamespaceImage::Blob),
+        h.blobDataAt};
+    for (std::size_t i = 1; i < sizeof(ends) / sizeof(ends[0]); i++) {
+        if (ends[i] < ends[i - 1]) {
+            return false;
+        }
+    }
+    bool slotsPowerOfTwo = h.slotCount != 0 && (h.slotCount & (h.slotCount - 1)) == 0;
+    return ends[sizeof(ends) / sizeof(ends[0]) - 1] <= h.fileSize && slotsPowerOfTwo && h.directoryCount > 0 &&
+           NameFilter::validLength(h.nameFilterBytes) &&
+           h.nameCount < NameTable::NONE && h.directoryCount < NamespaceImage::NO_DIRECTORY;
+}
+
+// Check that every directory's entries and filter lie inside their sections and its parent exists
+bool directoriesFit(const NamespaceImage::Header& h, const void* base) {
+    const NamespaceImage::Directory* directories =
+        reinterpret_cast<const NamespaceImage::Directory*>(static_cast<const char*>(base) + h.directoriesAt);
+    for (std::uint64_t id = 0; id < h.directoryCount; id++) {
+        const NamespaceImage::Directory& dir = directories[id];
+        bool isRoot = id == 0;
+        if (static_cast<std::uint64_t>(dir.firstEntry) + dir.entryCount > h.entryCount || dir.name >= h.nameCount ||
+            (isRoot ? dir.parent != NamespaceImage::NO_DIRECTORY : dir.parent >= h.directoryCount)) {
+            return false;
+        }
+        if (dir.filter != NamespaceImage::NO_FILTER &&
+            static_cast<std::uint64_t>(dir.filter) + NameFilter::wordsFor(dir.entryCount) > h.directoryFilterWords) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Check that every blob lies inside the blob data
+bool blobsFit(const NamespaceImage::Header& h, const void* base) {
+    const NamespaceImage::Blob* blobs =
+        reinterpret_cast<const NamespaceImage::Blob*>(static_cast<const char*>(base) + h.blobsAt);
+    std::uint64_t dataLength = h.fileSize - h.blobDataAt;
+    for (std::uint64_t i = 0; i < h.blobCount; i++) {
+        if (blobs[i].offset > dataLength || blobs[i].length > dataLength - blobs[i].offset) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Flush a file (or directory) to stable storage
+bool syncPath(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+}
+
+} // namespace
+
+// Implementation of NamespaceImage constructor
+NamespaceImage::NamespaceImage() : base(nullptr), length(0) {}
+
+// Implementation of NamespaceImage destructor
+NamespaceImage::~NamespaceImage() {
+    if (base != nullptr) {
+        munmap(base, length);
+    }
+}
+
+// Function to write an image
+bool NamespaceImage::write(const std::string& path, const NameTable& names, std::vector<Directory>& directories,
+                           const std::vector<Entry>& entries, const std::vector<std::uint32_t>& sorted,
+                           const std::vector<std::string_view>& blobs, std::uint64_t journalSequence, std::string& error) {
+    // String table: offsets, blob, hashes and a slot table at most half full
+    std::size_t nameCount = names.size();
+    std::vector<std::uint64_t> offsets(nameCount + 1, 0);
+    std::vector<std::uint32_t> hashes(nameCount);
+    for (std::size_t id = 0; id < nameCount; id++) {
+        offsets[id + 1] = offsets[id] + names.str(static_cast<NameId>(id)).size();
+        hashes[id] = NameTable::hashName(names.str(static_cast<NameId>(id)));
+    }
+    std::size_t slotCount = 16;
+    while (slotCount < nameCount * 2) {
+        slotCount *= 2;
+    }
+    std::vector<NameId> slots(slotCount, NameTable::NONE);
+    for (std::size_t id = 0; id < nameCount; id++) {
+        std::size_t i = hashes[id] & (slotCount - 1);
+        while (slots[i] != NameTable::NONE) {
+            i = (i + 1) & (slotCount - 1);
+        }
+        slots[i] = static_cast<NameId>(id);
+    }
+
+    // Holders: every (name, directory) pair, ordered by name
+    std::vector<Holder> holders;
+    holders.reserve(entries.size());
+    for (std::uint32_t dir = 0; dir < directories.size(); dir++) {
+        for (std::uint32_t i = 0; i < directories[dir].entryCount; i++) {
+            holders.push_back(Holder{entries[directories[dir].firstEntry + i].name, dir});
+        }
+    }
+    std::stable_sort(holders.begin(), holders.end(), [&names](const Holder& a, const Holder& b) {
+        return names.str(a.name) < names.str(b.name);
+    });
+
+    // Filters: counters over every entry's name (with room to grow before the
+    // file system has to rebuild them), and a word filter per larger directory
+    NameFilter nameFilter(entries.size() + entries.size() / 2);
+    for (const Entry& entry : entries) {
+        nameFilter.add(entry.name);
+    }
+    std::vector<std::uint8_t> nameCounters = nameFilter.counters();
+    std::vector<std::uint64_t> directoryFilters;
+    for (Directory& dir : directories) {
+        dir.filter = NO_FILTER;
+        if (dir.entryCount < DIRECTORY_FILTER_MIN) {
+            continue;
+        }
+        std::size_t words = NameFilter::wordsFor(dir.entryCount);
+        dir.filter = static_cast<std::uint32_t>(directoryFilters.size());
+        directoryFilters.resize(directoryFilters.size() + words, 0);
+        for (std::uint32_t i = 0; i < dir.entryCount; i++) {
+            NameFilter::addTo(directoryFilters.data() + dir.filter, words, entries[dir.firstEntry + i].name);
+        }
+    }
+
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.formatVersion = FORMAT_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.journalSequence = journalSequence;
+    header.nameCount = nameCount;
+    header.slotCount = slotCount;
+    header.directoryCount = directories.size();
+    header.entryCount = entries.size();
+    header.nameOffsetsAt = align8(sizeof(Header));
+    header.nameBlobAt = align8(header.nameOffsetsAt + offsets.size() * sizeof(std::uint64_t));
+    header.nameHashesAt = align8(header.nameBlobAt + offsets[nameCount]);
+    header.nameSlotsAt = align8(header.nameHashesAt + hashes.size() * sizeof(std::uint32_t));
+    header.directoriesAt = align8(header.nameSlotsAt + slots.size() * sizeof(NameId));
+    header.entriesAt = align8(header.directoriesAt + directories.size() * sizeof(Directory));
+    header.sortedAt = align8(header.entriesAt + entries.size() * sizeof(Entry));
+    header.holdersAt = align8(header.sortedAt + sorted.size() * sizeof(std::uint32_t));
+    std::vector<Blob> blobTable(blobs.size());
+    std::uint64_t dataLength = 0;
+    for (std::size_t i = 0; i < blobs.size(); i++) {
+        blobTable[i] = Blob{dataLength, blobs[i].size(), ContentStore::hashBytes(blobs[i])};
+        dataLength += blobs[i].size();
+    }
+    header.blobCount = blobTable.size();
+    header.nameFilterAt = align8(header.holdersAt + holders.size() * sizeof(Holder));
+    header.nameFilterBytes = nameCounters.size();
+    header.directoryFiltersAt = align8(header.nameFilterAt + nameCounters.size());
+    header.directoryFilterWords = directoryFilters.size();
+    header.blobsAt = align8(header.directoryFiltersAt + directoryFilters.size() * sizeof(std::uint64_t));
+    header.blobDataAt = align8(header.blobsAt + blobTable.size() * sizeof(Blob));
+    header.fileSize = header.blobDataAt + dataLength;
+
+    // Write to a temporary file and rename it over the target so a crash never leaves a torn image
+    std::string temporary = path + ".tmp";
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        error = "cannot create '" + temporary + "'";
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeSection(out, header.nameOffsetsAt, offsets.data(), offsets.size());
+    static const char zeros[8] = {0};
+    out.write(zeros, static_cast<std::streamsize>(header.nameBlobAt - static_cast<std::uint64_t>(out.tellp())));
+    for (std::size_t id = 0; id < nameCount; id++) {
+        std::string_view name = names.str(static_cast<NameId>(id));
+        out.write(name.data(), static_cast<std::streamsize>(name.size()));
+    }
+    writeSection(out, header.nameHashesAt, hashes.data(), hashes.size());
+    writeSection(out, header.nameSlotsAt, slots.data(), slots.size());
+    writeSection(out, header.directoriesAt, directories.data(), directories.size());
+    writeSection(out, header.entriesAt, entries.data(), entries.size());
+    writeSection(out, header.sortedAt, sorted.data(), sorted.size());
+    writeSection(out, header.holdersAt, holders.data(), holders.size());
+    writeSection(out, header.nameFilterAt, nameCounters.data(), nameCounters.size());
+    writeSection(out, header.directoryFiltersAt, directoryFilters.data(), directoryFilters.size());
+    writeSection(out, header.blobsAt, blobTable.data(), blobTable.size());
+    writeSection(out, header.blobDataAt, static_cast<const char*>(nullptr), 0);
+    for (std::string_view blob : blobs) {
+        out.write(blob.data(), static_cast<std::streamsize>(blob.size()));
+    }
+    out.close();
+    if (!out) {
+        error = "cannot write '" + temporary + "'";
+        return false;
+    }
+    if (!syncPath(temporary)) {
+        error = "cannot sync '" + temporary + "'";
+        return false;
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        error = "cannot replace '" + path + "'";
+        return false;
+    }
+    // Make the rename itself durable before a checkpoint drops the journal
+    std::string::size_type slash = path.rfind('/');
+    syncPath(slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash));
+    return true;
+}
+
+// Function to map an image read-only and validate its header
+bool NamespaceImage::map(const std::string& path, std::string& error) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "cannot open '" + path + "'";
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(Header)) {
+        ::close(fd);
+        error = "'" + path + "' is not a namespace image";
+        return false;
+    }
+    std::size_t size = static_cast<std::size_t>(info.st_size);
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        error = "cannot map '" + path + "'";
+        return false;
+    }
+
+    const Header* candidate = static_cast<const Header*>(mapped);
+    if (std::memcmp(candidate->magic, MAGIC, sizeof(MAGIC)) != 0 || candidate->byteOrder != BYTE_ORDER_MARK) {
+        error = "'" + path + "' is not a namespace image";
+    } else if (candidate->formatVersion != FORMAT_VERSION) {
+        error = "'" + path + "' has unsupported format version " + std::to_string(candidate->formatVersion);
+    } else if (candidate->fileSize != size) {
+        error = "'" + path + "' is truncated";
+    } else if (!sectionsFit(*candidate) || !directoriesFit(*candidate, mapped) || !blobsFit(*candidate, mapped)) {
+        error = "'" + path + "' is corrupt";
+    } else {
+        if (base != nullptr) {
+            munmap(base, length);
+        }
+        base = mapped;
+        length = size;
+        return true;
+    }
+    munmap(mapped, size);
+    return false;
+}
+
+// Function to attach a name table to the image's string table
+void NamespaceImage::attachNames(NameTable& names) const {
+    const Header& h = header();
+    names.attach(section<char>(h.nameBlobAt), section<std::uint64_t>(h.nameOffsetsAt), section<std::uint32_t>(h.nameHashesAt),
+                 section<NameId>(h.nameSlotsAt), static_cast<std::size_t>(h.slotCount), static_cast<NameId>(h.nameCount));
+}
@@ -0,0 +1,158 @@
+#ifndef NAMESPACE_IMAGE_H
+#define NAMESPACE_IMAGE_H
+
+#include <string>
+#include <vector>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+#include "NameTable.h"
+
+// Compact, versioned binary image of a namespace, read back through mmap.
+//
+// Layout (native byte order, every section 8-byte aligned):
+//   Header
+//   name offsets   nameCount + 1 x u64, into the name blob
+//   name blob      the bytes of every name, back to back
+//   name hashes    nameCount x u32 (NameTable::hashName)
+//   name slots     slotCount x u32, open-addressing table of name ids
+//   directories    directoryCount x Directory, the root first
+//   entries        entryCount x Entry, each directory's entries contiguous and in list order
+//   sorted         entryCount x u32, per directory the entry indexes ordered by name
+//   holders        entryCount x Holder, ordered by name: which directories hold each name
+//   name filter    NameFilter counters over the names of every entry
+//   dir filters    directoryFilterWords x u64, the NameFilter word filters of the larger directories
+//   blobs          blobCount x Blob, the distinct file contents
+//   blob data      the bytes of every blob, back to back
+//
+// Name ids in the image are NameTable ids, so a table attached to the image
+// needs no remapping. journalSequence is the last journal record the image
+// includes; replay after opening skips everything up to it.
+class NamespaceImage {
+public:
+    static constexpr std::uint32_t FORMAT_VERSION = 7;
+    static constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304u;
+    static constexpr std::uint32_t NO_DIRECTORY = 0xFFFFFFFFu;
+    static constexpr std::uint32_t NO_CONTENT = 0xFFFFFFFFu;
+    static constexpr std::uint32_t NO_FILTER = 0xFFFFFFFFu;
+    static constexpr std::uint32_t DIRECTORY_FILTER_MIN = 64; // smaller directories are binary searched unfiltered
+
+    class Header {
+    public:
+        char magic[8];
+        std::uint32_t formatVersion;
+        std::uint32_t byteOrder;
+        std::uint64_t journalSequence;
+        std::uint64_t nameCount;
+        std::uint64_t slotCount;
+        std::uint64_t directoryCount;
+        std::uint64_t entryCount;
+        std::uint64_t nameOffsetsAt;
+        std::uint64_t nameBlobAt;
+        std::uint64_t nameHashesAt;
+        std::uint64_t nameSlotsAt;
+        std::uint64_t directoriesAt;
+        std::uint64_t entriesAt;
+        std::uint64_t sortedAt;
+        std::uint64_t holdersAt;
+        std::uint64_t nameFilterAt;
+        std::uint64_t nameFilterBytes;
+        std::uint64_t directoryFiltersAt;
+        std::uint64_t directoryFilterWords;
+        std::uint64_t blobCount;
+        std::uint64_t blobsAt;
+        std::uint64_t blobDataAt;
+        std::uint64_t fileSize;
+    };
+
+    class Directory {
+    public:
+        std::uint32_t name;
+        std::uint32_t parent;     // NO_DIRECTORY for the root
+        std::uint32_t firstEntry;
+        std::uint32_t entryCount;
+        std::uint32_t order;      // key the entries are kept sorted by (FileSystem::SortKey), 0 for none
+        std::uint32_t filter;     // first word of its filter, NO_FILTER below DIRECTORY_FILTER_MIN entries
+        std::uint64_t bytes;      // FileSystem::Usage of the subtree
+        std::uint64_t entries;
+        std::int64_t newest;
+        std::int64_t changed;
+        std::uint64_t hash;       // of the subtree, as the file system keeps it
+    };
+
+    class Entry {
+    public:
+        std::uint32_t name;
+        std::uint32_t child;      // directory index, NO_DIRECTORY for a file
+        std::uint64_t size;       // FileSystem::Metadata
+        std::int64_t mtime;
+        std::int64_t ctime;
+        std::uint32_t mode;
+        std::uint32_t content;    // blob index, NO_CONTENT for an empty file or a directory
+    };
+
+    class Holder {
+    public:
+        std::uint32_t name;
+        std::uint32_t directory;
+    };
+
+    class Blob {
+    public:
+        std::uint64_t offset;     // into the blob data
+        std::uint64_t length;
+        std::uint64_t hash;       // ContentStore::hashBytes
+    };
+
+    NamespaceImage();
+    ~NamespaceImage();
+
+    NamespaceImage(const NamespaceImage&) = delete;
+    NamespaceImage& operator=(const NamespaceImage&) = delete;
+
+    // Function to write an image; directories, entries, sorted and the blob contents
+    // follow the layout above, and holders and filters are derived from them (the
+    // directories' filter fields are filled in). Returns false and sets error on failure.
+    static bool write(const std::string& path, const NameTable& names, std::vector<Directory>& directories,
+                      const std::vector<Entry>& entries, const std::vector<std::uint32_t>& sorted,
+                      const std::vector<std::string_view>& blobs, std::uint64_t journalSequence, std::string& error);
+
+    // Function to map an image read-only and validate its header
+    bool map(const std::string& path, std::string& error);
+
+    const Header& header() const {
+        return *static_cast<const Header*>(base);
+    }
+
+    template <typename T>
+    const T* section(std::uint64_t offset) const {
+        return reinterpret_cast<const T*>(static_cast<const char*>(base) + offset);
+    }
+
+    const Directory* directories() const { return section<Directory>(header().directoriesAt); }
+    const Entry* entries() const { return section<Entry>(header().entriesAt); }
+    const std::uint32_t* sorted() const { return section<std::uint32_t>(header().sortedAt); }
+    const Holder* holders() const { return section<Holder>(header().holdersAt); }
+    const std::uint8_t* nameFilter() const { return section<std::uint8_t>(header().nameFilterAt); }
+    const std::uint64_t* directoryFilters() const { return section<std::uint64_t>(header().directoryFiltersAt); }
+    const Blob* blobs() const { return section<Blob>(header().blobsAt); }
+
+    std::string_view blob(std::uint64_t index) const {
+        return std::string_view(section<char>(header().blobDataAt + blobs()[index].offset),
+                                static_cast<std::size_t>(blobs()[index].length));
+    }
+
+    // Bytes mapped
+    std::size_t size() const {
+        return length;
+    }
+
+    // Function to attach a name table to the image's string table
+    void attachNames(NameTable& names) const;
+
+private:
+    void* base;
+    std::size_t length;
+};
+
+#endif // NAMESPACE_IMAGE_H
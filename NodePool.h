@@ -0,0 +1,77 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <vector>
+#include <new>
+#include <utility>
+#include <cstddef>
+
+// Slab allocator for one node type. Nodes are carved out of fixed-size slabs
+// and recycled through a free list; the slabs are returned in bulk when the
+// pool is destroyed. Nodes still alive at that point are not destroyed, so
+// only trivially destructible types may be left in the pool.
+template <typename T>
+class NodePool {
+private:
+    static constexpr std::size_t SLAB_NODES = 1024;
+
+    union Slot {
+        Slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    std::vector<Slot*> slabs;
+    std::size_t slabUsed; // slots handed out from slabs.back()
+    Slot* freeList;
+    std::size_t live;
+
+public:
+    NodePool() : slabUsed(SLAB_NODES), freeList(nullptr), live(0) {}
+
+    ~NodePool() {
+        for (Slot* slab : slabs) {
+            delete[] slab;
+        }
+    }
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    // Function to construct a node in the pool
+    template <typename... Args>
+    T* create(Args&&... args) {
+        Slot* slot;
+        if (freeList != nullptr) {
+            slot = freeList;
+            freeList = freeList->next;
+        } else {
+            if (slabUsed == SLAB_NODES) {
+                slabs.push_back(new Slot[SLAB_NODES]);
+                slabUsed = 0;
+            }
+            slot = &slabs.back()[slabUsed++];
+        }
+        live++;
+        return new (slot->storage) T(std::forward<Args>(args)...);
+    }
+
+    // Function to destroy a node and recycle its slot
+    void destroy(T* node) {
+        node->~T();
+        Slot* slot = reinterpret_cast<Slot*>(node);
+        slot->next = freeList;
+        freeList = slot;
+        live--;
+    }
+
+    std::size_t size() const {
+        return live;
+    }
+
+    // Bytes of slab storage held by the pool
+    std::size_t bytes() const {
+        return slabs.size() * SLAB_NODES * sizeof(Slot);
+    }
+};
+
+#endif // NODE_POOL_H
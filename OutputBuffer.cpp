@@ -0,0 +1,70 @@
+#include "OutputBuffer.h"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+// Implementation of OutputBuffer constructor
+OutputBuffer::OutputBuffer(int fd, std::size_t capacity) : descriptor(fd), block(capacity < 1 ? 1 : capacity), failed(false) {
+    setp(block.data(), block.data() + block.size());
+}
+
+// Implementation of OutputBuffer destructor
+OutputBuffer::~OutputBuffer() {
+    drain();
+}
+
+// Private helper function to write out what the block holds
+bool OutputBuffer::drain() {
+    const char* at = pbase();
+    std::size_t left = static_cast<std::size_t>(pptr() - pbase());
+    while (left > 0 && !failed) {
+        ssize_t written = ::write(descriptor, at, left);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            failed = true;
+            break;
+        }
+        at += written;
+        left -= static_cast<std::size_t>(written);
+    }
+    setp(block.data(), block.data() + block.size());
+    return !failed;
+}
+
+// Function called when the block is full: write it out, then take the character
+int OutputBuffer::overflow(int c) {
+    if (!drain()) {
+        return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+// Function to copy text into the block, writing the block out each time it fills
+std::streamsize OutputBuffer::xsputn(const char* text, std::streamsize count) {
+    std::streamsize done = 0;
+    while (done < count) {
+        std::streamsize room = epptr() - pptr();
+        if (room == 0) {
+            if (!drain()) {
+                break;
+            }
+            continue;
+        }
+        std::streamsize part = count - done < room ? count - done : room;
+        std::memcpy(pptr(), text + done, static_cast<std::size_t>(part));
+        pbump(static_cast<int>(part));
+        done += part;
+    }
+    return done;
+}
+
+// Function called on flush
+int OutputBuffer::sync() {
+    return drain() ? 0 : -1;
+}
@@ -0,0 +1,39 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <streambuf>
+#include <vector>
+#include <cstddef>
+
+// A stream buffer that gathers output in one large block and hands it to a file
+// descriptor with a single write when the block fills, when the stream is
+// flushed, or when the buffer is destroyed. Meant for batch output, where a
+// write per line would dominate; text written with '\n' instead of std::endl
+// stays in the block.
+class OutputBuffer : public std::streambuf {
+public:
+    explicit OutputBuffer(int fd, std::size_t capacity = 1 << 20);
+    ~OutputBuffer();
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    // Whether every write so far reached the descriptor
+    bool good() const {
+        return !failed;
+    }
+
+protected:
+    int overflow(int c) override;
+    std::streamsize xsputn(const char* text, std::streamsize count) override;
+    int sync() override;
+
+private:
+    int descriptor;
+    std::vector<char> block;
+    bool failed;
+
+    bool drain();
+};
+
+#endif // OUTPUT_BUFFER_H
@@ -0,0 +1,236 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Small helpers for splitting work across threads. Each call starts its own
+// threads and joins them before returning; with one thread (or little work)
+// everything runs on the caller. WorkerPool keeps its threads between calls,
+// for callers that fan out small pieces of work often.
+
+// Function to pick a thread count, 0 meaning one per hardware thread
+inline unsigned workerCount(unsigned requested) {
+    if (requested != 0) {
+        return requested;
+    }
+    unsigned hardware = std::thread::hardware_concurrency();
+    return hardware == 0 ? 1 : hardware;
+}
+
+// Function to run work(slice) for slice = 0 .. slices-1, one thread per slice
+template <typename Work>
+void parallelFor(std::size_t slices, Work work) {
+    if (slices <= 1) {
+        if (slices == 1) {
+            work(0);
+        }
+        return;
+    }
+    std::vector<std::thread> threads;
+    threads.reserve(slices - 1);
+    for (std::size_t slice = 1; slice < slices; slice++) {
+        threads.emplace_back([&work, slice]() { work(slice); });
+    }
+    work(0);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+// Function to sort [first, last): every thread sorts one slice, then neighbouring
+// slices are merged pairwise, the merges of one round running in parallel
+template <typename Iterator, typename Less>
+void parallelSort(Iterator first, Iterator last, Less less, unsigned threads) {
+    static constexpr std::size_t MIN_SLICE = 1 << 14;
+    std::size_t count = static_cast<std::size_t>(last - first);
+    std::size_t slices = std::min<std::size_t>(threads, count / MIN_SLICE);
+    if (slices <= 1) {
+        std::sort(first, last, less);
+        return;
+    }
+
+    std::vector<Iterator> bounds;
+    for (std::size_t slice = 0; slice <= slices; slice++) {
+        bounds.push_back(first + static_cast<std::ptrdiff_t>(count * slice / slices));
+    }
+    parallelFor(slices, [&](std::size_t slice) { std::sort(bounds[slice], bounds[slice + 1], less); });
+
+    for (std::size_t width = 1; width < slices; width *= 2) {
+        std::size_t merges = (slices + 2 * width - 1) / (2 * width);
+        parallelFor(merges, [&](std::size_t merge) {
+            std::size_t left = merge * 2 * width;
+            std::size_t middle = std::min(left + width, slices);
+            std::size_t right = std::min(left + 2 * width, slices);
+            if (middle < right) {
+                std::inplace_merge(bounds[left], bounds[middle], bounds[right], less);
+            }
+        });
+    }
+}
+
+// Function to visit a tree of work items (the directories of a subtree, say) on
+// several threads. visit(worker, item, spawn) handles one item on thread number
+// worker and calls spawn(child) for each item found beneath it. Every thread
+// works from the back of its own deque, so it stays depth first and close to
+// what it just touched; one that runs dry steals from the front of another's,
+// which holds the oldest and usually largest pieces of work. Returns once every
+// item has been visited.
+template <typename Item, typename Visit>
+void parallelWalk(const std::vector<Item>& roots, unsigned threads, Visit visit) {
+    class WorkQueue {
+    public:
+        std::mutex lock;
+        std::deque<Item> items;
+    };
+
+    std::size_t workers = std::max<std::size_t>(1, threads);
+    std::unique_ptr<WorkQueue[]> queues(new WorkQueue[workers]);
+    std::atomic<std::size_t> pending(roots.size()); // spawned and not yet visited
+    for (std::size_t i = 0; i < roots.size(); i++) {
+        queues[i % workers].items.push_back(roots[i]);
+    }
+
+    parallelFor(workers, [&](std::size_t worker) {
+        WorkQueue& own = queues[worker];
+        auto spawn = [&](const Item& child) {
+            pending.fetch_add(1, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> guard(own.lock);
+            own.items.push_back(child);
+        };
+        for (;;) {
+            Item item;
+            bool found = false;
+            {
+                std::lock_guard<std::mutex> guard(own.lock);
+                if (!own.items.empty()) {
+                    item = own.items.back();
+                    own.items.pop_back();
+                    found = true;
+                }
+            }
+            for (std::size_t step = 1; !found && step < workers; step++) {
+                WorkQueue& victim = queues[(worker + step) % workers];
+                std::lock_guard<std::mutex> guard(victim.lock);
+                if (!victim.items.empty()) {
+                    item = victim.items.front();
+                    victim.items.pop_front();
+                    found = true;
+                }
+            }
+            if (found) {
+                visit(worker, item, spawn);
+                pending.fetch_sub(1, std::memory_order_acq_rel);
+            } else if (pending.load(std::memory_order_acquire) == 0) {
+                return;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+}
+
+// Threads started once and handed one job at a time. run(slices, work) calls
+// work(slice) for slice = 0 .. slices-1 like parallelFor: the caller takes
+// slices too, and it returns once all of them are done. A run started while
+// another is in progress (from another thread) does its slices on the caller.
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned threads) : job(nullptr), slices(0), next(0), active(0), generation(0), stopping(false) {
+        for (unsigned i = 1; i < threads; i++) {
+            workers.emplace_back([this]() { serve(); });
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    std::size_t size() const {
+        return workers.size() + 1;
+    }
+
+    void run(std::size_t count, const std::function<void(std::size_t)>& work) {
+        std::unique_lock<std::mutex> running(busy, std::try_to_lock);
+        if (count <= 1 || workers.empty() || !running.owns_lock()) {
+            for (std::size_t slice = 0; slice < count; slice++) {
+                work(slice);
+            }
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            job = &work;
+            slices = count;
+            next.store(0, std::memory_order_relaxed);
+            active = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        take(work, count);
+        std::unique_lock<std::mutex> guard(lock);
+        finished.wait(guard, [this]() { return active == 0; });
+        job = nullptr;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex busy;  // held by the run in progress
+    std::mutex lock;  // guards the job fields below
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const std::function<void(std::size_t)>* job;
+    std::size_t slices;
+    std::atomic<std::size_t> next; // next slice to hand out
+    std::size_t active;            // workers not yet done with the current job
+    std::uint64_t generation;      // jobs handed out so far
+    bool stopping;
+
+    void take(const std::function<void(std::size_t)>& work, std::size_t count) {
+        for (std::size_t slice = next.fetch_add(1, std::memory_order_relaxed); slice < count;
+             slice = next.fetch_add(1, std::memory_order_relaxed)) {
+            work(slice);
+        }
+    }
+
+    void serve() {
+        std::uint64_t seen = 0;
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+            wake.wait(guard, [&]() { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            const std::function<void(std::size_t)>* work = job;
+            std::size_t count = slices;
+            guard.unlock();
+            take(*work, count);
+            guard.lock();
+            if (--active == 0) {
+                finished.notify_one();
+            }
+        }
+    }
+};
+
+#endif // PARALLEL_H
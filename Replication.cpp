@@ -0,0 +1,477 @@
+#include "Replication.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+enum MessageType : std::uint8_t {
+    SNAPSHOT = 1,
+    RECORDS,
+    HEARTBEAT
+};
+
+constexpr std::size_t HEADER_BYTES = sizeof(std::uint8_t) + sizeof(std::uint64_t);
+
+std::int64_t wallClock() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+bool sendAll(int fd, const char* data, std::size_t length) {
+    while (length > 0) {
+        ssize_t sent = ::send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        length -= static_cast<std::size_t>(sent);
+    }
+    return true;
+}
+
+bool receiveAll(int fd, char* data, std::size_t length) {
+    while (length > 0) {
+        ssize_t got = ::recv(fd, data, length, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        data += got;
+        length -= static_cast<std::size_t>(got);
+    }
+    return true;
+}
+
+bool sendMessage(int fd, MessageType type, const std::string& payload) {
+    char header[HEADER_BYTES];
+    std::uint64_t length = payload.size();
+    header[0] = static_cast<char>(type);
+    std::memcpy(header + 1, &length, sizeof(length));
+    return sendAll(fd, header, sizeof(header)) && sendAll(fd, payload.data(), payload.size());
+}
+
+bool receiveMessage(int fd, MessageType& type, std::string& payload) {
+    char header[HEADER_BYTES];
+    std::uint64_t length;
+    if (!receiveAll(fd, header, sizeof(header))) {
+        return false;
+    }
+    type = static_cast<MessageType>(header[0]);
+    std::memcpy(&length, header + 1, sizeof(length));
+    payload.resize(length);
+    return receiveAll(fd, &payload[0], length);
+}
+
+// A socket address for path, or false if the path does not fit in one
+bool socketAddress(const std::string& path, sockaddr_un& address) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// A new empty file next to path, for an image on its way to or from the socket
+std::string temporaryFile(const std::string& path) {
+    std::string name = path + ".XXXXXX";
+    int file = ::mkstemp(&name[0]);
+    if (file < 0) {
+        return "";
+    }
+    ::close(file);
+    return name;
+}
+
+} // namespace
+
+// Implementation of Follower constructor
+ReplicationPrimary::Follower::Follower(int socket) : fd(socket), dropped(false), finished(false) {}
+
+// Implementation of ReplicationPrimary constructor
+ReplicationPrimary::ReplicationPrimary(FileSystem& fs) : fileSystem(fs), listener(-1), shipped(0), stopping(false) {}
+
+// Implementation of ReplicationPrimary destructor
+ReplicationPrimary::~ReplicationPrimary() {
+    stop();
+}
+
+// Function to start accepting followers on a socket at socketPath
+bool ReplicationPrimary::listen(const std::string& socketPath, std::string& error) {
+    if (listener >= 0) {
+        error = "already listening on '" + path + "'";
+        return false;
+    }
+    sockaddr_un address;
+    if (!socketAddress(socketPath, address)) {
+        error = "'" + socketPath + "' cannot name a socket";
+        return false;
+    }
+    // A socket left behind by an earlier primary is replaced; anything else is not
+    struct stat existing;
+    if (::lstat(socketPath.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+        ::unlink(socketPath.c_str());
+    }
+    int socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket < 0 || ::bind(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        ::listen(socket, 16) != 0) {
+        error = "cannot listen on '" + socketPath + "': " + std::strerror(errno);
+        if (socket >= 0) {
+            ::close(socket);
+        }
+        return false;
+    }
+
+    fileSystem.enableConcurrentAccess();
+    path = socketPath;
+    listener = socket;
+    stopping = false;
+    shipped = fileSystem.lastSequence();
+    fileSystem.setRecordSink([this](const Journal::Record& record) { ship(record); });
+    acceptor = std::thread([this]() { acceptFollowers(); });
+    return true;
+}
+
+// Function to disconnect every follower and stop listening
+void ReplicationPrimary::stop() {
+    if (listener < 0) {
+        return;
+    }
+    fileSystem.setRecordSink(nullptr);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        ::shutdown(listener, SHUT_RDWR); // wakes the acceptor
+        for (const std::unique_ptr<Follower>& follower : connected) {
+            if (follower->fd >= 0) {
+                ::shutdown(follower->fd, SHUT_RDWR); // wakes a sender blocked on a full socket
+            }
+        }
+    }
+    wake.notify_all();
+    acceptor.join();
+    for (const std::unique_ptr<Follower>& follower : connected) {
+        follower->sender.join();
+    }
+    connected.clear();
+    ::close(listener);
+    ::unlink(path.c_str());
+    listener = -1;
+}
+
+// Function to count the followers connected now
+std::size_t ReplicationPrimary::followers() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return static_cast<std::size_t>(std::count_if(connected.begin(), connected.end(),
+        [](const std::unique_ptr<Follower>& follower) { return !follower->finished && !follower->dropped; }));
+}
+
+// Private helper function to accept followers until stopped, giving each a sender thread
+void ReplicationPrimary::acceptFollowers() {
+    while (true) {
+        int socket = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        std::lock_guard<std::mutex> guard(lock);
+        if (stopping) {
+            if (socket >= 0) {
+                ::close(socket);
+            }
+            return;
+        }
+        if (socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+        // Senders that have exited are done with their followers
+        for (std::size_t i = 0; i < connected.size();) {
+            if (connected[i]->finished) {
+                connected[i]->sender.join();
+                connected.erase(connected.begin() + static_cast<std::ptrdiff_t>(i));
+            } else {
+                i++;
+            }
+        }
+        // From here every change is queued for the follower; those its snapshot
+        // already holds are skipped when it applies them
+        connected.emplace_back(new Follower(socket));
+        Follower* follower = connected.back().get();
+        follower->sender = std::thread([this, follower]() { serve(follower); });
+    }
+}
+
+// Private helper function to send a follower its snapshot, then its queued
+// records as they come, each batch followed by a heartbeat (as is every quiet interval)
+void ReplicationPrimary::serve(Follower* follower) {
+    bool sending = sendSnapshot(follower);
+    std::unique_lock<std::mutex> guard(lock);
+    while (sending) {
+        wake.wait_for(guard, std::chrono::milliseconds(HEARTBEAT_MS),
+                      [&]() { return stopping || follower->dropped || !follower->pending.empty(); });
+        if (stopping || follower->dropped) {
+            break;
+        }
+        std::string batch;
+        batch.swap(follower->pending);
+        std::string heartbeat;
+        std::int64_t now = wallClock();
+        heartbeat.append(reinterpret_cast<const char*>(&shipped), sizeof(shipped));
+        heartbeat.append(reinterpret_cast<const char*>(&now), sizeof(now));
+        guard.unlock();
+        sending = (batch.empty() || sendMessage(follower->fd, RECORDS, batch)) &&
+                      sendMessage(follower->fd, HEARTBEAT, heartbeat);
+        guard.lock();
+    }
+    ::close(follower->fd);
+    follower->fd = -1;
+    follower->pending.clear();
+    follower->finished = true;
+}
+
+// Private helper function to save an image of the file system as it is now and send it
+bool ReplicationPrimary::sendSnapshot(Follower* follower) {
+    std::string temporary = temporaryFile(path);
+    if (temporary.empty() || !fileSystem.save(temporary)) {
+        if (!temporary.empty()) {
+            ::unlink(temporary.c_str());
+        }
+        return false;
+    }
+    std::ifstream file(temporary.c_str(), std::ios::binary);
+    std::string image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    bool read = !file.bad();
+    file.close();
+    ::unlink(temporary.c_str());
+    return read && sendMessage(follower->fd, SNAPSHOT, image);
+}
+
+// Private helper function to queue one change for every follower. It runs inside
+// the change, so it only frames the record once and appends it.
+void ReplicationPrimary::ship(const Journal::Record& record) {
+    std::string frame;
+    Journal::encode(record, frame);
+    std::lock_guard<std::mutex> guard(lock);
+    shipped = record.sequence;
+    for (const std::unique_ptr<Follower>& follower : connected) {
+        if (follower->finished || follower->dropped) {
+            continue;
+        }
+        if (follower->pending.size() + frame.size() > PENDING_LIMIT) {
+            follower->dropped = true; // too far behind: it must start again from a snapshot
+            follower->pending.clear();
+            wake.notify_all();
+            continue;
+        }
+        bool idle = follower->pending.empty();
+        follower->pending += frame;
+        if (idle) {
+            wake.notify_all();
+        }
+    }
+}
+
+// Implementation of ReplicationFollower constructor
+ReplicationFollower::ReplicationFollower(FileSystem& fs)
+    : fileSystem(fs), fd(-1), receiving(false), applied(0), primary(0), incomingSince(0), applyingSince(0),
+      stopping(false) {}
+
+// Implementation of ReplicationFollower destructor
+ReplicationFollower::~ReplicationFollower() {
+    stop();
+}
+
+// Function to connect to a primary, load its snapshot and start applying its changes
+bool ReplicationFollower::connect(const std::string& socketPath, std::string& error) {
+    if (fd >= 0) {
+        error = "already following a primary";
+        return false;
+    }
+    sockaddr_un address;
+    if (!socketAddress(socketPath, address)) {
+        error = "'" + socketPath + "' cannot name a socket";
+        return false;
+    }
+    int socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket < 0 || ::connect(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        error = "cannot connect to '" + socketPath + "': " + std::strerror(errno);
+        if (socket >= 0) {
+            ::close(socket);
+        }
+        return false;
+    }
+
+    // The snapshot is opened from a file, which the mapping outlives
+    MessageType type;
+    std::string image;
+    if (!receiveMessage(socket, type, image) || type != SNAPSHOT) {
+        ::close(socket);
+        error = "no snapshot from '" + socketPath + "'";
+        return false;
+    }
+    std::string temporary = temporaryFile(socketPath);
+    std::ofstream file(temporary.c_str(), std::ios::binary | std::ios::trunc);
+    bool written = !temporary.empty() && file.write(image.data(), static_cast<std::streamsize>(image.size())) && file.flush();
+    file.close();
+    bool opened = written && fileSystem.open(temporary);
+    if (!temporary.empty()) {
+        ::unlink(temporary.c_str());
+    }
+    if (!opened) {
+        ::close(socket);
+        error = "cannot load the snapshot from '" + socketPath + "'";
+        return false;
+    }
+
+    fileSystem.enableConcurrentAccess();
+    applied.store(fileSystem.lastSequence(), std::memory_order_release);
+    primary.store(fileSystem.lastSequence(), std::memory_order_release);
+    fd = socket;
+    incoming.clear();
+    incomingSince = 0;
+    applyingSince = 0;
+    stopping = false;
+    receiving.store(true, std::memory_order_release);
+    receiver = std::thread([this]() { receive(); });
+    applier = std::thread([this]() { apply(); });
+    return true;
+}
+
+// Function to disconnect, keeping the file system as it is
+void ReplicationFollower::stop() {
+    if (fd < 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        ::shutdown(fd, SHUT_RDWR); // wakes the receiver
+    }
+    arrived.notify_all();
+    progressed.notify_all();
+    receiver.join();
+    applier.join();
+    ::close(fd);
+    fd = -1;
+}
+
+// Function to count the changes the primary has made that are not applied here yet
+std::uint64_t ReplicationFollower::lagRecords() const {
+    std::uint64_t reached = applied.load(std::memory_order_acquire);
+    std::uint64_t made = primary.load(std::memory_order_acquire);
+    return made > reached ? made - reached : 0;
+}
+
+// Function to measure how long the oldest change not applied yet has waited
+std::int64_t ReplicationFollower::lagNanoseconds() const {
+    std::lock_guard<std::mutex> guard(lock);
+    std::int64_t since = applyingSince != 0 ? applyingSince : incomingSince;
+    return since == 0 ? 0 : std::max<std::int64_t>(wallClock() - since, 0);
+}
+
+// Function to wait for the change with this sequence number to be applied
+bool ReplicationFollower::waitUntilApplied(std::uint64_t sequence, int timeoutMs) const {
+    std::unique_lock<std::mutex> guard(lock);
+    return progressed.wait_for(guard, std::chrono::milliseconds(timeoutMs), [&]() {
+        return applied.load(std::memory_order_acquire) >= sequence || stopping;
+    }) && applied.load(std::memory_order_acquire) >= sequence;
+}
+
+// Function to print the replication gauges
+void ReplicationFollower::dumpStats(std::ostream& out) const {
+    out << "gauge replication_connected " << (connected() ? 1 : 0) << '\n'
+        << "gauge replication_applied_sequence " << appliedSequence() << '\n'
+        << "gauge replication_primary_sequence " << primarySequence() << '\n'
+        << "gauge replication_lag_records " << lagRecords() << '\n'
+        << "gauge replication_lag_ns " << lagNanoseconds() << '\n';
+}
+
+// Private helper function to read messages until the primary goes away, queueing
+// the records they carry for the applier
+void ReplicationFollower::receive() {
+    MessageType type;
+    std::string payload;
+    std::vector<Journal::Record> records;
+    while (receiveMessage(fd, type, payload)) {
+        if (type == HEARTBEAT && payload.size() == sizeof(std::uint64_t) + sizeof(std::int64_t)) {
+            std::uint64_t sequence;
+            std::memcpy(&sequence, payload.data(), sizeof(sequence));
+            if (sequence > primary.load(std::memory_order_relaxed)) {
+                primary.store(sequence, std::memory_order_release);
+            }
+            continue;
+        }
+        if (type != RECORDS) {
+            break;
+        }
+        records.clear();
+        std::size_t at = 0;
+        std::size_t length = 0;
+        Journal::Record record;
+        while (at < payload.size() && (length = Journal::decode(payload.data() + at, payload.size() - at, record)) != 0) {
+            records.push_back(std::move(record));
+            at += length;
+        }
+        if (at != payload.size()) {
+            break; // a corrupt frame: nothing after it can be trusted
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        if (incoming.empty() && !records.empty()) {
+            incomingSince = records.front().time != 0 ? records.front().time : wallClock();
+        }
+        std::move(records.begin(), records.end(), std::back_inserter(incoming));
+        if (!incoming.empty() && incoming.back().sequence > primary.load(std::memory_order_relaxed)) {
+            primary.store(incoming.back().sequence, std::memory_order_release);
+        }
+        arrived.notify_one();
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    receiving.store(false, std::memory_order_release);
+    arrived.notify_one();
+}
+
+// Private helper function to apply whatever has arrived as one batch, again and
+// again, until the primary goes away and everything it sent is applied
+void ReplicationFollower::apply() {
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        arrived.wait(guard, [this]() {
+            return stopping || !incoming.empty() || !receiving.load(std::memory_order_acquire);
+        });
+        if (stopping || incoming.empty()) {
+            break;
+        }
+        std::vector<Journal::Record> batch;
+        batch.swap(incoming);
+        applyingSince = incomingSince;
+        incomingSince = 0;
+        guard.unlock();
+        fileSystem.applyRecords(batch);
+        std::uint64_t reached = fileSystem.lastSequence();
+        guard.lock();
+        applyingSince = 0;
+        applied.store(reached, std::memory_order_release);
+        progressed.notify_all();
+        if (reached < batch.back().sequence) {
+            // A record this file system cannot replay; the rest would diverge from the primary
+            stopping = true;
+            ::shutdown(fd, SHUT_RDWR);
+            incoming.clear();
+            break;
+        }
+    }
+    progressed.notify_all();
+}
@@ -0,0 +1,156 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+#include "FileSystem.h"
+#include "Journal.h"
+
+// Read replicas fed over a Unix domain socket. The primary ships every change
+// its file system makes, as the journal records it is logged as; a follower
+// applies them in batches to a file system of its own and answers reads from it.
+//
+// A follower that connects first receives a snapshot (an image saved at the
+// moment it joined) and then every record logged after it, so it can join at
+// any time. Every message is [u8 type][u64 payload length][payload]:
+//
+//   SNAPSHOT   the image
+//   RECORDS    journal frames, as Journal::encode writes them
+//   HEARTBEAT  the primary's last sequence number (u64) and the time (i64, ns
+//              since the epoch), sent after every batch and when idle
+//
+// A follower that falls too far behind is disconnected, and one that cannot
+// replay a restore of a backup taken before it joined (snapshots hold no
+// backups) disconnects itself; either has to join again from a fresh snapshot.
+
+// Serves a file system to followers. listen() puts the file system in
+// concurrent mode; it may be used from any number of threads while it is served.
+class ReplicationPrimary {
+public:
+    explicit ReplicationPrimary(FileSystem& fs);
+    ~ReplicationPrimary();
+
+    ReplicationPrimary(const ReplicationPrimary&) = delete;
+    ReplicationPrimary& operator=(const ReplicationPrimary&) = delete;
+
+    // Function to start accepting followers on a socket at socketPath. Returns
+    // false and sets error on failure.
+    bool listen(const std::string& socketPath, std::string& error);
+
+    // Function to disconnect every follower and stop listening
+    void stop();
+
+    // Followers connected now
+    std::size_t followers() const;
+
+private:
+    // One connected follower and the frames waiting to be sent to it
+    class Follower {
+    public:
+        int fd;
+        std::string pending;
+        bool dropped;        // set to disconnect it
+        bool finished;       // its sender has exited
+        std::thread sender;
+        explicit Follower(int socket);
+    };
+
+    static constexpr std::size_t PENDING_LIMIT = 64 * 1024 * 1024; // bytes a follower may fall behind
+    static constexpr int HEARTBEAT_MS = 100;
+
+    FileSystem& fileSystem;
+    std::string path;
+    int listener;
+    std::thread acceptor;
+    mutable std::mutex lock; // guards the fields below
+    std::condition_variable wake;
+    std::vector<std::unique_ptr<Follower>> connected;
+    std::uint64_t shipped;   // sequence number of the last record handed to the followers
+    bool stopping;
+
+    // Private helper functions run on the acceptor and sender threads
+    void acceptFollowers();
+    void serve(Follower* follower);
+    bool sendSnapshot(Follower* follower);
+
+    // Private helper function the file system calls with every change
+    void ship(const Journal::Record& record);
+};
+
+// Keeps a file system a read-only copy of a primary's. connect() replaces the
+// file system with the primary's snapshot and puts it in concurrent mode; reads
+// may then run on any thread while changes are applied in the background.
+// Nothing else may change the file system.
+class ReplicationFollower {
+public:
+    explicit ReplicationFollower(FileSystem& fs);
+    ~ReplicationFollower();
+
+    ReplicationFollower(const ReplicationFollower&) = delete;
+    ReplicationFollower& operator=(const ReplicationFollower&) = delete;
+
+    // Function to connect to the primary listening at socketPath and catch up
+    // from its snapshot. Returns false and sets error on failure.
+    bool connect(const std::string& socketPath, std::string& error);
+
+    // Function to disconnect, keeping the file system as it is
+    void stop();
+
+    // Whether changes are still arriving from the primary
+    bool connected() const {
+        return receiving.load(std::memory_order_acquire);
+    }
+
+    // Sequence numbers of the last change applied here and the last one the primary reported
+    std::uint64_t appliedSequence() const {
+        return applied.load(std::memory_order_acquire);
+    }
+
+    std::uint64_t primarySequence() const {
+        return primary.load(std::memory_order_acquire);
+    }
+
+    // Changes the primary has made that are not applied here yet
+    std::uint64_t lagRecords() const;
+
+    // How long the oldest change received but not yet applied has been waiting
+    // (from when the primary made it), 0 when caught up
+    std::int64_t lagNanoseconds() const;
+
+    // Function to wait up to timeoutMs milliseconds for the change with this
+    // sequence number to be applied; returns whether it was
+    bool waitUntilApplied(std::uint64_t sequence, int timeoutMs) const;
+
+    // Function to print the replication gauges, one line each
+    void dumpStats(std::ostream& out) const;
+
+private:
+    FileSystem& fileSystem;
+    int fd;
+    std::thread receiver;
+    std::thread applier;
+    std::atomic<bool> receiving;
+    std::atomic<std::uint64_t> applied;
+    std::atomic<std::uint64_t> primary;
+    mutable std::mutex lock; // guards the fields below
+    mutable std::condition_variable arrived;
+    mutable std::condition_variable progressed;
+    std::vector<Journal::Record> incoming; // received, waiting for the next batch
+    std::int64_t incomingSince;            // time of the oldest record waiting, 0 for none
+    std::int64_t applyingSince;            // time of the oldest record in the batch being applied
+    bool stopping;
+
+    // Private helper functions run on the receiver and applier threads
+    void receive();
+    void apply();
+};
+
+#endif // REPLICATION_H
@@ -0,0 +1,576 @@
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <utility>
+#include <cstddef>
+
+// B+-tree from a file name to every holder (directory) that contains that name.
+// Nodes are wide so a lookup touches few cache lines and all operations are
+// iterative. Nodes are reference counted and copied on write, so copying an
+// index is O(1) and a later update only copies the nodes on its path.
+// Keys are ordered by Less (an interned name id ordered by its text, say).
+//
+// The root is an atomic, so readers may call find() on an index that changes
+// underneath them as long as no node they can reach is changed in place: apply
+// the update to a copy (every node it touches is shared and gets copied), swap()
+// the copy in, and retire the old tree once no reader can be inside it.
+template <typename Holder, typename Key = std::string, typename Less = std::less<Key> >
+class SearchIndex {
+private:
+    static constexpr int ORDER = 32;         // maximum keys per node
+    static constexpr int MIN_KEYS = ORDER / 2;
+
+    class Node {
+    public:
+        bool leaf;
+        int count;
+        int refCount;                    // number of parents/indexes sharing this node
+        Key keys[ORDER + 1];             // one spare slot for the overflow before a split
+        Node(bool isLeaf) : leaf(isLeaf), count(0), refCount(1) {}
+    };
+
+    class LeafNode : public Node {
+    public:
+        std::vector<Holder> holders[ORDER + 1];
+        LeafNode() : Node(true) {}
+    };
+
+    class InnerNode : public Node {
+    public:
+        Node* children[ORDER + 2];
+        InnerNode() : Node(false) {}
+    };
+
+    // One step of a root-to-leaf descent: the inner node and the child taken
+    class PathStep {
+    public:
+        InnerNode* node;
+        int index;
+    };
+
+    std::atomic<Node*> root;
+    std::size_t keyCount;
+    Less less;
+
+    int lowerBound(const Node* node, const Key& key) const {
+        return static_cast<int>(std::lower_bound(node->keys, node->keys + node->count, key, less) - node->keys);
+    }
+
+    int childIndex(const Node* node, const Key& key) const {
+        return static_cast<int>(std::upper_bound(node->keys, node->keys + node->count, key, less) - node->keys);
+    }
+
+    LeafNode* descend(const Key& key) const {
+        Node* node = root.load(std::memory_order_acquire);
+        while (!node->leaf) {
+            InnerNode* inner = static_cast<InnerNode*>(node);
+            node = inner->children[childIndex(inner, key)];
+        }
+        return static_cast<LeafNode*>(node);
+    }
+
+    // Make the node in slot exclusively owned, copying it if it is shared
+    static Node* unshare(Node*& slot) {
+        Node* node = slot;
+        if (node->refCount == 1) {
+            return node;
+        }
+        Node* copy;
+        if (node->leaf) {
+            copy = new LeafNode(*static_cast<LeafNode*>(node));
+        } else {
+            InnerNode* inner = new InnerNode(*static_cast<InnerNode*>(node));
+            for (int i = 0; i <= inner->count; i++) {
+                inner->children[i]->refCount++;
+            }
+            copy = inner;
+        }
+        copy->refCount = 1;
+        node->refCount--;
+        slot = copy;
+        return copy;
+    }
+
+    // Descend for an update from an unpublished root, unsharing every node on the path
+    LeafNode* descendForWrite(Node*& top, const Key& key, std::vector<PathStep>& path) {
+        Node* node = unshare(top);
+        while (!node->leaf) {
+            InnerNode* inner = static_cast<InnerNode*>(node);
+            int i = childIndex(inner, key);
+            path.push_back(PathStep{inner, i});
+            node = unshare(inner->children[i]);
+        }
+        return static_cast<LeafNode*>(node);
+    }
+
+    // Insert a new key at position pos of a leaf (holders start with one entry)
+    static void leafInsertAt(LeafNode* leaf, int pos, const Key& key, Holder holder) {
+        for (int i = leaf->count; i > pos; i--) {
+            leaf->keys[i] = std::move(leaf->keys[i - 1]);
+            leaf->holders[i] = std::move(leaf->holders[i - 1]);
+        }
+        leaf->keys[pos] = key;
+        leaf->holders[pos].assign(1, holder);
+        leaf->count++;
+    }
+
+    static void leafEraseAt(LeafNode* leaf, int pos) {
+        for (int i = pos; i + 1 < leaf->count; i++) {
+            leaf->keys[i] = std::move(leaf->keys[i + 1]);
+            leaf->holders[i] = std::move(leaf->holders[i + 1]);
+        }
+        leaf->count--;
+        leaf->keys[leaf->count] = Key();
+        leaf->holders[leaf->count].clear();
+    }
+
+    // Insert separator key at pos and the child to its right at pos + 1
+    static void innerInsertAt(InnerNode* inner, int pos, const Key& key, Node* rightChild) {
+        for (int i = inner->count; i > pos; i--) {
+            inner->keys[i] = std::move(inner->keys[i - 1]);
+            inner->children[i + 1] = inner->children[i];
+        }
+        inner->keys[pos] = key;
+        inner->children[pos + 1] = rightChild;
+        inner->count++;
+    }
+
+    // Remove separator key at pos and the child to its right at pos + 1
+    static void innerEraseAt(InnerNode* inner, int pos) {
+        for (int i = pos; i + 1 < inner->count; i++) {
+            inner->keys[i] = std::move(inner->keys[i + 1]);
+            inner->children[i + 1] = inner->children[i + 2];
+        }
+        inner->count--;
+        inner->keys[inner->count] = Key();
+    }
+
+    // Split an overflowing node, returning the new right sibling and the separator to push up
+    static Node* split(Node* node, Key& separator) {
+        int half = node->count / 2;
+        if (node->leaf) {
+            LeafNode* left = static_cast<LeafNode*>(node);
+            LeafNode* right = new LeafNode();
+            for (int i = half; i < left->count; i++) {
+                right->keys[i - half] = std::move(left->keys[i]);
+                right->holders[i - half] = std::move(left->holders[i]);
+                left->keys[i] = Key();
+                left->holders[i].clear();
+            }
+            right->count = left->count - half;
+            left->count = half;
+            separator = right->keys[0];
+            return right;
+        }
+        InnerNode* left = static_cast<InnerNode*>(node);
+        InnerNode* right = new InnerNode();
+        separator = std::move(left->keys[half]);
+        for (int i = half + 1; i < left->count; i++) {
+            right->keys[i - half - 1] = std::move(left->keys[i]);
+            left->keys[i] = Key();
+        }
+        for (int i = half + 1; i <= left->count; i++) {
+            right->children[i - half - 1] = left->children[i];
+        }
+        right->count = left->count - half - 1;
+        left->count = half;
+        left->keys[half] = Key();
+        return right;
+    }
+
+    // Restore the minimum fill of parent->children[index] by borrowing from or merging with a sibling
+    static void rebalance(InnerNode* parent, int index) {
+        Node* node = parent->children[index];
+        Node* leftSibling = index > 0 ? unshare(parent->children[index - 1]) : nullptr;
+        Node* rightSibling = index < parent->count ? unshare(parent->children[index + 1]) : nullptr;
+
+        if (leftSibling && leftSibling->count > MIN_KEYS) {
+            if (node->leaf) {
+                LeafNode* leaf = static_cast<LeafNode*>(node);
+                LeafNode* from = static_cast<LeafNode*>(leftSibling);
+                leafInsertAt(leaf, 0, from->keys[from->count - 1], Holder());
+                leaf->holders[0] = std::move(from->holders[from->count - 1]);
+                leafEraseAt(from, from->count - 1);
+                parent->keys[index - 1] = leaf->keys[0];
+            } else {
+                InnerNode* inner = static_cast<InnerNode*>(node);
+                InnerNode* from = static_cast<InnerNode*>(leftSibling);
+                for (int i = inner->count; i > 0; i--) {
+                    inner->keys[i] = std::move(inner->keys[i - 1]);
+                }
+                for (int i = inner->count + 1; i > 0; i--) {
+                    inner->children[i] = inner->children[i - 1];
+                }
+                inner->keys[0] = std::move(parent->keys[index - 1]);
+                inner->children[0] = from->children[from->count];
+                inner->count++;
+                parent->keys[index - 1] = std::move(from->keys[from->count - 1]);
+                from->count--;
+                from->keys[from->count] = Key();
+            }
+            return;
+        }
+
+        if (rightSibling && rightSibling->count > MIN_KEYS) {
+            if (node->leaf) {
+                LeafNode* leaf = static_cast<LeafNode*>(node);
+                LeafNode* from = static_cast<LeafNode*>(rightSibling);
+                leaf->keys[leaf->count] = std::move(from->keys[0]);
+                leaf->holders[leaf->count] = std::move(from->holders[0]);
+                leaf->count++;
+                leafEraseAt(from, 0);
+                parent->keys[index] = from->keys[0];
+            } else {
+                InnerNode* inner = static_cast<InnerNode*>(node);
+                InnerNode* from = static_cast<InnerNode*>(rightSibling);
+                inner->keys[inner->count] = std::move(parent->keys[index]);
+                inner->children[inner->count + 1] = from->children[0];
+                inner->count++;
+                parent->keys[index] = std::move(from->keys[0]);
+                for (int i = 0; i + 1 < from->count; i++) {
+                    from->keys[i] = std::move(from->keys[i + 1]);
+                }
+                for (int i = 0; i < from->count; i++) {
+                    from->children[i] = from->children[i + 1];
+                }
+                from->count--;
+                from->keys[from->count] = Key();
+            }
+            return;
+        }
+
+        // Neither sibling can spare a key: merge the right one of the pair into the left one
+        int leftIndex = leftSibling ? index - 1 : index;
+        Node* left = parent->children[leftIndex];
+        Node* right = parent->children[leftIndex + 1];
+        if (left->leaf) {
+            LeafNode* leftLeaf = static_cast<LeafNode*>(left);
+            LeafNode* rightLeaf = static_cast<LeafNode*>(right);
+            for (int i = 0; i < rightLeaf->count; i++) {
+                leftLeaf->keys[leftLeaf->count + i] = std::move(rightLeaf->keys[i]);
+                leftLeaf->holders[leftLeaf->count + i] = std::move(rightLeaf->holders[i]);
+            }
+            leftLeaf->count += rightLeaf->count;
+            delete rightLeaf;
+        } else {
+            InnerNode* leftInner = static_cast<InnerNode*>(left);
+            InnerNode* rightInner = static_cast<InnerNode*>(right);
+            leftInner->keys[leftInner->count] = parent->keys[leftIndex];
+            for (int i = 0; i < rightInner->count; i++) {
+                leftInner->keys[leftInner->count + 1 + i] = std::move(rightInner->keys[i]);
+            }
+            for (int i = 0; i <= rightInner->count; i++) {
+                leftInner->children[leftInner->count + 1 + i] = rightInner->children[i];
+            }
+            leftInner->count += rightInner->count + 1;
+            delete rightInner;
+        }
+        innerEraseAt(parent, leftIndex);
+    }
+
+    // Drop this index's reference to the tree, freeing nodes nobody else shares
+    void release() {
+        std::vector<Node*> pending(1, root.load(std::memory_order_relaxed));
+        while (!pending.empty()) {
+            Node* node = pending.back();
+            pending.pop_back();
+            if (--node->refCount > 0) {
+                continue;
+            }
+            if (node->leaf) {
+                delete static_cast<LeafNode*>(node);
+            } else {
+                InnerNode* inner = static_cast<InnerNode*>(node);
+                for (int i = 0; i <= inner->count; i++) {
+                    pending.push_back(inner->children[i]);
+                }
+                delete inner;
+            }
+        }
+    }
+
+    // Number of nodes to spread items over for a bulk build: about fill per node,
+    // never more than maximum and (unless there is a single node) never fewer than minimum
+    static std::size_t nodesFor(std::size_t items, std::size_t fill, std::size_t minimum, std::size_t maximum) {
+        std::size_t nodes = std::min((items + fill - 1) / fill, std::max<std::size_t>(1, items / minimum));
+        return std::max(nodes, (items + maximum - 1) / maximum);
+    }
+
+    // Insert into the tree rooted at top, which may be replaced
+    void insertFrom(Node*& top, const Key& key, Holder holder) {
+        std::vector<PathStep> path;
+        LeafNode* leaf = descendForWrite(top, key, path);
+        int pos = lowerBound(leaf, key);
+        if (pos < leaf->count && leaf->keys[pos] == key) {
+            std::vector<Holder>& holders = leaf->holders[pos];
+            if (std::find(holders.begin(), holders.end(), holder) == holders.end()) {
+                holders.push_back(holder);
+            }
+            return;
+        }
+        leafInsertAt(leaf, pos, key, holder);
+        keyCount++;
+
+        // Split upwards while nodes overflow
+        Node* node = leaf;
+        while (node->count > ORDER) {
+            Key separator;
+            Node* right = split(node, separator);
+            if (path.empty()) {
+                InnerNode* newRoot = new InnerNode();
+                newRoot->keys[0] = std::move(separator);
+                newRoot->children[0] = node;
+                newRoot->children[1] = right;
+                newRoot->count = 1;
+                top = newRoot;
+                return;
+            }
+            PathStep step = path.back();
+            path.pop_back();
+            innerInsertAt(step.node, step.index, separator, right);
+            node = step.node;
+        }
+    }
+
+    // Erase a recorded (key, holder) from the tree rooted at top, which may be replaced
+    void eraseFrom(Node*& top, const Key& key, Holder holder) {
+        std::vector<PathStep> path;
+        LeafNode* leaf = descendForWrite(top, key, path);
+        int pos = lowerBound(leaf, key);
+        std::vector<Holder>& holders = leaf->holders[pos];
+        holders.erase(std::find(holders.begin(), holders.end(), holder));
+        if (!holders.empty()) {
+            return;
+        }
+        leafEraseAt(leaf, pos);
+        keyCount--;
+
+        // Rebalance upwards while nodes underflow
+        Node* node = leaf;
+        while (!path.empty() && node->count < MIN_KEYS) {
+            PathStep step = path.back();
+            path.pop_back();
+            rebalance(step.node, step.index);
+            node = step.node;
+        }
+        if (!top->leaf && top->count == 0) {
+            InnerNode* oldRoot = static_cast<InnerNode*>(top);
+            top = oldRoot->children[0];
+            oldRoot->count = 0;
+            delete oldRoot;
+        }
+    }
+
+public:
+    SearchIndex(Less order = Less()) : root(new LeafNode()), keyCount(0), less(order) {}
+    ~SearchIndex() { release(); }
+
+    // Copies share the whole tree until one of them is updated
+    SearchIndex(const SearchIndex& other)
+        : root(other.root.load(std::memory_order_relaxed)), keyCount(other.keyCount), less(other.less) {
+        root.load(std::memory_order_relaxed)->refCount++;
+    }
+
+    SearchIndex& operator=(const SearchIndex& other) {
+        if (this != &other) {
+            Node* shared = other.root.load(std::memory_order_relaxed);
+            shared->refCount++;
+            release();
+            root.store(shared, std::memory_order_release);
+            keyCount = other.keyCount;
+            less = other.less;
+        }
+        return *this;
+    }
+
+    // Function to exchange trees with an index ordered the same way, publishing other's tree here
+    void swap(SearchIndex& other) {
+        Node* mine = root.load(std::memory_order_relaxed);
+        root.store(other.root.load(std::memory_order_relaxed), std::memory_order_release);
+        other.root.store(mine, std::memory_order_relaxed);
+        std::swap(keyCount, other.keyCount);
+    }
+
+    // Function to record that holder contains key
+    void insert(const Key& key, Holder holder) {
+        Node* top = root.load(std::memory_order_relaxed);
+        insertFrom(top, key, holder);
+        root.store(top, std::memory_order_release);
+    }
+
+    // Function to record that holder no longer contains key, returns false if it was not recorded
+    bool erase(const Key& key, Holder holder) {
+        // Check first so a miss does not copy shared nodes
+        const std::vector<Holder>* found = find(key);
+        if (found == nullptr || std::find(found->begin(), found->end(), holder) == found->end()) {
+            return false;
+        }
+        Node* top = root.load(std::memory_order_relaxed);
+        eraseFrom(top, key, holder);
+        root.store(top, std::memory_order_release);
+        return true;
+    }
+
+    // Function to move holder's entry from oldKey to newKey
+    void rename(const Key& oldKey, const Key& newKey, Holder holder) {
+        if (erase(oldKey, holder)) {
+            insert(newKey, holder);
+        }
+    }
+
+    // Function to find every holder of key, nullptr if there is none
+    const std::vector<Holder>* find(const Key& key) const {
+        LeafNode* leaf = descend(key);
+        int pos = lowerBound(leaf, key);
+        if (pos < leaf->count && leaf->keys[pos] == key) {
+            return &leaf->holders[pos];
+        }
+        return nullptr;
+    }
+
+    bool contains(const Key& key) const {
+        return find(key) != nullptr;
+    }
+
+    // Function to visit every key in order together with its holders
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        std::vector<const Node*> pending(1, root.load(std::memory_order_acquire));
+        while (!pending.empty()) {
+            const Node* node = pending.back();
+            pending.pop_back();
+            if (node->leaf) {
+                const LeafNode* leaf = static_cast<const LeafNode*>(node);
+                for (int i = 0; i < leaf->count; i++) {
+                    visit(leaf->keys[i], leaf->holders[i]);
+                }
+            } else {
+                const InnerNode* inner = static_cast<const InnerNode*>(node);
+                for (int i = inner->count; i >= 0; i--) {
+                    pending.push_back(inner->children[i]);
+                }
+            }
+        }
+    }
+
+    // Function to visit keys in order with their holders, starting at the first
+    // key not ordered before probe, for as long as visit returns true. Less must
+    // also order keys against probes (names against a name prefix, say).
+    template <typename Probe, typename Visit>
+    void forEachFrom(const Probe& probe, Visit visit) const {
+        std::vector<std::pair<const InnerNode*, int>> path;
+        const Node* node = root.load(std::memory_order_acquire);
+        while (!node->leaf) {
+            const InnerNode* inner = static_cast<const InnerNode*>(node);
+            int i = static_cast<int>(std::upper_bound(inner->keys, inner->keys + inner->count, probe, less) -
+                                     inner->keys);
+            path.push_back(std::make_pair(inner, i));
+            node = inner->children[i];
+        }
+        const LeafNode* leaf = static_cast<const LeafNode*>(node);
+        int start = static_cast<int>(std::lower_bound(leaf->keys, leaf->keys + leaf->count, probe, less) - leaf->keys);
+        for (;;) {
+            for (int i = start; i < leaf->count; i++) {
+                if (!visit(leaf->keys[i], leaf->holders[i])) {
+                    return;
+                }
+            }
+            // Climb to the nearest ancestor with a child further right, then take its leftmost leaf
+            while (!path.empty() && path.back().second == path.back().first->count) {
+                path.pop_back();
+            }
+            if (path.empty()) {
+                return;
+            }
+            path.back().second++;
+            node = path.back().first->children[path.back().second];
+            while (!node->leaf) {
+                const InnerNode* inner = static_cast<const InnerNode*>(node);
+                path.push_back(std::make_pair(inner, 0));
+                node = inner->children[0];
+            }
+            leaf = static_cast<const LeafNode*>(node);
+            start = 0;
+        }
+    }
+
+    // Function to replace the contents with distinct keys, sorted by Less, and
+    // their holders (both are moved from). The tree is built bottom up, level by
+    // level, with nodes about three quarters full.
+    void build(std::vector<Key>& keys, std::vector<std::vector<Holder>>& holders) {
+        static constexpr std::size_t FILL = ORDER - ORDER / 4;
+        std::vector<Node*> level;
+        std::vector<Key> firsts; // smallest key beneath each node of the level
+        std::size_t leaves = nodesFor(keys.size(), FILL, MIN_KEYS, ORDER);
+        for (std::size_t l = 0; l < leaves; l++) {
+            std::size_t begin = keys.size() * l / leaves;
+            std::size_t end = keys.size() * (l + 1) / leaves;
+            LeafNode* leaf = new LeafNode();
+            for (std::size_t i = begin; i < end; i++) {
+                leaf->keys[i - begin] = std::move(keys[i]);
+                leaf->holders[i - begin] = std::move(holders[i]);
+            }
+            leaf->count = static_cast<int>(end - begin);
+            firsts.push_back(leaf->keys[0]);
+            level.push_back(leaf);
+        }
+        if (level.empty()) {
+            level.push_back(new LeafNode());
+        }
+
+        // Each separator is the smallest key of the child to its right
+        while (level.size() > 1) {
+            std::size_t parents = nodesFor(level.size(), FILL + 1, MIN_KEYS + 1, ORDER + 1);
+            std::vector<Node*> upper;
+            std::vector<Key> upperFirsts;
+            for (std::size_t p = 0; p < parents; p++) {
+                std::size_t begin = level.size() * p / parents;
+                std::size_t end = level.size() * (p + 1) / parents;
+                InnerNode* inner = new InnerNode();
+                for (std::size_t j = begin; j < end; j++) {
+                    inner->children[j - begin] = level[j];
+                    if (j > begin) {
+                        inner->keys[j - begin - 1] = std::move(firsts[j]);
+                    }
+                }
+                inner->count = static_cast<int>(end - begin - 1);
+                upperFirsts.push_back(std::move(firsts[begin]));
+                upper.push_back(inner);
+            }
+            level.swap(upper);
+            firsts.swap(upperFirsts);
+        }
+
+        release();
+        root.store(level[0], std::memory_order_release);
+        keyCount = keys.size();
+    }
+
+    // Function to drop every key
+    void clear() {
+        release();
+        root.store(new LeafNode(), std::memory_order_release);
+        keyCount = 0;
+    }
+
+    std::size_t size() const {
+        return keyCount;
+    }
+
+    // Levels from the root to the leaves (1 for a lone leaf)
+    std::size_t height() const {
+        std::size_t levels = 1;
+        for (const Node* node = root.load(std::memory_order_acquire); !node->leaf;
+             node = static_cast<const InnerNode*>(node)->children[0]) {
+            levels++;
+        }
+        return levels;
+    }
+};
+
+#endif // SEARCH_INDEX_H
@@ -0,0 +1,475 @@
+#include "ShardedFileSystem.h"
+#include <algorithm>
+#include <sstream>
+#include "NameTable.h"
+
+// Implementation of ShardedFileSystem constructor
+ShardedFileSystem::ShardedFileSystem(std::size_t shardCount, unsigned threads)
+    : pool(static_cast<unsigned>(std::min<std::size_t>(workerCount(threads), std::max<std::size_t>(shardCount, 1)))) {
+    shardCount = std::max<std::size_t>(shardCount, 1);
+    for (std::size_t index = 0; index < shardCount; index++) {
+        shards.emplace_back(new FileSystem());
+        shards.back()->enableConcurrentAccess();
+        for (unsigned point = 0; point < RING_POINTS_PER_SHARD; point++) {
+            std::string key = "shard " + std::to_string(index) + " point " + std::to_string(point);
+            ring.push_back(RingPoint{ringPosition(key), index});
+        }
+    }
+    std::sort(ring.begin(), ring.end(),
+              [](const RingPoint& a, const RingPoint& b) { return a.position < b.position; });
+}
+
+// Private helper function to place a key on the ring: FNV-1a, with its bits
+// mixed so that similar names land far apart
+std::uint32_t ShardedFileSystem::ringPosition(std::string_view key) {
+    std::uint32_t hash = NameTable::hashName(key);
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+// Private helper function to turn a path into "a/b/c" form (no empty components, root is "")
+std::string ShardedFileSystem::normalizePath(const std::string& path) {
+    std::string normalized;
+    std::size_t start = 0;
+    while (start <= path.size()) {
+        std::size_t slash = path.find('/', start);
+        if (slash == std::string::npos) {
+            slash = path.size();
+        }
+        if (slash > start) {
+            if (!normalized.empty()) {
+                normalized += '/';
+            }
+            normalized.append(path, start, slash - start);
+        }
+        start = slash + 1;
+    }
+    return normalized;
+}
+
+// Private helper function to split a normalized path into its parent path and last component
+void ShardedFileSystem::splitPath(const std::string& path, std::string& parent, std::string& leaf) {
+    std::size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        parent.clear();
+        leaf = path;
+    } else {
+        parent = path.substr(0, slash);
+        leaf = path.substr(slash + 1);
+    }
+}
+
+// Private helper function to find the shard of a path: the first point on the
+// ring at or after its top-level component's position
+std::size_t ShardedFileSystem::shardForPath(const std::string& path) const {
+    std::string normalized = normalizePath(path);
+    std::string_view top(normalized);
+    top = top.substr(0, top.find('/'));
+    std::uint32_t position = ringPosition(top);
+    std::vector<RingPoint>::const_iterator point = std::lower_bound(
+        ring.begin(), ring.end(), position, [](const RingPoint& p, std::uint32_t key) { return p.position < key; });
+    return point == ring.end() ? ring.front().shard : point->shard;
+}
+
+// Function to find the shard for an entry of a directory; entries of the root go by their own name
+std::size_t ShardedFileSystem::shardFor(const std::string& dirpath, const std::string& name) const {
+    std::string normalized = normalizePath(dirpath);
+    return shardForPath(normalized.empty() ? name : normalized);
+}
+
+// Private helper function to run work(shard) on every shard at once, on the pool
+template <typename Work>
+void ShardedFileSystem::fanOut(Work work) const {
+    pool.run(shards.size(), [&](std::size_t shard) { work(shard); });
+}
+
+// Function to insert a directory into the shard of its top-level component
+ShardedFileSystem::Status ShardedFileSystem::insertDirectory(const std::string& dirpath) {
+    std::shared_lock<std::shared_mutex> guard(transferLock);
+    return shards[shardForPath(dirpath)]->insertDirectory(dirpath);
+}
+
+// Function to insert a file or directory entry into the shard of its directory
+ShardedFileSystem::Status ShardedFileSystem::insertFile(const std::string& dirpath, const std::string& filename,
+                                                        bool isDir) {
+    std::shared_lock<std::shared_mutex> guard(transferLock);
+    return shards[shardFor(dirpath, filename)]->insertFile(dirpath, filename, isDir);
+}
+
+ShardedFileSystem::Status ShardedFileSystem::insertFile(const std::string& dirpath, const std::string& filename,
+                                                        bool isDir, const Metadata& metadata) {
+    std::shared_lock<std::shared_mutex> guard(transferLock);
+    return shards[shardFor(dirpath, filename)]->insertFile(dirpath, filename, isDir, metadata);
+}
+
+// Function to read an entry's metadata from its shard
+ShardedFileSystem::Status ShardedFileSystem::stat(const std::string& path, Metadata& metadata) const {
+    return shards[shardHolding(path)]->stat(path, metadata);
+}
+
+// Function to change an entry's metadata in its shard
+ShardedFileSystem::Status ShardedFileSystem::setMetadata(const std::string& path, const Metadata& metadata) {
+    std::shared_lock<std::shared_mutex> guard(transferLock);
+    return shards[shardHolding(path)]->setMetadata(path, metadata);
+}
+
+// Function to replace a file's contents in its shard
+ShardedFileSystem::Status ShardedFileSystem::writeFile(const std::string& path, std::string_view data) {
+    std::shared_lock<std::shared_mutex> guard(transferLock);
+    return shards[shardHolding(path)]->writeFile(path, data);
+}
+
+// Function to read a file's contents from its shard
+ShardedFileSystem::Status ShardedFileSystem::readFile(const std::string& path, std::string& data) const {
+    return shards[shardHolding(path)]->readFile(path, data);
+}
+
+// Private helper function to find the shard an entry is looked up on. A path
+// goes to its shard. A bare name (matched anywhere, as FileSystem does) is
+// tried on the shard a top-level entry of that name would be in, then looked
+// for on every shard at once; the lowest numbered one holding it wins.
+std::size_t ShardedFileSystem::shardHolding(const std::string& filename) const {
+    std::size_t home = shardForPath(filename);
+    if (filename.find('/') != std::string::npos || shards[home]->search(filename)) {
+        return home;
+    }
+    std::vector<char> holds(shards.size(), 0);
+    fanOut([&](std::size_t shard) { holds[shard] = shards[shard]->search(filename); });
+    std::vector<char>::const_iterator holder = std::find(holds.begin(), holds.end(), 1);
+    return holder == holds.end() ? home : static_cast<std::size_t>(holder - holds.begin());
+}
+
+// Private helper function to build the path of an entry, "/name" at the root
+// so that it is not taken for a bare name
+std::string ShardedFileSystem::entryPath(const std::string& dirpath, const std::string& name) {
+    return dirpath.empty() ? "/" + name : dirpath + "/" + name;
+}
+
+// Function to remove an entry by path, or a bare name from the shard holding it
+ShardedFileSystem::Status ShardedFileSystem::remove(const std::string& filename) {
+    std::shared_lock<std::shared_mutex> guard(transferLock);
+    return shards[shardHolding(filename)]->remove(filename);
+}
+
+// Function to search every shard for a name or path
+bool ShardedFileSystem::search(const std::string& filename) const {
+    if (filename.find('/') != std::string::npos) {
+        return shards[shardForPath(filename)]->search(filename);
+    }
+    std::vector<char> found(shards.size(), 0);
+    fanOut([&](std::size_t shard) { found[shard] = shards[shard]->search(filename); });
+    return std::find(found.begin(), found.end(), 1) != found.end();
+}
+
+// Function to find the directories holding a name, shard after shard
+std::vector<std::string> ShardedFileSystem::locate(const std::string& filename) const {
+    std::vector<std::vector<std::string>> found(shards.size());
+    fanOut([&](std::size_t shard) { found[shard] = shards[shard]->locate(filename); });
+    std::vector<std::string> dirnames;
+    for (std::vector<std::string>& holders : found) {
+        dirnames.insert(dirnames.end(), holders.begin(), holders.end());
+    }
+    return dirnames;
+}
+
+// Function to list a directory; the root is listed on every shard and the lists joined
+std::vector<std::string> ShardedFileSystem::listDirectory(const std::string& dirpath) const {
+    std::string normalized = normalizePath(dirpath);
+    if (!normalized.empty()) {
+        return shards[shardForPath(normalized)]->listDirectory(normalized);
+    }
+    std::vector<std::vector<std::string>> lists(shards.size());
+    fanOut([&](std::size_t shard) { lists[shard] = shards[shard]->listDirectory(""); });
+    std::vector<std::string> entries;
+    for (std::vector<std::string>& list : lists) {
+        entries.insert(entries.end(), list.begin(), list.end());
+    }
+    return entries;
+}
+
+// Function to read a directory's usage; the root's adds up every shard's
+ShardedFileSystem::Status ShardedFileSystem::usage(const std::string& dirpath, Usage& result) const {
+    std::string normalized = normalizePath(dirpath);
+    if (!normalized.empty()) {
+        return shards[shardForPath(normalized)]->usage(normalized, result);
+    }
+    std::vector<Usage> parts(shards.size());
+    fanOut([&](std::size_t shard) { shards[shard]->usage("", parts[shard]); });
+    result = Usage{0, 0, 0, 0};
+    for (const Usage& part : parts) {
+        result.bytes += part.bytes;
+        result.entries += part.entries;
+        result.newest = std::max(result.newest, part.newest);
+        result.changed = std::max(result.changed, part.changed);
+    }
+    return FileSystem::OK;
+}
+
+// Private helper function to merge per-shard matches (each ordered by name) into one list ordered by name
+std::vector<ShardedFileSystem::Match> ShardedFileSystem::mergeMatches(std::vector<std::vector<Match>>& perShard) const {
+    std::vector<Match> merged;
+    std::vector<std::size_t> bounds(1, 0);
+    for (std::vector<Match>& matches : perShard) {
+        merged.insert(merged.end(), std::make_move_iterator(matches.begin()), std::make_move_iterator(matches.end()));
+        bounds.push_back(merged.size());
+    }
+    for (std::size_t width = 1; width < perShard.size(); width *= 2) {
+        for (std::size_t left = 0; left + width < perShard.size(); left += 2 * width) {
+            std::size_t right = std::min(left + 2 * width, perShard.size());
+            std::inplace_merge(merged.begin() + bounds[left], merged.begin() + bounds[left + width],
+                               merged.begin() + bounds[right],
+                               [](const Match& a, const Match& b) { return a.name < b.name; });
+        }
+    }
+    return merged;
+}
+
+// Functions to find matching entries on every shard at once
+std::vector<ShardedFileSystem::Match> ShardedFileSystem::findByPrefix(const std::string& prefix) const {
+    std::vector<std::vector<Match>> found(shards.size());
+    fanOut([&](std::size_t shard) { found[shard] = shards[shard]->findByPrefix(prefix); });
+    return mergeMatches(found);
+}
+
+std::vector<ShardedFileSystem::Match> ShardedFileSystem::findBySuffix(const std::string& suffix) const {
+    std::vector<std::vector<Match>> found(shards.size());
+    fanOut([&](std::size_t shard) { found[shard] = shards[shard]->findBySuffix(suffix); });
+    return mergeMatches(found);
+}
+
+std::vector<ShardedFileSystem::Match> ShardedFileSystem::findByPattern(const std::string& pattern) const {
+    std::vector<std::vector<Match>> found(shards.size());
+    fanOut([&](std::size_t shard) { found[shard] = shards[shard]->findByPattern(pattern); });
+    return mergeMatches(found);
+}
+
+// Private helper function to print a directory and every directory beneath it,
+// as FileSystem::displayDirectoryStructure does, a page at a time
+void ShardedFileSystem::displayTree(FileSystem& fs, const std::string& path, std::ostream& out) const {
+    out << "Directory: " << path << '\n';
+    FileSystem::ListCursor cursor;
+    std::vector<FileSystem::DirectoryEntry> page;
+    while (!cursor.done && fs.listPage(path, cursor, TRANSFER_PAGE, page) == FileSystem::OK) {
+        for (const FileSystem::DirectoryEntry& entry : page) {
+            out << "- " << entry.name << (entry.isDirectory ? " (Directory)" : " (File)") << '\n';
+        }
+        page.clear();
+    }
+    FileSystem::ListCursor subdirectories;
+    while (!subdirectories.done && fs.listPage(path, subdirectories, TRANSFER_PAGE, page) == FileSystem::OK) {
+        for (const FileSystem::DirectoryEntry& entry : page) {
+            if (entry.isDirectory) {
+                displayTree(fs, path + "/" + entry.name, out);
+            }
+        }
+        page.clear();
+    }
+}
+
+// Function to display the whole structure. Every shard prints the subtrees of
+// its top-level directories at once; the root's entries are joined, then the
+// subtrees follow shard after shard.
+void ShardedFileSystem::displayDirectoryStructure(std::ostream& out) const {
+    std::vector<std::vector<FileSystem::DirectoryEntry>> roots(shards.size());
+    std::vector<std::string> trees(shards.size());
+    fanOut([&](std::size_t shard) {
+        FileSystem& fs = *shards[shard];
+        FileSystem::ListCursor cursor;
+        while (!cursor.done && fs.listPage("", cursor, TRANSFER_PAGE, roots[shard]) == FileSystem::OK) {
+        }
+        std::ostringstream rendered;
+        for (const FileSystem::DirectoryEntry& entry : roots[shard]) {
+            if (entry.isDirectory) {
+                displayTree(fs, entry.name, rendered);
+            }
+        }
+        trees[shard] = rendered.str();
+    });
+
+    bool hasFiles = false;
+    for (const std::vector<FileSystem::DirectoryEntry>& entries : roots) {
+        for (const FileSystem::DirectoryEntry& entry : entries) {
+            hasFiles = hasFiles || !entry.isDirectory;
+        }
+    }
+    if (hasFiles) {
+        out << "Directory: /" << '\n';
+        for (const std::vector<FileSystem::DirectoryEntry>& entries : roots) {
+            for (const FileSystem::DirectoryEntry& entry : entries) {
+                out << "- " << entry.name << (entry.isDirectory ? " (Directory)" : " (File)") << '\n';
+            }
+        }
+    }
+    for (const std::string& tree : trees) {
+        out << tree;
+    }
+}
+
+// Function to display one directory; the root's entries are gathered from every shard
+void ShardedFileSystem::displayDirectoryContents(const std::string& dirname, std::ostream& out) const {
+    std::string normalized = normalizePath(dirname);
+    if (!normalized.empty()) {
+        shards[shardForPath(normalized)]->displayDirectoryContents(dirname, out);
+        return;
+    }
+    std::vector<std::vector<FileSystem::DirectoryEntry>> roots(shards.size());
+    fanOut([&](std::size_t shard) {
+        FileSystem::ListCursor cursor;
+        while (!cursor.done && shards[shard]->listPage("", cursor, TRANSFER_PAGE, roots[shard]) == FileSystem::OK) {
+        }
+    });
+    bool empty = true;
+    for (const std::vector<FileSystem::DirectoryEntry>& entries : roots) {
+        empty = empty && entries.empty();
+    }
+    if (empty) {
+        out << "Directory '" << dirname << "' is empty." << '\n';
+        return;
+    }
+    out << "Contents of directory '" << dirname << "':" << '\n';
+    for (const std::vector<FileSystem::DirectoryEntry>& entries : roots) {
+        for (const FileSystem::DirectoryEntry& entry : entries) {
+            out << "- " << entry.name << (entry.isDirectory ? " (Directory)" : " (File)") << '\n';
+        }
+    }
+}
+
+// Function to rename a directory. When the old and new paths hash to the same
+// shard it renames there; otherwise the subtree is copied to the new shard and
+// removed from the old one.
+ShardedFileSystem::Status ShardedFileSystem::renameDirectory(const std::string& oldName, const std::string& newName) {
+    std::string oldPath = normalizePath(oldName);
+    std::string oldParent;
+    std::string oldLeaf;
+    splitPath(oldPath, oldParent, oldLeaf);
+    std::string newParent = oldParent;
+    std::string newLeaf = newName;
+    if (newName.find('/') != std::string::npos) {
+        splitPath(normalizePath(newName), newParent, newLeaf);
+    }
+    std::size_t from = shardForPath(oldPath);
+    std::size_t to = shardFor(newParent, newLeaf);
+    if (from == to) {
+        std::shared_lock<std::shared_mutex> guard(transferLock);
+        return shards[from]->renameDirectory(oldName, newName);
+    }
+    std::unique_lock<std::shared_mutex> guard(transferLock);
+    Usage subtree;
+    if (oldPath.empty() || shards[from]->usage(oldPath, subtree) != FileSystem::OK) {
+        return FileSystem::NOT_FOUND;
+    }
+    if (newLeaf.empty()) {
+        return FileSystem::DIRECTORY_NOT_FOUND;
+    }
+    return transfer(from, entryPath(oldParent, oldLeaf), to, newParent, newLeaf);
+}
+
+// Function to enqueue a move operation
+void ShardedFileSystem::enqueueMove(const std::string& sourceDir, const std::string& destDir,
+                                    const std::string& filename, bool isDir) {
+    std::lock_guard<std::mutex> guard(moveLock);
+    moveQueue.push(QueuedMove{sourceDir, destDir, filename, isDir});
+}
+
+// Function to process the move queue in order. Moves within one shard are
+// handed to it until a move between shards comes up; then every shard
+// processes what it was handed, in parallel, before that move is made.
+std::vector<ShardedFileSystem::MoveResult> ShardedFileSystem::processMoveQueue() {
+    std::queue<QueuedMove> queued;
+    {
+        std::lock_guard<std::mutex> guard(moveLock);
+        queued.swap(moveQueue);
+    }
+    std::vector<MoveResult> results;
+    std::vector<char> handed(shards.size(), 0);
+    auto flush = [&]() {
+        if (std::find(handed.begin(), handed.end(), 1) == handed.end()) {
+            return;
+        }
+        std::shared_lock<std::shared_mutex> guard(transferLock);
+        std::vector<std::vector<MoveResult>> processed(shards.size());
+        fanOut([&](std::size_t shard) {
+            if (handed[shard]) {
+                processed[shard] = shards[shard]->processMoveQueue();
+            }
+        });
+        for (std::vector<MoveResult>& shardResults : processed) {
+            results.insert(results.end(), shardResults.begin(), shardResults.end());
+        }
+        std::fill(handed.begin(), handed.end(), 0);
+    };
+
+    while (!queued.empty()) {
+        QueuedMove move = queued.front();
+        queued.pop();
+        std::size_t from = shardFor(move.sourceDirectory, move.filename);
+        std::size_t to = shardFor(move.destinationDirectory, move.filename);
+        if (from == to) {
+            shards[from]->enqueueMove(move.sourceDirectory, move.destinationDirectory, move.filename,
+                                      move.isDirectory);
+            handed[from] = 1;
+            continue;
+        }
+        flush();
+        std::string path = entryPath(normalizePath(move.sourceDirectory), move.filename);
+        std::unique_lock<std::shared_mutex> guard(transferLock);
+        Status status = transfer(from, path, to, normalizePath(move.destinationDirectory), move.filename);
+        results.push_back(MoveResult{move.sourceDirectory, move.destinationDirectory, status == FileSystem::OK,
+                                     status == FileSystem::NOT_FOUND || status == FileSystem::DIRECTORY_NOT_FOUND,
+                                     status == FileSystem::ALREADY_EXISTS});
+    }
+    flush();
+    return results;
+}
+
+// Private helper function to move the entry at path (with its subtree) to
+// destDir/name on another shard: it is copied over, metadata and contents
+// included, and then removed from the source. Callers hold transferLock exclusively.
+ShardedFileSystem::Status ShardedFileSystem::transfer(std::size_t from, const std::string& path, std::size_t to,
+                                                      const std::string& destDir, const std::string& name) {
+    FileSystem& source = *shards[from];
+    FileSystem& dest = *shards[to];
+    Metadata meta;
+    if (source.stat(path, meta) != FileSystem::OK) {
+        return FileSystem::NOT_FOUND;
+    }
+    Usage destUsage;
+    if (dest.usage(destDir, destUsage) != FileSystem::OK) {
+        return FileSystem::DIRECTORY_NOT_FOUND;
+    }
+    Metadata existing;
+    if (dest.stat(entryPath(destDir, name), existing) == FileSystem::OK) {
+        return FileSystem::ALREADY_EXISTS;
+    }
+    Usage subtree;
+    bool isDir = source.usage(path, subtree) == FileSystem::OK;
+    copyEntry(source, path, isDir, meta, dest, destDir, name);
+    return source.removeTree(path);
+}
+
+// Private helper function to copy one entry, and a directory's entries beneath it, into another shard
+void ShardedFileSystem::copyEntry(FileSystem& from, const std::string& path, bool isDir, const Metadata& meta,
+                                  FileSystem& to, const std::string& destDir, const std::string& name) {
+    to.insertFile(destDir, name, isDir, meta);
+    std::string copied = entryPath(destDir, name);
+    if (!isDir) {
+        std::string data;
+        if (from.readFile(path, data) == FileSystem::OK && !data.empty()) {
+            to.writeFile(copied, data);
+            to.setMetadata(copied, meta);
+        }
+        return;
+    }
+    FileSystem::ListCursor cursor;
+    std::vector<FileSystem::DirectoryEntry> page;
+    while (!cursor.done && from.listPage(path, cursor, TRANSFER_PAGE, page) == FileSystem::OK) {
+        for (const FileSystem::DirectoryEntry& entry : page) {
+            copyEntry(from, path + "/" + entry.name, entry.isDirectory, entry.meta, to, copied, entry.name);
+        }
+        page.clear();
+    }
+}
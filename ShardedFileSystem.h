@@ -0,0 +1,137 @@
+#ifndef SHARDED_FILE_SYSTEM_H
+#define SHARDED_FILE_SYSTEM_H
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <cstddef>
+#include <cstdint>
+#include "FileSystem.h"
+#include "Parallel.h"
+
+// A namespace split over several FileSystem shards. Each top-level entry, with
+// everything beneath it, lives in the shard its name hashes to on a consistent
+// hash ring, so an operation on one path goes to one shard, and adding a shard
+// would move only the top-level entries whose ring position it takes over.
+// Searches, pattern queries and listings of the root fan out to every shard on
+// a pool of worker threads and their results are merged.
+//
+// The shards run in concurrent mode, so any number of threads may call in at
+// once. An entry moved between shards (a rename or queued move whose
+// destination hashes elsewhere) is copied into the destination shard and then
+// removed from the source while other changes wait, so no change is lost, but a
+// concurrent reader may briefly see it in both.
+class ShardedFileSystem {
+public:
+    typedef FileSystem::Status Status;
+    typedef FileSystem::Match Match;
+    typedef FileSystem::Metadata Metadata;
+    typedef FileSystem::Usage Usage;
+    typedef FileSystem::MoveResult MoveResult;
+
+    // Namespace over shardCount shards, fanning out on threads worker threads
+    // (0 for one per hardware thread)
+    explicit ShardedFileSystem(std::size_t shardCount, unsigned threads = 0);
+
+    ShardedFileSystem(const ShardedFileSystem&) = delete;
+    ShardedFileSystem& operator=(const ShardedFileSystem&) = delete;
+
+    std::size_t shardCount() const {
+        return shards.size();
+    }
+
+    FileSystem& shard(std::size_t index) {
+        return *shards[index];
+    }
+
+    // Function to find the shard holding (or that would hold) an entry of dirpath
+    std::size_t shardFor(const std::string& dirpath, const std::string& name) const;
+
+    // Functions routed to the one shard holding the path...
+    Status insertDirectory(const std::string& dirpath);
+    Status insertFile(const std::string& dirpath, const std::string& filename, bool isDir);
+    Status insertFile(const std::string& dirpath, const std::string& filename, bool isDir, const Metadata& metadata);
+    Status stat(const std::string& path, Metadata& metadata) const;
+    Status setMetadata(const std::string& path, const Metadata& metadata);
+    Status writeFile(const std::string& path, std::string_view data);
+    Status readFile(const std::string& path, std::string& data) const;
+
+    // Function to remove an entry by path, or a bare name from the first shard holding it
+    Status remove(const std::string& filename);
+
+    // Functions fanned out to every shard (the root's entries are spread over all
+    // of them). Root listings keep each shard's order, shard after shard; matches
+    // are merged by name.
+    bool search(const std::string& filename) const;
+    std::vector<std::string> locate(const std::string& filename) const;
+    std::vector<std::string> listDirectory(const std::string& dirpath) const;
+    Status usage(const std::string& dirpath, Usage& result) const;
+    std::vector<Match> findByPrefix(const std::string& prefix) const;
+    std::vector<Match> findBySuffix(const std::string& suffix) const;
+    std::vector<Match> findByPattern(const std::string& pattern) const;
+    void displayDirectoryStructure(std::ostream& out = std::cout) const;
+    void displayDirectoryContents(const std::string& dirname, std::ostream& out = std::cout) const;
+
+    // Function to rename (or with a path, move) a directory, across shards if its new name hashes elsewhere
+    Status renameDirectory(const std::string& oldName, const std::string& newName);
+
+    // Functions to queue moves and process them in order: runs of moves within
+    // shards are handed to the shards' own queues and processed in parallel, a
+    // move between shards copies the entry over (one result each)
+    void enqueueMove(const std::string& sourceDir, const std::string& destDir, const std::string& filename, bool isDir);
+    std::vector<MoveResult> processMoveQueue();
+
+private:
+    // A queued move, as FileSystem keeps them
+    class QueuedMove {
+    public:
+        std::string sourceDirectory;
+        std::string destinationDirectory;
+        std::string filename;
+        bool isDirectory;
+    };
+
+    // A point on the hash ring, owned by the shard whose arc ends there
+    class RingPoint {
+    public:
+        std::uint32_t position;
+        std::size_t shard;
+    };
+
+    static constexpr unsigned RING_POINTS_PER_SHARD = 256;
+    static constexpr std::size_t TRANSFER_PAGE = 1024; // entries listed at a time while copying between shards
+
+    std::vector<std::unique_ptr<FileSystem>> shards;
+    std::vector<RingPoint> ring; // ordered by position
+    mutable WorkerPool pool;
+    std::shared_mutex transferLock; // shared by changes, held exclusively while moving between shards
+    std::mutex moveLock;         // guards moveQueue
+    std::queue<QueuedMove> moveQueue;
+
+    // Private helper functions for routing...
+    static std::string normalizePath(const std::string& path);
+    static void splitPath(const std::string& path, std::string& parent, std::string& leaf);
+    static std::uint32_t ringPosition(std::string_view key);
+    std::size_t shardForPath(const std::string& path) const;
+    std::size_t shardHolding(const std::string& filename) const;
+    static std::string entryPath(const std::string& dirpath, const std::string& name);
+
+    // Private helper function to run work(shard) on every shard at once
+    template <typename Work>
+    void fanOut(Work work) const;
+
+    std::vector<Match> mergeMatches(std::vector<std::vector<Match>>& perShard) const;
+    void displayTree(FileSystem& fs, const std::string& path, std::ostream& out) const;
+
+    // Private helper functions for moving entries between shards...
+    Status transfer(std::size_t from, const std::string& path, std::size_t to, const std::string& destDir,
+                    const std::string& name);
+    void copyEntry(FileSystem& from, const std::string& path, bool isDir, const Metadata& meta, FileSystem& to,
+                   const std::string& destDir, const std::string& name);
+};
+
+#endif // SHARDED_FILE_SYSTEM_H
@@ -0,0 +1,35 @@
+#include "SuffixIndex.h"
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+// Compares two strings from their last characters backwards
+bool reversedLess(std::string_view a, std::string_view b) {
+    return std::lexicographical_compare(a.rbegin(), a.rend(), b.rbegin(), b.rend());
+}
+
+bool endsWith(std::string_view text, std::string_view suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+// Implementation of SuffixIndex constructor
+SuffixIndex::SuffixIndex(const NameTable& table) : names(table), order(table.size()) {
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](NameId a, NameId b) {
+        return reversedLess(names.str(a), names.str(b));
+    });
+}
+
+// Function to append the ids of every covered name ending with suffix.
+// Reversed, those names all start with the reversed suffix, so they follow the
+// first name not ordered before the suffix itself.
+void SuffixIndex::findEnding(std::string_view suffix, std::vector<NameId>& found) const {
+    std::vector<NameId>::const_iterator it = std::lower_bound(order.begin(), order.end(), suffix,
+        [this](NameId id, std::string_view key) { return reversedLess(names.str(id), key); });
+    for (; it != order.end() && endsWith(names.str(*it), suffix); ++it) {
+        found.push_back(*it);
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef SUFFIX_INDEX_H
+#define SUFFIX_INDEX_H
+
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include "NameTable.h"
+
+// Name ids ordered by their text read backwards, so the names sharing a suffix
+// (an extension such as ".jpg", say) form one contiguous range. The index is
+// immutable once built and covers the names interned before it; names never
+// leave the table, so it only goes stale by missing the newest ids, which
+// callers check one by one until they build a fresh index.
+class SuffixIndex {
+public:
+    explicit SuffixIndex(const NameTable& table);
+
+    // Number of ids covered: every id below it is in the index
+    std::size_t covered() const {
+        return order.size();
+    }
+
+    // Function to append the ids of every covered name ending with suffix
+    void findEnding(std::string_view suffix, std::vector<NameId>& found) const;
+
+private:
+    const NameTable& names;
+    std::vector<NameId> order;
+};
+
+#endif // SUFFIX_INDEX_H
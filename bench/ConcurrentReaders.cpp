@@ -0,0 +1,181 @@
+// Read throughput of a shared FileSystem as reader threads are added, and a
+// stress test of its lock-free reads.
+//
+// Builds a namespace, switches it to concurrent mode and runs lookups (search
+// by name and by path, locate, directory listing) from 1, 2, 4, ... threads
+// while one writer keeps inserting and removing files. The same readers are
+// then run through one global mutex, the way callers had to share the object
+// before, for comparison.
+//
+// The writer only touches names starting with "w", so every lookup of the "f"
+// files must find them whatever it is doing: searches succeed, every listing
+// holds all of a directory's "f" files, and locate finds each in every
+// directory. Any lookup that does not is counted, and the exit status
+// is 1 if there were any.
+//
+// Build from the repository root, with every .cpp there except main.cpp and HostMirror.cpp:
+//   g++ -std=c++17 -O2 -I. bench/ConcurrentReaders.cpp CommandRunner.cpp ContentStore.cpp EpochManager.cpp FileNode.cpp
+//       FileSystem.cpp ImportList.cpp Journal.cpp Metrics.cpp NameFilter.cpp NamePattern.cpp NameTable.cpp
+//       NamespaceImage.cpp OutputBuffer.cpp Replication.cpp ShardedFileSystem.cpp SuffixIndex.cpp -o concurrent_readers -lpthread
+// Usage: concurrent_readers [max threads] [milliseconds per run]
+
+#include "FileSystem.h"
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdlib>
+
+namespace {
+
+const int DIRECTORIES = 1000;
+const int FILES_PER_DIRECTORY = 100;
+
+// Discards what the writer prints
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+std::string directoryName(unsigned n) {
+    return "tenant" + std::to_string(n % 10) + "/d" + std::to_string(n);
+}
+
+// Function to run one lookup chosen by the random number; false if its result
+// is wrong about an entry the writer never touches
+bool lookup(const FileSystem& fs, unsigned r) {
+    std::string file = "f" + std::to_string((r >> 8) % FILES_PER_DIRECTORY);
+    switch (r % 4) {
+        case 0:
+            return fs.search(file);
+        case 1:
+            return fs.search(directoryName((r >> 16) % DIRECTORIES) + "/" + file);
+        case 2:
+            return fs.locate(file).size() == static_cast<std::size_t>(DIRECTORIES);
+        default: {
+            int files = 0;
+            for (const std::string& name : fs.listDirectory(directoryName((r >> 16) % DIRECTORIES))) {
+                files += name[0] == 'f';
+            }
+            return files == FILES_PER_DIRECTORY;
+        }
+    }
+}
+
+// Function to measure lookups per second with the given number of reader threads,
+// adding the lookups that went wrong to mismatches
+double measure(FileSystem& fs, int readers, std::chrono::milliseconds duration, std::mutex* global,
+               std::atomic<long>& mismatches) {
+    std::atomic<bool> stop(false);
+    std::atomic<long> total(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < readers; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 rng(t + 1);
+            long done = 0;
+            long wrong = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                bool right;
+                if (global) {
+                    std::lock_guard<std::mutex> lock(*global);
+                    right = lookup(fs, rng());
+                } else {
+                    right = lookup(fs, rng());
+                }
+                wrong += !right;
+                done++;
+            }
+            total += done;
+            mismatches += wrong;
+        });
+    }
+    // One writer keeps churning a set of names the readers also look for
+    threads.emplace_back([&]() {
+        std::mt19937 rng(0);
+        while (!stop.load(std::memory_order_relaxed)) {
+            std::string dir = directoryName(rng() % DIRECTORIES);
+            std::string name = "w" + std::to_string(rng() % 64);
+            std::unique_lock<std::mutex> lock;
+            if (global) {
+                lock = std::unique_lock<std::mutex>(*global);
+            }
+            if (rng() % 2) {
+                fs.insertFile(dir, name, false);
+            } else {
+                fs.remove(dir + "/" + name);
+            }
+        }
+    });
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return total.load() / seconds;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int maxThreads = argc > 1 ? std::atoi(argv[1]) : static_cast<int>(std::thread::hardware_concurrency());
+    std::chrono::milliseconds duration(argc > 2 ? std::atoi(argv[2]) : 1000);
+    if (maxThreads < 1) {
+        maxThreads = 1;
+    }
+
+    NullBuffer discard;
+    std::streambuf* console = std::cout.rdbuf(&discard);
+    FileSystem fs;
+    for (int t = 0; t < 10; t++) {
+        fs.insertDirectory("tenant" + std::to_string(t));
+    }
+    for (int d = 0; d < DIRECTORIES; d++) {
+        fs.insertDirectory(directoryName(d));
+        for (int f = 0; f < FILES_PER_DIRECTORY; f++) {
+            fs.insertFile(directoryName(d), "f" + std::to_string(f), false);
+        }
+    }
+    fs.enableConcurrentAccess();
+
+    std::vector<int> counts;
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    if (counts.back() != maxThreads) {
+        counts.push_back(maxThreads);
+    }
+
+    std::vector<double> lockFree;
+    std::vector<double> locked;
+    std::mutex global;
+    std::atomic<long> mismatches(0);
+    for (int threads : counts) {
+        lockFree.push_back(measure(fs, threads, duration, nullptr, mismatches));
+        locked.push_back(measure(fs, threads, duration, &global, mismatches));
+    }
+    std::cout.rdbuf(console);
+
+    std::cout << "Readers  lock-free ops/s  speedup  global mutex ops/s  speedup" << std::endl;
+    for (std::size_t i = 0; i < counts.size(); i++) {
+        std::cout << std::setw(7) << counts[i] << std::fixed << std::setprecision(0) << std::setw(18) << lockFree[i]
+                  << std::setprecision(2) << std::setw(9) << lockFree[i] / lockFree[0] << std::setprecision(0)
+                  << std::setw(20) << locked[i] << std::setprecision(2) << std::setw(9) << locked[i] / locked[0]
+                  << std::endl;
+    }
+    std::cout << "(" << std::thread::hardware_concurrency() << " hardware thread(s), one writer running throughout)"
+              << std::endl;
+    if (mismatches.load() > 0) {
+        std::cerr << "Error: " << mismatches.load() << " lookup(s) missed entries the writer never touches." << std::endl;
+        return 1;
+    }
+    return 0;
+}
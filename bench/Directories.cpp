@@ -0,0 +1,278 @@
+// Scans of one large directory, with its entries packed into arrays or walked
+// as a linked list of nodes.
+//
+// Each run fills one directory with n entries (one in 16 a subdirectory, names
+// 12 random characters, a third with an extension) and sorts it by name, so the
+// list no longer runs through memory in allocation order, as in a directory that
+// has been in use for a while. Then it times:
+//   list        listDirectory, repeated; the first call walks the list
+//   page        listPage through the whole directory, 1024 entries at a time
+//   copy_tree   copyTree of the directory, which first walks it for subdirectories
+//   churn       an insert and a remove before every listDirectory, so the
+//               directory changes between every two scans
+//   sort        sortDirectory, alternately by extension and by name
+// Scans are reported per entry. Build the benchmark twice and compare the two
+// runs: as is, a large directory scanned twice without changing is laid out in
+// arrays; with -DFILESYSTEM_LIST_DIRECTORIES every directory stays a list, as
+// before. The "layout" field of the results says which build ran.
+//
+// Results are one line per (size, operation), JSON objects by default or CSV
+// with a header. Times are nanoseconds per entry: the median, the fastest and
+// the slowest of the repetitions.
+//
+// Build from the repository root, with every .cpp there except main.cpp and HostMirror.cpp:
+//   g++ -std=c++17 -O2 -I. bench/Directories.cpp CommandRunner.cpp ContentStore.cpp EpochManager.cpp FileNode.cpp
+//       FileSystem.cpp ImportList.cpp Journal.cpp Metrics.cpp NameFilter.cpp NamePattern.cpp NameTable.cpp
+//       NamespaceImage.cpp OutputBuffer.cpp Replication.cpp ShardedFileSystem.cpp SuffixIndex.cpp -o directories
+//       -lpthread
+// Usage: directories [--sizes 1000,100000,1000000] [--repeat 20] [--seed 1] [--format json|csv]
+
+#include "FileSystem.h"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+namespace {
+
+#if defined(FILESYSTEM_LIST_DIRECTORIES)
+const char* const LAYOUT = "lists";
+#else
+const char* const LAYOUT = "arrays";
+#endif
+
+const std::size_t PAGE = 1024;
+const char* const DIRECTORY = "/big";
+
+// Discards what the operations print
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+class Options {
+public:
+    std::vector<std::size_t> sizes{1000, 100000, 1000000};
+    int repeat = 20;
+    unsigned seed = 1;
+    bool csv = false;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// Times of the repetitions of one operation, each over the whole directory
+class Timings {
+public:
+    void add(double seconds) {
+        runs.push_back(seconds);
+    }
+
+    double median() const {
+        if (runs.empty()) {
+            return 0;
+        }
+        std::vector<double> sorted = runs;
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+        return sorted[sorted.size() / 2];
+    }
+
+    double fastest() const {
+        return runs.empty() ? 0 : *std::min_element(runs.begin(), runs.end());
+    }
+
+    double slowest() const {
+        return runs.empty() ? 0 : *std::max_element(runs.begin(), runs.end());
+    }
+
+private:
+    std::vector<double> runs;
+};
+
+// Function to time one call
+template <typename Call>
+double timed(Call call) {
+    Clock::time_point start = Clock::now();
+    call();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Collects one line of results per operation
+class Report {
+public:
+    Report(std::ostream& stream, bool asCsv, int repetitions) : out(stream), csv(asCsv), repeat(repetitions) {
+        if (csv) {
+            out << "size,layout,operation,repeat,median_ns_per_entry,min_ns_per_entry,max_ns_per_entry" << std::endl;
+        }
+    }
+
+    // Function to print one operation, its times divided over the entries it covered
+    void add(std::size_t size, const std::string& operation, const Timings& timings) {
+        double perEntry = 1e9 / static_cast<double>(size);
+        out << std::fixed << std::setprecision(2);
+        if (csv) {
+            out << size << "," << LAYOUT << "," << operation << "," << repeat << "," << timings.median() * perEntry
+                << "," << timings.fastest() * perEntry << "," << timings.slowest() * perEntry << std::endl;
+        } else {
+            out << "{\"size\":" << size << ",\"layout\":\"" << LAYOUT << "\",\"operation\":\"" << operation
+                << "\",\"repeat\":" << repeat << ",\"median_ns_per_entry\":" << timings.median() * perEntry
+                << ",\"min_ns_per_entry\":" << timings.fastest() * perEntry
+                << ",\"max_ns_per_entry\":" << timings.slowest() * perEntry << "}" << std::endl;
+        }
+    }
+
+private:
+    std::ostream& out;
+    bool csv;
+    int repeat;
+};
+
+// Function to make n unique names in a random order
+std::vector<std::string> makeNames(std::size_t n, unsigned seed) {
+    static const char ALPHABET[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    static const char* const EXTENSIONS[] = {".txt", ".cpp", ".log"};
+    std::mt19937_64 rng(seed);
+    std::vector<std::string> names(n);
+    for (std::size_t i = 0; i < n; i++) {
+        std::string name(12, ' ');
+        std::uint64_t bits = rng();
+        for (char& c : name) {
+            c = ALPHABET[bits % 36];
+            bits /= 36;
+        }
+        // Keep names unique by appending the entry number
+        names[i] = name + "-" + std::to_string(i) + (i % 3 == 0 ? EXTENSIONS[bits % 3] : "");
+    }
+    return names;
+}
+
+// Function to run every operation over a directory of n entries
+void run(std::size_t n, const Options& options, Report& report) {
+    std::vector<std::string> names = makeNames(n, options.seed + static_cast<unsigned>(n));
+    FileSystem fs;
+    fs.insertDirectory(DIRECTORY);
+    for (std::size_t i = 0; i < n; i++) {
+        fs.insertFile(DIRECTORY, names[i], i % 16 == 0);
+    }
+    fs.sortDirectory(DIRECTORY, FileSystem::BY_NAME);
+
+    {
+        Timings timings;
+        std::size_t listed = 0;
+        for (int i = 0; i < options.repeat; i++) {
+            timings.add(timed([&]() { listed += fs.listDirectory(DIRECTORY).size(); }));
+        }
+        if (listed != n * static_cast<std::size_t>(options.repeat)) {
+            std::cerr << "Error: listed " << listed << " entries." << std::endl;
+        }
+        report.add(n, "list", timings);
+    }
+    {
+        Timings timings;
+        std::vector<FileSystem::DirectoryEntry> page;
+        for (int i = 0; i < options.repeat; i++) {
+            timings.add(timed([&]() {
+                FileSystem::ListCursor cursor;
+                while (!cursor.done) {
+                    page.clear();
+                    fs.listPage(DIRECTORY, cursor, PAGE, page);
+                }
+            }));
+        }
+        report.add(n, "page", timings);
+    }
+    {
+        Timings timings;
+        for (int i = 0; i < options.repeat; i++) {
+            std::string copied;
+            timings.add(timed([&]() { fs.copyTree(DIRECTORY, "/", copied); }));
+            fs.removeTree("/" + copied);
+        }
+        report.add(n, "copy_tree", timings);
+    }
+    {
+        Timings timings;
+        for (int i = 0; i < options.repeat; i++) {
+            std::string name = "churn" + std::to_string(i);
+            timings.add(timed([&]() {
+                fs.insertFile(DIRECTORY, name, false);
+                fs.remove(std::string(DIRECTORY) + "/" + name);
+                fs.listDirectory(DIRECTORY);
+            }));
+        }
+        report.add(n, "churn", timings);
+    }
+    {
+        Timings timings;
+        for (int i = 0; i < options.repeat; i++) {
+            FileSystem::SortKey key = i % 2 == 0 ? FileSystem::BY_EXTENSION : FileSystem::BY_NAME;
+            timings.add(timed([&]() { fs.sortDirectory(DIRECTORY, key); }));
+        }
+        report.add(n, "sort", timings);
+    }
+}
+
+// Function to split a comma-separated list
+std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Error: Missing value for '" << flag << "'." << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (flag == "--sizes") {
+            // Sizes may be written as 1e6
+            options.sizes.clear();
+            for (const std::string& size : splitList(value)) {
+                options.sizes.push_back(static_cast<std::size_t>(std::strtod(size.c_str(), nullptr)));
+            }
+        } else if (flag == "--repeat") {
+            options.repeat = std::max(1, std::atoi(value.c_str()));
+        } else if (flag == "--seed") {
+            options.seed = static_cast<unsigned>(std::atoi(value.c_str()));
+        } else if (flag == "--format" && (value == "json" || value == "csv")) {
+            options.csv = value == "csv";
+        } else {
+            std::cerr << "Error: Unknown option '" << flag << " " << value << "'." << std::endl;
+            return false;
+        }
+    }
+    return !options.sizes.empty();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+    NullBuffer discard;
+    std::streambuf* console = std::cout.rdbuf(&discard);
+    std::ostream results(console);
+    Report report(results, options.csv, options.repeat);
+    for (std::size_t n : options.sizes) {
+        run(n, options, report);
+    }
+    std::cout.rdbuf(console);
+    return 0;
+}
@@ -0,0 +1,462 @@
+// Throughput, latency and memory of every FileSystem operation at scale.
+//
+// Each run builds a namespace of the given size from a reproducible synthetic
+// workload and times the public operations on it one call at a time:
+//   insert        insertFile into the layout's directories
+//   search_name   search by bare name (through the search index)
+//   search_path   search by full path (directory walk and directory index)
+//   mixed         reads and writes interleaved at --read-ratio
+//   sort          sortDirectory by name, once per directory, each call's time
+//                 divided over the entries it sorted
+//   backup        createBackup, followed by a write so the next restore has work
+//   restore       restoreBackup
+//   move          processMoveQueue over a queue of moves between two directories,
+//                 each call's time divided over the entries it moved
+//   remove        remove by full path, every entry
+// Layouts: "wide" spreads the entries over 16 top-level directories, "deep" over
+// a chain of 32 nested directories, so paths are long. Names are either
+// sequential ("f00000001", inserted in order) or 12 random characters followed
+// by the entry number.
+//
+// Results are one line per (size, layout, names, operation): JSON objects by
+// default, or CSV with a header. Latencies are in nanoseconds, taken from a
+// log-linear histogram (about 3% resolution). peak_rss_kb is the process
+// high-water mark when the operation finished, so it only grows within one
+// invocation; run one size per process to compare memory across sizes.
+//
+// The default sizes stop at 10^5 so that a run takes a minute or so. The full
+// sweep from 10^3 to 10^7 entries runs one size per process, which also keeps
+// peak_rss_kb per size (10^7 entries take several GB and a long time):
+//   for n in 1e3 1e4 1e5 1e6 1e7; do ./operations --sizes $n --format csv; done
+//
+// Build from the repository root, with every .cpp there except main.cpp and HostMirror.cpp:
+//   g++ -std=c++17 -O2 -I. bench/Operations.cpp CommandRunner.cpp ContentStore.cpp EpochManager.cpp FileNode.cpp
+//       FileSystem.cpp ImportList.cpp Journal.cpp Metrics.cpp NameFilter.cpp NamePattern.cpp NameTable.cpp
+//       NamespaceImage.cpp OutputBuffer.cpp Replication.cpp ShardedFileSystem.cpp SuffixIndex.cpp -o operations -lpthread
+// Usage: operations [--sizes 1000,100000] [--layout wide|deep|both] [--names sequential|random|both]
+//                   [--read-ratio 0.9] [--samples 1000000] [--seed 1] [--format json|csv]
+
+#include "FileSystem.h"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <sys/resource.h>
+
+namespace {
+
+const int WIDE_DIRECTORIES = 16;
+const int DEEP_LEVELS = 32;
+
+// Discards what the operations print
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+// Latencies in buckets of 1/32 of a power of two: fixed memory however many
+// operations are recorded, and percentiles within about 3%
+class Histogram {
+public:
+    Histogram() : buckets(64 * SUB_BUCKETS, 0), count(0), total(0), largest(0) {}
+
+    void record(std::uint64_t nanoseconds) {
+        buckets[bucketOf(nanoseconds)]++;
+        count++;
+        total += nanoseconds;
+        largest = std::max(largest, nanoseconds);
+    }
+
+    // Function to return the smallest latency at or above the given fraction of samples
+    std::uint64_t percentile(double fraction) const {
+        std::uint64_t rank = static_cast<std::uint64_t>(fraction * static_cast<double>(count) + 0.5);
+        rank = std::max<std::uint64_t>(1, std::min(rank, count));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < buckets.size(); i++) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return std::min(upperBoundOf(i), largest);
+            }
+        }
+        return largest;
+    }
+
+    std::uint64_t samples() const {
+        return count;
+    }
+
+    std::uint64_t sum() const {
+        return total;
+    }
+
+    std::uint64_t max() const {
+        return largest;
+    }
+
+private:
+    static const int SUB_BUCKETS = 32;
+    std::vector<std::uint64_t> buckets;
+    std::uint64_t count;
+    std::uint64_t total;
+    std::uint64_t largest;
+
+    static std::size_t bucketOf(std::uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<std::size_t>(value);
+        }
+        int magnitude = 63 - __builtin_clzll(value); // at least 5
+        std::uint64_t sub = (value >> (magnitude - 5)) & (SUB_BUCKETS - 1);
+        return static_cast<std::size_t>((magnitude - 4) * SUB_BUCKETS + sub);
+    }
+
+    static std::uint64_t upperBoundOf(std::size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        int magnitude = static_cast<int>(bucket / SUB_BUCKETS) + 4;
+        std::uint64_t sub = bucket % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (magnitude - 5)) - 1;
+    }
+};
+
+class Options {
+public:
+    std::vector<std::size_t> sizes{1000, 10000, 100000};
+    std::vector<std::string> layouts{"wide", "deep"};
+    std::vector<std::string> namings{"sequential", "random"};
+    double readRatio = 0.9;
+    std::size_t samples = 1000000; // cap on timed calls for the read and mixed phases
+    unsigned seed = 1;
+    bool csv = false;
+};
+
+// One workload: the directories and the (directory, name) of every entry
+class Workload {
+public:
+    std::vector<std::string> directories;
+    std::vector<std::uint32_t> holder; // index into directories, per entry
+    std::vector<std::string> names;
+};
+
+// Function to build a reproducible workload of n entries
+Workload makeWorkload(std::size_t n, const std::string& layout, const std::string& naming, unsigned seed) {
+    Workload work;
+    if (layout == "deep") {
+        std::string path;
+        for (int level = 0; level < DEEP_LEVELS; level++) {
+            path += (level ? "/l" : "l") + std::to_string(level);
+            work.directories.push_back(path);
+        }
+    } else {
+        for (int d = 0; d < WIDE_DIRECTORIES; d++) {
+            work.directories.push_back("w" + std::to_string(d));
+        }
+    }
+    std::mt19937_64 rng(seed);
+    work.holder.resize(n);
+    work.names.resize(n);
+    for (std::size_t i = 0; i < n; i++) {
+        work.holder[i] = static_cast<std::uint32_t>(i % work.directories.size());
+        if (naming == "random") {
+            static const char ALPHABET[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+            std::string name(12, ' ');
+            std::uint64_t bits = rng();
+            for (char& c : name) {
+                c = ALPHABET[bits % 36];
+                bits /= 36;
+            }
+            // Keep names unique within a directory by appending the entry number
+            work.names[i] = name + "." + std::to_string(i);
+        } else {
+            std::ostringstream name;
+            name << "f" << std::setw(8) << std::setfill('0') << i;
+            work.names[i] = name.str();
+        }
+    }
+    return work;
+}
+
+std::string pathOf(const Workload& work, std::size_t entry) {
+    return work.directories[work.holder[entry]] + "/" + work.names[entry];
+}
+
+long peakResidentKilobytes() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss; // kilobytes on Linux
+}
+
+// Collects one line of results per operation
+class Report {
+public:
+    Report(std::ostream& stream, bool asCsv) : out(stream), csv(asCsv) {
+        if (csv) {
+            out << "size,layout,names,operation,ops,seconds,ops_per_sec,mean_ns,p50_ns,p99_ns,max_ns,peak_rss_kb"
+                << std::endl;
+        }
+    }
+
+    // Function to print one operation; seconds is wall time for all of it, and
+    // units the number of items processed (entries moved, say) when not the call count
+    void add(std::size_t size, const std::string& layout, const std::string& naming, const std::string& operation,
+             const Histogram& latency, double seconds, std::uint64_t units = 0) {
+        std::uint64_t ops = units ? units : latency.samples();
+        double rate = seconds > 0 ? static_cast<double>(ops) / seconds : 0;
+        double mean = latency.samples() ? static_cast<double>(latency.sum()) / static_cast<double>(latency.samples()) : 0;
+        long rss = peakResidentKilobytes();
+        out << std::fixed;
+        if (csv) {
+            out << size << "," << layout << "," << naming << "," << operation << "," << ops << ","
+                << std::setprecision(6) << seconds << "," << std::setprecision(0) << rate << "," << mean << ","
+                << latency.percentile(0.50) << "," << latency.percentile(0.99) << "," << latency.max() << "," << rss
+                << std::endl;
+        } else {
+            out << "{\"size\":" << size << ",\"layout\":\"" << layout << "\",\"names\":\"" << naming
+                << "\",\"operation\":\"" << operation << "\",\"ops\":" << ops << ",\"seconds\":" << std::setprecision(6)
+                << seconds << ",\"ops_per_sec\":" << std::setprecision(0) << rate << ",\"mean_ns\":" << mean
+                << ",\"p50_ns\":" << latency.percentile(0.50) << ",\"p99_ns\":" << latency.percentile(0.99)
+                << ",\"max_ns\":" << latency.max() << ",\"peak_rss_kb\":" << rss << "}" << std::endl;
+        }
+    }
+
+private:
+    std::ostream& out;
+    bool csv;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// Function to time one call into the histogram, divided over the entries it covered
+template <typename Call>
+void timed(Histogram& latency, Call call, std::uint64_t entries = 1) {
+    Clock::time_point start = Clock::now();
+    call();
+    std::uint64_t elapsed = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+    latency.record(elapsed / std::max<std::uint64_t>(entries, 1));
+}
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Function to run every operation over one workload
+void run(std::size_t n, const std::string& layout, const std::string& naming, const Options& options, Report& report) {
+    Workload work = makeWorkload(n, layout, naming, options.seed);
+    std::mt19937_64 rng(options.seed + n);
+    std::size_t reads = std::min(n, options.samples);
+    FileSystem fs;
+    for (const std::string& dir : work.directories) {
+        fs.insertDirectory(dir);
+    }
+
+    {
+        Histogram latency;
+        Clock::time_point start = Clock::now();
+        for (std::size_t i = 0; i < n; i++) {
+            timed(latency, [&]() { fs.insertFile(work.directories[work.holder[i]], work.names[i], false); });
+        }
+        report.add(n, layout, naming, "insert", latency, secondsSince(start));
+    }
+    {
+        Histogram latency;
+        Clock::time_point start = Clock::now();
+        for (std::size_t i = 0; i < reads; i++) {
+            const std::string& name = work.names[rng() % n];
+            timed(latency, [&]() { fs.search(name); });
+        }
+        report.add(n, layout, naming, "search_name", latency, secondsSince(start));
+    }
+    {
+        std::vector<std::string> paths(reads);
+        for (std::string& path : paths) {
+            path = pathOf(work, rng() % n);
+        }
+        Histogram latency;
+        Clock::time_point start = Clock::now();
+        for (const std::string& path : paths) {
+            timed(latency, [&]() { fs.search(path); });
+        }
+        report.add(n, layout, naming, "search_path", latency, secondsSince(start));
+    }
+    {
+        // Writes insert a fresh name or remove one inserted earlier in this phase
+        std::uniform_real_distribution<double> coin(0.0, 1.0);
+        std::vector<std::string> added;
+        std::size_t next = 0;
+        Histogram latency;
+        Clock::time_point start = Clock::now();
+        for (std::size_t i = 0; i < reads; i++) {
+            if (coin(rng) < options.readRatio) {
+                const std::string& name = work.names[rng() % n];
+                timed(latency, [&]() { fs.search(name); });
+            } else if (!added.empty() && rng() % 2) {
+                std::string path = added.back();
+                added.pop_back();
+                timed(latency, [&]() { fs.remove(path); });
+            } else {
+                const std::string& dir = work.directories[rng() % work.directories.size()];
+                std::string name = "m" + std::to_string(next++);
+                timed(latency, [&]() { fs.insertFile(dir, name, false); });
+                added.push_back(dir + "/" + name);
+            }
+        }
+        report.add(n, layout, naming, "mixed", latency, secondsSince(start));
+        for (const std::string& path : added) {
+            fs.remove(path);
+        }
+    }
+    {
+        std::vector<std::uint64_t> held(work.directories.size(), 0);
+        for (std::uint32_t dir : work.holder) {
+            held[dir]++;
+        }
+        Histogram latency;
+        Clock::time_point start = Clock::now();
+        for (std::size_t d = 0; d < work.directories.size(); d++) {
+            timed(latency, [&]() { fs.sortDirectory(work.directories[d], FileSystem::BY_NAME); }, held[d]);
+        }
+        report.add(n, layout, naming, "sort", latency, secondsSince(start), n);
+    }
+    {
+        const int CYCLES = 16;
+        Histogram backup;
+        Histogram restore;
+        double backupSeconds = 0;
+        double restoreSeconds = 0;
+        for (int cycle = 0; cycle < CYCLES; cycle++) {
+            Clock::time_point start = Clock::now();
+            timed(backup, [&]() { fs.createBackup(); });
+            backupSeconds += secondsSince(start);
+            fs.insertFile(work.directories[cycle % work.directories.size()], "b" + std::to_string(cycle), false);
+            start = Clock::now();
+            timed(restore, [&]() { fs.restoreBackup(); });
+            restoreSeconds += secondsSince(start);
+        }
+        report.add(n, layout, naming, "backup", backup, backupSeconds);
+        report.add(n, layout, naming, "restore", restore, restoreSeconds);
+    }
+    {
+        // Move the first directory's entries to the second and back, in batches
+        const std::size_t BATCH = 4096;
+        std::vector<std::size_t> entries;
+        for (std::size_t i = 0; i < n; i += work.directories.size()) {
+            entries.push_back(i);
+        }
+        Histogram latency;
+        std::uint64_t moved = 0;
+        double seconds = 0;
+        for (int direction = 0; direction < 2; direction++) {
+            const std::string& from = work.directories[direction == 0 ? 0 : 1];
+            const std::string& to = work.directories[direction == 0 ? 1 : 0];
+            for (std::size_t first = 0; first < entries.size(); first += BATCH) {
+                std::size_t last = std::min(entries.size(), first + BATCH);
+                for (std::size_t i = first; i < last; i++) {
+                    fs.enqueueMove(from, to, work.names[entries[i]], false);
+                }
+                Clock::time_point start = Clock::now();
+                timed(latency, [&]() { fs.processMoveQueue(); }, last - first);
+                seconds += secondsSince(start);
+                moved += last - first;
+            }
+        }
+        report.add(n, layout, naming, "move", latency, seconds, moved);
+    }
+    {
+        std::vector<std::size_t> order(n);
+        for (std::size_t i = 0; i < n; i++) {
+            order[i] = i;
+        }
+        std::shuffle(order.begin(), order.end(), rng);
+        Histogram latency;
+        Clock::time_point start = Clock::now();
+        for (std::size_t i : order) {
+            std::string path = pathOf(work, i);
+            timed(latency, [&]() { fs.remove(path); });
+        }
+        report.add(n, layout, naming, "remove", latency, secondsSince(start));
+    }
+}
+
+// Function to split a comma-separated list
+std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+std::vector<std::string> choices(const std::string& value, const std::string& first, const std::string& second) {
+    if (value == "both") {
+        return {first, second};
+    }
+    return {value};
+}
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Error: Missing value for '" << flag << "'." << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (flag == "--sizes") {
+            // Sizes may be written as 1e7
+            options.sizes.clear();
+            for (const std::string& size : splitList(value)) {
+                options.sizes.push_back(static_cast<std::size_t>(std::strtod(size.c_str(), nullptr)));
+            }
+        } else if (flag == "--layout" && (value == "wide" || value == "deep" || value == "both")) {
+            options.layouts = choices(value, "wide", "deep");
+        } else if (flag == "--names" && (value == "sequential" || value == "random" || value == "both")) {
+            options.namings = choices(value, "sequential", "random");
+        } else if (flag == "--read-ratio") {
+            options.readRatio = std::atof(value.c_str());
+        } else if (flag == "--samples") {
+            options.samples = static_cast<std::size_t>(std::strtod(value.c_str(), nullptr));
+        } else if (flag == "--seed") {
+            options.seed = static_cast<unsigned>(std::atoi(value.c_str()));
+        } else if (flag == "--format" && (value == "json" || value == "csv")) {
+            options.csv = value == "csv";
+        } else {
+            std::cerr << "Error: Unknown option '" << flag << " " << value << "'." << std::endl;
+            return false;
+        }
+    }
+    return !options.sizes.empty();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+    NullBuffer discard;
+    std::streambuf* console = std::cout.rdbuf(&discard);
+    std::ostream results(console);
+    Report report(results, options.csv);
+    for (std::size_t n : options.sizes) {
+        for (const std::string& layout : options.layouts) {
+            for (const std::string& naming : options.namings) {
+                run(n, layout, naming, options, report);
+            }
+        }
+    }
+    std::cout.rdbuf(console);
+    return 0;
+}
@@ -1,25 +1,153 @@
 #include <iostream>
+#include <fstream>
+#include <unistd.h>
 #include "FileSystem.h"
+#include "CommandRunner.h"
+#include "Replication.h"
+#include "HostMirror.h"
+#include "OutputBuffer.h"
 
-int main() {
+// Function to print why a change failed; subject is the path it failed on
+void printError(FileSystem::Status status, const std::string& subject) {
+    if (status != FileSystem::OK) {
+        std::cout << "Error: '" << subject << "': " << FileSystem::describe(status) << "." << std::endl;
+    }
+}
+
+// Function to run a command script (a file, or stdin for "-") without prompts,
+// read-only when it runs against a replica. Output, including what the library
+// prints, goes through one large buffer.
+int runBatch(FileSystem& fileSystem, const std::string& scriptPath, const ReplicationFollower* follower = nullptr) {
+    std::ios::sync_with_stdio(false);
+    std::ifstream script;
+    if (scriptPath != "-") {
+        script.open(scriptPath.c_str());
+        if (!script) {
+            std::cout << "Error: cannot open '" << scriptPath << "'." << std::endl;
+            return 1;
+        }
+    }
+    OutputBuffer buffer(STDOUT_FILENO);
+    std::streambuf* console = std::cout.rdbuf(&buffer);
+    CommandRunner runner(fileSystem, std::cout);
+    runner.setFollower(follower);
+    runner.run(scriptPath == "-" ? std::cin : script);
+    std::cout.flush();
+    std::cout.rdbuf(console);
+    std::cerr << runner.commands() << " command(s), " << runner.failures() << " failed" << std::endl;
+    return runner.failures() == 0 ? 0 : 2;
+}
+
+// Function to stop a host mirror and say if any host directory went unwatched
+void stopMirror(HostMirror& mirror) {
+    mirror.stop();
+    if (mirror.unwatched() > 0) {
+        std::cerr << "Error: " << mirror.watchError() << " (" << mirror.unwatched()
+                  << " host director(ies) not followed)." << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
     FileSystem fileSystem;
 
-    // Insert directories
-    fileSystem.insertDirectory("documents");
-    fileSystem.insertDirectory("pictures");
-    fileSystem.insertDirectory("music");
+    // "--batch SCRIPT" runs a script instead of the menu; the exit status is 2 if
+    // any of its commands failed. "--primary SOCKET" serves every change to
+    // replicas connecting at SOCKET; "--follow SOCKET" makes this a read-only
+    // replica of the primary there, answering a script (stdin by default).
+    // "--mirror HOSTDIR" imports a host directory tree and keeps following it.
+    std::string scriptPath;
+    std::string primarySocket;
+    std::string followSocket;
+    std::string mirrorPath;
+    int firstArgument = 1;
+    while (argc > firstArgument + 1) {
+        std::string option = argv[firstArgument];
+        if (option == "--batch") {
+            scriptPath = argv[firstArgument + 1];
+        } else if (option == "--primary") {
+            primarySocket = argv[firstArgument + 1];
+        } else if (option == "--follow") {
+            followSocket = argv[firstArgument + 1];
+        } else if (option == "--mirror") {
+            mirrorPath = argv[firstArgument + 1];
+        } else {
+            break;
+        }
+        firstArgument += 2;
+    }
+
+    if (!followSocket.empty()) {
+        ReplicationFollower follower(fileSystem);
+        std::string error;
+        if (!follower.connect(followSocket, error)) {
+            std::cout << "Error: " << error << "." << std::endl;
+            return 1;
+        }
+        return runBatch(fileSystem, scriptPath.empty() ? "-" : scriptPath, &follower);
+    }
 
-    // Insert files into "documents" directory
-    fileSystem.insertFile("documents", "resume.docx", false);
-    fileSystem.insertFile("documents", "presentation.pptx", false);
+    // An image path on the command line is opened at start, every change is
+    // journaled next to it, and it is checkpointed on exit
+    std::string imagePath = argc > firstArgument ? argv[firstArgument] : "";
+    std::ifstream existingImage(imagePath.c_str());
+    if (existingImage.good()) {
+        existingImage.close();
+        if (!fileSystem.open(imagePath)) {
+            return 1;
+        }
+    } else if (scriptPath.empty() && mirrorPath.empty()) {
+        // Insert directories
+        fileSystem.insertDirectory("documents");
+        fileSystem.insertDirectory("pictures");
+        fileSystem.insertDirectory("music");
 
-    // Insert files into "pictures" directory
-    fileSystem.insertFile("pictures", "vacation.jpg", false);
-    fileSystem.insertFile("pictures", "family.jpg", false);
+        // Insert files into "documents" directory
+        fileSystem.insertFile("documents", "resume.docx", false);
+        fileSystem.insertFile("documents", "presentation.pptx", false);
 
-    // Insert files into "music" directory
-    fileSystem.insertFile("music", "song1.mp3", false);
-    fileSystem.insertFile("music", "song2.mp3", false);
+        // Insert files into "pictures" directory
+        fileSystem.insertFile("pictures", "vacation.jpg", false);
+        fileSystem.insertFile("pictures", "family.jpg", false);
+
+        // Insert files into "music" directory
+        fileSystem.insertFile("music", "song1.mp3", false);
+        fileSystem.insertFile("music", "song2.mp3", false);
+    }
+    if (!imagePath.empty()) {
+        std::string journalPath = imagePath + ".journal";
+        std::size_t replayed = 0;
+        if (!fileSystem.openJournal(journalPath, Journal::GROUP_COMMIT, &replayed)) {
+            return 1;
+        }
+        if (replayed > 0) {
+            std::cerr << "Replayed " << replayed << " operation(s) from journal '" << journalPath << "'." << std::endl;
+        }
+        fileSystem.setCheckpointInterval(imagePath, 100000);
+    }
+    ReplicationPrimary primary(fileSystem);
+    if (!primarySocket.empty()) {
+        std::string error;
+        if (!primary.listen(primarySocket, error)) {
+            std::cout << "Error: " << error << "." << std::endl;
+            return 1;
+        }
+    }
+    HostMirror mirror(fileSystem);
+    if (!mirrorPath.empty()) {
+        std::string error;
+        if (!mirror.start(mirrorPath, "", error)) {
+            std::cout << "Error: " << error << "." << std::endl;
+            return 1;
+        }
+    }
+    if (!scriptPath.empty()) {
+        int status = runBatch(fileSystem, scriptPath);
+        stopMirror(mirror);
+        if (!imagePath.empty() && !fileSystem.checkpoint(imagePath)) {
+            return 1;
+        }
+        return status;
+    }
 
     int choice;
     std::string name;
@@ -28,6 +156,7 @@ int main() {
     bool isDir;
     std::string dirName;
     std::string newName;
+    FileSystem::Status status;
 
     do {
         std::cout << "\nFile System Menu:\n";
@@ -50,7 +179,7 @@ int main() {
                 fileSystem.createBackup();
                 std::cout << "Enter directory name: ";
                 std::cin >> name;
-                fileSystem.insertDirectory(name);
+                printError(fileSystem.insertDirectory(name), name);
                 break;
             case 2:
                 fileSystem.createBackup();
@@ -59,14 +188,26 @@ int main() {
                 std::cout << "Enter file name: ";
                 std::cin >> filename;
                 isDir = false;
-                fileSystem.insertFile(name, filename, isDir);
+                status = fileSystem.insertFile(name, filename, isDir);
+                printError(status, status == FileSystem::DIRECTORY_NOT_FOUND ? name : name + "/" + filename);
                 break;
             case 3:
                 fileSystem.createBackup();
-                std::cout << "Enter file name to search: ";
+                std::cout << "Enter file name (or pattern, e.g. *.jpg) to search: ";
                 std::cin >> filename;
-                if (fileSystem.search(filename)) {
-                    std::cout << "File found: " << filename << std::endl;
+                if (filename.find_first_of("*?") != std::string::npos) {
+                    std::vector<FileSystem::Match> matches = fileSystem.findByPattern(filename);
+                    std::cout << matches.size() << " match(es) for " << filename << std::endl;
+                    for (const FileSystem::Match& match : matches) {
+                        std::cout << "  " << match.directory << (match.directory == "/" ? "" : "/") << match.name
+                                  << (match.isDirectory ? " (Directory)" : "") << std::endl;
+                    }
+                } else if (fileSystem.search(filename)) {
+                    std::cout << "File found: " << filename << " in";
+                    for (const std::string& dir : fileSystem.locate(filename)) {
+                        std::cout << " '" << dir << "'";
+                    }
+                    std::cout << std::endl;
                 } else {
                     std::cout << "File not found: " << filename << std::endl;
                 }
@@ -75,30 +216,42 @@ int main() {
                 fileSystem.createBackup();
                 std::cout << "Enter file name to remove: ";
                 std::cin >> filename;
-                fileSystem.remove(filename);
+                printError(fileSystem.remove(filename), filename);
                 break;
             case 5:
                 std::cout << std::endl << "Directory structure:" << std::endl;
                 fileSystem.displayDirectoryStructure();
                 break;
             case 6:
-                fileSystem.restoreBackup();
-                std::cout << "Previous structure restored." << std::endl;
+                if (fileSystem.restoreBackup() == FileSystem::OK) {
+                    std::cout << "Previous structure restored." << std::endl;
+                } else {
+                    std::cout << "No backup available." << std::endl;
+                }
                 break;
             case 7:
                 std::cout << "Enter desired directory: ";
                 std::cin >> dirName;
                 fileSystem.displayDirectoryContents(dirName);
+                break;
             case 8:
                 std::cout << "Enter the directory that will be renamed: ";
                 std::cin >> dirName;
                 std::cout << "Enter the new name for the directory: ";
                 std::cin >> newName;
-                fileSystem.renameDirectory(dirName, newName);
+                status = fileSystem.renameDirectory(dirName, newName);
+                if (status == FileSystem::OK) {
+                    std::cout << "Directory '" << dirName << "' renamed to '" << newName << "'." << std::endl;
+                } else {
+                    printError(status, status == FileSystem::NOT_FOUND || status == FileSystem::INTO_ITSELF ? dirName : newName);
+                }
+                break;
             case 9:
                 fileSystem.copyFile();
+                break;
             case 10:
                 fileSystem.sortFilesInDirectory();
+                break;
             case 11:
                 std::cout << "Exiting..." << std::endl;
                 break;
@@ -109,5 +262,9 @@ int main() {
 
     } while (choice != 11);
 
+    stopMirror(mirror);
+    if (!imagePath.empty() && !fileSystem.checkpoint(imagePath)) {
+        return 1;
+    }
     return 0;
 }